@@ -12,6 +12,9 @@ IMGPATH = "Render\\output.ppm"
 DLLPATH = "rt.dll"
 WINDOWNAME = "Output"
 DOWNSIZE_FACTOR = 1
+# frame size rt.dll renders, Bitmap::BITMAP_WIDTH x BITMAP_HEIGHT of a release build
+FRAME_WIDTH = 600
+FRAME_HEIGHT = 450
 
 
 def main():
@@ -42,7 +45,7 @@ def main():
             last_modified = modified
 
             now = time.time()
-            dll.main()
+            dll.render(ctypes.c_uint(FRAME_WIDTH), ctypes.c_uint(FRAME_HEIGHT))
             print(f"Runtime: {1000 * (time.time() - now):0.1f}ms")
 
             # most clean way to release dll
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+#include "Primitives.h"
+
+namespace Adaptive
+{
+    using namespace Primitives;
+    using namespace std::chrono_literals;
+
+    /// @brief When pixels and the frame count as converged
+    struct Settings
+    {
+        /// @brief Passes every pixel gets before its variance estimate is trusted, at least 2
+        unsigned int MinPasses = 8;
+
+        /// @brief Passes a pixel above the threshold gets per round
+        unsigned int PassesPerRound = 4;
+
+        /// @brief Hard limit per pixel
+        unsigned int MaxPasses = 1024;
+
+        /// @brief A pixel stops once the standard error of its mean luminance, relative to the mean, falls below
+        FloatingType_t PixelThreshold = 0.02;
+
+        /// @brief Pixels darker than this are judged relative to it instead, e.g. shadows
+        FloatingType_t MinLuminance = 1;
+
+        /// @brief The frame stops once the mean relative error over all pixels falls below
+        FloatingType_t TargetNoise = 0.01;
+
+        /// @brief The frame stops after the round that exceeds it
+        std::chrono::duration<double> TimeBudget = 60s;
+    };
+
+    /// @brief Running mean and variance of a pixel's passes, by Welford's algorithm
+    struct PixelStatistics
+    {
+        ColorD_t Sum{0, 0, 0};
+        FloatingType_t MeanLuminance = 0;
+        /// @brief Of the luminance from its running mean, summed up
+        FloatingType_t SquaredDeviations = 0;
+        uint32_t Passes = 0;
+
+        void Add(ColorD_t const &pass);
+
+        /// @brief Standard error of the mean luminance relative to the mean, INFINITY before the second pass
+        FloatingType_t GetRelativeError(FloatingType_t minLuminance) const;
+    };
+
+    /// @brief What an adaptive frame spent and reached
+    struct Summary
+    {
+        unsigned int Rounds = 0;
+        size_t Passes = 0;
+        size_t PixelCount = 0;
+        /// @brief Mean relative error over all pixels
+        FloatingType_t Noise = INFINITY;
+        std::chrono::duration<double> Wall{0};
+
+        /// @brief One line
+        std::string ToString() const;
+    };
+
+    /// @brief Per pixel statistics of a frame rendered in rounds. Every round adds passes to the pixels still above
+    /// the threshold only, tiles are written by a single worker each
+    class Frame
+    {
+    public:
+        /// @brief Ctor, every pixel starts active
+        Frame(Settings const &settings = Settings{}, unsigned int width = Bitmap::BITMAP_WIDTH, unsigned int height = Bitmap::BITMAP_HEIGHT);
+
+        Settings const Config;
+
+        unsigned int GetWidth() const;
+        unsigned int GetHeight() const;
+
+        PixelStatistics &At(unsigned int x, unsigned int y);
+        PixelStatistics const &At(unsigned int x, unsigned int y) const;
+
+        /// @return True if the pixel gets passes in the current round
+        bool IsActive(unsigned int x, unsigned int y) const;
+
+        /// @brief Passes an active pixel gets in the current round
+        unsigned int GetRoundPasses(unsigned int x, unsigned int y) const;
+
+        /// @brief Decides which pixels go on and updates the summary, after all tiles of a round are done
+        /// @param wall Time since the first round started
+        /// @return True if another round is needed: pixels are active, neither the target noise nor the time
+        /// budget is reached
+        bool EndRound(std::chrono::duration<double> wall);
+
+        Summary const &GetSummary() const;
+
+        size_t GetActiveCount() const;
+
+        /// @brief Mean of every pixel, in image space like the accumulator of a uniform frame
+        /// @param output Of the size of the frame
+        void Resolve(Bitmap::BitmapD &output) const;
+
+        /// @brief Resolve() of the pixels within [fromX, toX) x [fromY, toY) only, e.g. of a tile just rendered
+        void Resolve(Bitmap::BitmapD &output, unsigned int fromX, unsigned int fromY, unsigned int toX, unsigned int toY) const;
+
+        /// @brief Passes of every pixel in all channels, e.g. to check the hard regions get the work
+        void ResolvePasses(Bitmap::BitmapD &output) const;
+
+    private:
+        unsigned int Width;
+        unsigned int Height;
+        std::vector<PixelStatistics> Pixels;
+        std::vector<uint8_t> Active;
+        size_t ActiveCount;
+        Summary Statistics;
+    };
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Bitmap.h"
+#include "CompiledScene.h"
+#include "Primitives.h"
+
+namespace Aov
+{
+    using namespace Primitives;
+
+    /// @brief Arbitrary output variables: what the tracer knows about a pixel besides its color. Written by the
+    /// same render as the color, in image space like the accumulator. Single channel arrays are laid out like the
+    /// rows of Bitmap::BitmapD, see GetIndex()
+    class Framebuffer
+    {
+    public:
+        /// @brief Ctor, all channels 0
+        /// @param width Of the frame it is written along with
+        Framebuffer(unsigned int width = Bitmap::BITMAP_WIDTH, unsigned int height = Bitmap::BITMAP_HEIGHT);
+
+        /// @brief Distance along the camera ray to the first hit, 0 if nothing was hit
+        std::vector<FloatingType_t> Depth;
+        /// @brief Surface normal at the first hit, 0 if nothing was hit
+        Bitmap::BitmapD Normal;
+        /// @brief Color filter of the first hit, emission scaled to [0, 1] for emitters
+        Bitmap::BitmapD Albedo;
+        /// @brief Index of the first hit's shape within the shapes the scene was compiled from, or Scene::NO_SHAPE
+        std::vector<uint32_t> ShapeId;
+        /// @brief Surfaces the deepest ray of a sample hit, summed over all samples and passes like the accumulator
+        std::vector<uint32_t> Bounces;
+
+        unsigned int GetWidth() const;
+        unsigned int GetHeight() const;
+
+        /// @return True if the frame has the size of the bitmap
+        bool HasSizeOf(Bitmap::BitmapD const &bitmap) const;
+
+        /// @brief Index of a pixel in image space into the single channel arrays, the row BitmapD::atPixel() maps it to
+        size_t GetIndex(unsigned int x, unsigned int y) const
+        {
+            return (size_t)(Height - 1 - y) * Width + x;
+        }
+
+        /// @brief Writes the channels of a pixel that only depend on the camera ray
+        /// @param hit Closest hit of the camera ray
+        /// @param shape Index of its shape, see Scene::CompiledScene::GetShapeIndex()
+        void SetFirstHit(unsigned int x, unsigned int y, Scene::Intersection const &hit, uint32_t shape);
+
+    private:
+        unsigned int Width;
+        unsigned int Height;
+    };
+
+    enum class Channel
+    {
+        Depth,
+        Normal,
+        Albedo,
+        ShapeId,
+        Bounces
+    };
+
+    /// @brief Turns a channel into a color image, e.g. for ImgFile::writeNetPbm(). Normals are mapped to [0, 1],
+    /// every shape gets a color of its own and bounces are averaged
+    /// @param image Of the size of the framebuffer
+    /// @param samples Samples summed into Bounces, i.e. passes times samples per pixel
+    void Visualize(Framebuffer const &framebuffer, Channel channel, Bitmap::BitmapD &image, unsigned int samples = 1);
+}
@@ -0,0 +1,1141 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Camera.h"
+#include "CompiledScene.h"
+#include "Denoise.h"
+#include "ImgFile.h"
+#include "MappedImage.h"
+#include "Rt.h"
+#include "Shapes.h"
+
+namespace Benchmarks
+{
+    /// @brief Runs a workload and prints its throughput
+    /// @param label Name of the benchmark
+    /// @param operations Number of operations the workload performs
+    /// @param workload Callable running the operations
+    /// @return Operations per second
+    template <typename Workload>
+    inline double _measure(std::string const &label, size_t operations, Workload &&workload)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        workload();
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+
+        double const throughput = operations / elapsed.count();
+        std::cout << label << ": " << throughput / 1e6 << " Mops/s (" << elapsed.count() * 1000 << "ms)" << std::endl;
+        return throughput;
+    }
+
+    /// @brief Hardware cache misses of the calling thread, i.e. loads the last level cache could not serve. Counted
+    /// by perf_event_open() where the kernel and CPU allow it, virtual machines and containers often do not
+    class _cache_misses_t
+    {
+    public:
+        _cache_misses_t()
+        {
+#if defined(__linux__)
+            perf_event_attr attributes{};
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.size = sizeof(attributes);
+            attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+            attributes.disabled = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            Fd = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+#endif
+        }
+
+        ~_cache_misses_t()
+        {
+#if defined(__linux__)
+            if (Fd >= 0)
+                close(Fd);
+#endif
+        }
+
+        _cache_misses_t(_cache_misses_t const &) = delete;
+        _cache_misses_t &operator=(_cache_misses_t const &) = delete;
+
+        bool IsAvailable() const
+        {
+            return Fd >= 0;
+        }
+
+        /// @brief Counts the misses of a workload
+        /// @return Misses, 0 if not available
+        template <typename Workload>
+        uint64_t Count(Workload &&workload)
+        {
+            uint64_t misses = 0;
+#if defined(__linux__)
+            if (Fd >= 0)
+            {
+                ioctl(Fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(Fd, PERF_EVENT_IOC_ENABLE, 0);
+                workload();
+                ioctl(Fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(Fd, &misses, sizeof(misses)) != sizeof(misses))
+                    misses = 0;
+                return misses;
+            }
+#endif
+            workload();
+            return misses;
+        }
+
+    private:
+        int Fd = -1;
+    };
+
+    /// @brief Random normalized directions, deterministic for comparable runs
+    inline std::vector<Primitives::Line> _random_rays(size_t count, Primitives::Vec3d const &origin)
+    {
+        std::default_random_engine rng{42};
+        std::uniform_real_distribution<FloatingType_t> dist{-1, 1};
+
+        std::vector<Primitives::Line> rays;
+        rays.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            rays.push_back(Primitives::Line{origin, Primitives::Vec3d{dist(rng), dist(rng), dist(rng)}.ToNormalized()});
+        return rays;
+    }
+
+    inline void _bench_check_hit()
+    {
+        constexpr size_t RAYCOUNT = 4096;
+        constexpr size_t REPETITIONS = 2000;
+
+        Shapes::Sphere const sphere{"Sphere", Materials::Material{}, {3, 0, 1}, 2};
+        auto const rays = _random_rays(RAYCOUNT, {0, 0, 1});
+
+        FloatingType_t distanceSum = 0;
+        _measure("Sphere::CheckHit", RAYCOUNT * REPETITIONS, [&]()
+                 {
+                    for (size_t r = 0; r < REPETITIONS; r++)
+                        for (auto const &ray : rays)
+                        {
+                            auto const hitEvent = sphere.CheckHit(ray);
+                            if (hitEvent)
+                                distanceSum += hitEvent->DistanceToSurface;
+                        } });
+
+        // keep result alive
+        if (distanceSum == 0)
+            std::cout << "No hits" << std::endl;
+    }
+
+    inline void _bench_march_ray()
+    {
+        constexpr size_t RAYCOUNT = 65536;
+
+        Rt::Raytracer raytracer{};
+        Rt::WorkerState worker{Rt::RenderSettings{}};
+        auto const rays = _random_rays(RAYCOUNT, Camera::Origin);
+
+        FloatingType_t emissionSum = 0;
+        _measure("Raytracer::MarchRay", RAYCOUNT, [&]()
+                 {
+                    for (size_t i = 0; i < rays.size(); i++)
+                    {
+                        Random::Stream random{Random::Sampler::Independent, 1u, (uint32_t)i, 0, 0};
+                        emissionSum += raytracer.MarchRay(rays[i], random, worker) * Primitives::Vec3d{1, 1, 1};
+                    } });
+
+        if (emissionSum == 0)
+            std::cout << "No emission" << std::endl;
+    }
+
+    inline void _bench_diffuse_probes()
+    {
+        constexpr size_t HITCOUNT = 16384;
+        constexpr size_t REPETITIONS = 20;
+        constexpr uint32_t PROBES = 4;
+
+        // hits on random normals reflecting random directions, random numbers drawn up front to time just the geometry
+        auto const normals = _random_rays(HITCOUNT, {0, 0, 0});
+        auto const incoming = _random_rays(HITCOUNT, {1, 2, 3});
+        std::vector<FloatingType_t> numbers(HITCOUNT * PROBES * 2);
+        for (size_t i = 0; i < numbers.size(); i++)
+            numbers[i] = Random::Uniform(1u, (uint32_t)i, 0, 0, 0);
+
+        FloatingType_t const sinMaxAngleSquared = sin(Rt::DIFFUSE_LOBE_ANGLE) * sin(Rt::DIFFUSE_LOBE_ANGLE);
+        FloatingType_t const criticalAngle = Deg2Rad(80);
+        FloatingType_t const criticalCosine = cos(criticalAngle);
+
+        Primitives::Vec3d directionSum{0, 0, 0};
+        // previous approach: angle of incidence by acos, probes by two Rodrigues rotations of the normal
+        _measure("Diffuse probes, rotations", HITCOUNT * PROBES * REPETITIONS, [&]()
+                 {
+                    for (size_t r = 0; r < REPETITIONS; r++)
+                        for (size_t i = 0; i < HITCOUNT; i++)
+                        {
+                            Primitives::Vec3d const &normal = normals[i].Direction;
+                            Primitives::Vec3d const reflection = Shapes::Reflect(incoming[i].Direction, normal);
+                            if (abs(reflection.AngleTo(normal)) > criticalAngle)
+                                continue;
+
+                            FloatingType_t const *hitNumbers = &numbers[i * PROBES * 2];
+                            for (uint32_t probe = 0; probe < PROBES; probe++)
+                            {
+                                Primitives::Vec3d const direction = normal.RotateAboutPlane(normal, reflection, hitNumbers[2 * probe] * Rt::DIFFUSE_LOBE_ANGLE)
+                                                                        .RotateAboutAxis(normal, hitNumbers[2 * probe + 1] * Deg2Rad(360));
+                                directionSum = directionSum + direction * abs(normal * direction);
+                            }
+                        } });
+
+        _measure("Diffuse probes, orthonormal basis", HITCOUNT * PROBES * REPETITIONS, [&]()
+                 {
+                    for (size_t r = 0; r < REPETITIONS; r++)
+                        for (size_t i = 0; i < HITCOUNT; i++)
+                        {
+                            Primitives::Vec3d const &normal = normals[i].Direction;
+                            Primitives::Vec3d const reflection = Shapes::Reflect(incoming[i].Direction, normal);
+                            if (abs(reflection * normal) < criticalCosine)
+                                continue;
+
+                            FloatingType_t const *hitNumbers = &numbers[i * PROBES * 2];
+                            auto const basis = Sampling::Onb::FromNormal(normal);
+                            for (uint32_t probe = 0; probe < PROBES; probe++)
+                                directionSum = directionSum + basis.ToWorld(Sampling::SampleCosineCone(hitNumbers[2 * probe], hitNumbers[2 * probe + 1], sinMaxAngleSquared));
+                        } });
+
+        // keep result alive
+        if (directionSum.GetNorm() == 0)
+            std::cout << "No probes" << std::endl;
+    }
+
+    /// @brief Random spheres in front of the camera, shrinking with count to keep the density similar
+    inline std::vector<std::unique_ptr<Shapes::Sphere>> _random_spheres(size_t count)
+    {
+        std::default_random_engine rng{7};
+        std::uniform_real_distribution<FloatingType_t> unit{0, 1};
+        FloatingType_t const scale = std::cbrt(FloatingType_t{1000} / count);
+
+        std::vector<std::unique_ptr<Shapes::Sphere>> spheres;
+        spheres.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            Primitives::Vec3d const center{2 + 48 * unit(rng), -25 + 50 * unit(rng), -5 + 25 * unit(rng)};
+            spheres.push_back(std::make_unique<Shapes::Sphere>("", Materials::Material{}, center, (FloatingType_t{0.1} + unit(rng)) * scale));
+        }
+        return spheres;
+    }
+
+    inline void _bench_bvh_scaling()
+    {
+        Camera::RayTable const camera{Camera::Settings{}, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT};
+        std::vector<Primitives::Line> cameraRays;
+        for (unsigned int y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+            for (unsigned int x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+                cameraRays.push_back(camera.GetRay(x, y));
+
+        for (size_t const count : {size_t{10}, size_t{1000}, size_t{100000}, size_t{1000000}})
+        {
+            auto const spheres = _random_spheres(count);
+            std::vector<Shapes::Shape const *> shapes;
+            for (auto const &sphere : spheres)
+                shapes.push_back(sphere.get());
+
+            std::string const label = std::to_string(count) + " spheres";
+            std::unique_ptr<Scene::CompiledScene> scene;
+            _measure(label + ", compile & BVH build (shapes)", count, [&]()
+                     { scene = std::make_unique<Scene::CompiledScene>(shapes); });
+
+            size_t hitCount = 0;
+            _measure(label + ", BVH primary rays", cameraRays.size(), [&]()
+                     {
+                        for (auto const &ray : cameraRays)
+                            hitCount += scene->GetClosestIntersection(ray).Material != nullptr; });
+
+            // linear search is hopeless beyond this
+            if (count > 1000)
+                continue;
+
+            size_t linearHitCount = 0;
+            _measure(label + ", linear primary rays", cameraRays.size(), [&]()
+                     {
+                        for (auto const &ray : cameraRays)
+                        {
+                            FloatingType_t shortestDistance = INFINITY;
+                            for (auto const shape : shapes)
+                            {
+                                auto const candidate = shape->Intersect(ray);
+                                if (candidate && candidate->DistanceToSurface < shortestDistance)
+                                    shortestDistance = candidate->DistanceToSurface;
+                            }
+                            linearHitCount += shortestDistance < INFINITY;
+                        } });
+
+            Scene::SphereSoa soa;
+            for (auto const &sphere : spheres)
+                soa.Add(sphere->Centerpoint, sphere->Radius, 0);
+
+            size_t kernelHitCount = 0;
+            _measure(label + ", linear SoA kernel primary rays", cameraRays.size(), [&]()
+                     {
+                        for (auto const &ray : cameraRays)
+                        {
+                            Scene::KernelHit closest;
+                            Scene::IntersectSpheres(soa, 0, soa.Size(), ray, closest);
+                            kernelHitCount += closest.DistanceToSurface < INFINITY;
+                        } });
+
+            if (linearHitCount != hitCount || kernelHitCount != hitCount)
+                std::cout << "BVH and linear search disagree!" << std::endl;
+        }
+    }
+
+    inline void _bench_shadow_rays()
+    {
+        Camera::RayTable const camera{Camera::Settings{}, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT};
+        Primitives::Vec3d const lightPosition{25, 0, 30};
+
+        for (size_t const count : {size_t{1000}, size_t{100000}})
+        {
+            auto const spheres = _random_spheres(count);
+            std::vector<Shapes::Shape const *> shapes;
+            for (auto const &sphere : spheres)
+                shapes.push_back(sphere.get());
+            Scene::CompiledScene const scene{shapes};
+
+            // from every visible surface point towards a point light above the spheres
+            std::vector<std::pair<Primitives::Line, FloatingType_t>> shadowRays;
+            for (unsigned int y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+            {
+                for (unsigned int x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+                {
+                    auto const hit = scene.GetClosestIntersection(camera.GetRay(x, y));
+                    if (!hit.Material)
+                        continue;
+                    Primitives::Vec3d const toLight = lightPosition - hit.Hitevent.ReflectedRay.Origin;
+                    shadowRays.emplace_back(Primitives::Line{hit.Hitevent.ReflectedRay.Origin, toLight.ToNormalized()}, toLight.GetNorm());
+                }
+            }
+
+            std::string const label = std::to_string(count) + " spheres";
+            size_t closestOccluded = 0;
+            _measure(label + ", shadow rays by closest hit", shadowRays.size(), [&]()
+                     {
+                        for (auto const &[ray, distance] : shadowRays)
+                        {
+                            auto const hit = scene.GetClosestIntersection(ray);
+                            closestOccluded += hit.Material && hit.Hitevent.DistanceToSurface < distance;
+                        } });
+
+            size_t anyOccluded = 0;
+            _measure(label + ", shadow rays by any hit", shadowRays.size(), [&]()
+                     {
+                        for (auto const &[ray, distance] : shadowRays)
+                            anyOccluded += scene.IsOccluded(ray, distance); });
+
+            std::cout << label << ": " << anyOccluded << " of " << shadowRays.size() << " occluded" << std::endl;
+            if (anyOccluded != closestOccluded)
+                std::cout << "Any hit and closest hit disagree!" << std::endl;
+        }
+    }
+
+    /// @brief Small frame for convergence measurements
+    struct _frame_t
+    {
+        static constexpr unsigned int WIDTH = 64;
+        static constexpr unsigned int HEIGHT = 48;
+
+        std::vector<Primitives::Vec3d> Sum = std::vector<Primitives::Vec3d>(WIDTH * HEIGHT);
+        unsigned int Passes = 0;
+
+        /// @brief Adds a single pass
+        void AddPass(Rt::Raytracer const &raytracer, Rt::WorkerState &worker)
+        {
+            Camera::RayTable const camera{Camera::Settings{}, WIDTH, HEIGHT};
+            for (unsigned int y = 0; y < HEIGHT; y++)
+                for (unsigned int x = 0; x < WIDTH; x++)
+                    Sum[y * WIDTH + x] = Sum[y * WIDTH + x] + raytracer.TracePixel(camera.GetRay(x, y), x, y, Passes, worker);
+            Passes++;
+        }
+
+        /// @brief Adds passes until the time budget is spent
+        void RenderFor(Rt::Raytracer const &raytracer, std::chrono::duration<double> budget)
+        {
+            auto const worker = raytracer.CreateWorkerState();
+            auto const start = std::chrono::steady_clock::now();
+            do
+                AddPass(raytracer, *worker);
+            while (std::chrono::steady_clock::now() - start < budget);
+        }
+
+        /// @brief RMSE towards a reference, relative to the reference mean as the output gets normalized anyway
+        double RelativeRmse(_frame_t const &reference) const
+        {
+            double squaredError = 0;
+            double referenceSum = 0;
+            for (size_t i = 0; i < Sum.size(); i++)
+            {
+                Primitives::Vec3d const value = Sum[i] * (FloatingType_t{1} / Passes);
+                Primitives::Vec3d const referenceValue = reference.Sum[i] * (FloatingType_t{1} / reference.Passes);
+                Primitives::Vec3d const error = value - referenceValue;
+                squaredError += error * error;
+                referenceSum += referenceValue.X() + referenceValue.Y() + referenceValue.Z();
+            }
+            return std::sqrt(squaredError / (3 * Sum.size())) / (referenceSum / (3 * Sum.size()));
+        }
+    };
+
+    inline void _bench_ray_packets()
+    {
+        constexpr size_t REPETITIONS = 5;
+        Camera::RayTable const camera{Camera::Settings{}, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT};
+
+        auto const spheres = _random_spheres(1000);
+        std::vector<Shapes::Shape const *> randomShapes;
+        for (auto const &sphere : spheres)
+            randomShapes.push_back(sphere.get());
+
+        for (auto const &[label, shapes] : {std::pair{std::string{"Demo scene"}, std::vector<Shapes::Shape const *>(Scene::Objects.begin(), Scene::Objects.end())},
+                                            std::pair{std::string{"1000 spheres"}, randomShapes}})
+        {
+            Scene::CompiledScene const scene{shapes};
+
+            // camera rays in blocks like Raytracer::RenderTile(), plus the mirror reflections they start with
+            std::vector<Scene::RayPacket> cameraPackets;
+            std::vector<Scene::RayPacket> reflectionPackets;
+            for (unsigned int blockY = 0; blockY < Bitmap::BITMAP_HEIGHT; blockY += Rt::PACKET_HEIGHT)
+            {
+                for (unsigned int blockX = 0; blockX < Bitmap::BITMAP_WIDTH; blockX += Rt::PACKET_WIDTH)
+                {
+                    Scene::RayPacket &cameraRays = cameraPackets.emplace_back();
+                    Scene::RayPacket &reflectedRays = reflectionPackets.emplace_back();
+                    for (unsigned int y = blockY; y < std::min(Bitmap::BITMAP_HEIGHT, blockY + Rt::PACKET_HEIGHT); y++)
+                    {
+                        for (unsigned int x = blockX; x < std::min(Bitmap::BITMAP_WIDTH, blockX + Rt::PACKET_WIDTH); x++)
+                        {
+                            size_t const lane = (y - blockY) * Rt::PACKET_WIDTH + (x - blockX);
+                            cameraRays.Set(lane, camera.GetRay(x, y));
+                            auto const intersection = scene.GetClosestIntersection(cameraRays.Get(lane));
+                            if (intersection.Material)
+                                reflectedRays.Set(lane, intersection.Hitevent.ReflectedRay);
+                        }
+                    }
+                }
+            }
+
+            for (auto const &[bounce, packets] : {std::pair{std::string{"primary rays"}, &cameraPackets}, std::pair{std::string{"first bounce"}, &reflectionPackets}})
+            {
+                size_t rayCount = 0;
+                for (auto const &packet : *packets)
+                    rayCount += __builtin_popcount(packet.ActiveMask);
+
+                size_t hitCount = 0;
+                _measure(label + ", " + bounce + ", single rays", rayCount * REPETITIONS, [&]()
+                         {
+                            for (size_t r = 0; r < REPETITIONS; r++)
+                                for (auto const &packet : *packets)
+                                    for (size_t lane = 0; lane < Scene::PACKET_SIZE; lane++)
+                                        if (packet.IsActive(lane))
+                                            hitCount += scene.GetClosestIntersection(packet.Get(lane)).Material != nullptr; });
+
+                for (auto level = Scene::SimdLevel::Scalar; level <= Scene::GetSimdLevel(); level = (Scene::SimdLevel)((int)level + 1))
+                {
+                    std::array<Scene::Intersection, Scene::PACKET_SIZE> intersections;
+                    _measure(label + ", " + bounce + ", packets " + Scene::ToString(level), rayCount * REPETITIONS, [&]()
+                             {
+                                for (size_t r = 0; r < REPETITIONS; r++)
+                                    for (auto const &packet : *packets)
+                                    {
+                                        scene.GetClosestIntersections(packet, intersections, level);
+                                        hitCount += intersections[0].Material != nullptr;
+                                    } });
+                }
+
+                // keep result alive
+                if (hitCount == 0)
+                    std::cout << "No hits" << std::endl;
+            }
+        }
+    }
+
+    inline void _bench_wavefront()
+    {
+        constexpr unsigned int PASSES = 4;
+        std::unique_ptr<Bitmap::BitmapD> accumulator{new Bitmap::BitmapD{}};
+
+        // demo scene, and the demo scene cluttered with small mirror spheres
+        auto const spheres = _random_spheres(1000);
+        std::vector<Shapes::Shape const *> clutteredShapes(Scene::Objects.begin(), Scene::Objects.end());
+        for (auto const &sphere : spheres)
+            clutteredShapes.push_back(sphere.get());
+
+        for (auto const &[label, shapes] : {std::pair{std::string{"Demo scene"}, std::vector<Shapes::Shape const *>(Scene::Objects.begin(), Scene::Objects.end())},
+                                            std::pair{std::string{"Demo scene + 1000 spheres"}, clutteredShapes}})
+        {
+            for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+            {
+                std::string const modeLabel = label + (mode == Rt::Integrator::Branching ? ", branching" : ", path tracing");
+                for (auto const engine : {Rt::Engine::PerPixel, Rt::Engine::Wavefront})
+                {
+                    Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = mode, .Backend = engine}, shapes};
+                    Rt::RenderContext context{raytracer};
+                    _measure(modeLabel + (engine == Rt::Engine::PerPixel ? ", per pixel" : ", wavefront") + " samples", Bitmap::BITMAP_WIDTH * Bitmap::BITMAP_HEIGHT * PASSES, [&]()
+                             {
+                                context.Submit(*accumulator, PASSES);
+                                context.Wait(); });
+
+                    if (engine == Rt::Engine::Wavefront)
+                        std::cout << context.GetStageTimes().ToString();
+                }
+            }
+        }
+    }
+
+    inline void _bench_integrators()
+    {
+        using namespace std::chrono_literals;
+
+        // both integrators estimate the same image as long as every generation of MarchRay() has a single parent,
+        // so they are measured at that depth against one shared reference
+        std::vector<std::pair<Rt::RenderSettings, std::string>> const integrators = {
+            {Rt::RenderSettings{.Mode = Rt::Integrator::Branching, .RayGenerations = 1}, "Branching"},
+            {Rt::RenderSettings{.Mode = Rt::Integrator::PathTracing, .MaxBounces = 2}, "Path tracing"}};
+
+        _frame_t reference;
+        Rt::Raytracer const referenceRaytracer{12345u, integrators[1].first};
+        reference.RenderFor(referenceRaytracer, 8s);
+        std::cout << "Single bounce, reference: " << reference.Passes << " passes" << std::endl;
+
+        for (auto const &[settings, label] : integrators)
+        {
+            for (auto const budget : {20ms, 80ms, 320ms, 1280ms})
+            {
+                _frame_t frame;
+                Rt::Raytracer const raytracer{1u, settings};
+                frame.RenderFor(raytracer, budget);
+                std::cout << label << ", " << budget.count() << "ms: " << frame.Passes << " passes, relative RMSE " << frame.RelativeRmse(reference) << std::endl;
+            }
+        }
+
+        // at their default depths MarchRay() normalizes later generations over all siblings, which leaves the
+        // images apart by more than their noise
+        _frame_t branching;
+        branching.RenderFor(Rt::Raytracer{12345u, Rt::RenderSettings{.Mode = Rt::Integrator::Branching}}, 4s);
+        _frame_t pathTracing;
+        pathTracing.RenderFor(Rt::Raytracer{12345u, Rt::RenderSettings{.Mode = Rt::Integrator::PathTracing}}, 4s);
+        std::cout << "Default depths: " << branching.Passes << " and " << pathTracing.Passes << " passes, relative RMSE between the integrators "
+                  << branching.RelativeRmse(pathTracing) << std::endl;
+    }
+
+    inline void _bench_samplers()
+    {
+        using namespace std::chrono_literals;
+        constexpr double TARGET_RMSE = 0.04;
+        constexpr unsigned int MAX_SAMPLES = 1024;
+
+        std::vector<std::pair<Random::Sampler, std::string>> const samplers = {
+            {Random::Sampler::Independent, "independent"},
+            {Random::Sampler::Stratified, "stratified"},
+            {Random::Sampler::Sobol, "Sobol"},
+            {Random::Sampler::BlueNoise, "blue noise"}};
+
+        for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+        {
+            std::string const label = mode == Rt::Integrator::Branching ? "Branching" : "Path tracing";
+
+            _frame_t reference;
+            Rt::Raytracer const referenceRaytracer{12345u, Rt::RenderSettings{.Mode = mode}};
+            reference.RenderFor(referenceRaytracer, 8s);
+            std::cout << label << ", reference: " << reference.Passes << " passes" << std::endl;
+
+            for (auto const &[sampler, samplerLabel] : samplers)
+            {
+                // fresh frame per sample count, as stratification depends on it
+                std::cout << label << ", " << samplerLabel << ":";
+                unsigned int samples = 1;
+                for (; samples <= MAX_SAMPLES; samples *= 2)
+                {
+                    Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = mode, .Sampler = sampler, .ExpectedSamples = samples}};
+                    auto const worker = raytracer.CreateWorkerState();
+                    _frame_t frame;
+                    while (frame.Passes < samples)
+                        frame.AddPass(raytracer, *worker);
+
+                    double const rmse = frame.RelativeRmse(reference);
+                    std::cout << " " << samples << "spp " << rmse;
+                    if (rmse < TARGET_RMSE)
+                        break;
+                }
+                std::cout << std::endl
+                          << label << ", " << samplerLabel << ": " << (samples <= MAX_SAMPLES ? std::to_string(samples) : "> " + std::to_string(MAX_SAMPLES))
+                          << "spp to relative RMSE " << TARGET_RMSE << std::endl;
+            }
+        }
+    }
+
+    inline void _bench_next_event_estimation()
+    {
+        using namespace std::chrono_literals;
+        constexpr double TARGET_RMSE = 0.04;
+        constexpr unsigned int MAX_SAMPLES = 1024;
+
+        // the demo scene is lit by emitters covering half of all directions, the probes find them easily. The
+        // lamp scene swaps them for a small lamp and a dim sky, and its spheres are diffuse, so it is lit directly
+        // instead of by reflections of the lamp only probes can find
+        Shapes::Sphere const lamp{"Lamp", Materials::Material{}.MakeEmissive({255, 240, 200}), {3.5, 0, 4}, 0.5};
+        Shapes::Sphere const sky{"Skysphere", Materials::Material{}.MakeEmissive({2, 2, 5}), {0, 0, 0}, 1000};
+        Shapes::Sphere const red{"Red Sphere", Materials::Material{}.MakeAbsorbing({230, 100, 100}).MakeDiffuse(1), {3, -1, 1}, 1};
+        Shapes::Sphere const blue{"Blue Sphere", Materials::Material{}.MakeAbsorbing({150, 150, 255}).MakeDiffuse(1), {4, 1, 1.5}, 1.5};
+        std::vector<Shapes::Shape const *> const lampShapes{&lamp, &sky, Scene::Objects[2], &red, &blue};
+
+        for (auto const &[sceneLabel, shapes] : {std::pair{std::string{"Demo scene"}, std::vector<Shapes::Shape const *>(Scene::Objects.begin(), Scene::Objects.end())},
+                                                 std::pair{std::string{"Lamp scene"}, lampShapes}})
+        {
+            for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+            {
+                std::string const label = sceneLabel + (mode == Rt::Integrator::Branching ? ", branching" : ", path tracing");
+
+                // light samples do not change what the image converges to, one reference serves both
+                _frame_t reference;
+                Rt::Raytracer const referenceRaytracer{12345u, Rt::RenderSettings{.Mode = mode}, shapes};
+                reference.RenderFor(referenceRaytracer, 8s);
+                std::cout << label << ", reference: " << reference.Passes << " passes" << std::endl;
+
+                for (unsigned int const lightSamples : {0u, 1u})
+                {
+                    std::string const lightLabel = label + (lightSamples ? ", light samples" : ", probes only");
+                    std::cout << lightLabel << ":";
+                    Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = mode, .LightSamples = lightSamples}, shapes};
+                    auto const worker = raytracer.CreateWorkerState();
+                    _frame_t frame;
+                    double rmse = INFINITY;
+                    auto const start = std::chrono::steady_clock::now();
+                    for (unsigned int samples = 1; samples <= MAX_SAMPLES && rmse >= TARGET_RMSE; samples *= 2)
+                    {
+                        while (frame.Passes < samples)
+                            frame.AddPass(raytracer, *worker);
+                        rmse = frame.RelativeRmse(reference);
+                        std::cout << " " << samples << "spp " << rmse;
+                    }
+                    std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now() - start;
+                    std::cout << std::endl
+                              << lightLabel << ": " << (rmse < TARGET_RMSE ? std::to_string(frame.Passes) : "> " + std::to_string(MAX_SAMPLES))
+                              << "spp, " << elapsed.count() << "ms to relative RMSE " << TARGET_RMSE << std::endl;
+                }
+            }
+        }
+    }
+
+    /// @brief RMSE of two full size frames, relative to the reference mean
+    /// @param scale Turns the image into pixel means, e.g. 1 / passes for an accumulator
+    inline double _relativeRmse(Bitmap::BitmapD const &image, double scale, Bitmap::BitmapD const &reference, double referenceScale)
+    {
+        double squaredError = 0;
+        double referenceSum = 0;
+        size_t const rowLength = (size_t)image.GetWidth() * Bitmap::COLOR_COUNT;
+        for (unsigned int y = 0; y < image.GetHeight(); y++)
+        {
+            for (size_t i = 0; i < rowLength; i++)
+            {
+                double const error = image.Row(y)[i] * scale - reference.Row(y)[i] * referenceScale;
+                squaredError += error * error;
+                referenceSum += reference.Row(y)[i] * referenceScale;
+            }
+        }
+        size_t const count = rowLength * image.GetHeight();
+        return std::sqrt(squaredError / count) / (referenceSum / count);
+    }
+
+    inline void _bench_adaptive_sampling()
+    {
+        constexpr unsigned int UNIFORM_PASSES = 64;
+        constexpr unsigned int REFERENCE_PASSES = 256;
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::PathTracing};
+
+        std::unique_ptr<Bitmap::BitmapD> reference{new Bitmap::BitmapD{}};
+        Rt::Raytracer const referenceRaytracer{12345u, settings};
+        Rt::RenderContext referenceContext{referenceRaytracer};
+        referenceContext.Submit(*reference, REFERENCE_PASSES);
+        std::cout << "Reference: " << REFERENCE_PASSES << " passes, " << referenceContext.Wait().Wall.count() * 1000 << "ms" << std::endl;
+
+        Rt::Raytracer const raytracer{1u, settings};
+        Rt::RenderContext context{raytracer};
+        std::unique_ptr<Bitmap::BitmapD> uniform{new Bitmap::BitmapD{}};
+        context.Submit(*uniform, UNIFORM_PASSES);
+        auto const uniformWall = context.Wait().Wall;
+        std::cout << "Uniform, " << UNIFORM_PASSES << " passes per pixel: " << uniformWall.count() * 1000 << "ms, relative RMSE "
+                  << _relativeRmse(*uniform, 1.0 / UNIFORM_PASSES, *reference, 1.0 / REFERENCE_PASSES) << std::endl;
+
+        // the same time, spent on the pixels that are still noisy
+        Adaptive::Frame frame{Adaptive::Settings{.MinPasses = 8, .PassesPerRound = 8, .MaxPasses = REFERENCE_PASSES, .TargetNoise = 0, .TimeBudget = uniformWall}};
+        Adaptive::Summary const summary = context.RenderAdaptive(frame);
+        std::unique_ptr<Bitmap::BitmapD> adaptive{new Bitmap::BitmapD{}};
+        frame.Resolve(*adaptive);
+
+        unsigned int minPasses = REFERENCE_PASSES;
+        unsigned int maxPasses = 0;
+        for (unsigned int y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+            {
+                minPasses = std::min(minPasses, frame.At(x, y).Passes);
+                maxPasses = std::max(maxPasses, frame.At(x, y).Passes);
+            }
+        }
+        std::cout << "Adaptive, " << (double)summary.Passes / summary.PixelCount << " passes per pixel (" << minPasses << " to "
+                  << maxPasses << "), " << summary.Rounds << " rounds: " << summary.Wall.count() * 1000 << "ms, relative RMSE "
+                  << _relativeRmse(*adaptive, 1, *reference, 1.0 / REFERENCE_PASSES) << std::endl;
+    }
+
+    inline void _bench_denoiser()
+    {
+        constexpr unsigned int REFERENCE_PASSES = 128;
+        constexpr unsigned int MAX_PASSES = 16;
+        // the settings of the smoothing passes in main
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::Branching, .Sampler = Random::Sampler::Sobol};
+
+        std::unique_ptr<Bitmap::BitmapD> reference{new Bitmap::BitmapD{}};
+        Rt::Raytracer const referenceRaytracer{12345u, settings};
+        Rt::RenderContext referenceContext{referenceRaytracer};
+        referenceContext.Submit(*reference, REFERENCE_PASSES);
+        std::cout << "Reference: " << REFERENCE_PASSES << " passes, " << referenceContext.Wait().Wall.count() * 1000 << "ms" << std::endl;
+
+        Rt::Raytracer const raytracer{1u, settings};
+        Rt::RenderContext context{raytracer};
+        std::unique_ptr<Aov::Framebuffer> aovs{new Aov::Framebuffer{}};
+        Denoise::Denoiser denoiser;
+        for (unsigned int passes = 1; passes <= MAX_PASSES; passes *= 2)
+        {
+            std::unique_ptr<Bitmap::BitmapD> image{new Bitmap::BitmapD{}};
+            context.ResumeAt(0);
+            context.Submit(*image, passes, aovs.get());
+            double const renderTime = context.Wait().Wall.count() * 1000;
+            double const rmse = _relativeRmse(*image, 1.0 / passes, *reference, 1.0 / REFERENCE_PASSES);
+
+            Denoise::Timings const &timings = denoiser.Run(*image, *aovs);
+            std::cout << passes << " passes: " << renderTime << "ms, relative RMSE " << rmse << ", denoised: +" << timings.Wall.count() * 1000 << "ms, relative RMSE "
+                      << _relativeRmse(*image, 1.0 / passes, *reference, 1.0 / REFERENCE_PASSES) << std::endl;
+        }
+    }
+
+    inline void _bench_aovs()
+    {
+        constexpr unsigned int PASSES = 4;
+        constexpr size_t REPETITIONS = 3;
+        std::unique_ptr<Bitmap::BitmapD> accumulator{new Bitmap::BitmapD{}};
+        std::unique_ptr<Aov::Framebuffer> aovs{new Aov::Framebuffer{}};
+
+        // best of a few frames, the AOVs should add next to nothing to a full render
+        auto const measureFrame = [&](Rt::RenderSettings const &settings, Aov::Framebuffer *target)
+        {
+            Rt::Raytracer const raytracer{1u, settings};
+            Rt::RenderContext context{raytracer};
+            double best = INFINITY;
+            for (size_t i = 0; i < REPETITIONS; i++)
+            {
+                context.Submit(*accumulator, PASSES, target);
+                best = std::min(best, context.Wait().Wall.count() * 1000);
+            }
+            return best;
+        };
+
+        for (auto const &[label, mode] : {std::pair{"Branching", Rt::Integrator::Branching}, std::pair{"Path tracing", Rt::Integrator::PathTracing}})
+        {
+            for (auto const backend : {Rt::Engine::PerPixel, Rt::Engine::Wavefront})
+            {
+                Rt::RenderSettings const settings{.Mode = mode, .Backend = backend, .Sampler = Random::Sampler::Sobol};
+                std::cout << label << (backend == Rt::Engine::Wavefront ? ", wavefront" : ", per pixel") << ", " << PASSES << " passes: " << measureFrame(settings, nullptr)
+                          << "ms, with AOVs " << measureFrame(settings, aovs.get()) << "ms" << std::endl;
+            }
+        }
+
+        std::cout << "Primary visibility with AOVs, " << PASSES << " passes: " << measureFrame(Rt::RenderSettings{.Mode = Rt::Integrator::PrimaryVisibility}, aovs.get()) << "ms" << std::endl;
+    }
+
+    inline void _bench_frame_sizes()
+    {
+        // preview and final from the same binary, plus the default size in between
+        for (auto const &[width, height] : {std::pair{320u, 240u}, std::pair{Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT}, std::pair{3840u, 2160u}})
+        {
+            double const pixels = (double)width * height;
+            std::string const label = std::to_string(width) + "x" + std::to_string(height);
+
+            auto start = std::chrono::steady_clock::now();
+            Bitmap::BitmapD accumulator{width, height};
+            std::chrono::duration<double, std::milli> const allocation = std::chrono::steady_clock::now() - start;
+            std::cout << label << ": " << accumulator.GetStride() * height * sizeof(FloatingType_t) / 1e6 << "MB, allocated and cleared in " << allocation.count() << "ms" << std::endl;
+
+            for (auto const &[modeLabel, mode] : {std::pair{"primary visibility", Rt::Integrator::PrimaryVisibility}, std::pair{"path tracing", Rt::Integrator::PathTracing}})
+            {
+                Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = mode}};
+                Rt::RenderContext context{raytracer};
+                context.Submit(accumulator, 1);
+                double const wall = context.Wait().Wall.count();
+                std::cout << label << ", " << modeLabel << ": " << wall * 1000 << "ms, " << wall * 1e9 / pixels << "ns per pixel" << std::endl;
+            }
+
+            start = std::chrono::steady_clock::now();
+            ImgFile::writeNetPbm("Render\\bench_frame.ppm", accumulator);
+            std::chrono::duration<double> const output = std::chrono::steady_clock::now() - start;
+            std::cout << label << ", output conversion: " << output.count() * 1000 << "ms, " << pixels * Bitmap::COLOR_COUNT / output.count() / 1e6 << "MB/s" << std::endl;
+            std::filesystem::remove("Render\\bench_frame.ppm");
+        }
+    }
+
+    inline void _bench_tiled_accumulator()
+    {
+        // a 4K frame is far beyond any cache, what a pass costs besides tracing is getting its pixels in and out
+        constexpr unsigned int WIDTH = 3840;
+        constexpr unsigned int HEIGHT = 2160;
+        constexpr unsigned int PASSES = 4;
+        double const pixels = (double)WIDTH * HEIGHT;
+        _cache_misses_t cacheMisses;
+        if (!cacheMisses.IsAvailable())
+            std::cout << "Cache miss counter not available, timings only" << std::endl;
+
+        // tiles in the order one worker takes them, and interleaved like many workers taking tiles all over the frame
+        std::vector<Scheduler::Tile> tiles;
+        for (unsigned int y = 0; y < HEIGHT; y += Scheduler::TILE_SIZE)
+            for (unsigned int x = 0; x < WIDTH; x += Scheduler::TILE_SIZE)
+                tiles.push_back(Scheduler::Tile{x, y, std::min(WIDTH, x + Scheduler::TILE_SIZE), std::min(HEIGHT, y + Scheduler::TILE_SIZE)});
+        std::vector<Scheduler::Tile> shuffled = tiles;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::default_random_engine{42});
+
+        Bitmap::BitmapD rows{WIDTH, HEIGHT};
+        Bitmap::TiledBitmapD tiled{WIDTH, HEIGHT};
+        auto const accumulate = [&](auto &accumulator, std::vector<Scheduler::Tile> const &order)
+        {
+            for (unsigned int pass = 0; pass < PASSES; pass++)
+                for (Scheduler::Tile const &tile : order)
+                    for (unsigned int y = tile.FromY; y < tile.ToY; y++)
+                        for (unsigned int x = tile.FromX; x < tile.ToX; x++)
+                        {
+                            FloatingType_t *const target = accumulator.atPixel(x, y);
+                            for (size_t i = 0; i < Bitmap::COLOR_COUNT; i++)
+                                target[i] += (FloatingType_t)(pass + i);
+                        }
+        };
+        auto const report = [&](std::string const &label, auto &&workload, double operations)
+        {
+            auto const start = std::chrono::steady_clock::now();
+            uint64_t const misses = cacheMisses.Count(workload);
+            std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << label << ": " << elapsed.count() * 1e9 / operations << "ns per pixel";
+            if (cacheMisses.IsAvailable())
+                std::cout << ", " << misses / operations << " cache misses per pixel";
+            std::cout << std::endl;
+        };
+
+        for (auto const &[orderLabel, order] : {std::pair{"in order", &tiles}, std::pair{"interleaved", &shuffled}})
+        {
+            report(std::string{"Accumulate rows, tiles "} + orderLabel, [&]()
+                   { accumulate(rows, *order); }, pixels * PASSES);
+            report(std::string{"Accumulate tiled, tiles "} + orderLabel, [&]()
+                   { accumulate(tiled, *order); }, pixels * PASSES);
+        }
+        report("Detile, calling thread", [&]()
+               { tiled.Detile(rows); }, pixels);
+
+        // the same frame rendered into either layout, tiled including the conversion to rows
+        constexpr unsigned int FRAME_WIDTH = 1920;
+        constexpr unsigned int FRAME_HEIGHT = 1080;
+        Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = Rt::Integrator::PrimaryVisibility}};
+        Rt::RenderContext context{raytracer};
+        Bitmap::BitmapD frame{FRAME_WIDTH, FRAME_HEIGHT};
+        Bitmap::TiledBitmapD tiledFrame{FRAME_WIDTH, FRAME_HEIGHT};
+        auto start = std::chrono::steady_clock::now();
+        context.Submit(frame, PASSES);
+        context.Wait();
+        std::chrono::duration<double, std::milli> const rowsWall = std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        context.Submit(tiledFrame, PASSES);
+        context.Wait();
+        std::chrono::duration<double, std::milli> const tiledWall = std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        context.Detile(tiledFrame, frame);
+        std::chrono::duration<double, std::milli> const detileWall = std::chrono::steady_clock::now() - start;
+        std::cout << "Primary visibility " << FRAME_WIDTH << "x" << FRAME_HEIGHT << ", " << PASSES << " passes: rows " << rowsWall.count() << "ms, tiled "
+                  << tiledWall.count() << "ms plus " << detileWall.count() << "ms detiling on all workers ("
+                  << (double)FRAME_WIDTH * FRAME_HEIGHT * Bitmap::COLOR_COUNT * sizeof(FloatingType_t) / detileWall.count() / 1e3 << "MB/s)" << std::endl;
+    }
+
+    inline void _bench_tone_mapping()
+    {
+        constexpr unsigned int WIDTH = 3840;
+        constexpr unsigned int HEIGHT = 2160;
+        constexpr unsigned int REPETITIONS = 5;
+        size_t const rowLength = (size_t)WIDTH * Bitmap::COLOR_COUNT;
+        Bitmap::BitmapD image{WIDTH, HEIGHT};
+        std::default_random_engine rng{42};
+        std::uniform_real_distribution<FloatingType_t> dist{0, 1000};
+        for (unsigned int y = 0; y < HEIGHT; y++)
+            for (size_t i = 0; i < rowLength; i++)
+                image.Row(y)[i] = dist(rng);
+        std::vector<unsigned char> output(rowLength * HEIGHT);
+
+        auto const report = [&](std::string const &label, auto &&convert)
+        {
+            auto const start = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < REPETITIONS; i++)
+                convert();
+            std::chrono::duration<double> const elapsed = (std::chrono::steady_clock::now() - start) / REPETITIONS;
+            std::cout << label << ": " << elapsed.count() * 1000 << "ms, " << output.size() / elapsed.count() / 1e6 << "MB/s" << std::endl;
+        };
+
+        // what writeNetPbm() did before: a range pass, then a scalar loop on the calling thread
+        report("Scalar min max loop, calling thread", [&]()
+               {
+                   FloatingType_t minimum = image.Row(0)[0];
+                   FloatingType_t maximum = minimum;
+                   for (unsigned int y = 0; y < HEIGHT; y++)
+                   {
+                       auto const minMax = std::minmax_element(image.Row(y), image.Row(y) + rowLength);
+                       minimum = std::min(minimum, *minMax.first);
+                       maximum = std::max(maximum, *minMax.second);
+                   }
+                   FloatingType_t const scalar = FloatingType_t{255} / (maximum - minimum);
+                   FloatingType_t const offset = minimum * scalar;
+                   for (unsigned int y = 0; y < HEIGHT; y++)
+                       for (size_t i = 0; i < rowLength; i++)
+                           output[y * rowLength + i] = (unsigned char)(image.Row(y)[i] * scalar - offset);
+               });
+
+        std::vector<unsigned int> workerCounts{1};
+        if (Scheduler::TileScheduler::GetHardwareConcurrency() > 1)
+            workerCounts.push_back(Scheduler::TileScheduler::GetHardwareConcurrency());
+        for (auto const &[curveLabel, curve] : {std::pair{"min max", ToneMap::Curve::MinMax}, std::pair{"Reinhard", ToneMap::Curve::Reinhard}, std::pair{"ACES", ToneMap::Curve::Aces}})
+        {
+            for (bool srgb : {false, true})
+            {
+                // there are scalar and AVX2 kernels only
+                for (auto level : {Scene::SimdLevel::Scalar, Scene::SimdLevel::Avx2})
+                {
+                    if (level > Scene::GetSimdLevel())
+                        continue;
+                    for (unsigned int workers : workerCounts)
+                    {
+                        ToneMap::Mapper mapper{ToneMap::Settings{.Operator = curve, .Srgb = srgb, .Simd = level}, workers};
+                        report(std::string{"Mapper, "} + curveLabel + (srgb ? ", sRGB, " : ", linear, ") + Scene::ToString(level) + ", " + std::to_string(workers) + " workers", [&]()
+                               { mapper.Run(image, 4, output.data(), rowLength); });
+                    }
+                }
+            }
+        }
+
+        ToneMap::Mapper mapper{};
+        report("writeNetPbm", [&]()
+               { ImgFile::writeNetPbm("Render\\bench_tone_mapping.ppm", image, mapper, 4); });
+        std::filesystem::remove("Render\\bench_tone_mapping.ppm");
+    }
+
+    inline void _bench_mapped_image()
+    {
+        // a camera ray per pixel, so the output is a noticeable share of the frame
+        constexpr unsigned int WIDTH = 3840;
+        constexpr unsigned int HEIGHT = 2160;
+        std::string const file = "Render\\bench_stream";
+        ToneMap::Settings const toneMapping{.Operator = ToneMap::Curve::Aces, .Srgb = true};
+        Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = Rt::Integrator::PrimaryVisibility}};
+        Rt::RenderContext context{raytracer};
+        ToneMap::Mapper mapper{toneMapping};
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        {
+            Bitmap::BitmapD accumulator{WIDTH, HEIGHT};
+            auto const start = std::chrono::steady_clock::now();
+            context.Submit(accumulator, 1);
+            context.Wait();
+            auto const rendered = std::chrono::steady_clock::now();
+            ImgFile::writeNetPbm(file + ".ppm", accumulator, mapper, 1);
+            auto const written = std::chrono::steady_clock::now();
+            std::cout << "Render, then write PPM: " << milliseconds{rendered - start}.count() << "ms + " << milliseconds{written - rendered}.count() << "ms" << std::endl;
+        }
+
+        for (auto const &[label, format] : {std::pair{"PPM", ImgFile::Format::Ppm}, std::pair{"PFM", ImgFile::Format::Pfm}})
+        {
+            Bitmap::BitmapD accumulator{WIDTH, HEIGHT};
+            auto const start = std::chrono::steady_clock::now();
+            ImgFile::MappedImage image{file + (format == ImgFile::Format::Ppm ? ".ppm" : ".pfm"), format, WIDTH, HEIGHT, toneMapping};
+            auto const created = std::chrono::steady_clock::now();
+            context.Submit(accumulator, 1, nullptr, [&](Scheduler::Tile const &tile)
+                           { image.WriteTile(tile, accumulator, 1); });
+            context.Wait();
+            auto const rendered = std::chrono::steady_clock::now();
+            image.Flush();
+            auto const flushed = std::chrono::steady_clock::now();
+            std::cout << "Render streaming " << label << (image.IsMapped() ? ", mapped" : ", in memory") << ": create " << milliseconds{created - start}.count() << "ms, render "
+                      << milliseconds{rendered - created}.count() << "ms, flush " << milliseconds{flushed - rendered}.count() << "ms, " << image.GetSize() / 1e6 << "MB" << std::endl;
+        }
+        std::filesystem::remove(file + ".ppm");
+        std::filesystem::remove(file + ".pfm");
+    }
+
+    inline void _bench_image_writers()
+    {
+        // a clean frame with flat areas, and a noisy one whose neighbours rarely match
+        constexpr unsigned int WIDTH = 3840;
+        constexpr unsigned int HEIGHT = 2160;
+        constexpr size_t REPEATS = 3;
+        std::string const file = "Render\\bench_writer.";
+        ToneMap::Settings const toneMapping{.Operator = ToneMap::Curve::Aces, .Srgb = true};
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        for (auto const &[label, mode] : {std::pair{"Primary visibility", Rt::Integrator::PrimaryVisibility}, std::pair{"Path traced, 1 spp", Rt::Integrator::PathTracing}})
+        {
+            Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = mode}};
+            Rt::RenderContext context{raytracer};
+            Bitmap::BitmapD frame{WIDTH, HEIGHT};
+            context.Submit(frame, 1);
+            context.Wait();
+
+            // the bytes of a PPM, so formats compare by what they hold rather than what they write
+            double const rawSize = (double)WIDTH * HEIGHT * Bitmap::COLOR_COUNT;
+            for (ImgFile::Format const format : {ImgFile::Format::Ppm, ImgFile::Format::Pfm, ImgFile::Format::Qoi})
+            {
+                std::unique_ptr<ImgFile::Writer> const writer = ImgFile::CreateWriter(format, toneMapping);
+                std::string const target = file + writer->GetExtension();
+                // the first write sizes the buffers
+                writer->Write(target, frame, 1);
+                auto const start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < REPEATS; i++)
+                    writer->Write(target, frame, 1);
+                double const elapsed = milliseconds{std::chrono::steady_clock::now() - start}.count() / REPEATS;
+                double const size = (double)std::filesystem::file_size(target);
+                std::cout << label << ", " << writer->GetExtension() << ": " << elapsed << "ms, " << rawSize / 1e3 / elapsed << "MB/s of pixels, "
+                          << size / 1e6 << "MB, " << size / rawSize << " of raw" << std::endl;
+                std::filesystem::remove(target);
+            }
+        }
+    }
+
+    inline void _bench_camera_rays()
+    {
+        constexpr unsigned int WIDTH = 3840;
+        constexpr unsigned int HEIGHT = 2160;
+        constexpr size_t REPEATS = 5;
+        using nanoseconds = std::chrono::duration<double, std::nano>;
+
+        // sums the directions, so the rays cannot be optimized away
+        auto const report = [](std::string const &label, auto &&makeRay)
+        {
+            Vec3d sum{0, 0, 0};
+            auto const start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < REPEATS; i++)
+                for (unsigned int y = 0; y < HEIGHT; y++)
+                    for (unsigned int x = 0; x < WIDTH; x++)
+                        sum = sum + makeRay(x, y).Direction;
+            double const perRay = nanoseconds{std::chrono::steady_clock::now() - start}.count() / (REPEATS * WIDTH * HEIGHT);
+            std::cout << label << ": " << perRay << "ns per ray (" << sum.X() << ")" << std::endl;
+        };
+
+        // offsets of the jittered rays, drawn up front so only the rays are timed
+        std::mt19937 generator{1};
+        std::uniform_real_distribution<FloatingType_t> distribution{-0.5, 0.5};
+        std::array<FloatingType_t, 256> offsets;
+        for (FloatingType_t &offset : offsets)
+            offset = distribution(generator);
+
+        // trig per pixel, as the camera used to map pixels to the sphere
+        FloatingType_t const step = Camera::FOV / WIDTH;
+        report("Spherical, trig per ray", [step](unsigned int x, unsigned int y)
+               {
+                   FloatingType_t const longitude = (x - (FloatingType_t)WIDTH / 2) * step;
+                   FloatingType_t const latitude = (y - (FloatingType_t)HEIGHT / 2) * step;
+                   return Line{Camera::Origin, Vec3d{std::cos(latitude) * std::cos(longitude), std::cos(latitude) * std::sin(longitude), std::sin(latitude)}}; });
+
+        for (auto const &[label, model] : {std::pair{"Spherical", Camera::Projection::Spherical}, std::pair{"Pinhole", Camera::Projection::Pinhole}})
+        {
+            auto const start = std::chrono::steady_clock::now();
+            Camera::RayTable const camera{Camera::Settings{.Model = model}, WIDTH, HEIGHT};
+            std::cout << label << ", table built in " << nanoseconds{std::chrono::steady_clock::now() - start}.count() / 1000 << "us" << std::endl;
+            report(std::string{label} + ", table", [&camera](unsigned int x, unsigned int y)
+                   { return camera.GetRay(x, y); });
+            report(std::string{label} + ", table and jitter", [&camera, &offsets](unsigned int x, unsigned int y)
+                   { return camera.GetRay(x, y, offsets[(x * 7 + y * 3) % offsets.size()], offsets[(x * 5 + y) % offsets.size()]); });
+        }
+
+        // in a frame: rays shared by all passes, against a jittered ray and its packet per pass
+        constexpr unsigned int PASSES = 10;
+        for (bool const jitter : {false, true})
+        {
+            Rt::Raytracer const raytracer{1u, Rt::RenderSettings{.Mode = Rt::Integrator::PrimaryVisibility, .View = Camera::Settings{.Jitter = jitter}}};
+            Rt::RenderContext context{raytracer};
+            Bitmap::BitmapD accumulator{WIDTH / 2, HEIGHT / 2};
+            auto const start = std::chrono::steady_clock::now();
+            context.Submit(accumulator, PASSES);
+            context.Wait();
+            std::cout << "Primary visibility, " << PASSES << " passes" << (jitter ? ", jittered: " : ": ") << nanoseconds{std::chrono::steady_clock::now() - start}.count() / 1e6 << "ms" << std::endl;
+        }
+    }
+
+    inline void _bench_frame_startup()
+    {
+        constexpr size_t FRAMECOUNT = 200;
+        Rt::Raytracer const raytracer{};
+        std::unique_ptr<Bitmap::BitmapD> accumulator{new Bitmap::BitmapD{}};
+
+        // frames without passes, so only the overhead of getting the workers going and handing out tiles is left
+        auto const reportStartup = [](std::string const &label, std::chrono::duration<double> startup, std::chrono::duration<double> wall)
+        {
+            std::cout << label << ": startup " << startup.count() * 1e6 / FRAMECOUNT << "us, frame " << wall.count() * 1e6 / FRAMECOUNT << "us" << std::endl;
+        };
+
+        std::chrono::duration<double> startup{0};
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < FRAMECOUNT; i++)
+        {
+            Rt::RenderContext context{raytracer};
+            context.Submit(*accumulator, 0);
+            startup += context.Wait().Startup;
+        }
+        reportStartup("RenderContext per frame", startup, std::chrono::steady_clock::now() - start);
+
+        startup = std::chrono::duration<double>{0};
+        start = std::chrono::steady_clock::now();
+        Rt::RenderContext context{raytracer};
+        for (size_t i = 0; i < FRAMECOUNT; i++)
+        {
+            context.Submit(*accumulator, 0);
+            startup += context.Wait().Startup;
+        }
+        reportStartup("Persistent RenderContext", startup, std::chrono::steady_clock::now() - start);
+    }
+
+    inline void RunBenchmarks()
+    {
+        _bench_check_hit();
+        _bench_march_ray();
+        _bench_diffuse_probes();
+        _bench_bvh_scaling();
+        _bench_ray_packets();
+        _bench_shadow_rays();
+        _bench_wavefront();
+        _bench_integrators();
+        _bench_samplers();
+        _bench_next_event_estimation();
+        _bench_adaptive_sampling();
+        _bench_denoiser();
+        _bench_aovs();
+        _bench_frame_sizes();
+        _bench_tiled_accumulator();
+        _bench_tone_mapping();
+        _bench_mapped_image();
+        _bench_image_writers();
+        _bench_camera_rays();
+        _bench_frame_startup();
+    }
+}
@@ -1,11 +1,16 @@
 #pragma once
 
-#include <array>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
 
 #include "Primitives.h"
 
 namespace Bitmap
 {
+    /// @brief Size of frames unless the caller asks for another
 #ifdef NDEBUG
     constexpr unsigned int BITMAP_WIDTH = 600;
     constexpr unsigned int BITMAP_HEIGHT = 450;
@@ -15,42 +20,305 @@ namespace Bitmap
 #endif
     constexpr unsigned int COLOR_COUNT = 3;
 
-    constexpr unsigned int BUFFERSIZE = BITMAP_WIDTH * BITMAP_HEIGHT * COLOR_COUNT;
+    /// @brief Every row starts on a cache line, which is also the widest SIMD register
+    constexpr size_t ROW_ALIGNMENT = 64;
+
+    /// @brief Edge length of a tile of _tiled_bitmap_t in pixels, the size of the scheduler's tiles
+    constexpr unsigned int TILE_EDGE = 16;
+    /// @brief Channels per pixel of _tiled_bitmap_t: COLOR_COUNT padded to a single 16 byte vector of floats
+    constexpr unsigned int TILED_CHANNELS = 4;
+
+    template <typename T>
+    struct _aligned_deleter_t
+    {
+        void operator()(T *data) const
+        {
+            ::operator delete(data, std::align_val_t{ROW_ALIGNMENT});
+        }
+    };
 
+    template <typename T>
+    using _aligned_array_t = std::unique_ptr<T[], _aligned_deleter_t<T>>;
+
+    /// @brief Array starting on a cache line, all elements 0
+    template <typename T>
+    _aligned_array_t<T> _allocate_aligned(size_t count)
+    {
+        T *const data = static_cast<T *>(::operator new(std::max(count, size_t{1}) * sizeof(T), std::align_val_t{ROW_ALIGNMENT}));
+        std::fill_n(data, count, T{0});
+        return _aligned_array_t<T>{data};
+    }
+
+    /// @brief Interleaved color channels of a frame whose size is chosen at runtime. Rows are padded to
+    /// ROW_ALIGNMENT, so a row never shares a cache line with the next one and can be loaded aligned. Move only, as
+    /// a 4K frame of floats is some 100MB
     template <typename T>
     class _bitmap_t
     {
+        static_assert(std::is_trivially_copyable_v<T>, "Pixels are cleared and copied bytewise");
+
     public:
-        std::array<T, BUFFERSIZE> Pixels = {0};
+        /// @brief Ctor, all pixels 0
+        _bitmap_t(unsigned int width = BITMAP_WIDTH, unsigned int height = BITMAP_HEIGHT)
+            : Width{width}, Height{height}, Stride{getStride(width)}, Data{_allocate_aligned<T>(Stride * height)}
+        {
+        }
+
+        _bitmap_t(_bitmap_t &&other) noexcept
+            : Width{other.Width}, Height{other.Height}, Stride{other.Stride}, Data{std::move(other.Data)}
+        {
+            other.Width = other.Height = 0;
+            other.Stride = 0;
+        }
+
+        _bitmap_t &operator=(_bitmap_t &&other) noexcept
+        {
+            std::swap(Width, other.Width);
+            std::swap(Height, other.Height);
+            std::swap(Stride, other.Stride);
+            std::swap(Data, other.Data);
+            return *this;
+        }
+
+        _bitmap_t(_bitmap_t const &) = delete;
+        _bitmap_t &operator=(_bitmap_t const &) = delete;
+
+        /// @brief Explicit copy, including the padding
+        _bitmap_t Clone() const
+        {
+            _bitmap_t result{Width, Height};
+            std::copy_n(Data.get(), Stride * Height, result.Data.get());
+            return result;
+        }
+
+        unsigned int GetWidth() const
+        {
+            return Width;
+        }
+
+        unsigned int GetHeight() const
+        {
+            return Height;
+        }
+
+        /// @brief Elements from one row to the next, at least GetWidth() * COLOR_COUNT
+        size_t GetStride() const
+        {
+            return Stride;
+        }
+
+        /// @return True if both have the same size
+        template <typename T2>
+        bool HasSizeOf(_bitmap_t<T2> const &other) const
+        {
+            return Width == other.GetWidth() && Height == other.GetHeight();
+        }
+
+        /// @brief Row in physical order, GetWidth() * COLOR_COUNT elements followed by the padding
+        T *Row(unsigned int y)
+        {
+            return Data.get() + Stride * y;
+        }
+
+        T const *Row(unsigned int y) const
+        {
+            return Data.get() + Stride * y;
+        }
 
         T const &at(unsigned int x, unsigned int y, unsigned int color) const
         {
-            return Pixels[(BITMAP_WIDTH * COLOR_COUNT) * y + COLOR_COUNT * x + color];
+            return Row(y)[COLOR_COUNT * x + color];
         }
 
         T &at(unsigned int x, unsigned int y, unsigned int color)
         {
-            return Pixels[(BITMAP_WIDTH * COLOR_COUNT) * y + COLOR_COUNT * x + color];
+            return Row(y)[COLOR_COUNT * x + color];
         }
 
         /// @brief References a pixel at physical location and maps it to image location
         /// @param x X in physical coords
         /// @param y y in physical coords
         /// @return Color of that pixel in image space
-        constexpr T *atPixel(unsigned int x, unsigned int y)
+        T *atPixel(unsigned int x, unsigned int y)
         {
-            return Pixels.begin() + ((BITMAP_WIDTH * COLOR_COUNT) * (Bitmap::BITMAP_HEIGHT - 1 - y) + COLOR_COUNT * x);
+            return Row(Height - 1 - y) + COLOR_COUNT * x;
+        }
+
+        T const *atPixel(unsigned int x, unsigned int y) const
+        {
+            return Row(Height - 1 - y) + COLOR_COUNT * x;
+        }
+
+        /// @brief Sets every channel of every pixel, the padding stays 0
+        void Fill(T value)
+        {
+            for (unsigned int y = 0; y < Height; y++)
+                std::fill_n(Row(y), Width * COLOR_COUNT, value);
+        }
+
+        /// @brief Same size and pixels, the padding is not compared
+        bool operator==(_bitmap_t const &other) const
+        {
+            if (!HasSizeOf(other))
+                return false;
+            for (unsigned int y = 0; y < Height; y++)
+                if (!std::equal(Row(y), Row(y) + Width * COLOR_COUNT, other.Row(y)))
+                    return false;
+            return true;
         }
 
         template <typename T2>
         _bitmap_t<T2> Cast() const
         {
-            _bitmap_t<T2> result{};
-            std::copy(Pixels.begin(), Pixels.end(), result.Pixels.begin());
+            _bitmap_t<T2> result{Width, Height};
+            for (unsigned int y = 0; y < Height; y++)
+                std::copy_n(Row(y), Width * COLOR_COUNT, result.Row(y));
             return result;
         }
+
+    private:
+        unsigned int Width;
+        unsigned int Height;
+        size_t Stride;
+        _aligned_array_t<T> Data;
+
+        static size_t getStride(unsigned int width)
+        {
+            constexpr size_t elementsPerLine = ROW_ALIGNMENT / sizeof(T);
+            return (width * COLOR_COUNT + elementsPerLine - 1) / elementsPerLine * elementsPerLine;
+        }
     };
 
     using Bitmap = _bitmap_t<unsigned char>;
     using BitmapD = _bitmap_t<Primitives::FloatingType_t>;
-}
\ No newline at end of file
+
+    /// @brief Accumulator layout for tile by tile rendering: the frame is cut into TILE_EDGE x TILE_EDGE tiles, each
+    /// one a contiguous block, with the pixels of a tile in Z-order (Morton order) and their channels padded to
+    /// TILED_CHANNELS. A tile of floats is a single 4KB page, so a worker adding a tile streams through one block
+    /// instead of TILE_EDGE rows spread over the frame, and neighbours in both directions share cache lines. Image
+    /// space like the accumulator, rows only exist once Detile() converted it. Move only like _bitmap_t
+    template <typename T>
+    class _tiled_bitmap_t
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Pixels are cleared and copied bytewise");
+
+    public:
+        /// @brief Elements of a tile, padding included
+        static constexpr size_t TILE_ELEMENTS = TILE_EDGE * TILE_EDGE * TILED_CHANNELS;
+
+        /// @brief Ctor, all pixels 0. Partial tiles at the right and top edge are allocated whole
+        _tiled_bitmap_t(unsigned int width = BITMAP_WIDTH, unsigned int height = BITMAP_HEIGHT)
+            : Width{width}, Height{height}, TilesX{(width + TILE_EDGE - 1) / TILE_EDGE}, TilesY{(height + TILE_EDGE - 1) / TILE_EDGE},
+              Data{_allocate_aligned<T>((size_t)TilesX * TilesY * TILE_ELEMENTS)}
+        {
+        }
+
+        _tiled_bitmap_t(_tiled_bitmap_t &&other) noexcept
+            : Width{other.Width}, Height{other.Height}, TilesX{other.TilesX}, TilesY{other.TilesY}, Data{std::move(other.Data)}
+        {
+            other.Width = other.Height = 0;
+            other.TilesX = other.TilesY = 0;
+        }
+
+        _tiled_bitmap_t &operator=(_tiled_bitmap_t &&other) noexcept
+        {
+            std::swap(Width, other.Width);
+            std::swap(Height, other.Height);
+            std::swap(TilesX, other.TilesX);
+            std::swap(TilesY, other.TilesY);
+            std::swap(Data, other.Data);
+            return *this;
+        }
+
+        _tiled_bitmap_t(_tiled_bitmap_t const &) = delete;
+        _tiled_bitmap_t &operator=(_tiled_bitmap_t const &) = delete;
+
+        unsigned int GetWidth() const
+        {
+            return Width;
+        }
+
+        unsigned int GetHeight() const
+        {
+            return Height;
+        }
+
+        /// @return True if both have the same size
+        template <typename T2>
+        bool HasSizeOf(_bitmap_t<T2> const &other) const
+        {
+            return Width == other.GetWidth() && Height == other.GetHeight();
+        }
+
+        /// @brief Tile containing the pixel, TILE_ELEMENTS elements in Z-order
+        T *Tile(unsigned int x, unsigned int y)
+        {
+            return Data.get() + ((size_t)(y / TILE_EDGE) * TilesX + x / TILE_EDGE) * TILE_ELEMENTS;
+        }
+
+        T const *Tile(unsigned int x, unsigned int y) const
+        {
+            return Data.get() + ((size_t)(y / TILE_EDGE) * TilesX + x / TILE_EDGE) * TILE_ELEMENTS;
+        }
+
+        /// @brief References a pixel in image space, like _bitmap_t::atPixel()
+        /// @return COLOR_COUNT channels followed by the padding
+        T *atPixel(unsigned int x, unsigned int y)
+        {
+            return Tile(x, y) + getMortonIndex(x % TILE_EDGE, y % TILE_EDGE) * TILED_CHANNELS;
+        }
+
+        T const *atPixel(unsigned int x, unsigned int y) const
+        {
+            return Tile(x, y) + getMortonIndex(x % TILE_EDGE, y % TILE_EDGE) * TILED_CHANNELS;
+        }
+
+        /// @brief Converts a rectangle [fromX, toX) x [fromY, toY) to rows. Rectangles of whole tiles read and
+        /// write disjoint memory, so they can be converted concurrently
+        /// @param output Of the same size
+        void Detile(_bitmap_t<T> &output, unsigned int fromX, unsigned int fromY, unsigned int toX, unsigned int toY) const
+        {
+            for (unsigned int y = fromY; y < toY; y++)
+            {
+                T *target = output.atPixel(fromX, y);
+                for (unsigned int tileX = fromX; tileX < toX; tileX = (tileX / TILE_EDGE + 1) * TILE_EDGE)
+                {
+                    // the pixels of a tile row are spread over the Z-order, but within the tile's page
+                    T const *const tile = Tile(tileX, y);
+                    unsigned int const rowBits = getMortonIndex(0, y % TILE_EDGE);
+                    unsigned int const end = std::min(toX, (tileX / TILE_EDGE + 1) * TILE_EDGE);
+                    for (unsigned int x = tileX; x < end; x++, target += COLOR_COUNT)
+                        std::copy_n(tile + (rowBits | getMortonIndex(x % TILE_EDGE, 0)) * TILED_CHANNELS, COLOR_COUNT, target);
+                }
+            }
+        }
+
+        /// @brief Converts the whole frame to rows on the calling thread, see Rt::RenderContext::Detile() for all workers
+        void Detile(_bitmap_t<T> &output) const
+        {
+            Detile(output, 0, 0, Width, Height);
+        }
+
+    private:
+        unsigned int Width;
+        unsigned int Height;
+        unsigned int TilesX;
+        unsigned int TilesY;
+        _aligned_array_t<T> Data;
+
+        /// @brief Interleaves the bits of x and y, x in the even bits
+        static constexpr unsigned int getMortonIndex(unsigned int x, unsigned int y)
+        {
+            static_assert(TILE_EDGE <= 16, "Coordinates within a tile are spread as 4 bits");
+            return spreadBits(x) | spreadBits(y) << 1;
+        }
+
+        static constexpr unsigned int spreadBits(unsigned int value)
+        {
+            value = (value | value << 2) & 0x33u;
+            return (value | value << 1) & 0x55u;
+        }
+    };
+
+    using TiledBitmapD = _tiled_bitmap_t<Primitives::FloatingType_t>;
+}
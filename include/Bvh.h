@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "Primitives.h"
+#include "Debug.h"
+
+namespace Bvh
+{
+    using namespace Primitives;
+
+    /// @brief Deepest leaf Tree::Build() creates, which bounds the stack of the traversal
+    constexpr size_t MAX_TRAVERSAL_DEPTH = 64;
+
+    /// @brief Flattened node, laid out depth first. The first child of an inner node directly follows its parent
+    struct Node
+    {
+        Aabb Bounds;
+        /// @brief Leaf: index of the first primitive, inner: index of the second child
+        uint32_t Offset;
+        /// @brief Number of primitives, 0 for inner nodes
+        uint16_t Count;
+        /// @brief Split axis of inner nodes, used to visit children front to back
+        uint16_t Axis;
+    };
+
+    static_assert(sizeof(Node) == 32, "Node should fit two per cache line");
+
+    /// @brief Slab test
+    /// @return True if the ray enters the box before maxDistance
+    inline bool IntersectsBox(Aabb const &box, Vec3d const &origin, Vec3d const &inverseDirection, FloatingType_t maxDistance)
+    {
+        FloatingType_t nearDistance = 0;
+        FloatingType_t farDistance = maxDistance;
+        for (size_t i = 0; i < 3; i++)
+        {
+            FloatingType_t t0 = (box.Min.Data[i] - origin.Data[i]) * inverseDirection.Data[i];
+            FloatingType_t t1 = (box.Max.Data[i] - origin.Data[i]) * inverseDirection.Data[i];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            nearDistance = std::max(nearDistance, t0);
+            farDistance = std::min(farDistance, t1);
+        }
+        return nearDistance <= farDistance;
+    }
+
+    /// @brief Bounding volume hierarchy over a set of bounded primitives. The primitives themselves are owned by
+    /// the caller, who is expected to store them in GetPrimitiveOrder() such that every leaf is a contiguous range
+    class Tree
+    {
+    public:
+        /// @brief Empty tree
+        Tree() = default;
+
+        /// @brief Builds the hierarchy using the surface area heuristic
+        /// @param primitiveBounds Bounds of every primitive
+        Tree(std::vector<Aabb> const &primitiveBounds);
+
+        /// @brief Order in which the leaves reference the primitives
+        /// @return Original primitive indices, in leaf order
+        std::vector<uint32_t> const &GetPrimitiveOrder() const;
+
+        size_t GetNodeCount() const;
+
+        /// @brief Levels from the root down to the deepest leaf, at most MAX_TRAVERSAL_DEPTH
+        size_t GetDepth() const;
+
+        /// @brief Visits all leaves whose boxes are entered before maxDistance, front to back
+        /// @param maxDistance Boxes further away are culled, may shrink while visiting
+        /// @param visitLeaf Called with the range [begin, end) of primitives in leaf order. May return true to end
+        /// the traversal, e.g. at the first hit of a shadow ray
+        template <typename LeafVisitor>
+        void Traverse(Line const &ray, FloatingType_t const &maxDistance, LeafVisitor &&visitLeaf) const;
+
+        /// @brief Visits all leaves whose boxes pass a test, e.g. for a packet of rays sharing one traversal
+        /// @param directionIsNegative Per axis, decides which child is visited first
+        /// @param entersBox Called per node, may change its result while visiting
+        /// @param visitLeaf Called with the range [begin, end) of primitives in leaf order. May return true to end
+        /// the traversal
+        template <typename BoxTest, typename LeafVisitor>
+        void Traverse(std::array<bool, 3> const &directionIsNegative, BoxTest &&entersBox, LeafVisitor &&visitLeaf) const;
+
+    private:
+        struct buildReference_t
+        {
+            Aabb Bounds;
+            Vec3d Centroid;
+            uint32_t Index;
+        };
+
+        std::vector<Node> Nodes;
+        std::vector<uint32_t> PrimitiveOrder;
+
+        /// @param depth Levels above the node that is built
+        void Build(std::vector<buildReference_t> &references, size_t begin, size_t end, size_t depth);
+    };
+
+    template <typename LeafVisitor>
+    inline void Tree::Traverse(Line const &ray, FloatingType_t const &maxDistance, LeafVisitor &&visitLeaf) const
+    {
+        Vec3d const inverseDirection{1 / ray.Direction.X(), 1 / ray.Direction.Y(), 1 / ray.Direction.Z()};
+        std::array<bool, 3> const directionIsNegative = {inverseDirection.X() < 0, inverseDirection.Y() < 0, inverseDirection.Z() < 0};
+
+        // boxes behind the closest hit so far are skipped
+        Traverse(directionIsNegative, [&](Aabb const &box)
+                 { return IntersectsBox(box, ray.Origin, inverseDirection, maxDistance); },
+                 visitLeaf);
+    }
+
+    template <typename BoxTest, typename LeafVisitor>
+    inline void Tree::Traverse(std::array<bool, 3> const &directionIsNegative, BoxTest &&entersBox, LeafVisitor &&visitLeaf) const
+    {
+        if (Nodes.empty())
+            return;
+
+        std::array<uint32_t, MAX_TRAVERSAL_DEPTH> stack;
+        size_t stackSize = 0;
+        uint32_t current = 0;
+        while (true)
+        {
+            Node const &node = Nodes[current];
+            if (entersBox(node.Bounds))
+            {
+                if (node.Count > 0)
+                {
+                    if constexpr (std::is_same_v<std::invoke_result_t<LeafVisitor &, uint32_t, uint32_t>, bool>)
+                    {
+                        if (visitLeaf(node.Offset, node.Offset + node.Count))
+                            return;
+                    }
+                    else
+                    {
+                        visitLeaf(node.Offset, node.Offset + node.Count);
+                    }
+                }
+                else
+                {
+                    DEBUG_ASSERT(stackSize < MAX_TRAVERSAL_DEPTH, "Traversal stack overflow");
+
+                    // visit near child first, far child is likely culled by then
+                    if (directionIsNegative[node.Axis])
+                    {
+                        stack[stackSize++] = current + 1;
+                        current = node.Offset;
+                    }
+                    else
+                    {
+                        stack[stackSize++] = node.Offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stackSize == 0)
+                break;
+            current = stack[--stackSize];
+        }
+    }
+}
@@ -1,12 +1,113 @@
 #pragma once
 
+#include <array>
+#include <vector>
+
 #include "Primitives.h"
 
 using namespace Primitives;
 
 namespace Camera
 {
-    Vec3d const Origin{0, 0, 1};
-    Vec3d const Pointing{1, 0, 0};
-    FloatingType_t const FOV = Deg2Rad(90);
+    constexpr Vec3d Origin{0, 0, 1};
+    constexpr Vec3d Pointing{1, 0, 0};
+    constexpr Vec3d Upwards{0, 0, 1};
+    constexpr FloatingType_t FOV = Deg2Rad(90);
+
+    enum class Projection
+    {
+        /// @brief Longitude grows with x and latitude with y, both by the same angle per pixel. Covers any field of
+        /// view, but bends straight lines away from the centre
+        Spherical,
+        /// @brief Perspective through a point onto a plane, keeps straight lines straight. Below 180 degrees only
+        Pinhole
+    };
+
+    struct Settings
+    {
+        Projection Model = Projection::Spherical;
+
+        Vec3d Position = Origin;
+
+        /// @brief Direction the centre of the frame looks at, need not be normalized
+        Vec3d Forward = Pointing;
+
+        /// @brief Rolls the camera about Forward. Need not be normalized nor orthogonal to Forward, only not parallel
+        Vec3d Up = Upwards;
+
+        /// @brief Horizontal angle the frame covers, the vertical one follows from the aspect ratio
+        FloatingType_t FieldOfView = FOV;
+
+        /// @brief Moves the camera ray of every pass to a random point within the pixel, which antialiases edges as
+        /// passes add up. Otherwise all passes share the ray through the pixel's corner, and its hits
+        bool Jitter = false;
+
+        bool operator==(Settings const &) const = default;
+    };
+
+    /// @brief Camera rays of a frame size. A direction is separable into a factor per column and one per row, which
+    /// are computed once per camera and frame size, so a ray costs a few multiplications and no trig. A jittered ray
+    /// moves both factors within their pixel, again without trig
+    class RayTable
+    {
+    public:
+        /// @brief Ctor, computes the factors of all columns and rows
+        RayTable(Settings const &settings, unsigned int width, unsigned int height);
+
+        Settings const Config;
+
+        /// @return True if the table was built for the settings and frame size
+        bool IsFor(Settings const &settings, unsigned int width, unsigned int height) const;
+
+        unsigned int GetWidth() const;
+        unsigned int GetHeight() const;
+
+        /// @brief Ray through a pixel, in image space
+        Line GetRay(unsigned int x, unsigned int y) const
+        {
+            return Line{Config.Position, ToWorld(Columns[x], Rows[y])};
+        }
+
+        /// @brief Ray through a point within a pixel
+        /// @param offsetX Towards the next column, in pixels within [-0.5, 0.5]
+        /// @param offsetY Towards the next row, in pixels within [-0.5, 0.5]
+        Line GetRay(unsigned int x, unsigned int y, FloatingType_t offsetX, FloatingType_t offsetY) const
+        {
+            return Line{Config.Position, ToWorld(Offset(Columns[x], offsetX), Offset(Rows[y], offsetY))};
+        }
+
+    private:
+        /// @brief Two values, then their change per pixel
+        using factor_t = std::array<FloatingType_t, 4>;
+
+        unsigned int const Width;
+        unsigned int const Height;
+        /// @brief Spherical: angle per pixel, pinhole: length per pixel on the plane at distance 1
+        FloatingType_t Step;
+        /// @brief Second order term of an offset, half the squared step for the angles of spherical, 0 for the plane
+        FloatingType_t Curvature;
+        /// @brief Orthonormal, Side points towards growing x and Up towards growing y
+        Vec3d Forward;
+        Vec3d Side;
+        Vec3d Up;
+        /// @brief Spherical: cosine and sine of the longitude per column and of the latitude per row. Pinhole: 1 and
+        /// the coordinate on the plane, so both give the same product below
+        std::vector<factor_t> Columns;
+        std::vector<factor_t> Rows;
+
+        /// @brief Direction from the factors of its column and row
+        Vec3d ToWorld(factor_t const &column, factor_t const &row) const
+        {
+            Vec3d const direction = Forward * (row[0] * column[0]) + Side * (row[0] * column[1]) + Up * row[1];
+            return Config.Model == Projection::Pinhole ? direction.ToNormalized() : direction;
+        }
+
+        /// @brief Factor of a column or row moved by a fraction of a pixel. For spherical this is angle addition with
+        /// cosine and sine of the offset cut after their second order, well below a pixel for steps of a few degrees
+        factor_t Offset(factor_t const &factor, FloatingType_t offset) const
+        {
+            FloatingType_t const scale = 1 - Curvature * offset * offset;
+            return factor_t{factor[0] * scale + factor[2] * offset, factor[1] * scale + factor[3] * offset};
+        }
+    };
 }
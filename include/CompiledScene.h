@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Bvh.h"
+#include "Materials.h"
+#include "Primitives.h"
+#include "RayPacket.h"
+#include "Shapes.h"
+
+namespace Scene
+{
+    using namespace Primitives;
+
+    /// @brief Spheres, one contiguous array per component
+    struct SphereSoa
+    {
+        std::vector<FloatingType_t> CenterX;
+        std::vector<FloatingType_t> CenterY;
+        std::vector<FloatingType_t> CenterZ;
+        std::vector<FloatingType_t> Radius;
+        std::vector<uint32_t> MaterialIndex;
+
+        void Add(Vec3d const &center, FloatingType_t radius, uint32_t materialIndex);
+
+        size_t Size() const
+        {
+            return Radius.size();
+        }
+
+        Vec3d GetCenter(size_t index) const
+        {
+            return Vec3d{CenterX[index], CenterY[index], CenterZ[index]};
+        }
+    };
+
+    /// @brief Planes, one contiguous array per component
+    struct PlaneSoa
+    {
+        std::vector<FloatingType_t> PinX;
+        std::vector<FloatingType_t> PinY;
+        std::vector<FloatingType_t> PinZ;
+        std::vector<FloatingType_t> NormalX;
+        std::vector<FloatingType_t> NormalY;
+        std::vector<FloatingType_t> NormalZ;
+        std::vector<uint32_t> MaterialIndex;
+        /// @brief Material of every other checkerboard field
+        std::vector<uint32_t> CheckerMaterialIndex;
+        /// @brief Width of a checkerboard field, 0 for plain planes
+        std::vector<FloatingType_t> CheckerWidth;
+
+        void Add(Vec3d const &pin, Vec3d const &normal, uint32_t materialIndex, uint32_t checkerMaterialIndex, FloatingType_t checkerWidth);
+
+        size_t Size() const
+        {
+            return PinX.size();
+        }
+
+        Vec3d GetNormal(size_t index) const
+        {
+            return Vec3d{NormalX[index], NormalY[index], NormalZ[index]};
+        }
+    };
+
+    /// @brief Target of Shapes::Shape::Compile()
+    struct PrimitiveArrays
+    {
+        SphereSoa Spheres;
+        PlaneSoa Planes;
+        std::vector<Materials::Material> Materials;
+
+        /// @brief Stores a material
+        /// @return Index of the material
+        uint32_t AddMaterial(Materials::Material const &material);
+    };
+
+    /// @brief Closest primitive found by a kernel
+    struct KernelHit
+    {
+        FloatingType_t DistanceToSurface = INFINITY;
+        uint32_t Index = 0;
+        /// @brief Spheres: ray started outside
+        bool FromOutside = false;
+    };
+
+    /// @brief Tests a ray against the spheres [begin, end), no virtual dispatch
+    /// @param closest Updated if a sphere is closer than closest.DistanceToSurface
+    void IntersectSpheres(SphereSoa const &spheres, size_t begin, size_t end, Line const &ray, KernelHit &closest);
+
+    /// @brief Tests a ray against all planes, no virtual dispatch
+    /// @param closest Updated if a plane is closer than closest.DistanceToSurface
+    void IntersectPlanes(PlaneSoa const &planes, Line const &ray, KernelHit &closest);
+
+    /// @brief Shape index of hits that hit nothing
+    constexpr uint32_t NO_SHAPE = UINT32_MAX;
+
+    /// @brief Closest hit of a ray within the scene
+    struct Intersection
+    {
+        /// @brief Material at the hit, nullptr if nothing was hit
+        Materials::Material const *Material;
+        Shapes::HitEvent Hitevent;
+    };
+
+    /// @brief Direction towards an emitter, drawn by CompiledScene::SampleEmitter()
+    struct EmitterSample
+    {
+        Vec3d Direction;
+        /// @brief Occluders closer than this block the emitter
+        FloatingType_t Distance = 0;
+        /// @brief Solid angle density, including the probability of picking the emitter. 0 if nothing was drawn
+        FloatingType_t Pdf = 0;
+        Materials::Material const *Material = nullptr;
+    };
+
+    /// @brief Render representation of a scene: primitives in SoA layout per type, spheres ordered by a BVH.
+    /// Spheres enclosing the whole scene (sky sphere) and planes are tested linearly
+    class CompiledScene
+    {
+    public:
+        /// @brief Compiles the authoring shapes, which are not referenced afterwards
+        /// @param shapes Scene to compile
+        CompiledScene(std::span<Shapes::Shape const *const> shapes);
+
+        /// @brief Finds the closest intersection
+        /// @param ray Ray to check
+        /// @return Closest hit, Material is nullptr if nothing was hit
+        Intersection GetClosestIntersection(Line const &ray) const;
+
+        /// @brief Finds the closest intersections of a packet of rays, which share one traversal of the tree
+        /// @param packet Rays to check
+        /// @param intersections Written for the active lanes of the packet, same as GetClosestIntersection()
+        /// @param level Kernels to use, at most GetSimdLevel()
+        void GetClosestIntersections(RayPacket const &packet, std::array<Intersection, PACKET_SIZE> &intersections, SimdLevel level = GetSimdLevel()) const;
+
+        /// @brief Any hit query for shadow rays, stops at the first primitive found
+        /// @param ray Ray to check
+        /// @param maxDistance Primitives at least this far away are ignored
+        /// @return True if anything is hit closer than maxDistance
+        bool IsOccluded(Line const &ray, FloatingType_t maxDistance) const;
+
+        /// @brief Number of emitters that can be sampled explicitly: emissive spheres and plain emissive planes
+        size_t GetEmitterCount() const;
+
+        /// @brief Picks an emitter by its emission and draws a direction towards it
+        /// @param u Uniform in [0, 1), picks the emitter
+        /// @param u1 Uniform in [0, 1), first direction dimension
+        /// @param u2 Uniform in [0, 1), second direction dimension
+        /// @param origin Point to gather light at
+        /// @param normal Of the surface at origin, emitters surrounding it are sampled on its hemisphere
+        /// @return Pdf is 0 if there is no emitter or the direction misses it
+        EmitterSample SampleEmitter(FloatingType_t u, FloatingType_t u1, FloatingType_t u2, Vec3d const &origin, Vec3d const &normal) const;
+
+        /// @brief Density SampleEmitter() has for a ray that hit an emitter, to weight it against light samples
+        /// @param hit Closest hit of the ray
+        /// @param ray Started at the origin of SampleEmitter()
+        /// @param cosineToNormal Cosine between ray and the normal of SampleEmitter()
+        /// @return 0 if the hit is not an emitter of GetEmitterCount()
+        FloatingType_t GetEmitterPdf(Intersection const &hit, Line const &ray, FloatingType_t cosineToNormal) const;
+
+        size_t GetNodeCount() const;
+
+        /// @brief Number of distinct materials the hits point to
+        size_t GetMaterialCount() const;
+
+        /// @brief Position of a hit's material, e.g. to group hits by material
+        /// @param material Material of an Intersection
+        /// @return In [0, GetMaterialCount()), GetMaterialCount() for nullptr
+        size_t GetMaterialIndex(Materials::Material const *material) const;
+
+        /// @brief Position of the shape a hit's material belongs to, within the shapes the scene was compiled from
+        /// @param material Material of an Intersection
+        /// @return NO_SHAPE for nullptr
+        uint32_t GetShapeIndex(Materials::Material const *material) const;
+
+    private:
+        enum class EmitterShape
+        {
+            Sphere,
+            EnclosingSphere,
+            Plane
+        };
+
+        struct emitter_t
+        {
+            EmitterShape Shape;
+            /// @brief Into the primitive arrays of Shape
+            uint32_t Index;
+            /// @brief Of being picked by SampleEmitter(), by emitted luminance
+            FloatingType_t Probability;
+        };
+
+        std::vector<Materials::Material> Materials;
+        /// @brief Ordered such that every BVH leaf references a contiguous range
+        SphereSoa Spheres;
+        SphereSoa EnclosingSpheres;
+        PlaneSoa Planes;
+        Bvh::Tree SphereTree;
+        std::vector<emitter_t> Emitters;
+        /// @brief Per material, index into Emitters or NO_EMITTER. Every shape brings its own material
+        std::vector<uint32_t> EmitterOfMaterial;
+        /// @brief Per material, index of the shape that brought it
+        std::vector<uint32_t> ShapeOfMaterial;
+
+        /// @brief Finds the emitters and their probabilities, after the primitives are in place
+        void CollectEmitters();
+
+        /// @brief Solid angle density of SampleEmitter() for a direction towards the given emitter
+        FloatingType_t GetDirectionPdf(emitter_t const &emitter, Vec3d const &origin, Vec3d const &direction, FloatingType_t cosineToNormal) const;
+
+        /// @brief Turns the closest of the candidates of the linear parts and the tree into a hit
+        Intersection Shade(Line const &ray, KernelHit const &closestPlane, KernelHit const &closestEnclosing, KernelHit const &closestSphere) const;
+    };
+}
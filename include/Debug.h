@@ -3,10 +3,19 @@
 #include <string>
 #include <iostream>
 
+#ifdef NDEBUG
+// compiled out entirely, so release builds do not build message strings in hot loops. Conditions are still parsed,
+// though never evaluated, so whatever only feeds an assert stays in use
+#define DEBUG_PRINT(Message) ((void)0)
+#define DEBUG_WARN(Message) ((void)0)
+#define DEBUG_CRASH(Message) ((void)0)
+#define DEBUG_ASSERT(Condition, Message) ((void)sizeof(Condition))
+#else
 #define DEBUG_PRINT(Message) Debug::_print(Message)
 #define DEBUG_WARN(Message) Debug::_warn(Message, __FILE__, __LINE__)
 #define DEBUG_CRASH(Message) Debug::_crash(Message, __FILE__, __LINE__)
 #define DEBUG_ASSERT(Condition, Message) Debug::_assert(Condition, Message, __FILE__, __LINE__)
+#endif
 
 template <typename T1, typename T2>
 constexpr bool AlmostSame(T1 a, T2 b)
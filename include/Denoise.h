@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Aov.h"
+#include "Bitmap.h"
+#include "Primitives.h"
+#include "RayPacket.h"
+#include "Scheduler.h"
+
+namespace Denoise
+{
+    using namespace Primitives;
+
+    /// @brief Edge stopping of the filter, every term is a squared distance over its sigma squared
+    struct Settings
+    {
+        /// @brief Iterations of the 5x5 kernel, the taps of iteration i are 2^i pixels apart. At most
+        /// Denoiser::MAX_ITERATIONS of them run
+        unsigned int Iterations = 4;
+
+        /// @brief Color difference relative to the noise of the image, halved every iteration. The noise is the
+        /// standard deviation of the luminance, estimated from neighbours whose guides agree
+        FloatingType_t ColorSigma = 12;
+
+        FloatingType_t NormalSigma = 0.3;
+
+        /// @brief Depth difference relative to the depth of the pixel, per pixel of tap distance
+        FloatingType_t DepthSigma = 0.05;
+
+        FloatingType_t AlbedoSigma = 0.1;
+
+        /// @brief Widest kernel to use, AVX-512 runs the AVX2 one. All kernels give the same result
+        Scene::SimdLevel Simd = Scene::GetSimdLevel();
+    };
+
+    /// @brief Time spent by the last Run()
+    struct Timings
+    {
+        std::chrono::duration<double> Wall{0};
+        std::chrono::duration<double> Iterations{0};
+
+        /// @brief One line
+        std::string ToString() const;
+    };
+
+    /// @brief Edge avoiding a-trous wavelet filter (Dammertz et al.), guided by the first hit features. Keeps a
+    /// pool of workers and planar, padded copies of the image and guides, so rows of pixels map onto SIMD lanes
+    class Denoiser
+    {
+    public:
+        /// @brief Iterations beyond are skipped, their taps would reach past the border of the planes
+        static constexpr unsigned int MAX_ITERATIONS = 5;
+
+        /// @brief Ctor, starts the workers
+        /// @param numWorkers Number of worker threads, defaults to all hardware threads
+        Denoiser(Settings const &settings = Settings{}, unsigned int numWorkers = Scheduler::TileScheduler::GetHardwareConcurrency());
+
+        Settings const Config;
+
+        /// @brief Filters an image in place
+        /// @param image Sum or mean of the passes, the filter does not depend on its scale
+        /// @param guides AOVs of the same frame, the first hit channels guide the filter
+        Timings const &Run(Bitmap::BitmapD &image, Aov::Framebuffer const &guides);
+
+    private:
+        /// @brief Taps of the last iteration, two steps of 2^(MAX_ITERATIONS - 1) out, stay within it
+        static constexpr unsigned int BORDER = 1u << MAX_ITERATIONS;
+
+        /// @brief Of the image the planes are laid out for, they are reallocated when another size comes along
+        unsigned int Width = 0;
+        unsigned int Height = 0;
+        size_t Stride = 0;
+        size_t Rows = 0;
+
+        /// @brief One plane per channel, Stride x Rows, 0 in the border
+        using plane_t = std::vector<float>;
+
+        struct iteration_t
+        {
+            unsigned int Step;
+            float InverseColorVariance;
+            float InverseNormalVariance;
+            float InverseDepthVariance;
+            float InverseAlbedoVariance;
+        };
+
+        /// @brief Ping pong between two sets of color planes
+        std::array<std::array<plane_t, 3>, 2> Color;
+        std::array<plane_t, 3> Albedo;
+        std::array<plane_t, 3> Normal;
+        /// @brief Inverse depth, which turns the relative depth difference into a product
+        plane_t InverseDepth;
+        plane_t Depth;
+        /// @brief 1 inside the image, 0 in the border, so the border taps get no weight
+        plane_t Inside;
+
+        std::vector<FloatingType_t> NoiseScratch;
+        Timings Statistics;
+        Scheduler::TileScheduler Pool;
+
+        /// @brief Lays the planes out for an image size
+        void Resize(unsigned int width, unsigned int height);
+
+        /// @brief Standard deviation of the luminance of a pixel, from the input planes
+        FloatingType_t EstimateNoise();
+
+        void FilterTile(Scheduler::Tile const &tile, iteration_t const &iteration, unsigned int source);
+    };
+}
@@ -1,40 +1,129 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <fstream>
+#include <vector>
 #include <stdio.h>
 
 #include "Bitmap.h"
 #include "Debug.h"
+#include "ToneMap.h"
 
 namespace ImgFile
 {
     constexpr std::string NEWLINE = "\n";
     constexpr std::string FILETYPE_MAGICNUMBER = "P6";
     constexpr std::string PIXELDEPTH = "255";
+    constexpr std::string FLOAT_MAGICNUMBER = "PF";
 
-    template <typename T>
-    void writeNetPbm(std::string targetFile, Bitmap::_bitmap_t<T> const &bitmap)
+    enum class Format
+    {
+        /// @brief Binary 8 bit PPM (P6), tone mapped
+        Ppm,
+        /// @brief Portable float map, the mean of the samples as it is. Rows go from the bottom up
+        Pfm,
+        /// @brief "Quite OK Image" format: lossless, 8 bit, tone mapped like PPM and compressed in a single pass
+        Qoi
+    };
+
+    /// @brief Header of PPM and PFM files
+    inline std::string getNetPbmHeader(Format format, unsigned int width, unsigned int height)
+    {
+        std::string const size = std::to_string(width) + " " + std::to_string(height) + NEWLINE;
+        if (format == Format::Ppm)
+            return FILETYPE_MAGICNUMBER + NEWLINE + size + PIXELDEPTH + NEWLINE;
+        // the sign of the scale gives the byte order of the floats
+        return FLOAT_MAGICNUMBER + NEWLINE + size + (std::endian::native == std::endian::little ? "-1.0" : "1.0") + NEWLINE;
+    }
+
+    /// @brief Writes a frame as binary PPM, the file is a single write from a buffer the mapper converts into
+    /// @param mapper Converts the frame to bytes, see ToneMap::Settings
+    /// @param samples Summed into every pixel, 1 for means
+    inline void writeNetPbm(std::string targetFile, Bitmap::BitmapD const &bitmap, ToneMap::Mapper &mapper, Primitives::FloatingType_t samples = 1)
     {
         std::ofstream outfile{targetFile, std::ios::out | std::ios::binary};
         if (!outfile.good())
             DEBUG_CRASH("Cannot open output file");
 
-        // write header
-        std::string const header = FILETYPE_MAGICNUMBER + NEWLINE + (std::to_string(Bitmap::BITMAP_WIDTH) + " " + std::to_string(Bitmap::BITMAP_HEIGHT)) + NEWLINE + PIXELDEPTH + NEWLINE;
-        outfile.write((char const *)header.c_str(), header.length());
-
-        Bitmap::Bitmap targetFormat;
-        // cast to output format & write
-        auto const minMax = std::minmax_element(bitmap.Pixels.begin(), bitmap.Pixels.end());
-        FloatingType_t scalar = FloatingType_t{255} / (*minMax.second - *minMax.first);
-        FloatingType_t offset = -(*minMax.first * scalar);
-        for (size_t i = 0; i < Bitmap::BUFFERSIZE; i++)
-            targetFormat.Pixels[i] = (unsigned char)(bitmap.Pixels[i] * scalar - offset);
-        auto const minMaxAfter = std::minmax_element(targetFormat.Pixels.begin(), targetFormat.Pixels.end());
-        //std::copy(bitmap.Pixels.begin(), bitmap.Pixels.end(), targetFormat.Pixels.begin());
-        outfile.write((char const *)targetFormat.Pixels.begin(), targetFormat.Pixels.size());
+        // header, followed by the rows without padding
+        std::string const header = getNetPbmHeader(Format::Ppm, bitmap.GetWidth(), bitmap.GetHeight());
+        size_t const rowLength = (size_t)bitmap.GetWidth() * Bitmap::COLOR_COUNT;
+        std::vector<unsigned char> staging(header.length() + rowLength * bitmap.GetHeight());
+        std::copy(header.begin(), header.end(), staging.begin());
+        mapper.Run(bitmap, samples, staging.data() + header.length(), rowLength);
 
+        outfile.write((char const *)staging.data(), staging.size());
         outfile.close();
     }
+
+    /// @brief writeNetPbm() with a mapper of its own, whose workers only live for the call
+    inline void writeNetPbm(std::string targetFile, Bitmap::BitmapD const &bitmap, ToneMap::Settings const &settings = ToneMap::Settings{}, Primitives::FloatingType_t samples = 1)
+    {
+        ToneMap::Mapper mapper{settings};
+        writeNetPbm(targetFile, bitmap, mapper, samples);
+    }
+
+    /// @brief Writes whole frames in one format. Keeps what it needs from one frame to the next, e.g. the workers of
+    /// its tone mapper and its buffers
+    class Writer
+    {
+    public:
+        virtual ~Writer() = default;
+
+        /// @brief Extension of the files, without the dot
+        virtual char const *GetExtension() const = 0;
+
+        /// @param frame Sum of the samples, or their mean
+        /// @param samples Summed into every pixel, 1 for means
+        /// @return False if the file cannot be written
+        virtual bool Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples) = 0;
+    };
+
+    /// @brief Format::Ppm, like writeNetPbm()
+    class PpmWriter : public Writer
+    {
+    public:
+        PpmWriter(ToneMap::Settings const &toneMapping = ToneMap::Settings{});
+
+        char const *GetExtension() const override;
+        bool Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples) override;
+
+    private:
+        ToneMap::Mapper Mapper;
+        std::vector<unsigned char> Staging;
+    };
+
+    /// @brief Format::Pfm, lossless: neither tone mapped nor normalized
+    class PfmWriter : public Writer
+    {
+    public:
+        char const *GetExtension() const override;
+        bool Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples) override;
+
+    private:
+        std::vector<float> Row;
+    };
+
+    /// @brief Format::Qoi, tone mapped to the same bytes as PPM
+    class QoiWriter : public Writer
+    {
+    public:
+        QoiWriter(ToneMap::Settings const &toneMapping = ToneMap::Settings{});
+
+        char const *GetExtension() const override;
+        bool Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples) override;
+
+    private:
+        ToneMap::Mapper Mapper;
+        /// @brief Tone mapped pixels, top row first
+        std::vector<unsigned char> Pixels;
+        std::vector<unsigned char> Encoded;
+    };
+
+    /// @param toneMapping Ignored by Format::Pfm
+    std::unique_ptr<Writer> CreateWriter(Format format, ToneMap::Settings const &toneMapping = ToneMap::Settings{});
 }
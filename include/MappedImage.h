@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+#include "ImgFile.h"
+#include "Primitives.h"
+#include "Scheduler.h"
+#include "ToneMap.h"
+
+namespace ImgFile
+{
+    /// @brief Image file of its final size, mapped into memory, that finished tiles are written into in place. The
+    /// file is complete from the start, black until a tile arrives, so a viewer can follow a render while it runs
+    /// and nothing is left to write once the frame is done. Where memory mapping is not available, or the disk
+    /// cannot hold the file, the pixels are kept in memory and written on Flush()
+    class MappedImage
+    {
+    public:
+        /// @brief Ctor, creates or truncates the file and writes the header
+        /// @param format Ppm or Pfm, whose pixels have fixed places
+        /// @param toneMapping PPM only, any curve but MinMax, which needs the whole frame
+        MappedImage(std::string const &file, Format format, unsigned int width, unsigned int height,
+                    ToneMap::Settings const &toneMapping = ToneMap::Settings{.Operator = ToneMap::Curve::Exposure});
+
+        /// @brief Flushes and unmaps, the file stays
+        ~MappedImage();
+
+        MappedImage(MappedImage const &) = delete;
+        MappedImage &operator=(MappedImage const &) = delete;
+
+        /// @return True if the file is mapped, otherwise the pixels wait in memory for Flush()
+        bool IsMapped() const;
+
+        /// @brief Bytes of the file, header included
+        size_t GetSize() const;
+
+        /// @brief Converts the pixels of a tile and writes them into place. Tiles are disjoint, so different tiles
+        /// may be written concurrently
+        /// @param accumulator Bitmap::BitmapD or Bitmap::TiledBitmapD of the size of the image
+        /// @param samples Summed into every pixel, 1 for means
+        template <typename TAccumulator>
+        void WriteTile(Scheduler::Tile const &tile, TAccumulator const &accumulator, Primitives::FloatingType_t samples)
+        {
+            // runs of pixels are gathered first, the tiled layout keeps a row's pixels apart
+            constexpr unsigned int RUN = Scheduler::TILE_SIZE;
+            std::array<Primitives::FloatingType_t, RUN * Bitmap::COLOR_COUNT> run;
+            for (unsigned int y = tile.FromY; y < tile.ToY; y++)
+            {
+                for (unsigned int fromX = tile.FromX; fromX < tile.ToX; fromX += RUN)
+                {
+                    unsigned int const pixels = std::min(RUN, tile.ToX - fromX);
+                    for (unsigned int i = 0; i < pixels; i++)
+                        std::copy_n(accumulator.atPixel(fromX + i, y), Bitmap::COLOR_COUNT, run.data() + i * Bitmap::COLOR_COUNT);
+                    WriteRun(fromX, y, run.data(), pixels, samples);
+                }
+            }
+        }
+
+        /// @brief Starts writing everything so far to disk. A mapped file shows every tile as soon as it is written,
+        /// otherwise this writes the whole file
+        void Flush();
+
+    private:
+        Format const OutputFormat;
+        unsigned int const Width;
+        unsigned int const Height;
+        ToneMap::Settings const ToneMapping;
+        size_t HeaderSize = 0;
+        size_t Size = 0;
+        std::string File;
+        int Descriptor = -1;
+        unsigned char *Data = nullptr;
+        /// @brief The pixels if the file cannot be mapped
+        std::vector<unsigned char> Fallback;
+
+        /// @brief Writes pixels of a row
+        /// @param x First pixel in image space
+        /// @param y Row in image space
+        /// @param source Interleaved channels
+        void WriteRun(unsigned int x, unsigned int y, Primitives::FloatingType_t const *source, unsigned int pixels, Primitives::FloatingType_t samples);
+    };
+}
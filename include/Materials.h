@@ -20,8 +20,9 @@ namespace Materials
         /// @brief How diffuse the material is, 0 is a perfect mirror, 1 is a fuzzy material
         FloatingType_t DiffusionFactor = 0;
 
-        /// @brief Indicent angle towards surface normal at which (higher than this value) total reflection occurs
-        FloatingType_t CriticalAngle = Deg2Rad(90);
+        /// @brief Cosine of the incident angle towards surface normal at which (lower than this value) total reflection
+        /// occurs. Kept as cosine, so hits compare it to a dot product instead of an acos
+        FloatingType_t CriticalCosine = 0;
 
         inline Material &MakeEmissive(Color_t emissionSpectrum)
         {
@@ -42,10 +43,13 @@ namespace Materials
             return *this;
         }
 
+        /// @param totalReflectionAngle Indicent angle towards surface normal, in radians
         inline Material &MakeTotallyReflecting(FloatingType_t totalReflectionAngle)
         {
-            CriticalAngle = totalReflectionAngle;
+            CriticalCosine = cos(totalReflectionAngle);
             return *this;
         }
     };
+
+    static_assert(std::is_trivially_copyable_v<Material>, "Material must be trivially copyable");
 }
\ No newline at end of file
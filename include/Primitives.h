@@ -1,7 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <tuple>
+#include <type_traits>
 #include <math.h>
 
 namespace Primitives
@@ -14,55 +16,81 @@ namespace Primitives
     struct Vec3d
     {
         std::array<FloatingType_t, 3> Data;
-        FloatingType_t const &X = Data[0];
-        FloatingType_t const &Y = Data[1];
-        FloatingType_t const &Z = Data[2];
 
         /// @brief Ctor
         /// @param x
         /// @param y
         /// @param z
-        Vec3d(FloatingType_t x, FloatingType_t y, FloatingType_t z);
+        constexpr Vec3d(FloatingType_t x, FloatingType_t y, FloatingType_t z)
+            : Data{x, y, z}
+        {
+        }
 
         /// @brief Ctor
         /// @param vector from array
-        Vec3d(std::array<FloatingType_t, 3> const &vector);
+        constexpr Vec3d(std::array<FloatingType_t, 3> const &vector)
+            : Data{vector}
+        {
+        }
 
         /// @brief Ctor
         /// @param color from color
-        Vec3d(Color_t const &color);
+        constexpr Vec3d(Color_t const &color)
+            : Vec3d{(FloatingType_t)color[0], (FloatingType_t)color[1], (FloatingType_t)color[2]}
+        {
+        }
 
         /// @brief Default Ctor
-        Vec3d();
+        constexpr Vec3d()
+            : Vec3d{0, 0, 0}
+        {
+        }
 
-        /// @brief Copy Ctor
-        /// @param other from other instance
-        Vec3d(Vec3d const &other);
-
-        /// @brief Assignment operator
-        /// @param other from other instance
-        void operator=(Vec3d const &other);
+        constexpr FloatingType_t X() const { return Data[0]; }
+        constexpr FloatingType_t Y() const { return Data[1]; }
+        constexpr FloatingType_t Z() const { return Data[2]; }
 
         template <typename T>
-        std::array<T, 3> Cast() const;
+        constexpr std::array<T, 3> Cast() const
+        {
+            return std::array<T, 3>{(T)Data[0], (T)Data[1], (T)Data[2]};
+        }
 
         /// @brief Compute norm (length) of vector
         /// @return The norm (length)
-        FloatingType_t GetNorm() const;
+        inline FloatingType_t GetNorm() const
+        {
+            return sqrt(*this * *this);
+        }
 
         /// @brief Compute normalized version of this vector
         /// @return This vector scaled to length 1
-        Vec3d ToNormalized() const;
+        inline Vec3d ToNormalized() const
+        {
+            return *this * (FloatingType_t{1} / GetNorm());
+        }
 
         /// @brief Multiplies X with X, Y with Y, etc
         /// @param other another vector
         /// @return Elementwise mulitplied vector
-        Vec3d MultiplyElementwise(const Vec3d &other) const;
+        constexpr Vec3d MultiplyElementwise(const Vec3d &other) const
+        {
+            return Vec3d{Data[0] * other.Data[0],
+                         Data[1] * other.Data[1],
+                         Data[2] * other.Data[2]};
+        }
 
         /// @brief Calculates the crossproduct (this) x (other)
         /// @param other another vector
         /// @return Cross product
-        Vec3d CrossProd(const Vec3d &other) const;
+        constexpr Vec3d CrossProd(const Vec3d &other) const
+        {
+            return Vec3d{
+                Data[1] * other.Data[2] - Data[2] * other.Data[1],
+                Data[2] * other.Data[0] - Data[0] * other.Data[2],
+                Data[0] * other.Data[1] - Data[1] * other.Data[0],
+            };
+        }
 
         /// @brief Applies a somewhat slow rotation within a plane given by two vector
         /// @param planeV1 first plane vector
@@ -86,39 +114,71 @@ namespace Primitives
         /// @brief DOTPRODUCT
         /// @param righthand
         /// @return Elementwise multiplication and summation
-        FloatingType_t operator*(const Vec3d &righthand) const;
+        constexpr FloatingType_t operator*(const Vec3d &righthand) const
+        {
+            return Data[0] * righthand.Data[0] +
+                   Data[1] * righthand.Data[1] +
+                   Data[2] * righthand.Data[2];
+        }
 
         /// @brief Scalar multiply
         /// @param righthand scalar
         /// @return Scaled vector
-        Vec3d operator*(const FloatingType_t righthand) const;
+        constexpr Vec3d operator*(const FloatingType_t righthand) const
+        {
+            return Vec3d{Data[0] * righthand, Data[1] * righthand, Data[2] * righthand};
+        }
 
         /// @brief PLUS
         /// @param righthand
         /// @return Elementwise plus
-        Vec3d operator+(const Vec3d &righthand) const;
+        constexpr Vec3d operator+(const Vec3d &righthand) const
+        {
+            return Vec3d{Data[0] + righthand.Data[0],
+                         Data[1] + righthand.Data[1],
+                         Data[2] + righthand.Data[2]};
+        }
 
         /// @brief Inversion
         /// @return negative vector
-        Vec3d operator-() const;
+        constexpr Vec3d operator-() const
+        {
+            return Vec3d{-Data[0], -Data[1], -Data[2]};
+        }
 
         /// @brief MINUS
         /// @param righthand
         /// @return Elementwise minus
-        Vec3d operator-(const Vec3d &righthand) const;
+        constexpr Vec3d operator-(const Vec3d &righthand) const
+        {
+            return Vec3d{Data[0] - righthand.Data[0],
+                         Data[1] - righthand.Data[1],
+                         Data[2] - righthand.Data[2]};
+        }
+
+        /// @brief Exact comparison of all components
+        constexpr bool operator==(const Vec3d &righthand) const = default;
     };
 
-    template <typename T>
-    inline std::array<T, 3> Vec3d::Cast() const
-    {
-        return std::array<T, 3>{(T)Data[0], (T)Data[1], (T)Data[2]};
-    }
+    // Vec3d is passed by value through every hot loop, it must stay a plain bundle of 3 floats
+    static_assert(std::is_trivially_copyable_v<Vec3d>, "Vec3d must be trivially copyable");
+    static_assert(sizeof(Vec3d) == 3 * sizeof(FloatingType_t), "Vec3d must not carry padding");
 
     /// @brief Scalar multiplication (lefthanded)
     /// @param lefthand scalar
     /// @param righthand vector
     /// @return scaled vector
-    Vec3d operator*(FloatingType_t lefthand, const Vec3d &righthand);
+    constexpr Vec3d operator*(FloatingType_t lefthand, const Vec3d &righthand)
+    {
+        // commutative law
+        return righthand * lefthand;
+    }
+
+    /// @brief Rec. 709 luminance
+    constexpr FloatingType_t GetLuminance(ColorD_t const &color)
+    {
+        return FloatingType_t{0.2126} * color.X() + FloatingType_t{0.7152} * color.Y() + FloatingType_t{0.0722} * color.Z();
+    }
 
     struct Line
     {
@@ -126,6 +186,62 @@ namespace Primitives
         Vec3d Direction;
     };
 
+    static_assert(std::is_trivially_copyable_v<Line>, "Line must be trivially copyable");
+
+    /// @brief Axis aligned bounding box, default constructed as empty box
+    struct Aabb
+    {
+        Vec3d Min{INFINITY, INFINITY, INFINITY};
+        Vec3d Max{-INFINITY, -INFINITY, -INFINITY};
+
+        /// @brief Enlarges box such that it contains the point
+        /// @param point point to include
+        constexpr void Grow(Vec3d const &point)
+        {
+            for (size_t i = 0; i < 3; i++)
+            {
+                Min.Data[i] = std::min(Min.Data[i], point.Data[i]);
+                Max.Data[i] = std::max(Max.Data[i], point.Data[i]);
+            }
+        }
+
+        /// @brief Enlarges box such that it contains the other box
+        /// @param other box to include
+        constexpr void Grow(Aabb const &other)
+        {
+            Grow(other.Min);
+            Grow(other.Max);
+        }
+
+        constexpr Vec3d GetCentroid() const
+        {
+            return (Min + Max) * FloatingType_t{0.5};
+        }
+
+        constexpr Vec3d GetExtent() const
+        {
+            return Max - Min;
+        }
+
+        /// @brief Surface area, 0 for empty boxes
+        constexpr FloatingType_t GetSurfaceArea() const
+        {
+            Vec3d const extent = GetExtent();
+            if (extent.X() < 0 || extent.Y() < 0 || extent.Z() < 0)
+                return 0;
+            return 2 * (extent.X() * extent.Y() + extent.Y() * extent.Z() + extent.Z() * extent.X());
+        }
+
+        /// @brief Checks if the other box lies completely within this box
+        constexpr bool Contains(Aabb const &other) const
+        {
+            for (size_t i = 0; i < 3; i++)
+                if (other.Min.Data[i] < Min.Data[i] || other.Max.Data[i] > Max.Data[i])
+                    return false;
+            return true;
+        }
+    };
+
     constexpr FloatingType_t Deg2Rad(FloatingType_t deg)
     {
         return deg * M_PI / 180.0;
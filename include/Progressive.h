@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "Bitmap.h"
+#include "Rt.h"
+#include "ToneMap.h"
+
+namespace Progressive
+{
+    using namespace std::chrono_literals;
+
+    /// @brief How long a progressive render runs and how often it leaves its state on disk
+    struct Settings
+    {
+        /// @brief Passes per step, the budget and the intervals are checked between steps
+        unsigned int PassesPerStep = 1;
+
+        /// @brief Hard limit, including the passes of a resumed checkpoint
+        unsigned int MaxPasses = 1024;
+
+        /// @brief No step is started that would likely end after it, judged by the step before
+        std::chrono::duration<double> TimeBudget = 60s;
+
+        /// @brief An intermediate image is written once this much time passed since the last one
+        std::chrono::duration<double> PublishInterval = 5s;
+
+        /// @brief Empty for no intermediate images, the final image is left to the caller
+        std::string ImageFile = "Render\\output.ppm";
+
+        /// @brief Output conversion of the intermediate images
+        ToneMap::Settings ToneMapping;
+
+        /// @brief A checkpoint is written once this much time passed since the last one, and when the render ends
+        std::chrono::duration<double> CheckpointInterval = 30s;
+
+        /// @brief Empty for no checkpoints. The render resumes from it if it exists and matches the raytracer
+        std::string CheckpointFile = "Render\\checkpoint.bin";
+    };
+
+    /// @brief What a progressive render did
+    struct Summary
+    {
+        /// @brief Passes in the accumulator, including resumed ones
+        unsigned int Passes = 0;
+        /// @brief Passes taken over from the checkpoint
+        unsigned int ResumedPasses = 0;
+        unsigned int Steps = 0;
+        unsigned int Publishes = 0;
+        unsigned int Checkpoints = 0;
+        std::chrono::duration<double> Wall{0};
+
+        /// @brief One line
+        std::string ToString() const;
+    };
+
+    /// @brief Writes the accumulation state: the sums, the pass count and what keys the random numbers, i.e. the
+    /// seed and the render settings. Passes are numbered, so the pass count is the only counter to restore. The
+    /// scene is not recorded. Goes to a temporary file first, which then replaces the checkpoint, so a render killed
+    /// while writing keeps the previous one
+    /// @return False if the file cannot be written
+    bool WriteCheckpoint(std::string const &file, Rt::Raytracer const &raytracer, Bitmap::BitmapD const &accumulator, unsigned int passes);
+
+    /// @brief Reads the accumulation state written by WriteCheckpoint()
+    /// @param accumulator Overwritten with the sums, untouched if nothing is read. Its size has to match the checkpoint
+    /// @param passes Set to the pass count, untouched if nothing is read
+    /// @return False if there is no checkpoint, or it belongs to another image size, seed or settings
+    bool ReadCheckpoint(std::string const &file, Rt::Raytracer const &raytracer, Bitmap::BitmapD &accumulator, unsigned int &passes);
+
+    /// @brief Adds passes to the accumulator step by step until the pass limit or the time budget is reached.
+    /// Resumes from the checkpoint file first, if there is a matching one. Blocks until done
+    /// @param context Renders the steps, its pass numbering continues from the resumed passes
+    /// @param accumulator Sum of all passes, like Rt::RenderContext::Submit() leaves it
+    /// @param aovs Written by every step, nullptr for none. Checkpoints leave them out, so resumed passes are
+    /// missing from the bounces
+    Summary Render(Rt::RenderContext &context, Bitmap::BitmapD &accumulator, Settings const &settings = Settings{}, Aov::Framebuffer *aovs = nullptr);
+}
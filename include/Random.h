@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Primitives.h"
+
+namespace Random
+{
+    using Primitives::FloatingType_t;
+
+    enum class Sampler
+    {
+        /// @brief Every number hashed on its own, noise falls with 1/sqrt(samples)
+        Independent,
+        /// @brief Jittered strata per dimension, laid out for RenderSettings::ExpectedSamples
+        Stratified,
+        /// @brief Sobol (0, 2) sequence over dimension pairs, Owen scrambled and shuffled per pixel
+        Sobol,
+        /// @brief R2 sequence over dimension pairs, offset per pixel and dimension by a blue noise mask
+        BlueNoise
+    };
+
+    /// @brief Dimensions of a bounce, every use of random numbers gets its own
+    enum Dimension : uint32_t
+    {
+        ROULETTE = 0,
+        LOBE_SELECTION = 1,
+        /// @brief Probe k draws its lobe angle from DIFFUSE_PROBE + 2k and its azimuth from DIFFUSE_PROBE + 2k + 1
+        DIFFUSE_PROBE = 2,
+        /// @brief Light sample k picks its emitter by LIGHT_SAMPLE + 4k and its direction by the pair
+        /// LIGHT_SAMPLE + 4k + 2, LIGHT_SAMPLE + 4k + 3
+        LIGHT_SAMPLE = 16
+    };
+
+    /// @brief Dimensions of a bounce served by the sampler, the rest are independent
+    constexpr uint32_t SAMPLED_DIMENSIONS = 32;
+
+    /// @brief Bounce whose first pair of dimensions jitters the camera ray of a pass, beyond any real bounce
+    constexpr uint32_t CAMERA_BOUNCE = 0xffffffffu;
+
+    /// @brief Edge length of the tileable blue noise mask
+    constexpr uint32_t BLUE_NOISE_SIZE = 64;
+
+    /// @brief Largest float below 1, keeps [0, 1) half open after rounding
+    constexpr FloatingType_t ONE_MINUS_EPSILON = FloatingType_t{1} - FloatingType_t{1} / (1u << 24);
+
+    /// @brief Finalizer of SplitMix64, every input bit affects every output bit
+    constexpr uint64_t Mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    /// @brief 24 bits fill the mantissa of a float exactly, so 1 is never reached
+    /// @return Uniform in [0, 1)
+    constexpr FloatingType_t ToUnit(uint32_t bits)
+    {
+        return (FloatingType_t)(bits >> 8) * (FloatingType_t{1} / (1u << 24));
+    }
+
+    /// @brief Counter-based generator: the number drawn is a pure function of its coordinates, so it does not
+    /// matter which worker draws it or in which order
+    /// @param seed Seed of the frame
+    /// @param pixel Index of the pixel
+    /// @param sample Index of the sample within the pixel
+    /// @param bounce Index of the bounce within the sample
+    /// @param dimension Index of the number within the bounce
+    /// @return Uniform in [0, 1)
+    constexpr FloatingType_t Uniform(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t bounce, uint32_t dimension)
+    {
+        uint64_t x = Mix(((uint64_t)seed << 32 | pixel) + 0x9e3779b97f4a7c15ull);
+        x = Mix(x ^ ((uint64_t)sample << 32 | bounce));
+        return ToUnit((uint32_t)(Mix(x ^ dimension) >> 32));
+    }
+
+    constexpr uint32_t ReverseBits(uint32_t x)
+    {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    /// @brief Laine-Karras permutation: flipping a bit depends only on the bits below it
+    constexpr uint32_t LaineKarras(uint32_t x, uint32_t seed)
+    {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    /// @brief Hash based Owen scrambling (Burley 2020): flipping a bit depends only on the bits above it
+    constexpr uint32_t OwenScramble(uint32_t x, uint32_t seed)
+    {
+        return ReverseBits(LaineKarras(ReverseBits(x), seed));
+    }
+
+    /// @brief First two Sobol dimensions, together a (0, 2) sequence. Bit reversed, which is the order
+    /// LaineKarras() needs anyway
+    /// @param index Index of the point
+    /// @param dimension 0 or 1
+    /// @return ReverseBits() of the Sobol point
+    constexpr uint32_t ReversedSobol(uint32_t index, uint32_t dimension)
+    {
+        // dimension 0 is van der Corput, dimension 1 has direction numbers v[i + 1] = v[i] ^ (v[i] >> 1)
+        if (dimension == 0)
+            return index;
+
+        uint32_t result = 0;
+        uint32_t direction = 1;
+        for (; index; index >>= 1, direction ^= direction << 1)
+            result ^= direction & (0u - (index & 1));
+        return result;
+    }
+
+    /// @brief Random permutation of [0, count) without tables (Kensler 2013)
+    /// @return Position of index within the permutation
+    constexpr uint32_t Permute(uint32_t index, uint32_t count, uint32_t seed)
+    {
+        uint32_t mask = count - 1;
+        mask |= mask >> 1;
+        mask |= mask >> 2;
+        mask |= mask >> 4;
+        mask |= mask >> 8;
+        mask |= mask >> 16;
+
+        // cycle walking, values outside of count are permuted again
+        do
+        {
+            index ^= seed;
+            index *= 0xe170893du;
+            index ^= seed >> 16;
+            index ^= (index & mask) >> 4;
+            index ^= seed >> 8;
+            index *= 0x0929eb3fu;
+            index ^= seed >> 23;
+            index ^= (index & mask) >> 1;
+            index *= 1 | seed >> 27;
+            index *= 0x6935fa69u;
+            index ^= (index & mask) >> 11;
+            index *= 0x74dcb303u;
+            index ^= (index & mask) >> 2;
+            index *= 0x9e501cc3u;
+            index ^= (index & mask) >> 2;
+            index *= 0xc860a3dfu;
+            index &= mask;
+            index ^= index >> 5;
+        } while (index >= count);
+        return (index + seed) % count;
+    }
+
+    /// @brief Tileable mask of BLUE_NOISE_SIZE x BLUE_NOISE_SIZE ranks, computed on first use by void and cluster
+    /// @return Row major, values uniformly spread over [0, 1)
+    FloatingType_t const *GetBlueNoiseMask();
+
+    /// @brief Random numbers of a single sample of a pixel. Holds no state besides its coordinates and the hashes
+    /// derived from them
+    class Stream
+    {
+    public:
+        /// @brief Ctor
+        /// @param sampler Distribution of the sampled dimensions
+        /// @param seed Seed of the frame
+        /// @param x Pixel column
+        /// @param y Pixel row
+        /// @param sample Index of the sample within the pixel
+        /// @param expectedSamples Stratified: number of strata per dimension
+        Stream(Sampler sampler, uint32_t seed, uint32_t x, uint32_t y, uint32_t sample, uint32_t expectedSamples = 1)
+            : SamplerType{sampler}, X{x}, Y{y}, Sample{sample}, ReversedSample{ReverseBits(sample)},
+              ExpectedSamples{expectedSamples > 0 ? expectedSamples : 1},
+              PixelKey{Mix(((uint64_t)seed << 32 | (y << 16 | x)) + 0x9e3779b97f4a7c15ull)},
+              BlueNoiseMask{sampler == Sampler::BlueNoise ? GetBlueNoiseMask() : nullptr}
+        {
+            SetBounce(0);
+        }
+
+        /// @brief Moves on to a bounce, every bounce has its own dimensions
+        void SetBounce(uint32_t bounce)
+        {
+            // same chain as Uniform()
+            SampleKey = Mix(PixelKey ^ ((uint64_t)Sample << 32 | bounce));
+            // same for all samples of the pixel, the sequences rely on it
+            BounceKey = Mix(PixelKey ^ Mix(bounce));
+        }
+
+        /// @brief Number of a dimension of the current bounce
+        /// @param dimension See Random::Dimension
+        /// @return Uniform in [0, 1)
+        FloatingType_t Get(uint32_t dimension) const
+        {
+            if (SamplerType == Sampler::Independent || dimension >= SAMPLED_DIMENSIONS)
+                return ToUnit((uint32_t)(Mix(SampleKey ^ dimension) >> 32));
+
+            // decorrelates pixels, bounces and dimensions from each other
+            uint32_t const scramble = (uint32_t)Mix(BounceKey ^ dimension);
+            if (SamplerType == Sampler::Stratified)
+            {
+                // every run of ExpectedSamples samples visits every stratum once, in shuffled order
+                uint32_t const run = Sample / ExpectedSamples;
+                uint32_t const stratum = Permute(Sample % ExpectedSamples, ExpectedSamples, scramble ^ (uint32_t)Mix(run));
+                FloatingType_t const jitter = ToUnit((uint32_t)(Mix(SampleKey ^ dimension) >> 32));
+                return std::min((stratum + jitter) / ExpectedSamples, ONE_MINUS_EPSILON);
+            }
+
+            // pairs of dimensions share a shuffled sample index, so they form a 2d point. Shuffling keeps the first
+            // 2^k indices within the first 2^k, but decorrelates the pairs. Bits above 2^k come out the same for
+            // all of them and are cleared, which keeps the Sobol loop short
+            uint32_t const pairScramble = (uint32_t)Mix(BounceKey ^ (dimension / 2 + SAMPLED_DIMENSIONS));
+            uint32_t const pairIndex = ReverseBits(LaineKarras(ReversedSample, pairScramble) ^ LaineKarras(0, pairScramble));
+            if (SamplerType == Sampler::Sobol)
+                return ToUnit(ReverseBits(LaineKarras(ReversedSobol(pairIndex, dimension % 2), scramble)));
+
+            // blue noise: per dimension, the whole mask is shifted by a random offset
+            uint32_t const maskX = (X + (scramble & 0xffff)) % BLUE_NOISE_SIZE;
+            uint32_t const maskY = (Y + (scramble >> 16)) % BLUE_NOISE_SIZE;
+            uint32_t const offset = (uint32_t)(BlueNoiseMask[maskY * BLUE_NOISE_SIZE + maskX] * 4294967296.0);
+            // R2 additive recurrence (generalized golden ratio) in 0.32 fixed point, wrapping around is the fraction
+            return ToUnit(offset + pairIndex * (dimension % 2 ? 2447445414u : 3242174889u));
+        }
+
+    private:
+        Sampler SamplerType;
+        uint32_t X;
+        uint32_t Y;
+        uint32_t Sample;
+        uint32_t ReversedSample;
+        uint32_t ExpectedSamples;
+        uint64_t PixelKey;
+        uint64_t SampleKey;
+        uint64_t BounceKey;
+        FloatingType_t const *BlueNoiseMask;
+    };
+}
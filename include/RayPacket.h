@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Primitives.h"
+
+namespace Scene
+{
+    using namespace Primitives;
+
+    struct SphereSoa;
+    struct PlaneSoa;
+
+    /// @brief Rays traced together, the widest kernel handles all of them at once
+    constexpr size_t PACKET_SIZE = 16;
+
+    /// @brief Instruction sets the packet kernels are compiled for, ordered by width
+    enum class SimdLevel
+    {
+        /// @brief One ray at a time, through the single ray kernels
+        Scalar,
+        /// @brief 4 rays, baseline of x86-64
+        Sse,
+        /// @brief 8 rays
+        Avx2,
+        /// @brief 16 rays
+        Avx512
+    };
+
+    /// @brief Widest level the CPU supports, detected once by CPUID
+    SimdLevel GetSimdLevel();
+
+    char const *ToString(SimdLevel level);
+
+    /// @brief Up to PACKET_SIZE rays, one contiguous array per component
+    struct alignas(64) RayPacket
+    {
+        std::array<FloatingType_t, PACKET_SIZE> OriginX;
+        std::array<FloatingType_t, PACKET_SIZE> OriginY;
+        std::array<FloatingType_t, PACKET_SIZE> OriginZ;
+        std::array<FloatingType_t, PACKET_SIZE> DirectionX;
+        std::array<FloatingType_t, PACKET_SIZE> DirectionY;
+        std::array<FloatingType_t, PACKET_SIZE> DirectionZ;
+        /// @brief 1 / direction, for the box tests of a traversal
+        std::array<FloatingType_t, PACKET_SIZE> InverseDirectionX;
+        std::array<FloatingType_t, PACKET_SIZE> InverseDirectionY;
+        std::array<FloatingType_t, PACKET_SIZE> InverseDirectionZ;
+        /// @brief Bit i is set if lane i holds a ray. Kernels leave the results of other lanes untouched
+        uint32_t ActiveMask = 0;
+
+        void Set(size_t lane, Line const &ray)
+        {
+            OriginX[lane] = ray.Origin.X();
+            OriginY[lane] = ray.Origin.Y();
+            OriginZ[lane] = ray.Origin.Z();
+            DirectionX[lane] = ray.Direction.X();
+            DirectionY[lane] = ray.Direction.Y();
+            DirectionZ[lane] = ray.Direction.Z();
+            InverseDirectionX[lane] = 1 / ray.Direction.X();
+            InverseDirectionY[lane] = 1 / ray.Direction.Y();
+            InverseDirectionZ[lane] = 1 / ray.Direction.Z();
+            ActiveMask |= 1u << lane;
+        }
+
+        Line Get(size_t lane) const
+        {
+            return Line{{OriginX[lane], OriginY[lane], OriginZ[lane]}, {DirectionX[lane], DirectionY[lane], DirectionZ[lane]}};
+        }
+
+        bool IsActive(size_t lane) const
+        {
+            return ActiveMask & (1u << lane);
+        }
+    };
+
+    /// @brief Closest primitive per lane, see KernelHit
+    struct alignas(64) PacketHits
+    {
+        std::array<FloatingType_t, PACKET_SIZE> DistanceToSurface;
+        std::array<uint32_t, PACKET_SIZE> Index;
+    };
+
+    /// @brief Slab test of all lanes at once, see Bvh::IntersectsBox()
+    /// @param closest Boxes behind the closest hit of a lane do not count for it
+    /// @param level Kernel to use, at most GetSimdLevel()
+    /// @return Mask of the active lanes entering the box
+    uint32_t IntersectBox(Aabb const &box, RayPacket const &packet, PacketHits const &closest, SimdLevel level);
+
+    /// @brief Tests a packet against the spheres [begin, end)
+    /// @param closest Lanes are updated where a sphere is closer than their DistanceToSurface
+    /// @param level Kernel to use, at most GetSimdLevel()
+    void IntersectSpheres(SphereSoa const &spheres, size_t begin, size_t end, RayPacket const &packet, PacketHits &closest, SimdLevel level);
+
+    /// @brief Tests a packet against all planes
+    /// @param closest Lanes are updated where a plane is closer than their DistanceToSurface
+    /// @param level Kernel to use, at most GetSimdLevel()
+    void IntersectPlanes(PlaneSoa const &planes, RayPacket const &packet, PacketHits &closest, SimdLevel level);
+}
@@ -1,29 +1,305 @@
 #pragma once
 
-#include <random>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
 
+#include "Adaptive.h"
+#include "Aov.h"
 #include "Bitmap.h"
-#include "Transformation.h"
+#include "CompiledScene.h"
 #include "Camera.h"
+#include "Random.h"
+#include "Sampling.h"
 #include "Scene.h"
+#include "Scheduler.h"
 
 namespace Rt
 {
-    constexpr unsigned int NUM_RAY_GENERATIONS = 6;
-    constexpr unsigned int NUM_DIFFUSE_RAYS = 4;
+    /// @brief Maximal deviation of diffuse probes from the surface normal
+    constexpr FloatingType_t DIFFUSE_LOBE_ANGLE = Deg2Rad(60);
+
+    /// @brief Tiles are cut into blocks of PACKET_WIDTH x PACKET_HEIGHT pixels, whose camera rays form a packet
+    constexpr unsigned int PACKET_WIDTH = 4;
+    constexpr unsigned int PACKET_HEIGHT = Scene::PACKET_SIZE / PACKET_WIDTH;
+
+    enum class Integrator
+    {
+        /// @brief MarchRay(): spawns DiffuseRays children per hit for RayGenerations generations
+        Branching,
+        /// @brief TracePath(): follows a single path per sample, ended by russian roulette. Every hit picks the mirror
+        /// or the diffuse lobe by the weights MarchRay() gives them, so both converge to the same image as long as a
+        /// generation has a single parent, e.g. RayGenerations = 1 against MaxBounces = 2. Later generations of
+        /// MarchRay() normalize their weights over all siblings, which a single path cannot follow
+        PathTracing,
+        /// @brief Camera rays only, for previews and the AOVs: emitters show their emission, any other surface its
+        /// albedo, shaded by the angle towards the camera. Nothing bounces, so every sample is the same
+        PrimaryVisibility
+    };
+
+    /// @brief Order in which RenderTile() traces the rays of a tile
+    enum class Engine
+    {
+        /// @brief Every sample of a pixel is followed to its end before the next one starts
+        PerPixel,
+        /// @brief All samples of the tile advance together, one bounce at a time. Rays are traced sorted by
+        /// direction octant and shaded sorted by material, see WavefrontScratch
+        Wavefront
+    };
+
+    struct RenderSettings
+    {
+        Integrator Mode = Integrator::Branching;
+
+        Engine Backend = Engine::PerPixel;
+
+        /// @brief Samples averaged per pixel and pass
+        unsigned int SamplesPerPixel = 1;
+
+        /// @brief Distribution of the random numbers driving bounces
+        Random::Sampler Sampler = Random::Sampler::Independent;
+
+        /// @brief Stratified: samples per pixel the strata are laid out for, i.e. passes times SamplesPerPixel
+        unsigned int ExpectedSamples = 16;
+
+        /// @brief Branching: generations of child rays
+        unsigned int RayGenerations = 6;
+
+        /// @brief Branching: rays spawned per diffuse hit, including the reflection. The path tracer weights its
+        /// lobes as if it did the same. 0 and 1 both leave the reflection only
+        unsigned int DiffuseRays = 4;
+
+        /// @brief Path tracer: bounces before russian roulette may end a path
+        unsigned int RouletteStartBounce = 3;
+
+        /// @brief Path tracer: hard limit, e.g. for rays trapped between mirrors
+        unsigned int MaxBounces = 64;
+
+        /// @brief Shadow rays towards emitters per diffuse hit (next event estimation), weighted against the
+        /// probes by multiple importance sampling. 0 leaves emitters to the probes
+        unsigned int LightSamples = 1;
+
+        /// @brief Projection, placement and jitter of the camera rays
+        Camera::Settings View;
+    };
+
+    /// @brief Ray generations of MarchRay(), allocated once per worker and reused for every pixel
+    class GenerationScratch
+    {
+    public:
+        /// @brief Allocates room for the largest generation the settings can produce
+        GenerationScratch(RenderSettings const &settings);
+
+        size_t GetCapacity() const;
+
+        static size_t GetRequiredCapacity(RenderSettings const &settings);
+
+    private:
+        friend class Raytracer;
+
+        struct generationElement_t
+        {
+            Line Ray;
+            FloatingType_t ParentWeight;
+            FloatingType_t Weight;
+            Vec3d ColorFilter;
+            /// @brief Probes: cosine towards the normal of the parent hit, 0 for any other ray
+            FloatingType_t ProbeCosine;
+            /// @brief Probes: radiance the light samples of the parent hit received, shared by its probes
+            ColorD_t DirectLight;
+        };
+
+        size_t Capacity;
+        /// @brief Double buffered, MarchRay() swaps them on every generation
+        std::array<std::unique_ptr<generationElement_t[]>, 2> Generations;
+        std::array<size_t, 2> Counts;
+    };
+
+    /// @brief Time the wavefront engine spends per stage
+    struct StageTimes
+    {
+        /// @brief Camera rays and the random streams of all samples
+        std::chrono::duration<double> Generate{0};
+        /// @brief Sorting rays by octant and tracing them in packets
+        std::chrono::duration<double> Intersect{0};
+        /// @brief Sorting hits by material, deciding on and spawning their children
+        std::chrono::duration<double> Shade{0};
+        /// @brief Handing out slots to children, normalizing their weights and dropping the insignificant ones
+        std::chrono::duration<double> Compact{0};
+        /// @brief Rays intersected
+        size_t Rays = 0;
+
+        StageTimes &operator+=(StageTimes const &other);
+
+        /// @brief One line, every stage with its share of the total
+        std::string ToString() const;
+    };
+
+    /// @brief Queues of the wavefront engine, one per bounce, double buffered. Allocated once per worker and grown
+    /// to the largest tile seen
+    class WavefrontScratch
+    {
+    public:
+        /// @brief Summed over all tiles since the last reset
+        StageTimes Times;
+
+    private:
+        friend class Raytracer;
+
+        /// @brief Ray of a sample waiting to be traced. Queues are ordered by sample and, within a sample, by
+        /// spawn order, which keeps the results equal to MarchRay() and TracePath()
+        struct queueElement_t
+        {
+            Line Ray;
+            FloatingType_t ParentWeight;
+            FloatingType_t Weight;
+            /// @brief Path tracer: throughput
+            Vec3d ColorFilter;
+            /// @brief Same as GenerationScratch
+            FloatingType_t ProbeCosine;
+            /// @brief Branching: same as GenerationScratch
+            ColorD_t DirectLight;
+            uint32_t Sample;
+        };
+
+        /// @brief What a hit contributes and spawns
+        struct shading_t
+        {
+            ColorD_t Emission;
+            /// @brief Of all children
+            Vec3d ColorFilter;
+            /// @brief Branching: weight of the mirror child before normalization
+            FloatingType_t ReflectionWeight;
+            uint32_t Reflections;
+            uint32_t Probes;
+            /// @brief Slot of the first child within the next queue
+            uint32_t FirstChild;
+            /// @brief Index of the first probe within the bounce of the sample
+            uint32_t FirstProbe;
+        };
+
+        struct sample_t
+        {
+            Random::Stream Random;
+            ColorD_t Emission;
+            /// @brief Of the children spawned in the current bounce
+            FloatingType_t WeightSum;
+            uint32_t Children;
+            /// @brief Bounces that hit anything, the last one counts
+            uint32_t Bounces;
+        };
+
+        /// @brief Grow only, so the vectors are not initialized again on every bounce. Counts holds the live length
+        std::array<std::vector<queueElement_t>, 2> Queues;
+        std::array<size_t, 2> Counts;
+        /// @brief Per element of the current queue
+        std::vector<Scene::Intersection> Hits;
+        std::vector<shading_t> Shading;
+        /// @brief Sort key per element, and the elements sorted by it
+        std::vector<uint32_t> Keys;
+        std::vector<uint32_t> Order;
+        /// @brief Position of each key's first element within Order, plus the end
+        std::vector<uint32_t> KeyStarts;
+        std::vector<sample_t> Samples;
+
+        /// @brief Makes room for the per element data of a queue of the given length
+        void Grow(size_t length);
+    };
+
+    /// @brief Everything a worker mutates while rendering. Kept apart per worker, so workers never share cache lines
+    struct alignas(64) WorkerState
+    {
+        /// @brief Ctor
+        /// @param settings Settings the scratch is sized for
+        WorkerState(RenderSettings const &settings);
+
+        GenerationScratch Scratch;
+        WavefrontScratch Wavefront;
+
+        /// @brief Surfaces the deepest ray of a sample hit, summed over the samples traced since the caller reset it
+        uint32_t Bounces = 0;
+
+        /// @brief Camera rays of the last frame size rendered, rebuilt when the size or the camera changes
+        std::optional<Camera::RayTable> CameraRays;
+    };
+
+    /// @brief Hits every sample of a pixel starts with, traced ahead of time in packets: the camera ray and its
+    /// mirror reflection
+    struct PrimaryHits
+    {
+        Scene::Intersection Camera;
+        /// @brief Hit of Camera.Hitevent.ReflectedRay, only traced if the camera ray hit anything
+        Scene::Intersection Reflection;
+    };
 
     class Raytracer
     {
 
     public:
-        Raytracer(unsigned int seed = 1u);
+        /// @brief Ctor
+        /// @param seed Seed of the frame, every random number is derived from it and the pixel, sample and bounce
+        /// @param settings Integrator and sample count
+        /// @param objects Shapes to render, compiled once
+        Raytracer(unsigned int seed = 1u, RenderSettings const &settings = RenderSettings{}, std::span<Shapes::Shape const *const> objects = Scene::Objects);
 
+        /// @brief Renders a single pass pixel by pixel on the calling thread
+        /// @param output Receives the frame, its size is the size of the frame
         void RunBitmap(Bitmap::BitmapD &output);
 
-        void RunBitmapParallel(Bitmap::BitmapD &output, unsigned int numSidethreads);
+        /// @brief Renders a tile several times and adds the results to a running sum
+        /// @param tile Pixels to render
+        /// @param accumulator Sum of all passes so far, not normalized. Its size is the size of the frame. Either
+        /// Bitmap::BitmapD or Bitmap::TiledBitmapD, both get the same sums
+        /// @param firstPass Index of the first pass to add, passes with the same index draw the same random numbers
+        /// @param passes Number of passes to add
+        /// @param worker State of the calling worker
+        /// @param aovs Receives the first hits of the tile and adds its bounces, nullptr for none. Costs no rays
+        template <typename TAccumulator>
+        void RenderTile(Scheduler::Tile const &tile, TAccumulator &accumulator, unsigned int firstPass, unsigned int passes, WorkerState &worker, Aov::Framebuffer *aovs = nullptr) const;
+
+        /// @brief Adds a round of passes to the pixels of a tile that are still active, see Adaptive::Frame. Always
+        /// renders pixel by pixel, whatever the engine
+        /// @param tile Pixels to render
+        /// @param frame Statistics of all pixels, the tile's belong to this worker alone
+        /// @param worker State of the calling worker
+        /// @param aovs Same as RenderTile(), written for the active pixels only
+        void RenderTileAdaptive(Scheduler::Tile const &tile, Adaptive::Frame &frame, WorkerState &worker, Aov::Framebuffer *aovs = nullptr) const;
+
+        /// @brief State for an additional worker
+        std::unique_ptr<WorkerState> CreateWorkerState() const;
+
+        unsigned int GetSeed() const;
+
+        RenderSettings const &GetSettings() const;
+
+        /// @brief Lets a ray bounce through the scene
+        /// @param ray Ray to follow
+        /// @param random Random numbers of the sample, generation i draws from bounce i
+        /// @param worker State of the calling worker
+        /// @param primary Hits of ray and its reflection if traced ahead of time, nullptr otherwise
+        /// @return Accumulated emission along all ray generations. Adds the generations that hit anything to
+        /// worker.Bounces
+        ColorD_t MarchRay(Line const &ray, Random::Stream &random, WorkerState &worker, PrimaryHits const *primary = nullptr) const;
+
+        /// @brief Renders a pixel with the configured integrator and sample count
+        /// @param ray Camera ray of the pixel
+        /// @param x Pixel column, keys its random numbers
+        /// @param y Pixel row, keys its random numbers
+        /// @param pass Index of the pass, keys its random numbers
+        /// @param worker State of the calling worker
+        /// @param primary Hits of ray and its reflection if traced ahead of time, nullptr otherwise
+        /// @return Average of all samples
+        ColorD_t TracePixel(Line const &ray, uint32_t x, uint32_t y, uint32_t pass, WorkerState &worker, PrimaryHits const *primary = nullptr) const;
 
     private:
-        std::default_random_engine RngEngine;
+        unsigned int const Seed;
+        RenderSettings const Settings;
+        Scene::CompiledScene const CompiledObjects;
 
         struct RayMarchResult
         {
@@ -31,8 +307,136 @@ namespace Rt
             ColorD_t Emissions;
         };
 
-        FloatingType_t RandFloat();
-        ColorD_t MarchRay(Line const &ray);
+        /// @brief Follows a single path, see Integrator::PathTracing. Adds the surfaces it hit to worker.Bounces
+        ColorD_t TracePath(Line const &ray, Random::Stream &random, WorkerState &worker, PrimaryHits const *primary) const;
+
+        /// @brief Color of a camera ray's first hit, see Integrator::PrimaryVisibility
+        static ColorD_t ShadeFirstHit(Scene::Intersection const &nearest, Line const &ray);
+
+        /// @brief Writes the first hits of a block of pixels to the AOVs
+        /// @param hits Row major within the block, PACKET_WIDTH pixels per row
+        void WriteFirstHits(Scheduler::Tile const &block, std::array<PrimaryHits, Scene::PACKET_SIZE> const &hits, Aov::Framebuffer &aovs) const;
+
+        /// @brief RenderTile() with Engine::Wavefront
+        template <typename TAccumulator>
+        void RenderTileWavefront(Scheduler::Tile const &tile, TAccumulator &accumulator, unsigned int firstPass, unsigned int passes, WorkerState &worker, Aov::Framebuffer *aovs) const;
+
+        /// @brief Traces the current queue in packets of rays sorted by direction octant
+        void IntersectQueue(WavefrontScratch &scratch, std::span<WavefrontScratch::queueElement_t const> queue) const;
+
+        /// @brief Traces camera rays and their reflections as packets. PrimaryVisibility never reads the reflections,
+        /// they are left out
+        /// @param cameraRays Of a block of pixels, row major within the block, PACKET_WIDTH pixels per row
+        /// @param hits Per lane, lanes outside of the packet are left untouched
+        void TracePrimaryHits(Scene::RayPacket const &cameraRays, std::array<PrimaryHits, Scene::PACKET_SIZE> &hits) const;
+
+        /// @brief Camera rays of the frame size from the worker's cache, built on its first frame of that size
+        Camera::RayTable const &GetCameraRays(WorkerState &worker, unsigned int width, unsigned int height) const;
+
+        /// @brief Camera ray of a pixel in a pass, jittered within the pixel if the camera asks for it
+        Line GetCameraRay(Camera::RayTable const &camera, uint32_t x, uint32_t y, uint32_t pass) const;
+
+        /// @brief Probes spawned at a diffuse hit, which share the hit's light samples
+        uint32_t GetProbesPerHit() const;
+
+        /// @brief Probes MarchRay() spawns at a diffuse hit, whose weights the path tracer picks its lobes by
+        uint32_t GetBranchingProbes() const;
+
+        /// @brief Next event estimation: LightSamples shadow rays from a diffuse hit towards the emitters
+        /// @param firstLight Index of the first light sample within the bounce, selects its dimensions
+        /// @param probes Spawned at the hit, the balance heuristic weights both against each other
+        /// @return Radiance, already weighted, to be added to every probe of the hit
+        ColorD_t SampleLights(Vec3d const &normal, Vec3d const &origin, Random::Stream const &random, uint32_t firstLight, uint32_t probes) const;
+
+        /// @brief Balance heuristic weight of a ray that hit an emitter the light samples could have found too
+        /// @param probeCosine 0 for rays other than probes, which are weighted 1
+        FloatingType_t GetProbeMisWeight(Scene::Intersection const &nearest, Line const &ray, FloatingType_t probeCosine, uint32_t probes) const;
+
+        /// @brief Branching: radiance a ray brings back, i.e. the light samples it carries plus the weighted
+        /// emission of its hit
+        ColorD_t GetIncidentRadiance(Scene::Intersection const &nearest, Line const &ray, FloatingType_t probeCosine, ColorD_t const &directLight, uint32_t probes) const;
+
+        /// @brief Random diffuse ray within DIFFUSE_LOBE_ANGLE of the surface normal, cosine weighted
+        /// @param basis Built from the surface normal, once per hit
+        /// @param origin Hit point
+        /// @param probe Index of the probe within the bounce, selects its dimensions
+        static Line SpawnDiffuseProbe(Sampling::Onb const &basis, Vec3d const &origin, Random::Stream const &random, uint32_t probe);
+    };
+
+    /// @brief Long-lived render state: a pool of worker threads plus their random engines and scratch memory,
+    /// which stay warm from one frame to the next
+    class RenderContext
+    {
+    public:
+        using TileDone_t = std::function<void(Scheduler::Tile const &tile)>;
+
+        /// @brief Ctor, starts the workers
+        /// @param raytracer Has to outlive the context
+        /// @param numWorkers Number of worker threads, defaults to all hardware threads
+        RenderContext(Raytracer const &raytracer, unsigned int numWorkers = Scheduler::TileScheduler::GetHardwareConcurrency());
+
+        /// @brief Starts rendering a frame and returns immediately. Waits for the previous frame first
+        /// @param accumulator Every pass is added to it, the sum is left for the output conversion to normalize.
+        /// Its size is the size of the frame. Has to stay alive until the frame is done
+        /// @param passes Number of passes to add. Passes are numbered across all submissions, so consecutive
+        /// submissions continue the sample sequence instead of repeating it
+        /// @param aovs Written along with the accumulator, nullptr for none. Has to stay alive as well
+        /// @param tileDone Called by the worker that added the passes of a tile, right after, e.g. to stream the
+        /// tile to an ImgFile::MappedImage. Tiles are disjoint, calls for different tiles run concurrently
+        void Submit(Bitmap::BitmapD &accumulator, unsigned int passes, Aov::Framebuffer *aovs = nullptr, TileDone_t tileDone = nullptr);
+
+        /// @brief Submit() into the tiled layout, every tile of the frame is a contiguous block. Rows only exist
+        /// once Detile() converted the sum
+        void Submit(Bitmap::TiledBitmapD &accumulator, unsigned int passes, Aov::Framebuffer *aovs = nullptr, TileDone_t tileDone = nullptr);
+
+        /// @brief Converts a tiled accumulator to rows on all workers, tile by tile. Waits for the submitted frame
+        /// first, blocks until done
+        /// @param output Of the size of the accumulator
+        void Detile(Bitmap::TiledBitmapD const &accumulator, Bitmap::BitmapD &output);
+
+        /// @brief Renders a frame in rounds, each one adding passes to the pixels still above the threshold only.
+        /// Blocks until the frame reaches its target noise or time budget, or every pixel is done
+        /// @param frame Statistics of all pixels, may continue a frame rendered before
+        /// @param aovs Written along with the frame, nullptr for none
+        /// @param tileDone Called after every tile of every round, like for Submit()
+        /// @return Summary of the frame
+        Adaptive::Summary const &RenderAdaptive(Adaptive::Frame &frame, Aov::Framebuffer *aovs = nullptr, TileDone_t tileDone = nullptr);
+
+        /// @brief Passes submitted so far, the next submission starts with this pass index
+        unsigned int GetSubmittedPasses() const;
+
+        /// @brief Continues the pass numbering of an earlier frame, e.g. one restored from a checkpoint. Waits for
+        /// the submitted frame first
+        /// @param passes Passes the accumulator already holds
+        void ResumeAt(unsigned int passes);
+
+        Raytracer const &GetRaytracer() const;
+
+        /// @brief Non-blocking
+        /// @return True if no frame is in flight
+        bool Poll() const;
+
+        /// @brief Blocks until the submitted frame is done
+        /// @return Load balance and startup latency of the frame
+        Scheduler::FrameStatistics Wait();
+
+        /// @brief Stages of the wavefront engine during the last frame, summed over all workers. Only valid once the
+        /// frame is done
+        StageTimes GetStageTimes() const;
+
+    private:
+        Raytracer const &Tracer;
+        std::vector<std::unique_ptr<WorkerState>> Workers;
+        Aov::Framebuffer *Aovs = nullptr;
+        TileDone_t TileDone;
+        unsigned int FirstPass = 0;
+        unsigned int Passes = 0;
+        /// @brief Last member, its threads are stopped before the rest is destroyed
+        Scheduler::TileScheduler Pool;
+
+        /// @brief Submit() for either layout
+        template <typename TAccumulator>
+        void SubmitPasses(TAccumulator &accumulator, unsigned int passes, Aov::Framebuffer *aovs, TileDone_t tileDone);
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "Primitives.h"
+
+namespace Sampling
+{
+    using namespace Primitives;
+
+    /// @brief Orthonormal basis around a normal, Z is the normal
+    struct Onb
+    {
+        Vec3d Tangent;
+        Vec3d Bitangent;
+        Vec3d Normal;
+
+        /// @brief Branchless construction (Duff et al. 2017), no normalization or trigonometry
+        /// @param normal Normalized
+        static Onb FromNormal(Vec3d const &normal)
+        {
+            FloatingType_t const sign = std::copysign(FloatingType_t{1}, normal.Z());
+            FloatingType_t const a = -1 / (sign + normal.Z());
+            FloatingType_t const b = normal.X() * normal.Y() * a;
+            return Onb{.Tangent = Vec3d{1 + sign * normal.X() * normal.X() * a, sign * b, -sign * normal.X()},
+                       .Bitangent = Vec3d{b, sign + normal.Y() * normal.Y() * a, -normal.Y()},
+                       .Normal = normal};
+        }
+
+        /// @brief Local (x, y, z) to world space
+        Vec3d ToWorld(Vec3d const &local) const
+        {
+            return Tangent * local.X() + Bitangent * local.Y() + Normal * local.Z();
+        }
+    };
+
+    /// @brief Point on the unit circle at angle 2 pi u, by polynomials instead of cos and sin. Max. error about 1e-5
+    /// @param u In [0, 1)
+    /// @return cos, sin
+    inline std::array<FloatingType_t, 2> UnitCircle(FloatingType_t u)
+    {
+        // half the angle, shifted into [-pi/2, pi/2] where short Taylor series suffice: 2 pi u = 2 (x + pi/2)
+        FloatingType_t const x = (u - FloatingType_t{0.5}) * FloatingType_t{M_PI};
+        FloatingType_t const x2 = x * x;
+        FloatingType_t const sinX = x * (1 + x2 * (FloatingType_t{-1.0 / 6} + x2 * (FloatingType_t{1.0 / 120} + x2 * (FloatingType_t{-1.0 / 5040} + x2 * FloatingType_t{1.0 / 362880}))));
+        FloatingType_t const cosX = 1 + x2 * (FloatingType_t{-1.0 / 2} + x2 * (FloatingType_t{1.0 / 24} + x2 * (FloatingType_t{-1.0 / 720} + x2 * (FloatingType_t{1.0 / 40320} + x2 * FloatingType_t{-1.0 / 3628800}))));
+
+        // double angle, plus the pi of the shift: cos(2x + pi) = -cos(2x), sin(2x + pi) = -sin(2x)
+        return {sinX * sinX - cosX * cosX, -2 * sinX * cosX};
+    }
+
+    /// @brief Cosine weighted direction within a cone around Z, by projecting a uniform point of a disk (Malley)
+    /// @param u1 Uniform in [0, 1), radius
+    /// @param u2 Uniform in [0, 1), azimuth
+    /// @param sinMaxAngleSquared sin² of the cone's half angle, 1 for the whole hemisphere
+    /// @return Normalized, in local space
+    inline Vec3d SampleCosineCone(FloatingType_t u1, FloatingType_t u2, FloatingType_t sinMaxAngleSquared)
+    {
+        FloatingType_t const radiusSquared = u1 * sinMaxAngleSquared;
+        FloatingType_t const radius = std::sqrt(radiusSquared);
+        auto const [cosPhi, sinPhi] = UnitCircle(u2);
+        return Vec3d{radius * cosPhi, radius * sinPhi, std::sqrt(std::max(FloatingType_t{0}, 1 - radiusSquared))};
+    }
+
+    /// @brief Uniformly distributed direction within a cone around Z
+    /// @param u1 Uniform in [0, 1), angle to Z
+    /// @param u2 Uniform in [0, 1), azimuth
+    /// @param oneMinusCosMaxAngle 1 - cos of the cone's half angle, passed as such to keep narrow cones precise
+    /// @return Normalized, in local space. Density 1 / (2 pi oneMinusCosMaxAngle)
+    inline Vec3d SampleUniformCone(FloatingType_t u1, FloatingType_t u2, FloatingType_t oneMinusCosMaxAngle)
+    {
+        FloatingType_t const oneMinusCos = u1 * oneMinusCosMaxAngle;
+        FloatingType_t const sinAngle = std::sqrt(std::max(FloatingType_t{0}, oneMinusCos * (2 - oneMinusCos)));
+        auto const [cosPhi, sinPhi] = UnitCircle(u2);
+        return Vec3d{sinAngle * cosPhi, sinAngle * sinPhi, 1 - oneMinusCos};
+    }
+
+    /// @brief Mean of cos(angle to Z) of SampleCosineCone()
+    /// @param cosMaxAngle cos of the cone's half angle
+    inline FloatingType_t GetCosineConeMeanCosine(FloatingType_t cosMaxAngle)
+    {
+        // integral of cos² over integral of cos, both over the cap
+        return 2 * (1 - cosMaxAngle * cosMaxAngle * cosMaxAngle) / (3 * (1 - cosMaxAngle * cosMaxAngle));
+    }
+}
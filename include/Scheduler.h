@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Scheduler
+{
+    /// @brief Edge length of a tile in pixels
+    constexpr unsigned int TILE_SIZE = 16;
+
+    /// @brief Rectangle [FromX, ToX) x [FromY, ToY), owned by a single worker while rendered
+    struct Tile
+    {
+        unsigned int FromX;
+        unsigned int FromY;
+        unsigned int ToX;
+        unsigned int ToY;
+    };
+
+    struct WorkerStatistics
+    {
+        /// @brief Time from submitting the frame until the worker woke up to take tiles
+        std::chrono::duration<double> Startup{0};
+        std::chrono::duration<double> Busy{0};
+        /// @brief Time within the frame not spent rendering, i.e. waiting for the slowest worker
+        std::chrono::duration<double> Idle{0};
+        size_t TilesRendered = 0;
+        size_t TilesStolen = 0;
+    };
+
+    struct FrameStatistics
+    {
+        /// @brief Time from submitting the frame until the last tile was done
+        std::chrono::duration<double> Wall{0};
+        /// @brief Time from submitting the frame until the first worker woke up
+        std::chrono::duration<double> Startup{0};
+        std::vector<WorkerStatistics> Workers;
+
+        /// @brief One line for the frame, one line per worker
+        std::string ToString() const;
+    };
+
+    /// @brief Cuts frames into tiles and spreads them over a fixed number of workers. Every worker owns a deque
+    /// of tiles, workers running dry steal from the far end of the others. The worker threads live as long as the
+    /// scheduler and sleep between frames
+    class TileScheduler
+    {
+    public:
+        using RenderTile_t = std::function<void(unsigned int worker, Tile const &tile)>;
+
+        /// @brief Ctor, starts the worker threads
+        /// @param numWorkers Number of worker threads, defaults to all hardware threads
+        TileScheduler(unsigned int numWorkers = GetHardwareConcurrency());
+
+        /// @brief Finishes the current frame and stops the worker threads
+        ~TileScheduler();
+
+        TileScheduler(TileScheduler const &) = delete;
+        TileScheduler &operator=(TileScheduler const &) = delete;
+
+        unsigned int GetWorkerCount() const;
+
+        /// @brief Starts rendering a frame and returns immediately. Waits for the previous frame first
+        /// @param width Frame width
+        /// @param height Frame height
+        /// @param renderTile Called concurrently, with the index of the calling worker. Every tile is handed out
+        /// exactly once. Everything it references has to stay alive until the frame is done
+        void Submit(unsigned int width, unsigned int height, RenderTile_t renderTile);
+
+        /// @brief Non-blocking
+        /// @return True if no frame is in flight
+        bool Poll() const;
+
+        /// @brief Blocks until the submitted frame is done
+        /// @return Load balance of the frame
+        FrameStatistics Wait();
+
+        /// @brief Submit() and Wait()
+        FrameStatistics Run(unsigned int width, unsigned int height, RenderTile_t renderTile);
+
+        static unsigned int GetHardwareConcurrency();
+
+    private:
+        struct alignas(64) workerQueue_t
+        {
+            std::mutex Mutex;
+            std::deque<Tile> Tiles;
+        };
+
+        unsigned int const NumWorkers;
+        std::vector<workerQueue_t> Queues;
+
+        /// @brief Guards everything below
+        mutable std::mutex FrameMutex;
+        std::condition_variable FrameStarted;
+        std::condition_variable FrameDone;
+        /// @brief Incremented by every Submit(), workers compare it to the last frame they worked on
+        size_t FrameIndex = 0;
+        unsigned int BusyWorkers = 0;
+        bool Stopping = false;
+        RenderTile_t RenderTile;
+        std::chrono::steady_clock::time_point SubmitTime;
+        FrameStatistics Statistics;
+
+        std::vector<std::thread> Threads;
+
+        void WorkerLoop(unsigned int worker);
+
+        void RunWorker(unsigned int worker, WorkerStatistics &statistics);
+    };
+}
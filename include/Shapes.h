@@ -1,15 +1,34 @@
 #pragma once
 
+#include <cstdint>
 #include <optional>
 #include <string>
 
 #include "Primitives.h"
 #include "Materials.h"
+#include "Debug.h"
+
+namespace Scene
+{
+    struct PrimitiveArrays;
+}
 
 namespace Shapes
 {
     using namespace Primitives;
 
+    /// @brief Hits are moved this far towards the ray origin, such that reflections do not intersect with the surface itself
+    constexpr FloatingType_t OFFSET_DELTA = 1e-3;
+
+    inline Vec3d Reflect(Vec3d const &direction, Vec3d const &normal)
+    {
+        // https://math.stackexchange.com/questions/13261/how-to-get-a-reflection-vector
+        Vec3d const reflectionDirection = direction - 2.0 * (direction * normal) * normal;
+        DEBUG_ASSERT(AlmostSame(reflectionDirection.GetNorm(), 1.0), "Reflection did not yield normalized vector");
+
+        return reflectionDirection;
+    }
+
     struct HitEvent
     {
         FloatingType_t DistanceToSurface;
@@ -17,15 +36,42 @@ namespace Shapes
         Line ReflectedRay;
     };
 
+    static_assert(std::is_trivially_copyable_v<HitEvent>, "HitEvent must be trivially copyable");
+
+    /// @brief Result of the cheap intersection stage, only the closest one gets shaded into a HitEvent
+    struct HitCandidate
+    {
+        FloatingType_t DistanceToSurface;
+        /// @brief Shape specific information carried over to shading
+        uint32_t Payload;
+    };
+
     /// @brief VIRTUAL
     class Shape
     {
     public:
         std::string Label;
 
-        virtual std::optional<HitEvent> CheckHit(Line const &line) const = 0;
+        /// @brief Cheap intersection test, used while searching for the closest shape
+        /// @param line Ray to check
+        /// @return Distance to the hit or nullopt
+        virtual std::optional<HitCandidate> Intersect(Line const &line) const = 0;
+
+        /// @brief Computes normal and reflection of a hit previously found by Intersect()
+        /// @param line Same ray as passed to Intersect()
+        /// @param candidate Result of Intersect()
+        /// @return Full hit information
+        virtual HitEvent Shade(Line const &line, HitCandidate const &candidate) const = 0;
+
+        /// @brief Intersect() and Shade() in one go
+        std::optional<HitEvent> CheckHit(Line const &line) const;
+
         virtual Materials::Material const &GetMaterial(HitEvent const & hitEvent) const = 0;
 
+        /// @brief Appends the shape to the structure of arrays representation used for rendering
+        /// @param target Arrays to append to
+        virtual void Compile(Scene::PrimitiveArrays &target) const = 0;
+
     protected:
         Shape(std::string const &label);
     };
@@ -37,8 +83,10 @@ namespace Shapes
 
         Sphere(std::string const &label, Materials::Material const &material, Vec3d center, FloatingType_t radius);
 
-        std::optional<HitEvent> CheckHit(Line const &line) const override;
+        std::optional<HitCandidate> Intersect(Line const &line) const override;
+        HitEvent Shade(Line const &line, HitCandidate const &candidate) const override;
         Materials::Material const &GetMaterial(HitEvent const & hitEvent) const override;
+        void Compile(Scene::PrimitiveArrays &target) const override;
 
     private:
         Materials::Material Material;
@@ -51,8 +99,10 @@ namespace Shapes
 
         Plane(std::string const &label, Materials::Material const &material, Vec3d pin, Vec3d planeNormal);
 
-        std::optional<HitEvent> CheckHit(Line const &line) const override;
+        std::optional<HitCandidate> Intersect(Line const &line) const override;
+        HitEvent Shade(Line const &line, HitCandidate const &candidate) const override;
         Materials::Material const &GetMaterial(HitEvent const & hitEvent) const override;
+        void Compile(Scene::PrimitiveArrays &target) const override;
 
     protected:
         Plane(std::string const &label, Vec3d pin, Vec3d planeNormal);
@@ -66,6 +116,8 @@ namespace Shapes
         CheckerboardPlane(std::string const &label, std::pair<Materials::Material, Materials::Material> materials, FloatingType_t width, Vec3d pin, Vec3d normal);
 
         Materials::Material const &GetMaterial(HitEvent const & hitEvent) const override;
+        void Compile(Scene::PrimitiveArrays &target) const override;
+
     private:
         std::pair<Materials::Material, Materials::Material> Materials;
         FloatingType_t Width;
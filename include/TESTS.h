@@ -1,6 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Bvh.h"
+#include "Camera.h"
+#include "CompiledScene.h"
+#include "Denoise.h"
+#include "ImgFile.h"
+#include "MappedImage.h"
+#include "Progressive.h"
+#include "Rt.h"
 #include "Shapes.h"
+#include "ToneMap.h"
 #include "Debug.h"
 
 namespace Tests
@@ -49,12 +69,991 @@ namespace Tests
 
             DEBUG_ASSERT(AlmostSame(probingRay.Direction.GetNorm(), 1.0), "Rotation is bad for vector");
 
-            DEBUG_ASSERT(probingRay.Direction.Z > 0, "Probe penetrates surface");
+            DEBUG_ASSERT(probingRay.Direction.Z() > 0, "Probe penetrates surface");
+        }
+    }
+
+    inline void _test_cosine_cone_sampling()
+    {
+        std::default_random_engine rng{5};
+        std::uniform_real_distribution<FloatingType_t> dist{-1, 1};
+        FloatingType_t const sinMaxAngleSquared = sin(Rt::DIFFUSE_LOBE_ANGLE) * sin(Rt::DIFFUSE_LOBE_ANGLE);
+
+        // the poles are where naive bases break down
+        std::vector<Vec3d> normals = {{0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {0, -1, 0}};
+        for (size_t i = 0; i < 100; i++)
+            normals.push_back(Vec3d{dist(rng), dist(rng), dist(rng)}.ToNormalized());
+
+        for (auto const &normal : normals)
+        {
+            auto const basis = Sampling::Onb::FromNormal(normal);
+            DEBUG_ASSERT(AlmostSame(basis.Tangent.GetNorm(), 1.0) && AlmostSame(basis.Bitangent.GetNorm(), 1.0), "Basis is not normalized");
+            DEBUG_ASSERT(abs(basis.Tangent * basis.Bitangent) < 1e-5 && abs(basis.Tangent * normal) < 1e-5 && abs(basis.Bitangent * normal) < 1e-5,
+                         "Basis is not orthogonal");
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                Vec3d const direction = basis.ToWorld(Sampling::SampleCosineCone((dist(rng) + 1) / 2, (dist(rng) + 1) / 2, sinMaxAngleSquared));
+                DEBUG_ASSERT(AlmostSame(direction.GetNorm(), 1.0), "Probe is not normalized");
+                DEBUG_ASSERT(direction * normal >= cos(Rt::DIFFUSE_LOBE_ANGLE) - 1e-5, "Probe leaves the lobe");
+            }
+        }
+    }
+
+    inline void _test_bvh_depth()
+    {
+        // points on the axes in turn, every one about 18 times further out than the last on its axis. Every split
+        // can only peel off the outermost point, SAH alone would build a tree of about a hundred levels
+        constexpr size_t PRIMITIVECOUNT = 180;
+        std::vector<Aabb> bounds(PRIMITIVECOUNT);
+        for (size_t i = 0; i < PRIMITIVECOUNT; i++)
+        {
+            Vec3d point{0, 0, 0};
+            point.Data[i % 3] = std::ldexp(FloatingType_t{1}, (int)(i * 7 / 5) - 125);
+            bounds[i].Grow(point);
+        }
+
+        Bvh::Tree const tree{bounds};
+        DEBUG_ASSERT(tree.GetDepth() <= Bvh::MAX_TRAVERSAL_DEPTH, "Tree must fit the traversal stack");
+
+        // every leaf once, down to the deepest one
+        size_t visited = 0;
+        tree.Traverse({false, false, false}, [](Aabb const &)
+                      { return true; },
+                      [&visited](uint32_t begin, uint32_t end)
+                      { visited += end - begin; });
+        DEBUG_ASSERT(visited == PRIMITIVECOUNT, "Traversal must reach every primitive");
+    }
+
+    inline void _test_compiled_scene_matches_shapes()
+    {
+        std::default_random_engine rng{3};
+        std::uniform_real_distribution<FloatingType_t> dist{-10, 10};
+
+        std::vector<std::unique_ptr<Shapes::Sphere>> spheres;
+        std::vector<Shapes::Shape const *> shapes;
+        for (size_t i = 0; i < 200; i++)
+        {
+            spheres.push_back(std::make_unique<Shapes::Sphere>("", Materials::Material{}, Vec3d{dist(rng), dist(rng), dist(rng)}, 0.5));
+            shapes.push_back(spheres.back().get());
+        }
+        // one plane and an enclosing sphere end up in the linear kernels
+        Shapes::Plane const plane{"", Materials::Material{}, {0, 0, -9}, {0, 0.1, 1}};
+        Shapes::Sphere const enclosing{"", Materials::Material{}, {0, 0, 0}, 100};
+        shapes.push_back(&plane);
+        shapes.push_back(&enclosing);
+        Scene::CompiledScene const scene{shapes};
+
+        for (size_t i = 0; i < 1000; i++)
+        {
+            Line const ray{{0, 0, 0}, Vec3d{dist(rng), dist(rng), dist(rng)}.ToNormalized()};
+
+            std::optional<Shapes::HitEvent> nearest;
+            uint32_t nearestShape = Scene::NO_SHAPE;
+            for (uint32_t j = 0; j < shapes.size(); j++)
+            {
+                auto const hitEvent = shapes[j]->CheckHit(ray);
+                if (hitEvent && (!nearest || hitEvent->DistanceToSurface < nearest->DistanceToSurface))
+                {
+                    nearest = hitEvent;
+                    nearestShape = j;
+                }
+            }
+
+            auto const intersection = scene.GetClosestIntersection(ray);
+            DEBUG_ASSERT(intersection.Material && nearest, "Enclosing sphere must always be hit");
+            DEBUG_ASSERT(AlmostSame(intersection.Hitevent.DistanceToSurface, nearest->DistanceToSurface), "Compiled scene must find the same hit as the shapes");
+            DEBUG_ASSERT(AlmostSame(intersection.Hitevent.SurfaceNormal * nearest->SurfaceNormal, 1.0), "Compiled scene must shade the same normal as the shapes");
+            DEBUG_ASSERT(scene.GetShapeIndex(intersection.Material) == nearestShape, "Compiled scene must report the shape that was hit");
+        }
+    }
+
+    inline void _test_shadow_rays()
+    {
+        std::default_random_engine rng{13};
+        std::uniform_real_distribution<FloatingType_t> dist{-10, 10};
+
+        std::vector<std::unique_ptr<Shapes::Sphere>> spheres;
+        std::vector<Shapes::Shape const *> shapes;
+        for (size_t i = 0; i < 200; i++)
+        {
+            spheres.push_back(std::make_unique<Shapes::Sphere>("", Materials::Material{}, Vec3d{dist(rng), dist(rng), dist(rng)}, 0.5));
+            shapes.push_back(spheres.back().get());
+        }
+        Shapes::Plane const plane{"", Materials::Material{}, {0, 0, -9}, {0, 0.1, 1}};
+        Shapes::Sphere const enclosing{"", Materials::Material{}, {0, 0, 0}, 100};
+        shapes.push_back(&plane);
+        shapes.push_back(&enclosing);
+        Scene::CompiledScene const scene{shapes};
+
+        for (size_t i = 0; i < 1000; i++)
+        {
+            Line const ray{{dist(rng), dist(rng), dist(rng)}, Vec3d{dist(rng), dist(rng), dist(rng)}.ToNormalized()};
+            FloatingType_t const closest = scene.GetClosestIntersection(ray).Hitevent.DistanceToSurface;
+            for (FloatingType_t const maxDistance : {FloatingType_t{1}, FloatingType_t{5}, FloatingType_t{20}, FloatingType_t{200}})
+                DEBUG_ASSERT(scene.IsOccluded(ray, maxDistance) == (closest < maxDistance), "Any hit must agree with the closest hit");
+        }
+    }
+
+    inline void _test_emitter_sampling()
+    {
+        // one emitter of each kind, lit from a point above a diffuse floor
+        Shapes::Sphere const lamp{"", Materials::Material{}.MakeEmissive({200, 200, 200}), {1, 2, 4}, 0.5};
+        Shapes::Plane const wall{"", Materials::Material{}.MakeEmissive({50, 0, 0}), {0, 10, 0}, {0, -1, 0}};
+        Shapes::Sphere const sky{"", Materials::Material{}.MakeEmissive({0, 0, 50}), {0, 0, 0}, 100};
+        Shapes::Plane const floor{"", Materials::Material{}.MakeDiffuse(1), {0, 0, 0}, {0, 0, 1}};
+        std::vector<Shapes::Shape const *> const shapes{&lamp, &wall, &sky, &floor};
+        Scene::CompiledScene const scene{shapes};
+        DEBUG_ASSERT(scene.GetEmitterCount() == 3, "Emissive spheres and plain planes must be emitters");
+
+        std::default_random_engine rng{17};
+        std::uniform_real_distribution<FloatingType_t> unit{0, 1};
+        Vec3d const origin{0, 0, 1};
+        Vec3d const normal{0, 0, 1};
+        for (size_t i = 0; i < 1000; i++)
+        {
+            auto const sample = scene.SampleEmitter(unit(rng), unit(rng), unit(rng), origin, normal);
+            if (sample.Pdf == 0)
+                continue;
+
+            // the closest hit must be the drawn emitter, with the same density for probes to weight against
+            Line const ray{origin, sample.Direction};
+            auto const hit = scene.GetClosestIntersection(ray);
+            if (!(hit.Hitevent.DistanceToSurface < sample.Distance))
+            {
+                DEBUG_ASSERT(hit.Material == sample.Material, "Light sample must reach its emitter");
+                DEBUG_ASSERT(AlmostSame(scene.GetEmitterPdf(hit, ray, sample.Direction * normal), sample.Pdf), "Light sample and hit must agree on the density");
+            }
+            DEBUG_ASSERT(scene.IsOccluded(ray, sample.Distance) == (hit.Hitevent.DistanceToSurface < sample.Distance), "Shadow ray must agree with the closest hit");
+        }
+    }
+
+    inline void _test_next_event_estimation()
+    {
+        // white floor lit by a lamp straight above and a dim sky. The lamp covers sin² = 1/9 of the disk probes
+        // are projected from, the sky the rest of it
+        Shapes::Sphere const lamp{"", Materials::Material{}.MakeEmissive({100, 100, 100}), {0, 0, 3}, 1};
+        Shapes::Sphere const sky{"", Materials::Material{}.MakeEmissive({10, 10, 10}), {0, 0, 0}, 100};
+        Shapes::Plane const floor{"", Materials::Material{}.MakeDiffuse(1), {0, 0, 0}, {0, 0, 1}};
+        std::vector<Shapes::Shape const *> const shapes{&lamp, &sky, &floor};
+        FloatingType_t const lampShare = FloatingType_t{1} / 9 / (sin(Rt::DIFFUSE_LOBE_ANGLE) * sin(Rt::DIFFUSE_LOBE_ANGLE));
+        FloatingType_t const expected = 100 * lampShare + 10 * (1 - lampShare);
+
+        constexpr unsigned int SAMPLECOUNT = 16384;
+        Line const ray{{0, -2, 1}, Vec3d{0, 2, -1}.ToNormalized()};
+        for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+        {
+            for (unsigned int lightSamples : {0u, 1u})
+            {
+                Rt::RenderSettings const settings{.Mode = mode, .RayGenerations = 2, .LightSamples = lightSamples};
+                Rt::Raytracer const raytracer{9u, settings, shapes};
+                Rt::WorkerState worker{settings};
+                FloatingType_t sum = 0;
+                for (unsigned int pass = 0; pass < SAMPLECOUNT; pass++)
+                    sum += raytracer.TracePixel(ray, 0, 0, pass, worker).X();
+
+                // unbiased with and without light samples
+                DEBUG_ASSERT(std::abs(sum / SAMPLECOUNT - expected) < FloatingType_t{0.03} * expected, "Light samples and probes must converge to the same radiance");
+            }
+        }
+    }
+
+    inline void _test_integrators_agree()
+    {
+        // with a single generation MarchRay() never normalizes over siblings, so the path tracer must converge to the
+        // same radiance. Rays towards both spheres, whose materials mix mirror and diffuse lobes, and the floor
+        Camera::RayTable const camera{Camera::Settings{}, 64, 48};
+        for (auto const &[x, y] : {std::pair{20u, 24u}, std::pair{40u, 26u}, std::pair{32u, 5u}})
+        {
+            Line const ray = camera.GetRay(x, y);
+            std::array<FloatingType_t, 2> means;
+            for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+            {
+                Rt::RenderSettings const settings{.Mode = mode, .RayGenerations = 1, .MaxBounces = 2};
+                Rt::Raytracer const raytracer{9u, settings};
+                Rt::WorkerState worker{settings};
+                // a path carries a single probe, the branching tree three
+                unsigned int const sampleCount = mode == Rt::Integrator::Branching ? 4096 : 16384;
+                FloatingType_t sum = 0;
+                for (unsigned int pass = 0; pass < sampleCount; pass++)
+                {
+                    ColorD_t const color = raytracer.TracePixel(ray, x, y, pass, worker);
+                    sum += color.X() + color.Y() + color.Z();
+                }
+                means[mode == Rt::Integrator::Branching ? 0 : 1] = sum / sampleCount;
+            }
+            DEBUG_ASSERT(means[0] > 0 && std::abs(means[0] - means[1]) < FloatingType_t{0.03} * means[0], "Path tracing must converge to the radiance of branching");
+        }
+    }
+
+    inline void _test_ray_packets()
+    {
+        std::default_random_engine rng{11};
+        std::uniform_real_distribution<FloatingType_t> dist{-10, 10};
+
+        std::vector<std::unique_ptr<Shapes::Sphere>> spheres;
+        std::vector<Shapes::Shape const *> shapes;
+        for (size_t i = 0; i < 100; i++)
+        {
+            spheres.push_back(std::make_unique<Shapes::Sphere>("", Materials::Material{}.MakeDiffuse(i / FloatingType_t{100}), Vec3d{dist(rng), dist(rng), dist(rng)}, 0.5));
+            shapes.push_back(spheres.back().get());
+        }
+        Shapes::Plane const plane{"", Materials::Material{}.MakeDiffuse(0.5), {0, 0, -9}, {0, 0.1, 1}};
+        Shapes::Sphere const enclosing{"", Materials::Material{}.MakeDiffuse(1), {0, 0, 0}, 100};
+        shapes.push_back(&plane);
+        shapes.push_back(&enclosing);
+        Scene::CompiledScene const scene{shapes};
+
+        for (size_t i = 0; i < 200; i++)
+        {
+            // a bundle of similar rays, some of them missing
+            Vec3d const mainDirection{dist(rng), dist(rng), dist(rng)};
+            Scene::RayPacket packet;
+            for (size_t lane = 0; lane < Scene::PACKET_SIZE; lane++)
+                if (dist(rng) > -7)
+                    packet.Set(lane, Line{{dist(rng) / 10, dist(rng) / 10, 0}, (mainDirection + Vec3d{dist(rng), dist(rng), dist(rng)} * 0.1).ToNormalized()});
+
+            for (auto level = Scene::SimdLevel::Scalar; level <= Scene::GetSimdLevel(); level = (Scene::SimdLevel)((int)level + 1))
+            {
+                std::array<Scene::Intersection, Scene::PACKET_SIZE> intersections;
+                scene.GetClosestIntersections(packet, intersections, level);
+                for (size_t lane = 0; lane < Scene::PACKET_SIZE; lane++)
+                {
+                    if (!packet.IsActive(lane))
+                        continue;
+
+                    auto const single = scene.GetClosestIntersection(packet.Get(lane));
+                    DEBUG_ASSERT(intersections[lane].Material == single.Material, std::string{"Packet must hit the same primitive as a single ray: "} + Scene::ToString(level));
+                    DEBUG_ASSERT(intersections[lane].Hitevent.DistanceToSurface == single.Hitevent.DistanceToSurface, std::string{"Packet must find the same distance as a single ray: "} + Scene::ToString(level));
+                }
+            }
+        }
+    }
+
+    inline void _test_samplers()
+    {
+        constexpr uint32_t SAMPLECOUNT = 16;
+        for (auto const sampler : {Random::Sampler::Independent, Random::Sampler::Stratified, Random::Sampler::Sobol, Random::Sampler::BlueNoise})
+        {
+            for (uint32_t dimension = 0; dimension < Random::SAMPLED_DIMENSIONS + 2; dimension++)
+            {
+                std::array<unsigned int, SAMPLECOUNT> strata = {0};
+                for (uint32_t sample = 0; sample < SAMPLECOUNT; sample++)
+                {
+                    Random::Stream random{sampler, 3u, 17, 5, sample, SAMPLECOUNT};
+                    random.SetBounce(2);
+                    FloatingType_t const value = random.Get(dimension);
+                    DEBUG_ASSERT(value >= 0 && value < 1, "Sample out of range");
+                    strata[(size_t)(value * SAMPLECOUNT)]++;
+                }
+
+                // blue noise only stratifies over pixels, dimensions beyond the sampled ones are independent
+                if ((sampler == Random::Sampler::Stratified || sampler == Random::Sampler::Sobol) && dimension < Random::SAMPLED_DIMENSIONS)
+                    DEBUG_ASSERT(std::all_of(strata.begin(), strata.end(), [](unsigned int count)
+                                             { return count == 1; }),
+                                 "Every stratum must be hit exactly once");
+            }
+        }
+    }
+
+    inline void _test_render_reproducible()
+    {
+        for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+        {
+            Rt::Raytracer const raytracer{7u, Rt::RenderSettings{.Mode = mode, .RayGenerations = 3}};
+
+            // single threaded, scanline order
+            std::unique_ptr<Bitmap::BitmapD> sequential{new Bitmap::BitmapD{}};
+            Rt::WorkerState worker{Rt::RenderSettings{.Mode = mode, .RayGenerations = 3}};
+            raytracer.RenderTile(Scheduler::Tile{0, 0, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT}, *sequential, 0, 1, worker);
+
+            // several workers, tile order up to the scheduler
+            std::unique_ptr<Bitmap::BitmapD> parallel{new Bitmap::BitmapD{}};
+            Rt::RenderContext context{raytracer, 3};
+            context.Submit(*parallel, 1);
+            context.Wait();
+
+            DEBUG_ASSERT(*sequential == *parallel, "Render must not depend on workers or tile order");
+
+            // pixels one by one, without packets. Includes partially filled packets at the border
+            Camera::RayTable const camera{Camera::Settings{}, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT};
+            for (unsigned int y = Bitmap::BITMAP_HEIGHT - 6; y < Bitmap::BITMAP_HEIGHT; y++)
+            {
+                for (unsigned int x = Bitmap::BITMAP_WIDTH - 6; x < Bitmap::BITMAP_WIDTH; x++)
+                {
+                    ColorD_t const single = raytracer.TracePixel(camera.GetRay(x, y), x, y, 0, worker);
+                    DEBUG_ASSERT(std::equal(single.Data.begin(), single.Data.end(), sequential->atPixel(x, y)), "Packets must not change the image");
+                }
+            }
+        }
+    }
+
+    inline void _test_wavefront_matches_pixels()
+    {
+        for (auto const mode : {Rt::Integrator::Branching, Rt::Integrator::PathTracing})
+        {
+            // several samples and passes per pixel, so samples of different pixels share the queues
+            Rt::RenderSettings const settings{.Mode = mode, .SamplesPerPixel = 2, .Sampler = Random::Sampler::Sobol, .RayGenerations = 4};
+            Rt::RenderSettings wavefrontSettings = settings;
+            wavefrontSettings.Backend = Rt::Engine::Wavefront;
+
+            Rt::Raytracer const raytracer{5u, settings};
+            std::unique_ptr<Bitmap::BitmapD> perPixel{new Bitmap::BitmapD{}};
+            Rt::WorkerState worker{settings};
+            raytracer.RenderTile(Scheduler::Tile{0, 0, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT}, *perPixel, 1, 2, worker);
+
+            Rt::Raytracer const wavefrontRaytracer{5u, wavefrontSettings};
+            std::unique_ptr<Bitmap::BitmapD> wavefront{new Bitmap::BitmapD{}};
+            Rt::WorkerState wavefrontWorker{wavefrontSettings};
+            wavefrontRaytracer.RenderTile(Scheduler::Tile{0, 0, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT}, *wavefront, 1, 2, wavefrontWorker);
+
+            DEBUG_ASSERT(*perPixel == *wavefront, "Wavefront must render the same image as pixel by pixel");
+            DEBUG_ASSERT(wavefrontWorker.Wavefront.Times.Rays >= Bitmap::BITMAP_WIDTH * Bitmap::BITMAP_HEIGHT, "Wavefront must count its rays");
+        }
+    }
+
+    inline void _test_no_diffuse_rays()
+    {
+        // no probes at all, each hit spawns its reflection only, just like a single diffuse ray does
+        for (auto const backend : {Rt::Engine::PerPixel, Rt::Engine::Wavefront})
+        {
+            std::array<std::unique_ptr<Bitmap::BitmapD>, 2> images;
+            for (unsigned int diffuseRays : {0u, 1u})
+            {
+                Rt::RenderSettings const settings{.Mode = Rt::Integrator::Branching, .Backend = backend, .RayGenerations = 3, .DiffuseRays = diffuseRays};
+                Rt::Raytracer const raytracer{3u, settings};
+                Rt::WorkerState worker{settings};
+                DEBUG_ASSERT(worker.Scratch.GetCapacity() >= 1, "Scratch must hold the camera ray");
+                images[diffuseRays].reset(new Bitmap::BitmapD{});
+                raytracer.RenderTile(Scheduler::Tile{0, 0, Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT}, *images[diffuseRays], 0, 1, worker);
+            }
+            DEBUG_ASSERT(*images[0] == *images[1], "No diffuse rays must render like the reflection alone");
+        }
+    }
+
+    inline void _test_adaptive_sampling()
+    {
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::PathTracing, .Sampler = Random::Sampler::Sobol};
+        Adaptive::Settings const adaptiveSettings{.MinPasses = 4, .PassesPerRound = 4, .MaxPasses = 16, .PixelThreshold = 0.05, .TargetNoise = 0};
+        Rt::Raytracer const raytracer{3u, settings};
+
+        Adaptive::Frame sequential{adaptiveSettings};
+        Rt::RenderContext{raytracer, 1}.RenderAdaptive(sequential);
+        Adaptive::Frame parallel{adaptiveSettings};
+        // means resolved tile by tile as rounds go, like for streaming
+        Bitmap::BitmapD streamed;
+        Rt::RenderContext{raytracer, 3}.RenderAdaptive(parallel, nullptr, [&](Scheduler::Tile const &tile)
+                                                       { parallel.Resolve(streamed, tile.FromX, tile.FromY, tile.ToX, tile.ToY); });
+        Bitmap::BitmapD resolved;
+        parallel.Resolve(resolved);
+        DEBUG_ASSERT(streamed == resolved, "Every round must report its tiles");
+
+        unsigned int minPasses = UINT32_MAX;
+        unsigned int maxPasses = 0;
+        for (unsigned int y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+            {
+                Adaptive::PixelStatistics const &pixel = sequential.At(x, y);
+                minPasses = std::min(minPasses, pixel.Passes);
+                maxPasses = std::max(maxPasses, pixel.Passes);
+                DEBUG_ASSERT(pixel.Passes == parallel.At(x, y).Passes && pixel.Sum.Data == parallel.At(x, y).Sum.Data, "Adaptive frame must not depend on workers or tile order");
+                DEBUG_ASSERT(pixel.Passes >= adaptiveSettings.MinPasses && pixel.Passes <= adaptiveSettings.MaxPasses, "Pixel passes out of range");
+                DEBUG_ASSERT(sequential.IsActive(x, y) == (pixel.Passes < adaptiveSettings.MaxPasses && pixel.GetRelativeError(adaptiveSettings.MinLuminance) > adaptiveSettings.PixelThreshold),
+                             "Pixels must stop exactly at the threshold");
+            }
+        }
+
+        // the sky converges on the minimum, the diffuse floor does not
+        DEBUG_ASSERT(minPasses == adaptiveSettings.MinPasses && maxPasses == adaptiveSettings.MaxPasses, "Passes must go to the hard pixels only");
+        DEBUG_ASSERT(sequential.GetActiveCount() == 0, "Frame must run until every pixel is done");
+
+        // Welford against the two pass formula
+        Adaptive::PixelStatistics statistics;
+        std::array<FloatingType_t, 5> const luminances = {1, 4, 2, 8, 5};
+        for (auto const luminance : luminances)
+            statistics.Add(ColorD_t{luminance, luminance, luminance});
+        FloatingType_t const mean = 4;
+        FloatingType_t squaredDeviations = 0;
+        for (auto const luminance : luminances)
+            squaredDeviations += (luminance - mean) * (luminance - mean);
+        DEBUG_ASSERT(AlmostSame(statistics.MeanLuminance, mean) && AlmostSame(statistics.SquaredDeviations, squaredDeviations), "Running variance must match the two pass formula");
+    }
+
+    inline void _test_progressive_resume()
+    {
+        std::string const checkpointFile = "Render\\test_checkpoint.bin";
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::PathTracing, .Sampler = Random::Sampler::Sobol};
+        Rt::Raytracer const raytracer{5u, settings};
+        std::filesystem::remove(checkpointFile);
+
+        // one pass per submission, like the progressive steps
+        std::unique_ptr<Bitmap::BitmapD> uninterrupted{new Bitmap::BitmapD{}};
+        Rt::RenderContext context{raytracer};
+        for (unsigned int pass = 0; pass < 4; pass++)
+            context.Submit(*uninterrupted, 1);
+        context.Wait();
+
+        // pre-empted after 2 passes, continued by a fresh context and accumulator
+        std::unique_ptr<Bitmap::BitmapD> preempted{new Bitmap::BitmapD{}};
+        Progressive::Settings progressiveSettings{.MaxPasses = 2, .ImageFile = "", .CheckpointFile = checkpointFile};
+        Progressive::Summary const first = Progressive::Render(context, *preempted, progressiveSettings);
+        DEBUG_ASSERT(first.Passes == 2 && first.ResumedPasses == 0 && first.Checkpoints == 1, "Progressive render must stop at the pass limit and checkpoint");
+
+        std::unique_ptr<Bitmap::BitmapD> resumed{new Bitmap::BitmapD{}};
+        progressiveSettings.MaxPasses = 4;
+        Progressive::Summary const second = Progressive::Render(context, *resumed, progressiveSettings);
+        DEBUG_ASSERT(second.Passes == 4 && second.ResumedPasses == 2 && second.Steps == 2, "Progressive render must resume from the checkpoint");
+        DEBUG_ASSERT(*resumed == *uninterrupted, "Resumed render must match an uninterrupted one");
+
+        // other seeds draw other random numbers, their sums must not be continued
+        unsigned int passes = 0;
+        DEBUG_ASSERT(!Progressive::ReadCheckpoint(checkpointFile, Rt::Raytracer{6u, settings}, *resumed, passes) && passes == 0, "Checkpoint of another seed must be rejected");
+        std::filesystem::resize_file(checkpointFile, std::filesystem::file_size(checkpointFile) - 1);
+        DEBUG_ASSERT(!Progressive::ReadCheckpoint(checkpointFile, raytracer, *resumed, passes) && passes == 0, "Truncated checkpoint must be rejected");
+        std::filesystem::remove(checkpointFile);
+    }
+
+    inline void _test_denoiser()
+    {
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::Branching, .Sampler = Random::Sampler::Sobol};
+        Rt::Raytracer const raytracer{7u, settings};
+        Rt::RenderContext context{raytracer};
+        std::unique_ptr<Aov::Framebuffer> guides{new Aov::Framebuffer{}};
+        std::unique_ptr<Bitmap::BitmapD> noisy{new Bitmap::BitmapD{}};
+        context.Submit(*noisy, 1, guides.get());
+        std::unique_ptr<Bitmap::BitmapD> reference{new Bitmap::BitmapD{}};
+        context.Submit(*reference, 16);
+        context.Wait();
+
+        // an image without noise keeps its colors
+        std::unique_ptr<Bitmap::BitmapD> flat{new Bitmap::BitmapD{}};
+        flat->Fill(5);
+        Denoise::Denoiser{}.Run(*flat, *guides);
+        for (unsigned int y = 0; y < flat->GetHeight(); y++)
+            DEBUG_ASSERT(std::all_of(flat->Row(y), flat->Row(y) + flat->GetWidth() * Bitmap::COLOR_COUNT, [](FloatingType_t value)
+                                     { return AlmostSame(value, 5); }),
+                         "Flat image must stay flat");
+
+        // every kernel weighs the taps alike
+        std::unique_ptr<Bitmap::BitmapD> denoised{new Bitmap::BitmapD{noisy->Clone()}};
+        Denoise::Denoiser{Denoise::Settings{.Simd = Scene::SimdLevel::Scalar}, 2}.Run(*denoised, *guides);
+        if (Scene::GetSimdLevel() >= Scene::SimdLevel::Avx2)
+        {
+            std::unique_ptr<Bitmap::BitmapD> vectorized{new Bitmap::BitmapD{noisy->Clone()}};
+            Denoise::Denoiser{Denoise::Settings{.Simd = Scene::SimdLevel::Avx2}, 3}.Run(*vectorized, *guides);
+            DEBUG_ASSERT(*vectorized == *denoised, "SIMD kernel must match the scalar one");
+        }
+
+        // iterations beyond the border are skipped rather than read outside of the planes
+        std::unique_ptr<Bitmap::BitmapD> capped{new Bitmap::BitmapD{noisy->Clone()}};
+        Denoise::Denoiser{Denoise::Settings{.Iterations = Denoise::Denoiser::MAX_ITERATIONS}, 2}.Run(*capped, *guides);
+        std::unique_ptr<Bitmap::BitmapD> excess{new Bitmap::BitmapD{noisy->Clone()}};
+        Denoise::Denoiser{Denoise::Settings{.Iterations = 2 * Denoise::Denoiser::MAX_ITERATIONS}, 2}.Run(*excess, *guides);
+        DEBUG_ASSERT(*excess == *capped, "Iterations beyond the border must be skipped");
+
+        auto const squaredError = [&](Bitmap::BitmapD const &image)
+        {
+            double sum = 0;
+            for (unsigned int y = 0; y < image.GetHeight(); y++)
+                for (size_t i = 0; i < image.GetWidth() * Bitmap::COLOR_COUNT; i++)
+                    sum += (image.Row(y)[i] - reference->Row(y)[i] / 16) * (image.Row(y)[i] - reference->Row(y)[i] / 16);
+            return sum;
+        };
+        DEBUG_ASSERT(squaredError(*denoised) < squaredError(*noisy) / 4, "Denoised pass must be closer to the converged image");
+    }
+
+    inline void _test_aovs()
+    {
+        constexpr unsigned int PASSES = 2;
+        Rt::RenderSettings settings{.Mode = Rt::Integrator::Branching, .SamplesPerPixel = 2};
+        Rt::Raytracer const raytracer{8u, settings};
+        Rt::RenderContext context{raytracer};
+        std::unique_ptr<Bitmap::BitmapD> accumulator{new Bitmap::BitmapD{}};
+        std::unique_ptr<Aov::Framebuffer> aovs{new Aov::Framebuffer{}};
+        context.Submit(*accumulator, PASSES, aovs.get());
+        context.Wait();
+
+        unsigned int const samples = PASSES * settings.SamplesPerPixel;
+        for (unsigned int y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+            {
+                size_t const index = aovs->GetIndex(x, y);
+                FloatingType_t const *normal = aovs->Normal.atPixel(x, y);
+                DEBUG_ASSERT(aovs->Depth[index] > 0 && AlmostSame(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2], 1), "Every camera ray of the demo scene hits a surface");
+                DEBUG_ASSERT(aovs->ShapeId[index] < Scene::Objects.size(), "Shape of the first hit must be part of the scene");
+                DEBUG_ASSERT(aovs->Bounces[index] >= samples && aovs->Bounces[index] <= samples * (settings.RayGenerations + 1), "Every sample hits at least the first surface");
+            }
+        }
+
+        // the wavefront engine follows the same rays, so it finds the same surfaces
+        settings.Backend = Rt::Engine::Wavefront;
+        Rt::Raytracer const wavefrontRaytracer{8u, settings};
+        Rt::RenderContext wavefrontContext{wavefrontRaytracer};
+        std::unique_ptr<Aov::Framebuffer> wavefrontAovs{new Aov::Framebuffer{}};
+        wavefrontContext.Submit(*accumulator, PASSES, wavefrontAovs.get());
+        wavefrontContext.Wait();
+        DEBUG_ASSERT(wavefrontAovs->Depth == aovs->Depth && wavefrontAovs->Normal == aovs->Normal && wavefrontAovs->Albedo == aovs->Albedo &&
+                         wavefrontAovs->ShapeId == aovs->ShapeId && wavefrontAovs->Bounces == aovs->Bounces,
+                     "Wavefront AOVs must match the per pixel ones");
+
+        // camera rays only: the emitters' own color, the albedo elsewhere, and no randomness at all
+        Rt::Raytracer const primaryRaytracer{9u, Rt::RenderSettings{.Mode = Rt::Integrator::PrimaryVisibility, .SamplesPerPixel = 2}};
+        Rt::RenderContext primaryContext{primaryRaytracer};
+        std::unique_ptr<Bitmap::BitmapD> primary{new Bitmap::BitmapD{}};
+        std::unique_ptr<Aov::Framebuffer> primaryAovs{new Aov::Framebuffer{}};
+        primaryContext.Submit(*primary, 1, primaryAovs.get());
+        primaryContext.Wait();
+        DEBUG_ASSERT(primaryAovs->ShapeId == aovs->ShapeId && primaryAovs->Albedo == aovs->Albedo, "Primary visibility must find the same first hits");
+        for (unsigned int y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+            {
+                FloatingType_t const *color = primary->atPixel(x, y);
+                FloatingType_t const *albedo = primaryAovs->Albedo.atPixel(x, y);
+                for (size_t c = 0; c < Bitmap::COLOR_COUNT; c++)
+                    DEBUG_ASSERT(color[c] >= 0 && color[c] <= albedo[c] * 255 * (1 + 1e-5), "Primary visibility must not exceed the albedo");
+                DEBUG_ASSERT(primaryAovs->Bounces[primaryAovs->GetIndex(x, y)] == 2, "Primary visibility must stop at the first hit");
+            }
+        }
+
+        std::unique_ptr<Bitmap::BitmapD> repeated{new Bitmap::BitmapD{}};
+        Rt::Raytracer const otherSeed{10u, Rt::RenderSettings{.Mode = Rt::Integrator::PrimaryVisibility, .SamplesPerPixel = 2}};
+        Rt::RenderContext otherContext{otherSeed};
+        otherContext.Submit(*repeated, 1);
+        otherContext.Wait();
+        DEBUG_ASSERT(*repeated == *primary, "Primary visibility must not depend on the seed");
+    }
+
+    inline void _test_frame_sizes()
+    {
+        // odd sizes leave partial tiles, packets and cache lines everywhere
+        Bitmap::BitmapD bitmap{37, 5};
+        DEBUG_ASSERT(bitmap.GetStride() >= 37 * Bitmap::COLOR_COUNT && bitmap.GetStride() * sizeof(FloatingType_t) % Bitmap::ROW_ALIGNMENT == 0, "Rows must be padded to whole cache lines");
+        for (unsigned int y = 0; y < bitmap.GetHeight(); y++)
+            DEBUG_ASSERT((uintptr_t)bitmap.Row(y) % Bitmap::ROW_ALIGNMENT == 0, "Rows must start on a cache line");
+        bitmap.at(36, 4, 2) = 7;
+        Bitmap::BitmapD moved{std::move(bitmap)};
+        DEBUG_ASSERT(bitmap.GetWidth() == 0 && moved.GetWidth() == 37 && *moved.atPixel(36, 0) == 0 && moved.atPixel(36, 0)[2] == 7, "Move must hand over the pixels");
+        DEBUG_ASSERT(moved.Clone() == moved && moved.Cast<unsigned char>().Cast<FloatingType_t>() == moved, "Copies must keep the pixels");
+
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::PathTracing};
+        Rt::Raytracer const raytracer{11u, settings};
+        constexpr unsigned int WIDTH = 53;
+        constexpr unsigned int HEIGHT = 29;
+        Bitmap::BitmapD sequential{WIDTH, HEIGHT};
+        Rt::WorkerState worker{settings};
+        raytracer.RenderTile(Scheduler::Tile{0, 0, WIDTH, HEIGHT}, sequential, 0, 1, worker);
+
+        Bitmap::BitmapD parallel{WIDTH, HEIGHT};
+        Rt::RenderContext context{raytracer, 2};
+        context.Submit(parallel, 1);
+        context.Wait();
+        DEBUG_ASSERT(sequential == parallel, "Render must tile frames of any size alike");
+
+        // camera rays are spread over the frame's own size
+        Camera::RayTable const camera{Camera::Settings{}, WIDTH, HEIGHT};
+        ColorD_t const corner = raytracer.TracePixel(camera.GetRay(WIDTH - 1, HEIGHT - 1), WIDTH - 1, HEIGHT - 1, 0, worker);
+        DEBUG_ASSERT(std::equal(corner.Data.begin(), corner.Data.end(), sequential.atPixel(WIDTH - 1, HEIGHT - 1)), "Pixels must follow the frame's own camera");
+
+        // a checkpoint of another size must not be continued
+        std::string const checkpointFile = "Render\\test_size_checkpoint.bin";
+        DEBUG_ASSERT(Progressive::WriteCheckpoint(checkpointFile, raytracer, sequential, 1), "Checkpoint must be written");
+        unsigned int passes = 0;
+        Bitmap::BitmapD resumed{WIDTH, HEIGHT};
+        DEBUG_ASSERT(Progressive::ReadCheckpoint(checkpointFile, raytracer, resumed, passes) && passes == 1 && resumed == sequential, "Checkpoint must restore the frame");
+        Bitmap::BitmapD other{WIDTH + 1, HEIGHT};
+        DEBUG_ASSERT(!Progressive::ReadCheckpoint(checkpointFile, raytracer, other, passes), "Checkpoint of another size must be rejected");
+        std::filesystem::remove(checkpointFile);
+    }
+
+    inline void _test_tiled_accumulator()
+    {
+        // partial tiles at the right and top edge
+        constexpr unsigned int WIDTH = 37;
+        constexpr unsigned int HEIGHT = 21;
+        Bitmap::TiledBitmapD tiled{WIDTH, HEIGHT};
+        Bitmap::BitmapD expected{WIDTH, HEIGHT};
+        for (unsigned int y = 0; y < HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < WIDTH; x++)
+            {
+                FloatingType_t *const pixel = tiled.atPixel(x, y);
+                DEBUG_ASSERT(pixel[0] == 0 && pixel[Bitmap::TILED_CHANNELS - 1] == 0, "Every pixel must have memory of its own");
+                DEBUG_ASSERT(pixel >= tiled.Tile(x, y) && pixel < tiled.Tile(x, y) + Bitmap::TiledBitmapD::TILE_ELEMENTS, "Pixels must stay within their tile");
+                for (unsigned int c = 0; c < Bitmap::COLOR_COUNT; c++)
+                    pixel[c] = expected.atPixel(x, y)[c] = (FloatingType_t)((y * WIDTH + x) * Bitmap::COLOR_COUNT + c + 1);
+                pixel[Bitmap::TILED_CHANNELS - 1] = -1;
+            }
+        }
+        DEBUG_ASSERT((uintptr_t)tiled.Tile(WIDTH - 1, HEIGHT - 1) % Bitmap::ROW_ALIGNMENT == 0, "Tiles must start on a cache line");
+        Bitmap::BitmapD detiled{WIDTH, HEIGHT};
+        tiled.Detile(detiled);
+        DEBUG_ASSERT(detiled == expected, "Detiling must restore the rows");
+
+        // both layouts get the same sums, with either engine
+        for (Rt::Engine backend : {Rt::Engine::PerPixel, Rt::Engine::Wavefront})
+        {
+            Rt::RenderSettings const settings{.Mode = Rt::Integrator::PathTracing, .Backend = backend};
+            Rt::Raytracer const raytracer{5u, settings};
+            Bitmap::BitmapD rows{53, 29};
+            Rt::RenderContext context{raytracer, 2};
+            context.Submit(rows, 2);
+            context.Wait();
+
+            Bitmap::TiledBitmapD tiles{53, 29};
+            Rt::RenderContext tiledContext{raytracer, 2};
+            tiledContext.Submit(tiles, 2);
+            Bitmap::BitmapD result{53, 29};
+            tiledContext.Detile(tiles, result);
+            DEBUG_ASSERT(result == rows, "Tiled accumulator must sum the same passes");
+        }
+    }
+
+    inline void _test_tone_mapping()
+    {
+        // odd width, so every row ends in a scalar tail
+        constexpr unsigned int WIDTH = 37;
+        constexpr unsigned int HEIGHT = 5;
+        constexpr FloatingType_t SAMPLES = 4;
+        Bitmap::BitmapD image{WIDTH, HEIGHT};
+        std::default_random_engine rng{3};
+        std::uniform_real_distribution<FloatingType_t> dist{0, 4 * 255 * SAMPLES};
+        for (unsigned int y = 0; y < HEIGHT; y++)
+            for (unsigned int x = 0; x < WIDTH * Bitmap::COLOR_COUNT; x++)
+                image.Row(y)[x] = dist(rng);
+        image.at(0, 0, 0) = 0;
+        image.at(1, 0, 0) = 255 * SAMPLES;
+        image.at(2, 0, 0) = 255 * SAMPLES / 2;
+
+        size_t const rowLength = WIDTH * Bitmap::COLOR_COUNT;
+        auto const convert = [&](ToneMap::Settings const &settings)
+        {
+            std::vector<unsigned char> output(rowLength * HEIGHT);
+            ToneMap::Mapper{settings, 2}.Run(image, SAMPLES, output.data(), rowLength);
+            return output;
+        };
+
+        for (ToneMap::Curve curve : {ToneMap::Curve::MinMax, ToneMap::Curve::Exposure, ToneMap::Curve::Reinhard, ToneMap::Curve::Aces})
+        {
+            for (bool srgb : {false, true})
+            {
+                std::vector<unsigned char> const scalar = convert(ToneMap::Settings{.Operator = curve, .Srgb = srgb, .Simd = Scene::SimdLevel::Scalar});
+                if (Scene::GetSimdLevel() >= Scene::SimdLevel::Avx2)
+                    DEBUG_ASSERT(convert(ToneMap::Settings{.Operator = curve, .Srgb = srgb, .Simd = Scene::SimdLevel::Avx2}) == scalar, "Kernels must give the same bytes");
+                DEBUG_ASSERT(scalar[0] == 0, "Black must stay black");
+            }
+        }
+
+        // the range is spread over all bytes
+        std::vector<unsigned char> const minMax = convert(ToneMap::Settings{.Operator = ToneMap::Curve::MinMax});
+        DEBUG_ASSERT(*std::max_element(minMax.begin(), minMax.end()) == 255, "Maximum must become white");
+
+        // the mean of the samples is exposed, a white emitter becomes white
+        std::vector<unsigned char> const exposure = convert(ToneMap::Settings{.Operator = ToneMap::Curve::Exposure});
+        DEBUG_ASSERT(exposure[3] == 255 && exposure[6] == 128, "Exposure must divide by the samples");
+        std::vector<unsigned char> const srgb = convert(ToneMap::Settings{.Operator = ToneMap::Curve::Exposure, .Srgb = true});
+        DEBUG_ASSERT(srgb[3] == 255 && srgb[6] == 188, "sRGB must encode mid grey brighter");
+        std::vector<unsigned char> const reinhard = convert(ToneMap::Settings{.Operator = ToneMap::Curve::Reinhard});
+        DEBUG_ASSERT(reinhard[3] == 128 && *std::max_element(reinhard.begin(), reinhard.end()) < 255, "Reinhard must compress without clipping");
+    }
+
+    inline void _test_mapped_image()
+    {
+        constexpr unsigned int WIDTH = 53;
+        constexpr unsigned int HEIGHT = 29;
+        constexpr unsigned int PASSES = 2;
+        std::string const floatFile = "Render\\test_stream.pfm";
+        std::string const byteFile = "Render\\test_stream.ppm";
+        std::string const referenceFile = "Render\\test_stream_reference.ppm";
+        auto const readFile = [](std::string const &file)
+        {
+            std::ifstream infile{file, std::ios::in | std::ios::binary};
+            return std::vector<char>{std::istreambuf_iterator<char>{infile}, std::istreambuf_iterator<char>{}};
+        };
+
+        Rt::Raytracer const raytracer{3u, Rt::RenderSettings{.Mode = Rt::Integrator::PathTracing}};
+        Bitmap::BitmapD accumulator{WIDTH, HEIGHT};
+        Bitmap::TiledBitmapD tiled{WIDTH, HEIGHT};
+        ToneMap::Settings const toneMapping{.Operator = ToneMap::Curve::Aces, .Srgb = true};
+        {
+            ImgFile::MappedImage floats{floatFile, ImgFile::Format::Pfm, WIDTH, HEIGHT};
+            ImgFile::MappedImage bytes{byteFile, ImgFile::Format::Ppm, WIDTH, HEIGHT, toneMapping};
+            DEBUG_ASSERT(std::filesystem::file_size(floatFile) == floats.GetSize() && std::filesystem::file_size(byteFile) == bytes.GetSize(), "Files must have their final size from the start");
+
+            // either layout streams the same tiles
+            Rt::RenderContext context{raytracer, 2};
+            context.Submit(accumulator, PASSES, nullptr, [&](Scheduler::Tile const &tile)
+                           { floats.WriteTile(tile, accumulator, PASSES); });
+            context.Wait();
+            Rt::RenderContext tiledContext{raytracer, 2};
+            tiledContext.Submit(tiled, PASSES, nullptr, [&](Scheduler::Tile const &tile)
+                                { bytes.WriteTile(tile, tiled, PASSES); });
+            tiledContext.Wait();
+        }
+
+        // floats are the means, from the bottom row up
+        std::vector<char> const floatData = readFile(floatFile);
+        std::string const floatHeader = "PF\n53 29\n-1.0\n";
+        DEBUG_ASSERT(std::equal(floatHeader.begin(), floatHeader.end(), floatData.begin()), "PFM header must be little endian");
+        bool floatsMatch = floatData.size() == floatHeader.size() + WIDTH * HEIGHT * Bitmap::COLOR_COUNT * sizeof(float);
+        for (unsigned int y = 0; y < HEIGHT && floatsMatch; y++)
+        {
+            for (unsigned int x = 0; x < WIDTH * Bitmap::COLOR_COUNT && floatsMatch; x++)
+            {
+                float value;
+                std::memcpy(&value, floatData.data() + floatHeader.size() + ((size_t)y * WIDTH * Bitmap::COLOR_COUNT + x) * sizeof(float), sizeof(float));
+                floatsMatch = value == accumulator.atPixel(0, y)[x] / PASSES;
+            }
+        }
+        DEBUG_ASSERT(floatsMatch, "PFM must hold the means");
+
+        // bytes are what the whole frame conversion gives
+        ImgFile::writeNetPbm(referenceFile, accumulator, toneMapping, PASSES);
+        DEBUG_ASSERT(readFile(byteFile) == readFile(referenceFile), "Streamed PPM must equal the written one");
+        for (std::string const &file : {floatFile, byteFile, referenceFile})
+            std::filesystem::remove(file);
+    }
+
+    /// @brief Decodes a QOI file to RGB bytes, top row first, independently of the encoder
+    inline std::vector<unsigned char> _decode_qoi(std::vector<char> const &file, unsigned int &width, unsigned int &height)
+    {
+        auto const byteAt = [&file](size_t i)
+        { return (unsigned char)file[i]; };
+        auto const readBigEndian = [&byteAt](size_t i)
+        { return (unsigned int)byteAt(i) << 24 | byteAt(i + 1) << 16 | byteAt(i + 2) << 8 | byteAt(i + 3); };
+        width = readBigEndian(4);
+        height = readBigEndian(8);
+
+        std::vector<unsigned char> pixels;
+        std::array<std::array<unsigned char, 4>, 64> seen{};
+        std::array<unsigned char, 4> pixel{0, 0, 0, 255};
+        size_t position = 14;
+        while (pixels.size() < (size_t)width * height * Bitmap::COLOR_COUNT && position < file.size())
+        {
+            unsigned char const tag = byteAt(position++);
+            unsigned int run = 1;
+            if (tag == 0xfe)
+            {
+                for (int i = 0; i < 3; i++)
+                    pixel[i] = byteAt(position++);
+            }
+            else if ((tag & 0xc0) == 0x00)
+            {
+                pixel = seen[tag & 0x3f];
+            }
+            else if ((tag & 0xc0) == 0x40)
+            {
+                pixel[0] += ((tag >> 4) & 3) - 2;
+                pixel[1] += ((tag >> 2) & 3) - 2;
+                pixel[2] += (tag & 3) - 2;
+            }
+            else if ((tag & 0xc0) == 0x80)
+            {
+                unsigned char const next = byteAt(position++);
+                int const green = (tag & 0x3f) - 32;
+                pixel[0] += green + (next >> 4) - 8;
+                pixel[1] += green;
+                pixel[2] += green + (next & 0xf) - 8;
+            }
+            else
+            {
+                run = (tag & 0x3f) + 1;
+            }
+            seen[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64] = pixel;
+            for (unsigned int i = 0; i < run; i++)
+                pixels.insert(pixels.end(), pixel.begin(), pixel.begin() + 3);
+        }
+        return pixels;
+    }
+
+    inline void _test_image_writers()
+    {
+        constexpr unsigned int WIDTH = 67;
+        constexpr unsigned int HEIGHT = 31;
+        constexpr unsigned int PASSES = 2;
+        auto const readFile = [](std::string const &file)
+        {
+            std::ifstream infile{file, std::ios::in | std::ios::binary};
+            return std::vector<char>{std::istreambuf_iterator<char>{infile}, std::istreambuf_iterator<char>{}};
+        };
+
+        for (ImgFile::Format const format : {ImgFile::Format::Ppm, ImgFile::Format::Pfm, ImgFile::Format::Qoi})
+        {
+            char const *const expected = format == ImgFile::Format::Ppm ? "ppm" : format == ImgFile::Format::Pfm ? "pfm"
+                                                                                                                  : "qoi";
+            DEBUG_ASSERT(std::string{ImgFile::CreateWriter(format)->GetExtension()} == expected, "Writer must match its format");
+        }
+
+        // a noisy render, and a frame of flat areas, repeated colours and gradients for every kind of QOI chunk
+        Rt::Raytracer const raytracer{3u, Rt::RenderSettings{.Mode = Rt::Integrator::PathTracing}};
+        Bitmap::BitmapD rendered{WIDTH, HEIGHT};
+        Rt::RenderContext context{raytracer, 2};
+        context.Submit(rendered, PASSES);
+        context.Wait();
+        Bitmap::BitmapD synthetic{WIDTH, HEIGHT};
+        for (unsigned int y = 0; y < HEIGHT; y++)
+            for (unsigned int x = 0; x < WIDTH; x++)
+                for (unsigned int color = 0; color < Bitmap::COLOR_COUNT; color++)
+                    synthetic.atPixel(x, y)[color] = y < HEIGHT / 3 ? 100 : y < 2 * HEIGHT / 3 ? (FloatingType_t)((x / 4) % 3 * 50 + color) * PASSES
+                                                                                                 : (FloatingType_t)(x * (color + 1) + y) * PASSES;
+
+        ToneMap::Settings const toneMapping{.Operator = ToneMap::Curve::Aces, .Srgb = true};
+        ImgFile::PpmWriter ppm{toneMapping};
+        ImgFile::QoiWriter qoi{toneMapping};
+        ImgFile::PfmWriter pfm;
+        for (Bitmap::BitmapD const *frame : {&rendered, &synthetic})
+        {
+            // QOI holds the bytes of the PPM, top row first
+            DEBUG_ASSERT(ppm.Write("Render\\test_writer.ppm", *frame, PASSES) && qoi.Write("Render\\test_writer.qoi", *frame, PASSES), "Writers must write");
+            std::vector<char> const ppmData = readFile("Render\\test_writer.ppm");
+            std::string const ppmHeader = ImgFile::getNetPbmHeader(ImgFile::Format::Ppm, WIDTH, HEIGHT);
+            unsigned int width, height;
+            std::vector<unsigned char> const decoded = _decode_qoi(readFile("Render\\test_writer.qoi"), width, height);
+            DEBUG_ASSERT(width == WIDTH && height == HEIGHT, "QOI must have the size of the frame");
+            DEBUG_ASSERT(std::equal(decoded.begin(), decoded.end(), ppmData.begin() + ppmHeader.size(), ppmData.end(), [](unsigned char decodedByte, char ppmByte)
+                                    { return decodedByte == (unsigned char)ppmByte; }),
+                         "QOI must decode to the PPM");
+
+            // PFM holds the means, from the bottom row up
+            DEBUG_ASSERT(pfm.Write("Render\\test_writer.pfm", *frame, PASSES), "Writers must write");
+            std::vector<char> const pfmData = readFile("Render\\test_writer.pfm");
+            std::string const pfmHeader = ImgFile::getNetPbmHeader(ImgFile::Format::Pfm, WIDTH, HEIGHT);
+            bool floatsMatch = pfmData.size() == pfmHeader.size() + WIDTH * HEIGHT * Bitmap::COLOR_COUNT * sizeof(float);
+            for (unsigned int y = 0; y < HEIGHT && floatsMatch; y++)
+            {
+                for (unsigned int x = 0; x < WIDTH * Bitmap::COLOR_COUNT && floatsMatch; x++)
+                {
+                    float value;
+                    std::memcpy(&value, pfmData.data() + pfmHeader.size() + ((size_t)y * WIDTH * Bitmap::COLOR_COUNT + x) * sizeof(float), sizeof(float));
+                    floatsMatch = value == frame->atPixel(0, y)[x] / PASSES;
+                }
+            }
+            DEBUG_ASSERT(floatsMatch, "PFM must hold the means");
+        }
+        std::vector<char> const compressed = readFile("Render\\test_writer.qoi");
+        DEBUG_ASSERT(compressed.size() < WIDTH * HEIGHT * Bitmap::COLOR_COUNT / 2, "Flat areas must compress");
+
+        for (char const *file : {"Render\\test_writer.ppm", "Render\\test_writer.qoi", "Render\\test_writer.pfm"})
+            std::filesystem::remove(file);
+    }
+
+    inline void _test_camera()
+    {
+        constexpr unsigned int WIDTH = 48;
+        constexpr unsigned int HEIGHT = 28;
+        auto const isClose = [](Vec3d const &a, Vec3d const &b)
+        { return (a - b).GetNorm() < 1e-5; };
+
+        // the default camera is the spherical mapping of earlier renders, bit for bit. Half a pixel off, the angle
+        // addition lands on the midpoint between the pixels
+        Camera::RayTable const spherical{Camera::Settings{}, WIDTH, HEIGHT};
+        FloatingType_t const step = Camera::FOV / WIDTH;
+        bool matchesMapping = true;
+        bool matchesOffsets = true;
+        for (unsigned int y = 0; y < HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < WIDTH; x++)
+            {
+                FloatingType_t const longitude = (x - (FloatingType_t)WIDTH / 2) * step;
+                FloatingType_t const latitude = (y - (FloatingType_t)HEIGHT / 2) * step;
+                Line const ray = spherical.GetRay(x, y);
+                matchesMapping &= ray.Origin == Camera::Origin && ray.Direction == Vec3d{std::cos(latitude) * std::cos(longitude), std::cos(latitude) * std::sin(longitude), std::sin(latitude)};
+
+                FloatingType_t const midLongitude = longitude + step / 2;
+                FloatingType_t const midLatitude = latitude - step / 2;
+                Vec3d const midpoint{std::cos(midLatitude) * std::cos(midLongitude), std::cos(midLatitude) * std::sin(midLongitude), std::sin(midLatitude)};
+                matchesOffsets &= isClose(spherical.GetRay(x, y, 0.5, -0.5).Direction, midpoint) && spherical.GetRay(x, y, 0, 0).Direction == ray.Direction;
+            }
+        }
+        DEBUG_ASSERT(matchesMapping, "Default camera must keep the spherical mapping");
+        DEBUG_ASSERT(matchesOffsets, "Offsets within the pixel must follow the mapping");
+
+        // a moved and rolled pinhole: the frame's centre looks along Forward, its edges at half the field of view
+        Camera::Settings const pinholeSettings{.Model = Camera::Projection::Pinhole, .Position = {1, 2, 3}, .Forward = {0, 2, 0}, .Up = {0, 0.3, 1}, .FieldOfView = Deg2Rad(60)};
+        Camera::RayTable const pinhole{pinholeSettings, WIDTH, HEIGHT};
+        Line const centre = pinhole.GetRay(WIDTH / 2, HEIGHT / 2, -0.5, -0.5);
+        DEBUG_ASSERT(centre.Origin == pinholeSettings.Position && isClose(centre.Direction, Vec3d{0, 1, 0}), "Centre must look along Forward");
+        DEBUG_ASSERT(std::abs(pinhole.GetRay(0, HEIGHT / 2, -0.5, -0.5).Direction.Y() - std::cos(Deg2Rad(30))) < 1e-5, "Frame must span the field of view");
+
+        // straight lines stay straight: rows share the slope towards Up, columns the one towards the side
+        bool isStraight = true;
+        for (unsigned int y = 0; y < HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < WIDTH; x++)
+            {
+                Vec3d const direction = pinhole.GetRay(x, y).Direction;
+                Vec3d const rowStart = pinhole.GetRay(0, y).Direction;
+                Vec3d const columnStart = pinhole.GetRay(x, 0).Direction;
+                isStraight &= std::abs(direction.Z() / direction.Y() - rowStart.Z() / rowStart.Y()) < 1e-5 && std::abs(direction.X() / direction.Y() - columnStart.X() / columnStart.Y()) < 1e-5 && AlmostSame(direction.GetNorm(), 1);
+            }
+        }
+        DEBUG_ASSERT(isStraight, "Pinhole must keep straight lines straight");
+
+        // jittered passes: both engines and adaptive rounds trace the same rays, and the rays move away from the
+        // corner of the pixel
+        Rt::RenderSettings const settings{.Mode = Rt::Integrator::PathTracing, .SamplesPerPixel = 2, .Sampler = Random::Sampler::Sobol, .View = Camera::Settings{.Jitter = true}};
+        Rt::RenderSettings wavefrontSettings = settings;
+        wavefrontSettings.Backend = Rt::Engine::Wavefront;
+        Rt::Raytracer const raytracer{5u, settings};
+        Rt::Raytracer const wavefrontRaytracer{5u, wavefrontSettings};
+        Rt::Raytracer const fixedRaytracer{5u, Rt::RenderSettings{.Mode = Rt::Integrator::PathTracing, .SamplesPerPixel = 2, .Sampler = Random::Sampler::Sobol}};
+        Bitmap::BitmapD perPixel{WIDTH, HEIGHT};
+        Bitmap::BitmapD wavefront{WIDTH, HEIGHT};
+        Bitmap::BitmapD fixed{WIDTH, HEIGHT};
+        Rt::WorkerState worker{settings};
+        Rt::WorkerState wavefrontWorker{wavefrontSettings};
+        raytracer.RenderTile(Scheduler::Tile{0, 0, WIDTH, HEIGHT}, perPixel, 1, 3, worker);
+        wavefrontRaytracer.RenderTile(Scheduler::Tile{0, 0, WIDTH, HEIGHT}, wavefront, 1, 3, wavefrontWorker);
+        fixedRaytracer.RenderTile(Scheduler::Tile{0, 0, WIDTH, HEIGHT}, fixed, 1, 3, worker);
+        DEBUG_ASSERT(perPixel == wavefront, "Wavefront must jitter like pixel by pixel");
+        DEBUG_ASSERT(!(perPixel == fixed), "Jitter must move the camera rays");
+
+        // rounds give pixels different pass counts, every lane of a packet traces its own pass
+        Adaptive::Frame frame{Adaptive::Settings{.MinPasses = 2, .PassesPerRound = 3, .MaxPasses = 8, .PixelThreshold = 0.05, .TargetNoise = 0}, WIDTH, HEIGHT};
+        Rt::RenderContext{raytracer, 2}.RenderAdaptive(frame);
+        bool matchesPasses = true;
+        bool passesDiffer = false;
+        for (unsigned int y = 0; y < HEIGHT; y++)
+        {
+            for (unsigned int x = 0; x < WIDTH; x++)
+            {
+                Adaptive::PixelStatistics const &pixel = frame.At(x, y);
+                Bitmap::BitmapD single{WIDTH, HEIGHT};
+                raytracer.RenderTile(Scheduler::Tile{x, y, x + 1, y + 1}, single, 0, pixel.Passes, worker);
+                matchesPasses &= std::equal(pixel.Sum.Data.begin(), pixel.Sum.Data.end(), single.atPixel(x, y));
+                passesDiffer |= pixel.Passes != frame.At(0, 0).Passes;
+            }
         }
+        DEBUG_ASSERT(passesDiffer, "Pixels must end with different pass counts");
+        DEBUG_ASSERT(matchesPasses, "Adaptive rounds must jitter like consecutive passes");
     }
 
     inline void RunTests()
     {
         _test_probes();
+        _test_cosine_cone_sampling();
+        _test_bvh_depth();
+        _test_compiled_scene_matches_shapes();
+        _test_shadow_rays();
+        _test_emitter_sampling();
+        _test_next_event_estimation();
+        _test_integrators_agree();
+        _test_ray_packets();
+        _test_samplers();
+        _test_render_reproducible();
+        _test_wavefront_matches_pixels();
+        _test_no_diffuse_rays();
+        _test_adaptive_sampling();
+        _test_progressive_resume();
+        _test_aovs();
+        _test_denoiser();
+        _test_frame_sizes();
+        _test_tiled_accumulator();
+        _test_tone_mapping();
+        _test_mapped_image();
+        _test_image_writers();
+        _test_camera();
     }
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Bitmap.h"
+#include "Primitives.h"
+#include "RayPacket.h"
+#include "Scheduler.h"
+
+namespace ToneMap
+{
+    using namespace Primitives;
+
+    /// @brief Maps the linear radiance of a channel to [0, 1]
+    enum class Curve
+    {
+        /// @brief The range of the frame is spread over [0, 1], whatever its exposure
+        MinMax,
+        /// @brief Linear, clipped at 1
+        Exposure,
+        /// @brief x / (1 + x), never clips
+        Reinhard,
+        /// @brief Narkowicz's fit of the ACES filmic curve, clips at about 11
+        Aces
+    };
+
+    struct Settings
+    {
+        Curve Operator = Curve::MinMax;
+
+        /// @brief Multiplies the mean of the samples before the curve, ignored by MinMax. Emitters are given in
+        /// [0, 255], so 1 / 255 maps a white emitter seen head-on to 1
+        FloatingType_t Exposure = FloatingType_t{1} / 255;
+
+        /// @brief Encodes with the sRGB transfer function instead of linearly
+        bool Srgb = false;
+
+        /// @brief Widest kernel to use, AVX-512 runs the AVX2 one. All kernels give the same bytes
+        Scene::SimdLevel Simd = Scene::GetSimdLevel();
+    };
+
+    /// @brief Converts channels on the calling thread, e.g. a tile as soon as it is done. Same bytes as Mapper
+    /// @param settings Any curve but MinMax, which needs the range of the whole frame
+    /// @param samples Summed into every channel, 1 for means
+    void Convert(Settings const &settings, FloatingType_t samples, FloatingType_t const *source, size_t count, unsigned char *target);
+
+    /// @brief Output conversion from the accumulator to 8 bit: division by the sample count, normalization, the curve,
+    /// the transfer function and quantization in a single pass over the rows, straight into the caller's staging
+    /// buffer. Keeps a pool of workers, every one converts bands of whole rows
+    class Mapper
+    {
+    public:
+        /// @brief Ctor, starts the workers
+        /// @param numWorkers Number of worker threads, defaults to all hardware threads
+        Mapper(Settings const &settings = Settings{}, unsigned int numWorkers = Scheduler::TileScheduler::GetHardwareConcurrency());
+
+        Settings const Config;
+
+        /// @brief Converts every row of an image, in physical order
+        /// @param image Sum of the samples, or their mean
+        /// @param samples Summed into every pixel, 1 for means
+        /// @param output Receives GetWidth() * COLOR_COUNT bytes per row, physical row y starts at y * outputStride
+        void Run(Bitmap::BitmapD const &image, FloatingType_t samples, unsigned char *output, size_t outputStride);
+
+    private:
+        /// @brief Smallest and largest channel per band of rows, MinMax only
+        std::vector<FloatingType_t> BandMinimum;
+        std::vector<FloatingType_t> BandMaximum;
+        Scheduler::TileScheduler Pool;
+
+        /// @brief Range of the channels within [fromY, toY) into the band's slots
+        void FindRange(Bitmap::BitmapD const &image, unsigned int fromY, unsigned int toY);
+    };
+}
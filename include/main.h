@@ -2,5 +2,6 @@
 
 extern "C"
 {
-    __declspec(dllexport) int main();
+    /// @brief DLL entry point, renders a frame of the size given and writes it to Render\output
+    __declspec(dllexport) int render(unsigned int width, unsigned int height);
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "Adaptive.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "Debug.h"
+
+namespace Adaptive
+{
+    void PixelStatistics::Add(ColorD_t const &pass)
+    {
+        Sum = Sum + pass;
+        Passes++;
+
+        // the deviation from the old and the new mean, which keeps the sum stable for many passes
+        FloatingType_t const luminance = GetLuminance(pass);
+        FloatingType_t const delta = luminance - MeanLuminance;
+        MeanLuminance += delta / Passes;
+        SquaredDeviations += delta * (luminance - MeanLuminance);
+    }
+
+    FloatingType_t PixelStatistics::GetRelativeError(FloatingType_t minLuminance) const
+    {
+        if (Passes < 2)
+            return INFINITY;
+
+        FloatingType_t const variance = SquaredDeviations / (Passes - 1);
+        return std::sqrt(variance / Passes) / std::max(MeanLuminance, minLuminance);
+    }
+
+    std::string Summary::ToString() const
+    {
+        std::stringstream stream;
+        stream << "Adaptive: " << Rounds << " rounds, " << (double)Passes / std::max(PixelCount, size_t{1}) << " passes per pixel, noise "
+               << Noise << ", " << Wall.count() * 1000 << "ms" << std::endl;
+        return stream.str();
+    }
+
+    Frame::Frame(Settings const &settings, unsigned int width, unsigned int height)
+        : Config{settings},
+          Width{width},
+          Height{height},
+          Pixels((size_t)width * height),
+          Active((size_t)width * height, 1),
+          ActiveCount((size_t)width * height)
+    {
+        Statistics.PixelCount = Pixels.size();
+    }
+
+    unsigned int Frame::GetWidth() const
+    {
+        return Width;
+    }
+
+    unsigned int Frame::GetHeight() const
+    {
+        return Height;
+    }
+
+    PixelStatistics &Frame::At(unsigned int x, unsigned int y)
+    {
+        return Pixels[(size_t)y * Width + x];
+    }
+
+    PixelStatistics const &Frame::At(unsigned int x, unsigned int y) const
+    {
+        return Pixels[(size_t)y * Width + x];
+    }
+
+    bool Frame::IsActive(unsigned int x, unsigned int y) const
+    {
+        return Active[(size_t)y * Width + x];
+    }
+
+    unsigned int Frame::GetRoundPasses(unsigned int x, unsigned int y) const
+    {
+        // the first round brings every pixel up to the minimum at once
+        unsigned int const passes = At(x, y).Passes;
+        unsigned int const target = passes < std::max(Config.MinPasses, 2u) ? std::max(Config.MinPasses, 2u) : passes + Config.PassesPerRound;
+        return std::min(target, Config.MaxPasses) - std::min(passes, Config.MaxPasses);
+    }
+
+    bool Frame::EndRound(std::chrono::duration<double> wall)
+    {
+        Statistics.Rounds++;
+        Statistics.Wall = wall;
+        Statistics.Passes = 0;
+        ActiveCount = 0;
+        FloatingType_t errorSum = 0;
+        for (size_t i = 0; i < Pixels.size(); i++)
+        {
+            PixelStatistics const &pixel = Pixels[i];
+            FloatingType_t const error = pixel.GetRelativeError(Config.MinLuminance);
+            Active[i] = pixel.Passes < Config.MaxPasses && (pixel.Passes < std::max(Config.MinPasses, 2u) || error > Config.PixelThreshold);
+            ActiveCount += Active[i];
+            Statistics.Passes += pixel.Passes;
+            errorSum += error;
+        }
+        Statistics.Noise = errorSum / Pixels.size();
+
+        return ActiveCount > 0 && Statistics.Noise > Config.TargetNoise && wall < Config.TimeBudget;
+    }
+
+    Summary const &Frame::GetSummary() const
+    {
+        return Statistics;
+    }
+
+    size_t Frame::GetActiveCount() const
+    {
+        return ActiveCount;
+    }
+
+    void Frame::Resolve(Bitmap::BitmapD &output) const
+    {
+        Resolve(output, 0, 0, Width, Height);
+    }
+
+    void Frame::Resolve(Bitmap::BitmapD &output, unsigned int fromX, unsigned int fromY, unsigned int toX, unsigned int toY) const
+    {
+        DEBUG_ASSERT(output.GetWidth() == Width && output.GetHeight() == Height, "Output must have the size of the frame");
+        DEBUG_ASSERT(fromX <= toX && toX <= Width && fromY <= toY && toY <= Height, "Range must lie within the frame");
+        for (unsigned int y = fromY; y < toY; y++)
+        {
+            for (unsigned int x = fromX; x < toX; x++)
+            {
+                PixelStatistics const &pixel = At(x, y);
+                ColorD_t const mean = pixel.Passes ? pixel.Sum * (FloatingType_t{1} / pixel.Passes) : ColorD_t{0, 0, 0};
+                std::copy(mean.Data.begin(), mean.Data.end(), output.atPixel(x, y));
+            }
+        }
+    }
+
+    void Frame::ResolvePasses(Bitmap::BitmapD &output) const
+    {
+        DEBUG_ASSERT(output.GetWidth() == Width && output.GetHeight() == Height, "Output must have the size of the frame");
+        for (unsigned int y = 0; y < Height; y++)
+            for (unsigned int x = 0; x < Width; x++)
+                std::fill_n(output.atPixel(x, y), Bitmap::COLOR_COUNT, (FloatingType_t)At(x, y).Passes);
+    }
+}
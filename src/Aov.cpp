@@ -0,0 +1,101 @@
+#include "Aov.h"
+
+#include <algorithm>
+
+#include "Debug.h"
+
+namespace Aov
+{
+    Framebuffer::Framebuffer(unsigned int width, unsigned int height)
+        : Depth((size_t)width * height),
+          Normal{width, height},
+          Albedo{width, height},
+          ShapeId((size_t)width * height),
+          Bounces((size_t)width * height),
+          Width{width},
+          Height{height}
+    {
+    }
+
+    unsigned int Framebuffer::GetWidth() const
+    {
+        return Width;
+    }
+
+    unsigned int Framebuffer::GetHeight() const
+    {
+        return Height;
+    }
+
+    bool Framebuffer::HasSizeOf(Bitmap::BitmapD const &bitmap) const
+    {
+        return Width == bitmap.GetWidth() && Height == bitmap.GetHeight();
+    }
+
+    void Framebuffer::SetFirstHit(unsigned int x, unsigned int y, Scene::Intersection const &hit, uint32_t shape)
+    {
+        size_t const index = GetIndex(x, y);
+        ColorD_t albedo{0, 0, 0};
+        Vec3d normal{0, 0, 0};
+        Depth[index] = 0;
+        if (hit.Material)
+        {
+            albedo = hit.Material->IsLightsource ? hit.Material->Emission * (FloatingType_t{1} / 255) : hit.Material->ColorFilter;
+            normal = hit.Hitevent.SurfaceNormal;
+            Depth[index] = hit.Hitevent.DistanceToSurface;
+        }
+
+        std::copy(albedo.Data.begin(), albedo.Data.end(), Albedo.atPixel(x, y));
+        std::copy(normal.Data.begin(), normal.Data.end(), Normal.atPixel(x, y));
+        ShapeId[index] = shape;
+    }
+
+    /// @brief Fixed color per shape, neighbouring indices get unrelated hues
+    ColorD_t getShapeColor(uint32_t shape)
+    {
+        if (shape == Scene::NO_SHAPE)
+            return ColorD_t{0, 0, 0};
+
+        uint32_t hash = (shape + 1) * 0x9E3779B1u;
+        hash ^= hash >> 15;
+        hash *= 0x85EBCA77u;
+        hash ^= hash >> 13;
+        return ColorD_t{(FloatingType_t)(hash & 0xFF), (FloatingType_t)(hash >> 8 & 0xFF), (FloatingType_t)(hash >> 16 & 0xFF)} * (FloatingType_t{1} / 255);
+    }
+
+    void Visualize(Framebuffer const &framebuffer, Channel channel, Bitmap::BitmapD &image, unsigned int samples)
+    {
+        DEBUG_ASSERT(framebuffer.HasSizeOf(image), "Image must have the size of the framebuffer");
+        for (unsigned int y = 0; y < image.GetHeight(); y++)
+        {
+            FloatingType_t *const row = image.Row(y);
+            for (unsigned int x = 0; x < image.GetWidth(); x++)
+            {
+                size_t const index = (size_t)y * framebuffer.GetWidth() + x;
+                FloatingType_t *const target = row + x * Bitmap::COLOR_COUNT;
+                switch (channel)
+                {
+                case Channel::Depth:
+                    std::fill_n(target, Bitmap::COLOR_COUNT, framebuffer.Depth[index]);
+                    break;
+                case Channel::Normal:
+                    for (size_t c = 0; c < Bitmap::COLOR_COUNT; c++)
+                        target[c] = FloatingType_t{0.5} + FloatingType_t{0.5} * framebuffer.Normal.at(x, y, c);
+                    break;
+                case Channel::Albedo:
+                    std::copy_n(&framebuffer.Albedo.at(x, y, 0), Bitmap::COLOR_COUNT, target);
+                    break;
+                case Channel::ShapeId:
+                {
+                    ColorD_t const color = getShapeColor(framebuffer.ShapeId[index]);
+                    std::copy(color.Data.begin(), color.Data.end(), target);
+                    break;
+                }
+                case Channel::Bounces:
+                    std::fill_n(target, Bitmap::COLOR_COUNT, (FloatingType_t)framebuffer.Bounces[index] / std::max(samples, 1u));
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,189 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+namespace Bvh
+{
+    constexpr size_t NUM_SAH_BINS = 16;
+    constexpr size_t MAX_LEAF_SIZE = 4;
+    /// @brief Cost of visiting a node, relative to intersecting a shape
+    constexpr FloatingType_t TRAVERSAL_COST = 1;
+
+    Tree::Tree(std::vector<Aabb> const &primitiveBounds)
+    {
+        if (primitiveBounds.empty())
+            return;
+
+        std::vector<buildReference_t> references;
+        references.reserve(primitiveBounds.size());
+        for (size_t i = 0; i < primitiveBounds.size(); i++)
+            references.push_back(buildReference_t{primitiveBounds[i], primitiveBounds[i].GetCentroid(), (uint32_t)i});
+
+        Nodes.reserve(2 * references.size());
+        PrimitiveOrder.reserve(references.size());
+        Build(references, 0, references.size(), 0);
+    }
+
+    void Tree::Build(std::vector<buildReference_t> &references, size_t begin, size_t end, size_t depth)
+    {
+        size_t const nodeIndex = Nodes.size();
+        Nodes.emplace_back();
+
+        Aabb bounds;
+        Aabb centroidBounds;
+        for (size_t i = begin; i < end; i++)
+        {
+            bounds.Grow(references[i].Bounds);
+            centroidBounds.Grow(references[i].Centroid);
+        }
+        Nodes[nodeIndex].Bounds = bounds;
+
+        size_t const count = end - begin;
+        auto const makeLeaf = [&]()
+        {
+            Nodes[nodeIndex].Offset = (uint32_t)PrimitiveOrder.size();
+            Nodes[nodeIndex].Count = (uint16_t)count;
+            for (size_t i = begin; i < end; i++)
+                PrimitiveOrder.push_back(references[i].Index);
+        };
+
+        if (count == 1)
+        {
+            makeLeaf();
+            return;
+        }
+
+        // split along largest centroid extent
+        Vec3d const extent = centroidBounds.GetExtent();
+        unsigned int axis = 0;
+        if (extent.Y() > extent.Data[axis])
+            axis = 1;
+        if (extent.Z() > extent.Data[axis])
+            axis = 2;
+
+        // median splits halve the primitives, so below this node they need ceil(log2(count)) more levels at most.
+        // SAH may peel off a single primitive per level, it only gets to split while median splits could still
+        // finish within MAX_TRAVERSAL_DEPTH
+        bool const mustHalve = depth + std::bit_width(count - 1) >= MAX_TRAVERSAL_DEPTH;
+
+        size_t mid = begin;
+        if (extent.Data[axis] <= 0 || mustHalve)
+        {
+            // all centroids coincide and no split can separate them, or the depth is used up
+            if (count <= MAX_LEAF_SIZE)
+            {
+                makeLeaf();
+                return;
+            }
+        }
+        else
+        {
+            struct bin_t
+            {
+                Aabb Bounds;
+                size_t Count = 0;
+            };
+            std::array<bin_t, NUM_SAH_BINS> bins{};
+
+            FloatingType_t const binScale = NUM_SAH_BINS / extent.Data[axis];
+            auto const binOf = [&](buildReference_t const &reference)
+            {
+                return std::min(NUM_SAH_BINS - 1, (size_t)((reference.Centroid.Data[axis] - centroidBounds.Min.Data[axis]) * binScale));
+            };
+
+            for (size_t i = begin; i < end; i++)
+            {
+                bin_t &bin = bins[binOf(references[i])];
+                bin.Bounds.Grow(references[i].Bounds);
+                bin.Count++;
+            }
+
+            // sweep from the right to know the cost of every right hand side
+            std::array<FloatingType_t, NUM_SAH_BINS - 1> rightAreas;
+            std::array<size_t, NUM_SAH_BINS - 1> rightCounts;
+            Aabb rightBounds;
+            size_t rightCount = 0;
+            for (size_t i = NUM_SAH_BINS - 1; i > 0; i--)
+            {
+                rightBounds.Grow(bins[i].Bounds);
+                rightCount += bins[i].Count;
+                rightAreas[i - 1] = rightBounds.GetSurfaceArea();
+                rightCounts[i - 1] = rightCount;
+            }
+
+            // costs are not normalized by the parent area, they are only compared with each other
+            Aabb leftBounds;
+            size_t leftCount = 0;
+            FloatingType_t bestCost = INFINITY;
+            size_t bestSplit = 0;
+            for (size_t i = 0; i < NUM_SAH_BINS - 1; i++)
+            {
+                leftBounds.Grow(bins[i].Bounds);
+                leftCount += bins[i].Count;
+                FloatingType_t const cost = TRAVERSAL_COST * bounds.GetSurfaceArea() + leftBounds.GetSurfaceArea() * leftCount + rightAreas[i] * rightCounts[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            FloatingType_t const leafCost = bounds.GetSurfaceArea() * count;
+            if (count <= MAX_LEAF_SIZE && leafCost <= bestCost)
+            {
+                makeLeaf();
+                return;
+            }
+
+            mid = std::partition(references.begin() + begin, references.begin() + end, [&](buildReference_t const &reference)
+                                 { return binOf(reference) <= bestSplit; }) -
+                  references.begin();
+        }
+
+        // degenerated or no split, fall back to median
+        if (mid == begin || mid == end)
+        {
+            mid = begin + count / 2;
+            std::nth_element(references.begin() + begin, references.begin() + mid, references.begin() + end, [&](buildReference_t const &a, buildReference_t const &b)
+                             { return a.Centroid.Data[axis] < b.Centroid.Data[axis]; });
+        }
+
+        Nodes[nodeIndex].Axis = (uint16_t)axis;
+        Build(references, begin, mid, depth + 1);
+        Nodes[nodeIndex].Offset = (uint32_t)Nodes.size();
+        Build(references, mid, end, depth + 1);
+    }
+
+    std::vector<uint32_t> const &Tree::GetPrimitiveOrder() const
+    {
+        return PrimitiveOrder;
+    }
+
+    size_t Tree::GetNodeCount() const
+    {
+        return Nodes.size();
+    }
+
+    size_t Tree::GetDepth() const
+    {
+        // nodes with their level, the first child of an inner node follows it and the second is at its offset
+        std::vector<std::pair<uint32_t, size_t>> pending;
+        if (!Nodes.empty())
+            pending.emplace_back(0, 0);
+        size_t depth = 0;
+        while (!pending.empty())
+        {
+            auto const [current, level] = pending.back();
+            pending.pop_back();
+            depth = std::max(depth, level);
+            if (Nodes[current].Count == 0)
+            {
+                pending.emplace_back(current + 1, level + 1);
+                pending.emplace_back(Nodes[current].Offset, level + 1);
+            }
+        }
+        return depth;
+    }
+}
@@ -0,0 +1,60 @@
+#include "Camera.h"
+
+#include <cmath>
+
+#include "Debug.h"
+
+namespace Camera
+{
+    RayTable::RayTable(Settings const &settings, unsigned int width, unsigned int height)
+        : Config{settings}, Width{width}, Height{height}, Columns(width), Rows(height)
+    {
+        DEBUG_ASSERT(settings.Model != Projection::Pinhole || (settings.FieldOfView > 0 && settings.FieldOfView < Deg2Rad(180)), "Pinhole needs a field of view below 180 degrees");
+        Forward = settings.Forward.ToNormalized();
+        Side = settings.Up.CrossProd(Forward).ToNormalized();
+        Up = Forward.CrossProd(Side);
+
+        FloatingType_t const halfWidth = (FloatingType_t)width / 2;
+        FloatingType_t const halfHeight = (FloatingType_t)height / 2;
+        if (settings.Model == Projection::Spherical)
+        {
+            // the pixel's corner lies on the grid of angles, latitude takes the same step to keep pixels square
+            Step = settings.FieldOfView / width;
+            Curvature = Step * Step / 2;
+            auto const getFactor = [this](FloatingType_t angle)
+            {
+                FloatingType_t const cosine = std::cos(angle);
+                FloatingType_t const sine = std::sin(angle);
+                return factor_t{cosine, sine, -sine * Step, cosine * Step};
+            };
+            for (unsigned int x = 0; x < width; x++)
+                Columns[x] = getFactor((x - halfWidth) * Step);
+            for (unsigned int y = 0; y < height; y++)
+                Rows[y] = getFactor((y - halfHeight) * Step);
+            return;
+        }
+
+        // the plane at distance 1, rays pass through the centres of the pixels
+        Step = 2 * std::tan(settings.FieldOfView / 2) / width;
+        Curvature = 0;
+        for (unsigned int x = 0; x < width; x++)
+            Columns[x] = factor_t{1, (x + FloatingType_t{0.5} - halfWidth) * Step, 0, Step};
+        for (unsigned int y = 0; y < height; y++)
+            Rows[y] = factor_t{1, (y + FloatingType_t{0.5} - halfHeight) * Step, 0, Step};
+    }
+
+    bool RayTable::IsFor(Settings const &settings, unsigned int width, unsigned int height) const
+    {
+        return Config == settings && Width == width && Height == height;
+    }
+
+    unsigned int RayTable::GetWidth() const
+    {
+        return Width;
+    }
+
+    unsigned int RayTable::GetHeight() const
+    {
+        return Height;
+    }
+}
@@ -0,0 +1,480 @@
+#include "CompiledScene.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "Debug.h"
+#include "Sampling.h"
+
+namespace Scene
+{
+    /// @brief Shared by all kernels to mark "nothing found yet"
+    constexpr uint32_t NO_INDEX = UINT32_MAX;
+    /// @brief Number of primitives whose distances are computed in one vectorized batch
+    constexpr size_t KERNEL_BLOCK_SIZE = 16;
+    /// @brief Materials of primitives that are not sampled explicitly
+    constexpr uint32_t NO_EMITTER = UINT32_MAX;
+
+    void SphereSoa::Add(Vec3d const &center, FloatingType_t radius, uint32_t materialIndex)
+    {
+        CenterX.push_back(center.X());
+        CenterY.push_back(center.Y());
+        CenterZ.push_back(center.Z());
+        Radius.push_back(radius);
+        MaterialIndex.push_back(materialIndex);
+    }
+
+    void PlaneSoa::Add(Vec3d const &pin, Vec3d const &normal, uint32_t materialIndex, uint32_t checkerMaterialIndex, FloatingType_t checkerWidth)
+    {
+        PinX.push_back(pin.X());
+        PinY.push_back(pin.Y());
+        PinZ.push_back(pin.Z());
+        NormalX.push_back(normal.X());
+        NormalY.push_back(normal.Y());
+        NormalZ.push_back(normal.Z());
+        MaterialIndex.push_back(materialIndex);
+        CheckerMaterialIndex.push_back(checkerMaterialIndex);
+        CheckerWidth.push_back(checkerWidth);
+    }
+
+    uint32_t PrimitiveArrays::AddMaterial(Materials::Material const &material)
+    {
+        Materials.push_back(material);
+        return (uint32_t)Materials.size() - 1;
+    }
+
+    void IntersectSpheres(SphereSoa const &spheres, size_t begin, size_t end, Line const &ray, KernelHit &closest)
+    {
+        FloatingType_t const *__restrict centerX = spheres.CenterX.data();
+        FloatingType_t const *__restrict centerY = spheres.CenterY.data();
+        FloatingType_t const *__restrict centerZ = spheres.CenterZ.data();
+        FloatingType_t const *__restrict radius = spheres.Radius.data();
+
+        // same math as Shapes::Sphere::Intersect(), but branchless. Distances are computed in fixed size blocks
+        // the compiler can vectorize, the arg min search over a block stays scalar
+        FloatingType_t bestDistance = closest.DistanceToSurface;
+        uint32_t bestIndex = NO_INDEX;
+        for (size_t blockBegin = begin; blockBegin < end; blockBegin += KERNEL_BLOCK_SIZE)
+        {
+            size_t const blockSize = std::min(KERNEL_BLOCK_SIZE, end - blockBegin);
+            std::array<FloatingType_t, KERNEL_BLOCK_SIZE> distances;
+            for (size_t j = 0; j < blockSize; j++)
+            {
+                size_t const i = blockBegin + j;
+                FloatingType_t const betweenX = ray.Origin.X() - centerX[i];
+                FloatingType_t const betweenY = ray.Origin.Y() - centerY[i];
+                FloatingType_t const betweenZ = ray.Origin.Z() - centerZ[i];
+                FloatingType_t const b = betweenX * ray.Direction.X() + betweenY * ray.Direction.Y() + betweenZ * ray.Direction.Z();
+                FloatingType_t const c = betweenX * betweenX + betweenY * betweenY + betweenZ * betweenZ - radius[i] * radius[i];
+                FloatingType_t const discriminant = b * b - c;
+
+                // no intersection, or ray is outside of sphere and pointing away from sphere
+                FloatingType_t const miss = ((discriminant < 0) | ((c > 0) & (b > 0))) ? INFINITY : 0;
+
+                FloatingType_t const root = std::sqrt(std::max(discriminant, FloatingType_t{0}));
+                FloatingType_t const sign = c > 0 ? 1 : -1;
+                distances[j] = -b - sign * root - Shapes::OFFSET_DELTA + miss;
+            }
+
+            for (size_t j = 0; j < blockSize; j++)
+            {
+                if (distances[j] >= bestDistance)
+                    continue;
+                bestDistance = distances[j];
+                bestIndex = (uint32_t)(blockBegin + j);
+            }
+        }
+
+        if (bestIndex == NO_INDEX)
+            return;
+
+        Vec3d const between = ray.Origin - spheres.GetCenter(bestIndex);
+        closest = KernelHit{.DistanceToSurface = bestDistance,
+                            .Index = bestIndex,
+                            .FromOutside = between * between > radius[bestIndex] * radius[bestIndex]};
+    }
+
+    void IntersectPlanes(PlaneSoa const &planes, Line const &ray, KernelHit &closest)
+    {
+        // same math as Shapes::Plane::Intersect(), there are only a few planes
+        FloatingType_t bestDistance = closest.DistanceToSurface;
+        uint32_t bestIndex = NO_INDEX;
+        for (size_t i = 0; i < planes.Size(); i++)
+        {
+            FloatingType_t const denominator = ray.Direction.X() * planes.NormalX[i] + ray.Direction.Y() * planes.NormalY[i] + ray.Direction.Z() * planes.NormalZ[i];
+            FloatingType_t const numerator = (planes.PinX[i] - ray.Origin.X()) * planes.NormalX[i] +
+                                             (planes.PinY[i] - ray.Origin.Y()) * planes.NormalY[i] +
+                                             (planes.PinZ[i] - ray.Origin.Z()) * planes.NormalZ[i];
+            FloatingType_t const distance = numerator / denominator - Shapes::OFFSET_DELTA;
+
+            // parallel rays never hit
+            if (denominator == 0 || distance < -Shapes::OFFSET_DELTA || distance >= bestDistance)
+                continue;
+
+            bestDistance = distance;
+            bestIndex = (uint32_t)i;
+        }
+
+        if (bestIndex == NO_INDEX)
+            return;
+
+        closest = KernelHit{.DistanceToSurface = bestDistance, .Index = bestIndex, .FromOutside = false};
+    }
+
+    CompiledScene::CompiledScene(std::span<Shapes::Shape const *const> shapes)
+    {
+        PrimitiveArrays arrays;
+        for (size_t i = 0; i < shapes.size(); i++)
+        {
+            // materials are never shared, all the ones added now belong to this shape
+            shapes[i]->Compile(arrays);
+            ShapeOfMaterial.resize(arrays.Materials.size(), (uint32_t)i);
+        }
+
+        Materials = std::move(arrays.Materials);
+        Planes = std::move(arrays.Planes);
+
+        std::vector<Aabb> bounds;
+        Aabb sceneBounds;
+        for (size_t i = 0; i < arrays.Spheres.Size(); i++)
+        {
+            Vec3d const radius{arrays.Spheres.Radius[i], arrays.Spheres.Radius[i], arrays.Spheres.Radius[i]};
+            Vec3d const center = arrays.Spheres.GetCenter(i);
+            bounds.push_back(Aabb{.Min = center - radius, .Max = center + radius});
+            sceneBounds.Grow(bounds.back());
+        }
+
+        // spheres enclosing the whole scene (sky sphere) are hit by every ray anyway
+        std::vector<Aabb> treeBounds;
+        std::vector<uint32_t> treeSpheres;
+        for (size_t i = 0; i < bounds.size(); i++)
+        {
+            if (bounds.size() > 1 && bounds[i].Contains(sceneBounds))
+            {
+                EnclosingSpheres.Add(arrays.Spheres.GetCenter(i), arrays.Spheres.Radius[i], arrays.Spheres.MaterialIndex[i]);
+                continue;
+            }
+
+            treeBounds.push_back(bounds[i]);
+            treeSpheres.push_back((uint32_t)i);
+        }
+
+        // store spheres in leaf order
+        SphereTree = Bvh::Tree{treeBounds};
+        for (auto const treeIndex : SphereTree.GetPrimitiveOrder())
+        {
+            uint32_t const i = treeSpheres[treeIndex];
+            Spheres.Add(arrays.Spheres.GetCenter(i), arrays.Spheres.Radius[i], arrays.Spheres.MaterialIndex[i]);
+        }
+
+        CollectEmitters();
+    }
+
+    void CompiledScene::CollectEmitters()
+    {
+        // a hit finds its emitter by material, which only works for materials of a single primitive
+        std::vector<uint32_t> primitivesOfMaterial(Materials.size(), 0);
+        for (auto const index : Spheres.MaterialIndex)
+            primitivesOfMaterial[index]++;
+        for (auto const index : EnclosingSpheres.MaterialIndex)
+            primitivesOfMaterial[index]++;
+        for (size_t i = 0; i < Planes.Size(); i++)
+        {
+            primitivesOfMaterial[Planes.MaterialIndex[i]]++;
+            if (Planes.CheckerWidth[i] > 0)
+                primitivesOfMaterial[Planes.CheckerMaterialIndex[i]]++;
+        }
+
+        EmitterOfMaterial.assign(Materials.size(), NO_EMITTER);
+        FloatingType_t totalLuminance = 0;
+        auto const add = [&](EmitterShape shape, size_t index, uint32_t materialIndex)
+        {
+            Materials::Material const &material = Materials[materialIndex];
+            FloatingType_t const luminance = GetLuminance(material.Emission);
+            if (!material.IsLightsource || luminance <= 0 || primitivesOfMaterial[materialIndex] != 1)
+                return;
+
+            EmitterOfMaterial[materialIndex] = (uint32_t)Emitters.size();
+            Emitters.push_back(emitter_t{.Shape = shape, .Index = (uint32_t)index, .Probability = luminance});
+            totalLuminance += luminance;
+        };
+
+        for (size_t i = 0; i < Spheres.Size(); i++)
+            add(EmitterShape::Sphere, i, Spheres.MaterialIndex[i]);
+        for (size_t i = 0; i < EnclosingSpheres.Size(); i++)
+            add(EmitterShape::EnclosingSphere, i, EnclosingSpheres.MaterialIndex[i]);
+
+        // checkerboards emit from every other field only, left to the probes
+        for (size_t i = 0; i < Planes.Size(); i++)
+        {
+            if (Planes.CheckerWidth[i] == 0)
+                add(EmitterShape::Plane, i, Planes.MaterialIndex[i]);
+        }
+
+        for (auto &emitter : Emitters)
+            emitter.Probability /= totalLuminance;
+    }
+
+    Intersection CompiledScene::GetClosestIntersection(Line const &ray) const
+    {
+        DEBUG_ASSERT(AlmostSame(ray.Direction.GetNorm(), 1.0), "Line argument not normalized");
+
+        // linear parts first, they give the tree a tight distance to cull against
+        KernelHit closestPlane;
+        IntersectPlanes(Planes, ray, closestPlane);
+
+        KernelHit closestEnclosing{.DistanceToSurface = closestPlane.DistanceToSurface};
+        IntersectSpheres(EnclosingSpheres, 0, EnclosingSpheres.Size(), ray, closestEnclosing);
+
+        KernelHit closestSphere{.DistanceToSurface = closestEnclosing.DistanceToSurface};
+        SphereTree.Traverse(ray, closestSphere.DistanceToSurface, [&](uint32_t begin, uint32_t end)
+                            { IntersectSpheres(Spheres, begin, end, ray, closestSphere); });
+
+        return Shade(ray, closestPlane, closestEnclosing, closestSphere);
+    }
+
+    bool CompiledScene::IsOccluded(Line const &ray, FloatingType_t maxDistance) const
+    {
+        DEBUG_ASSERT(AlmostSame(ray.Direction.GetNorm(), 1.0), "Line argument not normalized");
+
+        // same kernels as GetClosestIntersection(), but any hit closer than maxDistance ends the query
+        KernelHit closest{.DistanceToSurface = maxDistance};
+        IntersectPlanes(Planes, ray, closest);
+        IntersectSpheres(EnclosingSpheres, 0, EnclosingSpheres.Size(), ray, closest);
+        if (closest.DistanceToSurface < maxDistance)
+            return true;
+
+        bool occluded = false;
+        SphereTree.Traverse(ray, closest.DistanceToSurface, [&](uint32_t begin, uint32_t end)
+                            {
+                                IntersectSpheres(Spheres, begin, end, ray, closest);
+                                occluded = closest.DistanceToSurface < maxDistance;
+                                return occluded; });
+        return occluded;
+    }
+
+    size_t CompiledScene::GetEmitterCount() const
+    {
+        return Emitters.size();
+    }
+
+    EmitterSample CompiledScene::SampleEmitter(FloatingType_t u, FloatingType_t u1, FloatingType_t u2, Vec3d const &origin, Vec3d const &normal) const
+    {
+        if (Emitters.empty())
+            return EmitterSample{};
+
+        // scenes have a handful of emitters, a linear search over the cumulative probabilities does
+        size_t pick = 0;
+        FloatingType_t cumulative = Emitters[0].Probability;
+        while (pick + 1 < Emitters.size() && u >= cumulative)
+            cumulative += Emitters[++pick].Probability;
+        emitter_t const &emitter = Emitters[pick];
+
+        Line ray{origin, normal};
+        uint32_t materialIndex = 0;
+        FloatingType_t distance = INFINITY;
+        if (emitter.Shape == EmitterShape::Plane)
+        {
+            // cosine weighted over the half space the plane covers
+            Vec3d const pin{Planes.PinX[emitter.Index], Planes.PinY[emitter.Index], Planes.PinZ[emitter.Index]};
+            Vec3d const planeNormal = Planes.GetNormal(emitter.Index);
+            FloatingType_t const numerator = (pin - origin) * planeNormal;
+            Vec3d const towardsPlane = numerator > 0 ? planeNormal : -planeNormal;
+            ray.Direction = Sampling::Onb::FromNormal(towardsPlane).ToWorld(Sampling::SampleCosineCone(u1, u2, 1));
+
+            // same math as IntersectPlanes(), grazing directions never arrive
+            FloatingType_t const denominator = ray.Direction * planeNormal;
+            if (denominator != 0)
+                distance = numerator / denominator - Shapes::OFFSET_DELTA;
+            materialIndex = Planes.MaterialIndex[emitter.Index];
+        }
+        else
+        {
+            SphereSoa const &spheres = emitter.Shape == EmitterShape::Sphere ? Spheres : EnclosingSpheres;
+            Vec3d const toCenter = spheres.GetCenter(emitter.Index) - origin;
+            FloatingType_t const distanceSquared = toCenter * toCenter;
+            FloatingType_t const radiusSquared = spheres.Radius[emitter.Index] * spheres.Radius[emitter.Index];
+            if (distanceSquared > radiusSquared)
+            {
+                // uniform within the cone the sphere covers, 1 - cos computed without cancellation for small cones
+                FloatingType_t const sinSquared = radiusSquared / distanceSquared;
+                FloatingType_t const oneMinusCos = sinSquared / (1 + std::sqrt(1 - sinSquared));
+                Vec3d const axis = toCenter * (1 / std::sqrt(distanceSquared));
+                ray.Direction = Sampling::Onb::FromNormal(axis).ToWorld(Sampling::SampleUniformCone(u1, u2, oneMinusCos));
+            }
+            else
+            {
+                // surrounded by the emitter, e.g. a sky sphere: cosine weighted over the surface's hemisphere
+                ray.Direction = Sampling::Onb::FromNormal(normal).ToWorld(Sampling::SampleCosineCone(u1, u2, 1));
+            }
+
+            KernelHit hit;
+            IntersectSpheres(spheres, emitter.Index, emitter.Index + 1, ray, hit);
+            distance = hit.DistanceToSurface;
+            materialIndex = spheres.MaterialIndex[emitter.Index];
+        }
+
+        // directions grazing the silhouette may miss numerically
+        if (!(distance < INFINITY) || distance < 0)
+            return EmitterSample{};
+
+        return EmitterSample{.Direction = ray.Direction,
+                             .Distance = distance - Shapes::OFFSET_DELTA,
+                             .Pdf = emitter.Probability * GetDirectionPdf(emitter, origin, ray.Direction, ray.Direction * normal),
+                             .Material = &Materials[materialIndex]};
+    }
+
+    FloatingType_t CompiledScene::GetEmitterPdf(Intersection const &hit, Line const &ray, FloatingType_t cosineToNormal) const
+    {
+        if (!hit.Material)
+            return 0;
+
+        uint32_t const emitter = EmitterOfMaterial[GetMaterialIndex(hit.Material)];
+        if (emitter == NO_EMITTER)
+            return 0;
+
+        return Emitters[emitter].Probability * GetDirectionPdf(Emitters[emitter], ray.Origin, ray.Direction, cosineToNormal);
+    }
+
+    FloatingType_t CompiledScene::GetDirectionPdf(emitter_t const &emitter, Vec3d const &origin, Vec3d const &direction, FloatingType_t cosineToNormal) const
+    {
+        // mirrors the branches of SampleEmitter(), the direction is known to reach the emitter
+        if (emitter.Shape == EmitterShape::Plane)
+            return std::abs(direction * Planes.GetNormal(emitter.Index)) * FloatingType_t{M_1_PI};
+
+        SphereSoa const &spheres = emitter.Shape == EmitterShape::Sphere ? Spheres : EnclosingSpheres;
+        Vec3d const toCenter = spheres.GetCenter(emitter.Index) - origin;
+        FloatingType_t const distanceSquared = toCenter * toCenter;
+        FloatingType_t const radiusSquared = spheres.Radius[emitter.Index] * spheres.Radius[emitter.Index];
+        if (distanceSquared > radiusSquared)
+        {
+            FloatingType_t const sinSquared = radiusSquared / distanceSquared;
+            FloatingType_t const oneMinusCos = sinSquared / (1 + std::sqrt(1 - sinSquared));
+            return 1 / (2 * FloatingType_t{M_PI} * oneMinusCos);
+        }
+
+        return std::max(FloatingType_t{0}, cosineToNormal) * FloatingType_t{M_1_PI};
+    }
+
+    void CompiledScene::GetClosestIntersections(RayPacket const &packet, std::array<Intersection, PACKET_SIZE> &intersections, SimdLevel level) const
+    {
+        if (!packet.ActiveMask)
+            return;
+
+        // same order as GetClosestIntersection(), every stage starts from the distances of the one before
+        PacketHits closestPlane;
+        closestPlane.DistanceToSurface.fill(INFINITY);
+        closestPlane.Index.fill(0);
+        IntersectPlanes(Planes, packet, closestPlane, level);
+
+        PacketHits closestEnclosing = closestPlane;
+        IntersectSpheres(EnclosingSpheres, 0, EnclosingSpheres.Size(), packet, closestEnclosing, level);
+
+        PacketHits closestSphere = closestEnclosing;
+
+        // coherent rays agree on the order of children, the first one decides
+        size_t const firstLane = __builtin_ctz(packet.ActiveMask);
+        std::array<bool, 3> const directionIsNegative = {packet.InverseDirectionX[firstLane] < 0, packet.InverseDirectionY[firstLane] < 0, packet.InverseDirectionZ[firstLane] < 0};
+
+        // a leaf is visited if any ray enters its box before its closest hit so far, the kernel tests all of them
+        SphereTree.Traverse(
+            directionIsNegative, [&](Aabb const &box)
+            { return IntersectBox(box, packet, closestSphere, level) != 0; },
+            [&](uint32_t begin, uint32_t end)
+            { IntersectSpheres(Spheres, begin, end, packet, closestSphere, level); });
+
+        for (size_t lane = 0; lane < PACKET_SIZE; lane++)
+        {
+            if (!packet.IsActive(lane))
+                continue;
+
+            Line const ray = packet.Get(lane);
+            auto const toKernelHit = [&](SphereSoa const &spheres, PacketHits const &hits, PacketHits const &previous)
+            {
+                // not closer than the stage before, the index is not one of these spheres
+                if (hits.DistanceToSurface[lane] >= previous.DistanceToSurface[lane])
+                    return KernelHit{.DistanceToSurface = hits.DistanceToSurface[lane]};
+
+                // same as the single ray kernel
+                uint32_t const index = hits.Index[lane];
+                Vec3d const between = ray.Origin - spheres.GetCenter(index);
+                return KernelHit{.DistanceToSurface = hits.DistanceToSurface[lane],
+                                 .Index = index,
+                                 .FromOutside = between * between > spheres.Radius[index] * spheres.Radius[index]};
+            };
+
+            intersections[lane] = Shade(ray,
+                                        KernelHit{.DistanceToSurface = closestPlane.DistanceToSurface[lane], .Index = closestPlane.Index[lane]},
+                                        toKernelHit(EnclosingSpheres, closestEnclosing, closestPlane),
+                                        toKernelHit(Spheres, closestSphere, closestEnclosing));
+        }
+    }
+
+    Intersection CompiledScene::Shade(Line const &ray, KernelHit const &closestPlane, KernelHit const &closestEnclosing, KernelHit const &closestSphere) const
+    {
+        // only the winner gets shaded
+        auto const shadeSphere = [&](SphereSoa const &spheres, KernelHit const &hit)
+        {
+            Vec3d const intersectionPoint = ray.Origin + hit.DistanceToSurface * ray.Direction;
+
+            // takes into consideration when within sphere
+            Vec3d const directionToIntersection = (intersectionPoint - spheres.GetCenter(hit.Index)).ToNormalized();
+            Vec3d const normal = hit.FromOutside ? directionToIntersection : -directionToIntersection;
+
+            return Intersection{.Material = &Materials[spheres.MaterialIndex[hit.Index]],
+                                .Hitevent = Shapes::HitEvent{.DistanceToSurface = hit.DistanceToSurface,
+                                                             .SurfaceNormal = normal,
+                                                             .ReflectedRay = Line{intersectionPoint, Shapes::Reflect(ray.Direction, normal)}}};
+        };
+
+        if (closestSphere.DistanceToSurface < closestEnclosing.DistanceToSurface)
+            return shadeSphere(Spheres, closestSphere);
+
+        if (closestEnclosing.DistanceToSurface < closestPlane.DistanceToSurface)
+            return shadeSphere(EnclosingSpheres, closestEnclosing);
+
+        if (closestPlane.DistanceToSurface == INFINITY)
+            return Intersection{};
+
+        Vec3d const normal = Planes.GetNormal(closestPlane.Index);
+        Vec3d const reflectionPoint = ray.Origin + closestPlane.DistanceToSurface * ray.Direction;
+
+        // checkerboard planes alternate between both materials
+        uint32_t materialIndex = Planes.MaterialIndex[closestPlane.Index];
+        FloatingType_t const width = Planes.CheckerWidth[closestPlane.Index];
+        if (width > 0 && !(((int)std::floor(reflectionPoint.X() / width) + (int)std::floor(reflectionPoint.Y() / width)) % 2))
+            materialIndex = Planes.CheckerMaterialIndex[closestPlane.Index];
+
+        return Intersection{.Material = &Materials[materialIndex],
+                            .Hitevent = Shapes::HitEvent{.DistanceToSurface = closestPlane.DistanceToSurface,
+                                                         .SurfaceNormal = normal,
+                                                         .ReflectedRay = Line{reflectionPoint, Shapes::Reflect(ray.Direction, normal)}}};
+    }
+
+    size_t CompiledScene::GetNodeCount() const
+    {
+        return SphereTree.GetNodeCount();
+    }
+
+    size_t CompiledScene::GetMaterialCount() const
+    {
+        return Materials.size();
+    }
+
+    size_t CompiledScene::GetMaterialIndex(Materials::Material const *material) const
+    {
+        if (!material)
+            return Materials.size();
+
+        DEBUG_ASSERT(material >= Materials.data() && material < Materials.data() + Materials.size(), "Material of another scene");
+        return (size_t)(material - Materials.data());
+    }
+
+    uint32_t CompiledScene::GetShapeIndex(Materials::Material const *material) const
+    {
+        if (!material)
+            return NO_SHAPE;
+        return ShapeOfMaterial[GetMaterialIndex(material)];
+    }
+}
@@ -0,0 +1,350 @@
+#include "Denoise.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+
+#include "Debug.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Denoise
+{
+    static_assert(std::is_same_v<FloatingType_t, float>, "Filter kernels work on single precision lanes");
+
+    /// @brief B3 spline, the 5x5 kernel is its outer product
+    constexpr std::array<float, 5> SPLINE = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+
+    /// @brief Edge length of the kernel
+    constexpr int TAPS = 5;
+
+    constexpr float LOG2E = 1.44269504f;
+
+    /// @brief Weights below e^-30 count for nothing next to the center tap. They are set to 0, which also keeps the
+    /// sums clear of denormals, whose arithmetic is slower by orders of magnitude
+    constexpr float MAX_EXPONENT = 30;
+
+    /// @brief Neighbours whose guides are closer than this count as the same surface when estimating the noise
+    constexpr float SAME_SURFACE_DISTANCE = 1e-2f;
+
+    /// @brief Lower bound of the noise estimate, relative to the mean luminance
+    constexpr FloatingType_t MIN_RELATIVE_NOISE = 1e-3;
+
+    /// @brief Minimax polynomial of 2^f on [0, 1)
+    constexpr std::array<float, 5> EXP2_COEFFICIENTS = {0.69314718f, 0.24022651f, 0.05550411f, 0.00961813f, 0.00133336f};
+
+    /// @brief Pointers into the planes of a Denoiser for one iteration, at the first pixel of the padded image
+    struct filterKernel_t
+    {
+        std::array<float const *, 3> Source;
+        std::array<float *, 3> Target;
+        std::array<float const *, 3> Albedo;
+        std::array<float const *, 3> Normal;
+        float const *Depth;
+        float const *InverseDepth;
+        float const *Inside;
+        /// @brief Offsets of the taps, row major
+        std::array<ptrdiff_t, TAPS * TAPS> Offsets;
+        float InverseColorVariance;
+        float InverseNormalVariance;
+        float InverseDepthVariance;
+        float InverseAlbedoVariance;
+    };
+
+    /// @brief e^-x for x >= 0 through 2^n * 2^f, 0 from MAX_EXPONENT on. The SIMD kernels repeat it operation by
+    /// operation, so all kernels give the same weights
+    inline float negativeExp(float x)
+    {
+        if (!(x < MAX_EXPONENT))
+            return 0;
+        float const t = x * -LOG2E;
+        float const n = std::floor(t);
+        float const f = t - n;
+        float const p = 1 + f * (EXP2_COEFFICIENTS[0] + f * (EXP2_COEFFICIENTS[1] + f * (EXP2_COEFFICIENTS[2] + f * (EXP2_COEFFICIENTS[3] + f * EXP2_COEFFICIENTS[4]))));
+        return p * std::bit_cast<float>(((int32_t)n + 127) << 23);
+    }
+
+    static void filterPixelScalar(filterKernel_t const &kernel, size_t pixel)
+    {
+        float const depth = kernel.Depth[pixel];
+        // relative to the depth of the pixel
+        float const depthScale = kernel.InverseDepth[pixel] * kernel.InverseDepth[pixel] * kernel.InverseDepthVariance;
+
+        float sumRed = 0;
+        float sumGreen = 0;
+        float sumBlue = 0;
+        float sumWeight = 0;
+        for (int tap = 0; tap < TAPS * TAPS; tap++)
+        {
+            size_t const neighbour = pixel + kernel.Offsets[tap];
+            float const tapRed = kernel.Source[0][neighbour];
+            float const tapGreen = kernel.Source[1][neighbour];
+            float const tapBlue = kernel.Source[2][neighbour];
+
+            float colorDistance = 0;
+            float normalDistance = 0;
+            float albedoDistance = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                float const colorDelta = kernel.Source[c][neighbour] - kernel.Source[c][pixel];
+                float const normalDelta = kernel.Normal[c][neighbour] - kernel.Normal[c][pixel];
+                float const albedoDelta = kernel.Albedo[c][neighbour] - kernel.Albedo[c][pixel];
+                colorDistance = colorDistance + colorDelta * colorDelta;
+                normalDistance = normalDistance + normalDelta * normalDelta;
+                albedoDistance = albedoDistance + albedoDelta * albedoDelta;
+            }
+            float const depthDelta = kernel.Depth[neighbour] - depth;
+
+            float const exponent = colorDistance * kernel.InverseColorVariance + normalDistance * kernel.InverseNormalVariance +
+                                   depthDelta * depthDelta * depthScale + albedoDistance * kernel.InverseAlbedoVariance;
+            float const weight = SPLINE[tap / TAPS] * SPLINE[tap % TAPS] * kernel.Inside[neighbour] * negativeExp(exponent);
+            sumRed = sumRed + weight * tapRed;
+            sumGreen = sumGreen + weight * tapGreen;
+            sumBlue = sumBlue + weight * tapBlue;
+            sumWeight = sumWeight + weight;
+        }
+
+        // the center tap always has weight
+        kernel.Target[0][pixel] = sumRed / sumWeight;
+        kernel.Target[1][pixel] = sumGreen / sumWeight;
+        kernel.Target[2][pixel] = sumBlue / sumWeight;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("avx2"))) static __m256 negativeExpAvx2(__m256 x)
+    {
+        __m256 const inRange = _mm256_cmp_ps(x, _mm256_set1_ps(MAX_EXPONENT), _CMP_LT_OQ);
+        __m256 const t = _mm256_mul_ps(_mm256_min_ps(x, _mm256_set1_ps(MAX_EXPONENT)), _mm256_set1_ps(-LOG2E));
+        __m256 const n = _mm256_floor_ps(t);
+        __m256 const f = _mm256_sub_ps(t, n);
+        __m256 p = _mm256_set1_ps(EXP2_COEFFICIENTS[4]);
+        for (int i = 3; i >= 0; i--)
+            p = _mm256_add_ps(_mm256_set1_ps(EXP2_COEFFICIENTS[i]), _mm256_mul_ps(f, p));
+        p = _mm256_add_ps(_mm256_set1_ps(1), _mm256_mul_ps(f, p));
+        __m256i const power = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_and_ps(_mm256_mul_ps(p, _mm256_castsi256_ps(power)), inRange);
+    }
+
+    /// @brief filterPixelScalar() for 8 neighbouring pixels of a row
+    __attribute__((target("avx2"))) static void filterPixelsAvx2(filterKernel_t const &kernel, size_t pixel)
+    {
+        __m256 center[3];
+        __m256 centerNormal[3];
+        __m256 centerAlbedo[3];
+        for (int c = 0; c < 3; c++)
+        {
+            center[c] = _mm256_loadu_ps(kernel.Source[c] + pixel);
+            centerNormal[c] = _mm256_loadu_ps(kernel.Normal[c] + pixel);
+            centerAlbedo[c] = _mm256_loadu_ps(kernel.Albedo[c] + pixel);
+        }
+        __m256 const depth = _mm256_loadu_ps(kernel.Depth + pixel);
+        __m256 const inverseDepth = _mm256_loadu_ps(kernel.InverseDepth + pixel);
+        __m256 const depthScale = _mm256_mul_ps(_mm256_mul_ps(inverseDepth, inverseDepth), _mm256_set1_ps(kernel.InverseDepthVariance));
+        __m256 const inverseColorVariance = _mm256_set1_ps(kernel.InverseColorVariance);
+        __m256 const inverseNormalVariance = _mm256_set1_ps(kernel.InverseNormalVariance);
+        __m256 const inverseAlbedoVariance = _mm256_set1_ps(kernel.InverseAlbedoVariance);
+
+        __m256 sum[3] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+        __m256 sumWeight = _mm256_setzero_ps();
+        for (int tap = 0; tap < TAPS * TAPS; tap++)
+        {
+            size_t const neighbour = pixel + kernel.Offsets[tap];
+            __m256 color[3];
+            __m256 colorDistance = _mm256_setzero_ps();
+            __m256 normalDistance = _mm256_setzero_ps();
+            __m256 albedoDistance = _mm256_setzero_ps();
+            for (int c = 0; c < 3; c++)
+            {
+                color[c] = _mm256_loadu_ps(kernel.Source[c] + neighbour);
+                __m256 const colorDelta = _mm256_sub_ps(color[c], center[c]);
+                __m256 const normalDelta = _mm256_sub_ps(_mm256_loadu_ps(kernel.Normal[c] + neighbour), centerNormal[c]);
+                __m256 const albedoDelta = _mm256_sub_ps(_mm256_loadu_ps(kernel.Albedo[c] + neighbour), centerAlbedo[c]);
+                colorDistance = _mm256_add_ps(colorDistance, _mm256_mul_ps(colorDelta, colorDelta));
+                normalDistance = _mm256_add_ps(normalDistance, _mm256_mul_ps(normalDelta, normalDelta));
+                albedoDistance = _mm256_add_ps(albedoDistance, _mm256_mul_ps(albedoDelta, albedoDelta));
+            }
+            __m256 const depthDelta = _mm256_sub_ps(_mm256_loadu_ps(kernel.Depth + neighbour), depth);
+
+            __m256 exponent = _mm256_add_ps(_mm256_mul_ps(colorDistance, inverseColorVariance), _mm256_mul_ps(normalDistance, inverseNormalVariance));
+            exponent = _mm256_add_ps(exponent, _mm256_mul_ps(_mm256_mul_ps(depthDelta, depthDelta), depthScale));
+            exponent = _mm256_add_ps(exponent, _mm256_mul_ps(albedoDistance, inverseAlbedoVariance));
+            __m256 const spline = _mm256_set1_ps(SPLINE[tap / TAPS] * SPLINE[tap % TAPS]);
+            __m256 const weight = _mm256_mul_ps(_mm256_mul_ps(spline, _mm256_loadu_ps(kernel.Inside + neighbour)), negativeExpAvx2(exponent));
+            for (int c = 0; c < 3; c++)
+                sum[c] = _mm256_add_ps(sum[c], _mm256_mul_ps(weight, color[c]));
+            sumWeight = _mm256_add_ps(sumWeight, weight);
+        }
+
+        for (int c = 0; c < 3; c++)
+            _mm256_storeu_ps(kernel.Target[c] + pixel, _mm256_div_ps(sum[c], sumWeight));
+    }
+#endif
+
+    std::string Timings::ToString() const
+    {
+        std::stringstream stream;
+        stream << "Denoise: " << Wall.count() * 1000 << "ms, iterations " << Iterations.count() * 1000 << "ms" << std::endl;
+        return stream.str();
+    }
+
+    Denoiser::Denoiser(Settings const &settings, unsigned int numWorkers)
+        : Config{settings},
+          Pool{numWorkers}
+    {
+        if (Config.Iterations > MAX_ITERATIONS)
+            DEBUG_WARN("Only " + std::to_string(MAX_ITERATIONS) + " denoiser iterations fit the border, skipping the rest");
+    }
+
+    void Denoiser::Resize(unsigned int width, unsigned int height)
+    {
+        Width = width;
+        Height = height;
+        Stride = width + 2 * BORDER;
+        Rows = height + 2 * BORDER;
+
+        // every pixel inside the image is written by Run(), the border stays 0
+        for (auto &colors : Color)
+            for (auto &plane : colors)
+                plane.assign(Stride * Rows, 0.f);
+        for (auto &plane : Albedo)
+            plane.assign(Stride * Rows, 0.f);
+        for (auto &plane : Normal)
+            plane.assign(Stride * Rows, 0.f);
+        InverseDepth.assign(Stride * Rows, 0.f);
+        Depth.assign(Stride * Rows, 0.f);
+        Inside.assign(Stride * Rows, 0.f);
+        for (unsigned int y = 0; y < Height; y++)
+            std::fill_n(Inside.begin() + (y + BORDER) * Stride + BORDER, Width, 1.f);
+    }
+
+    Timings const &Denoiser::Run(Bitmap::BitmapD &image, Aov::Framebuffer const &guides)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        DEBUG_ASSERT(guides.HasSizeOf(image), "Guides must have the size of the image");
+        if (image.GetWidth() != Width || image.GetHeight() != Height)
+            Resize(image.GetWidth(), image.GetHeight());
+
+        // the filter does not care whether rows are in image space, as long as all planes agree
+        double luminanceSum = 0;
+        for (unsigned int y = 0; y < Height; y++)
+        {
+            for (unsigned int x = 0; x < Width; x++)
+            {
+                size_t const pixel = (y + BORDER) * Stride + BORDER + x;
+                for (unsigned int c = 0; c < 3; c++)
+                {
+                    Color[0][c][pixel] = image.at(x, y, c);
+                    Albedo[c][pixel] = guides.Albedo.at(x, y, c);
+                    Normal[c][pixel] = guides.Normal.at(x, y, c);
+                }
+                Depth[pixel] = guides.Depth[(size_t)y * Width + x];
+                InverseDepth[pixel] = Depth[pixel] > 0 ? 1 / Depth[pixel] : 0;
+                luminanceSum += GetLuminance(ColorD_t{image.at(x, y, 0), image.at(x, y, 1), image.at(x, y, 2)});
+            }
+        }
+
+        // an image without noise keeps its edges at any color sigma, but the inverse variance has to stay finite
+        FloatingType_t const meanLuminance = luminanceSum / std::max((size_t)Width * Height, size_t{1});
+        FloatingType_t const noise = std::max(EstimateNoise(), MIN_RELATIVE_NOISE * meanLuminance);
+
+        auto const iterationsStart = std::chrono::steady_clock::now();
+        unsigned int source = 0;
+        if (meanLuminance > 0)
+        {
+            for (unsigned int i = 0; i < std::min(Config.Iterations, MAX_ITERATIONS); i++)
+            {
+                // taps further apart need a closer color to count, as every iteration removes noise
+                unsigned int const step = 1u << i;
+                FloatingType_t const colorSigma = Config.ColorSigma * noise / step;
+                iteration_t const iteration{.Step = step,
+                                            .InverseColorVariance = 1 / (colorSigma * colorSigma),
+                                            .InverseNormalVariance = 1 / (Config.NormalSigma * Config.NormalSigma),
+                                            .InverseDepthVariance = 1 / (Config.DepthSigma * Config.DepthSigma * step * step),
+                                            .InverseAlbedoVariance = 1 / (Config.AlbedoSigma * Config.AlbedoSigma)};
+                Pool.Run(Width, Height, [this, &iteration, source](unsigned int, Scheduler::Tile const &tile)
+                         { FilterTile(tile, iteration, source); });
+                source ^= 1;
+            }
+        }
+        Statistics.Iterations = std::chrono::steady_clock::now() - iterationsStart;
+
+        for (unsigned int y = 0; y < Height; y++)
+            for (unsigned int x = 0; x < Width; x++)
+                for (unsigned int c = 0; c < 3; c++)
+                    image.at(x, y, c) = Color[source][c][(y + BORDER) * Stride + BORDER + x];
+
+        Statistics.Wall = std::chrono::steady_clock::now() - start;
+        return Statistics;
+    }
+
+    FloatingType_t Denoiser::EstimateNoise()
+    {
+        // neighbours on the same surface differ by noise mostly, the median ignores the edges the guides miss
+        NoiseScratch.clear();
+        for (unsigned int y = 0; y < Height; y++)
+        {
+            size_t const row = (y + BORDER) * Stride + BORDER;
+            for (size_t pixel = row; pixel + 1 < row + Width; pixel++)
+            {
+                float featureDistance = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    float const normalDelta = Normal[c][pixel + 1] - Normal[c][pixel];
+                    float const albedoDelta = Albedo[c][pixel + 1] - Albedo[c][pixel];
+                    featureDistance += normalDelta * normalDelta + albedoDelta * albedoDelta;
+                }
+                if (featureDistance > SAME_SURFACE_DISTANCE || std::abs(Depth[pixel + 1] - Depth[pixel]) > SAME_SURFACE_DISTANCE * Depth[pixel])
+                    continue;
+
+                ColorD_t const left{Color[0][0][pixel], Color[0][1][pixel], Color[0][2][pixel]};
+                ColorD_t const right{Color[0][0][pixel + 1], Color[0][1][pixel + 1], Color[0][2][pixel + 1]};
+                FloatingType_t const difference = std::abs(GetLuminance(left) - GetLuminance(right));
+                if (difference > 0)
+                    NoiseScratch.push_back(difference);
+            }
+        }
+        if (NoiseScratch.empty())
+            return 0;
+
+        // median absolute difference to the standard deviation of a pixel, assuming normally distributed noise
+        auto const median = NoiseScratch.begin() + NoiseScratch.size() / 2;
+        std::nth_element(NoiseScratch.begin(), median, NoiseScratch.end());
+        return *median * FloatingType_t{1.4826} / std::sqrt(FloatingType_t{2});
+    }
+
+    void Denoiser::FilterTile(Scheduler::Tile const &tile, iteration_t const &iteration, unsigned int source)
+    {
+        filterKernel_t kernel{.Depth = Depth.data(),
+                              .InverseDepth = InverseDepth.data(),
+                              .Inside = Inside.data(),
+                              .InverseColorVariance = iteration.InverseColorVariance,
+                              .InverseNormalVariance = iteration.InverseNormalVariance,
+                              .InverseDepthVariance = iteration.InverseDepthVariance,
+                              .InverseAlbedoVariance = iteration.InverseAlbedoVariance};
+        for (int c = 0; c < 3; c++)
+        {
+            kernel.Source[c] = Color[source][c].data();
+            kernel.Target[c] = Color[source ^ 1][c].data();
+            kernel.Albedo[c] = Albedo[c].data();
+            kernel.Normal[c] = Normal[c].data();
+        }
+        for (int tap = 0; tap < TAPS * TAPS; tap++)
+            kernel.Offsets[tap] = ((ptrdiff_t)(tap / TAPS - TAPS / 2) * Stride + (tap % TAPS - TAPS / 2)) * (ptrdiff_t)iteration.Step;
+
+        for (unsigned int y = tile.FromY; y < tile.ToY; y++)
+        {
+            size_t const row = (y + BORDER) * Stride + BORDER;
+            unsigned int x = tile.FromX;
+#if defined(__x86_64__)
+            if (Config.Simd >= Scene::SimdLevel::Avx2)
+                for (; x + 8 <= tile.ToX; x += 8)
+                    filterPixelsAvx2(kernel, row + x);
+#endif
+            for (; x < tile.ToX; x++)
+                filterPixelScalar(kernel, row + x);
+        }
+    }
+}
@@ -0,0 +1,192 @@
+#include "ImgFile.h"
+
+#include <array>
+#include <cstdint>
+
+namespace ImgFile
+{
+    /// @brief Chunk tags of QOI, the 2 bit ones are followed by 6 bits of payload
+    constexpr unsigned char QOI_OP_INDEX = 0x00;
+    constexpr unsigned char QOI_OP_DIFF = 0x40;
+    constexpr unsigned char QOI_OP_LUMA = 0x80;
+    constexpr unsigned char QOI_OP_RUN = 0xc0;
+    constexpr unsigned char QOI_OP_RGB = 0xfe;
+
+    /// @brief Longest run a single chunk holds, 63 and 64 would collide with the 8 bit tags
+    constexpr unsigned int QOI_MAX_RUN = 62;
+
+    constexpr size_t QOI_HEADER_SIZE = 14;
+    constexpr std::array<unsigned char, 8> QOI_END_MARKER = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    inline unsigned char *writeBigEndian(unsigned char *target, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            *target++ = (unsigned char)(value >> shift);
+        return target;
+    }
+
+    /// @brief Encodes 8 bit RGB pixels, see https://qoiformat.org/qoi-specification.pdf
+    /// @param pixels Top row first, without padding
+    /// @param encoded Receives the whole file
+    void encodeQoi(unsigned char const *pixels, unsigned int width, unsigned int height, bool srgb, std::vector<unsigned char> &encoded)
+    {
+        // every pixel takes 4 bytes at most, as QOI_OP_RGB
+        size_t const pixelCount = (size_t)width * height;
+        encoded.resize(QOI_HEADER_SIZE + pixelCount * 4 + QOI_END_MARKER.size());
+        unsigned char *target = encoded.data();
+        for (char const magic : {'q', 'o', 'i', 'f'})
+            *target++ = (unsigned char)magic;
+        target = writeBigEndian(target, width);
+        target = writeBigEndian(target, height);
+        *target++ = (unsigned char)Bitmap::COLOR_COUNT;
+        *target++ = srgb ? 0 : 1;
+
+        // pixels as r | g << 8 | b << 16 | a << 24, alpha is always opaque
+        constexpr uint32_t OPAQUE = 0xffu << 24;
+        std::array<uint32_t, 64> seen{};
+        uint32_t previous = OPAQUE;
+        unsigned int run = 0;
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            unsigned char const *const pixel = pixels + i * Bitmap::COLOR_COUNT;
+            uint32_t const current = pixel[0] | pixel[1] << 8 | pixel[2] << 16 | OPAQUE;
+            if (current == previous)
+            {
+                if (++run == QOI_MAX_RUN || i + 1 == pixelCount)
+                {
+                    *target++ = QOI_OP_RUN | (unsigned char)(run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                *target++ = QOI_OP_RUN | (unsigned char)(run - 1);
+                run = 0;
+            }
+
+            unsigned int const hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + 255 * 11) % 64;
+            if (seen[hash] == current)
+            {
+                *target++ = QOI_OP_INDEX | (unsigned char)hash;
+            }
+            else
+            {
+                seen[hash] = current;
+                // differences wrap around like the bytes they are added to
+                int const red = (int8_t)(pixel[0] - (unsigned char)previous);
+                int const green = (int8_t)(pixel[1] - (unsigned char)(previous >> 8));
+                int const blue = (int8_t)(pixel[2] - (unsigned char)(previous >> 16));
+                int const redGreen = red - green;
+                int const blueGreen = blue - green;
+                if (red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 && blue <= 1)
+                {
+                    *target++ = QOI_OP_DIFF | (unsigned char)((red + 2) << 4 | (green + 2) << 2 | (blue + 2));
+                }
+                else if (green >= -32 && green <= 31 && redGreen >= -8 && redGreen <= 7 && blueGreen >= -8 && blueGreen <= 7)
+                {
+                    *target++ = QOI_OP_LUMA | (unsigned char)(green + 32);
+                    *target++ = (unsigned char)((redGreen + 8) << 4 | (blueGreen + 8));
+                }
+                else
+                {
+                    *target++ = QOI_OP_RGB;
+                    target = std::copy_n(pixel, Bitmap::COLOR_COUNT, target);
+                }
+            }
+            previous = current;
+        }
+
+        target = std::copy(QOI_END_MARKER.begin(), QOI_END_MARKER.end(), target);
+        encoded.resize(target - encoded.data());
+    }
+
+    PpmWriter::PpmWriter(ToneMap::Settings const &toneMapping)
+        : Mapper{toneMapping}
+    {
+    }
+
+    char const *PpmWriter::GetExtension() const
+    {
+        return "ppm";
+    }
+
+    bool PpmWriter::Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples)
+    {
+        std::ofstream outfile{file, std::ios::out | std::ios::binary};
+        if (!outfile.good())
+            return false;
+
+        std::string const header = getNetPbmHeader(Format::Ppm, frame.GetWidth(), frame.GetHeight());
+        size_t const rowLength = (size_t)frame.GetWidth() * Bitmap::COLOR_COUNT;
+        Staging.resize(header.length() + rowLength * frame.GetHeight());
+        std::copy(header.begin(), header.end(), Staging.begin());
+        Mapper.Run(frame, samples, Staging.data() + header.length(), rowLength);
+        outfile.write((char const *)Staging.data(), Staging.size());
+        return outfile.good();
+    }
+
+    char const *PfmWriter::GetExtension() const
+    {
+        return "pfm";
+    }
+
+    bool PfmWriter::Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples)
+    {
+        std::ofstream outfile{file, std::ios::out | std::ios::binary};
+        if (!outfile.good())
+            return false;
+
+        std::string const header = getNetPbmHeader(Format::Pfm, frame.GetWidth(), frame.GetHeight());
+        outfile.write(header.c_str(), header.length());
+
+        // bottom row first, i.e. image space
+        size_t const rowLength = (size_t)frame.GetWidth() * Bitmap::COLOR_COUNT;
+        Row.resize(rowLength);
+        for (unsigned int y = 0; y < frame.GetHeight(); y++)
+        {
+            Primitives::FloatingType_t const *const source = frame.atPixel(0, y);
+            for (size_t i = 0; i < rowLength; i++)
+                Row[i] = source[i] / samples;
+            outfile.write((char const *)Row.data(), rowLength * sizeof(float));
+        }
+        return outfile.good();
+    }
+
+    QoiWriter::QoiWriter(ToneMap::Settings const &toneMapping)
+        : Mapper{toneMapping}
+    {
+    }
+
+    char const *QoiWriter::GetExtension() const
+    {
+        return "qoi";
+    }
+
+    bool QoiWriter::Write(std::string const &file, Bitmap::BitmapD const &frame, Primitives::FloatingType_t samples)
+    {
+        std::ofstream outfile{file, std::ios::out | std::ios::binary};
+        if (!outfile.good())
+            return false;
+
+        size_t const rowLength = (size_t)frame.GetWidth() * Bitmap::COLOR_COUNT;
+        Pixels.resize(rowLength * frame.GetHeight());
+        Mapper.Run(frame, samples, Pixels.data(), rowLength);
+        encodeQoi(Pixels.data(), frame.GetWidth(), frame.GetHeight(), Mapper.Config.Srgb, Encoded);
+        outfile.write((char const *)Encoded.data(), Encoded.size());
+        return outfile.good();
+    }
+
+    std::unique_ptr<Writer> CreateWriter(Format format, ToneMap::Settings const &toneMapping)
+    {
+        switch (format)
+        {
+        case Format::Pfm:
+            return std::make_unique<PfmWriter>();
+        case Format::Qoi:
+            return std::make_unique<QoiWriter>(toneMapping);
+        default:
+            return std::make_unique<PpmWriter>(toneMapping);
+        }
+    }
+}
@@ -0,0 +1,124 @@
+#include "MappedImage.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "Debug.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define IMGFILE_MMAP 1
+#endif
+
+namespace ImgFile
+{
+    /// @brief Bytes of a pixel in the file
+    inline size_t getPixelSize(Format format)
+    {
+        return format == Format::Ppm ? Bitmap::COLOR_COUNT : Bitmap::COLOR_COUNT * sizeof(float);
+    }
+
+    MappedImage::MappedImage(std::string const &file, Format format, unsigned int width, unsigned int height, ToneMap::Settings const &toneMapping)
+        : OutputFormat{format}, Width{width}, Height{height}, ToneMapping{toneMapping}, File{file}
+    {
+        DEBUG_ASSERT(format != Format::Qoi, "Compressed pixels have no fixed place in the file");
+        DEBUG_ASSERT(format != Format::Ppm || toneMapping.Operator != ToneMap::Curve::MinMax, "Tiles cannot be mapped by the range of the frame");
+        std::string const header = getNetPbmHeader(format, width, height);
+        HeaderSize = header.size();
+        Size = HeaderSize + (size_t)width * height * getPixelSize(format);
+
+#if defined(IMGFILE_MMAP)
+        Descriptor = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        bool sized = Descriptor >= 0 && ftruncate(Descriptor, (off_t)Size) == 0;
+#if defined(__linux__)
+        // reserves the blocks up front, so a full disk shows now rather than as a fault while writing a tile
+        sized = sized && posix_fallocate(Descriptor, 0, (off_t)Size) == 0;
+#endif
+        if (sized)
+        {
+            void *const mapping = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Descriptor, 0);
+            if (mapping != MAP_FAILED)
+                Data = static_cast<unsigned char *>(mapping);
+        }
+        if (!Data)
+        {
+            DEBUG_WARN("Cannot map " + file + ", writing it on flush");
+            if (Descriptor >= 0)
+                close(Descriptor);
+            Descriptor = -1;
+        }
+#endif
+        if (!Data)
+        {
+            Fallback.assign(Size, 0);
+            Data = Fallback.data();
+        }
+        std::memcpy(Data, header.data(), HeaderSize);
+    }
+
+    MappedImage::~MappedImage()
+    {
+        Flush();
+#if defined(IMGFILE_MMAP)
+        if (Descriptor >= 0)
+        {
+            munmap(Data, Size);
+            close(Descriptor);
+        }
+#endif
+    }
+
+    bool MappedImage::IsMapped() const
+    {
+        return Descriptor >= 0;
+    }
+
+    size_t MappedImage::GetSize() const
+    {
+        return Size;
+    }
+
+    void MappedImage::Flush()
+    {
+#if defined(IMGFILE_MMAP)
+        if (Descriptor >= 0)
+        {
+            // readers of the file see the shared pages already, this only starts writing them back
+            msync(Data, Size, MS_ASYNC);
+            return;
+        }
+#endif
+        std::ofstream outfile{File, std::ios::out | std::ios::binary};
+        if (!outfile.good())
+        {
+            DEBUG_WARN("Cannot write " + File);
+            return;
+        }
+        outfile.write((char const *)Fallback.data(), Fallback.size());
+        if (!outfile.good())
+            DEBUG_WARN("Cannot write " + File);
+    }
+
+    void MappedImage::WriteRun(unsigned int x, unsigned int y, Primitives::FloatingType_t const *source, unsigned int pixels, Primitives::FloatingType_t samples)
+    {
+        DEBUG_ASSERT(x + pixels <= Width && y < Height, "Run must lie within the image");
+        // PPM goes from the top row down like the physical rows, PFM from the bottom up like image space
+        size_t const row = OutputFormat == Format::Ppm ? Height - 1 - y : y;
+        unsigned char *const target = Data + HeaderSize + (row * Width + x) * getPixelSize(OutputFormat);
+        size_t const channels = (size_t)pixels * Bitmap::COLOR_COUNT;
+        if (OutputFormat == Format::Ppm)
+        {
+            ToneMap::Convert(ToneMapping, samples, source, channels, target);
+            return;
+        }
+
+        // the header leaves the floats unaligned
+        for (size_t i = 0; i < channels; i++)
+        {
+            float const mean = source[i] / samples;
+            std::memcpy(target + i * sizeof(float), &mean, sizeof(float));
+        }
+    }
+}
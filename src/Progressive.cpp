@@ -0,0 +1,181 @@
+#include "Progressive.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "Debug.h"
+#include "ImgFile.h"
+
+namespace Progressive
+{
+    constexpr std::array<char, 4> CHECKPOINT_MAGIC = {'R', 'T', 'C', 'P'};
+    constexpr uint32_t CHECKPOINT_VERSION = 2;
+
+    using fingerprint_t = std::array<uint32_t, 27>;
+
+    /// @brief Everything a pass depends on besides the scene: the image layout, the camera, what keys the random
+    /// numbers and what the integrators do with them. The engine is left out, both add the same sums
+    fingerprint_t getFingerprint(Rt::Raytracer const &raytracer, Bitmap::BitmapD const &accumulator)
+    {
+        Rt::RenderSettings const &settings = raytracer.GetSettings();
+        Camera::Settings const &view = settings.View;
+        auto const bits = [](FloatingType_t value)
+        { return std::bit_cast<uint32_t>(value); };
+        return {CHECKPOINT_VERSION,
+                accumulator.GetWidth(),
+                accumulator.GetHeight(),
+                Bitmap::COLOR_COUNT,
+                sizeof(FloatingType_t),
+                raytracer.GetSeed(),
+                (uint32_t)settings.Mode,
+                (uint32_t)settings.Sampler,
+                settings.SamplesPerPixel,
+                settings.ExpectedSamples,
+                settings.RayGenerations,
+                settings.DiffuseRays,
+                settings.RouletteStartBounce,
+                settings.MaxBounces,
+                settings.LightSamples,
+                (uint32_t)view.Model,
+                bits(view.Position.X()), bits(view.Position.Y()), bits(view.Position.Z()),
+                bits(view.Forward.X()), bits(view.Forward.Y()), bits(view.Forward.Z()),
+                bits(view.Up.X()), bits(view.Up.Y()), bits(view.Up.Z()),
+                bits(view.FieldOfView),
+                (uint32_t)view.Jitter};
+    }
+
+    size_t getRowBytes(Bitmap::BitmapD const &accumulator)
+    {
+        return (size_t)accumulator.GetWidth() * Bitmap::COLOR_COUNT * sizeof(FloatingType_t);
+    }
+
+    std::string Summary::ToString() const
+    {
+        std::stringstream stream;
+        stream << "Progressive: " << Passes << " passes (" << ResumedPasses << " resumed) in " << Steps << " steps, " << Publishes << " images, "
+               << Checkpoints << " checkpoints, " << Wall.count() * 1000 << "ms" << std::endl;
+        return stream.str();
+    }
+
+    bool WriteCheckpoint(std::string const &file, Rt::Raytracer const &raytracer, Bitmap::BitmapD const &accumulator, unsigned int passes)
+    {
+        std::string const temporaryFile = file + ".tmp";
+        {
+            std::ofstream outfile{temporaryFile, std::ios::out | std::ios::binary | std::ios::trunc};
+            if (!outfile.good())
+            {
+                DEBUG_WARN("Cannot open checkpoint file " + temporaryFile);
+                return false;
+            }
+
+            fingerprint_t const fingerprint = getFingerprint(raytracer, accumulator);
+            uint32_t const passCount = passes;
+            outfile.write(CHECKPOINT_MAGIC.data(), CHECKPOINT_MAGIC.size());
+            outfile.write((char const *)fingerprint.data(), sizeof(fingerprint));
+            outfile.write((char const *)&passCount, sizeof(passCount));
+            // rows without their padding
+            for (unsigned int y = 0; y < accumulator.GetHeight(); y++)
+                outfile.write((char const *)accumulator.Row(y), getRowBytes(accumulator));
+            if (!outfile.good())
+            {
+                DEBUG_WARN("Cannot write checkpoint file " + temporaryFile);
+                return false;
+            }
+        }
+
+        // replaces the previous checkpoint in one step
+        std::error_code error;
+        std::filesystem::rename(temporaryFile, file, error);
+        return !error;
+    }
+
+    bool ReadCheckpoint(std::string const &file, Rt::Raytracer const &raytracer, Bitmap::BitmapD &accumulator, unsigned int &passes)
+    {
+        std::ifstream infile{file, std::ios::in | std::ios::binary};
+        if (!infile.good())
+            return false;
+
+        std::array<char, 4> magic;
+        fingerprint_t fingerprint;
+        uint32_t passCount;
+        infile.read(magic.data(), magic.size());
+        infile.read((char *)fingerprint.data(), sizeof(fingerprint));
+        infile.read((char *)&passCount, sizeof(passCount));
+        if (!infile.good() || magic != CHECKPOINT_MAGIC || fingerprint != getFingerprint(raytracer, accumulator))
+        {
+            DEBUG_WARN("Checkpoint " + file + " belongs to another image or settings, starting over");
+            return false;
+        }
+
+        // a truncated file must not leave half of the sums behind
+        std::error_code error;
+        if (std::filesystem::file_size(file, error) != (uintmax_t)infile.tellg() + getRowBytes(accumulator) * accumulator.GetHeight() || error)
+        {
+            DEBUG_WARN("Checkpoint " + file + " is truncated, starting over");
+            return false;
+        }
+
+        for (unsigned int y = 0; y < accumulator.GetHeight(); y++)
+            infile.read((char *)accumulator.Row(y), getRowBytes(accumulator));
+        passes = passCount;
+        return true;
+    }
+
+    Summary Render(Rt::RenderContext &context, Bitmap::BitmapD &accumulator, Settings const &settings, Aov::Framebuffer *aovs)
+    {
+        Rt::Raytracer const &raytracer = context.GetRaytracer();
+        Summary summary;
+        if (!settings.CheckpointFile.empty() && ReadCheckpoint(settings.CheckpointFile, raytracer, accumulator, summary.ResumedPasses))
+            summary.Passes = summary.ResumedPasses;
+        context.ResumeAt(summary.Passes);
+
+        using clock = std::chrono::steady_clock;
+        auto const start = clock::now();
+        auto lastPublish = start;
+        auto lastCheckpoint = start;
+        unsigned int checkpointPasses = summary.Passes;
+        std::chrono::duration<double> lastStep{0};
+        while (summary.Passes < settings.MaxPasses)
+        {
+            // a step that would end after the budget is not started, so the render stops with its state written
+            auto const stepStart = clock::now();
+            if (summary.Steps > 0 && stepStart - start + lastStep > settings.TimeBudget)
+                break;
+
+            unsigned int const passes = std::min(settings.PassesPerStep, settings.MaxPasses - summary.Passes);
+            context.Submit(accumulator, passes, aovs);
+            context.Wait();
+            summary.Passes += passes;
+            summary.Steps++;
+
+            auto const now = clock::now();
+            lastStep = now - stepStart;
+            if (!settings.ImageFile.empty() && now - lastPublish >= settings.PublishInterval)
+            {
+                ImgFile::writeNetPbm(settings.ImageFile, accumulator, settings.ToneMapping, (FloatingType_t)summary.Passes * raytracer.GetSettings().SamplesPerPixel);
+                summary.Publishes++;
+                lastPublish = now;
+            }
+            if (!settings.CheckpointFile.empty() && now - lastCheckpoint >= settings.CheckpointInterval)
+            {
+                if (WriteCheckpoint(settings.CheckpointFile, raytracer, accumulator, summary.Passes))
+                {
+                    summary.Checkpoints++;
+                    checkpointPasses = summary.Passes;
+                }
+                lastCheckpoint = now;
+            }
+        }
+
+        // the final state, unless the checkpoint holds it already
+        if (!settings.CheckpointFile.empty() && checkpointPasses != summary.Passes)
+            summary.Checkpoints += WriteCheckpoint(settings.CheckpointFile, raytracer, accumulator, summary.Passes);
+
+        summary.Wall = clock::now() - start;
+        return summary;
+    }
+}
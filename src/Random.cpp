@@ -0,0 +1,128 @@
+#include "Random.h"
+
+#include <array>
+#include <vector>
+
+#include "Debug.h"
+
+namespace Random
+{
+    /// @brief Width of the gaussian deciding how close two points are, in pixels
+    constexpr FloatingType_t VOID_AND_CLUSTER_SIGMA = 1.5;
+    /// @brief Fraction of the mask set in the initial pattern
+    constexpr FloatingType_t VOID_AND_CLUSTER_INITIAL_FILL = 0.1;
+
+    constexpr uint32_t MASK_AREA = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+
+    /// @brief Void and cluster (Ulichney 1993) on a torus
+    class voidAndCluster_t
+    {
+    public:
+        voidAndCluster_t()
+        {
+            // gaussian energy of a point, by wrapped offset
+            for (uint32_t y = 0; y < BLUE_NOISE_SIZE; y++)
+            {
+                for (uint32_t x = 0; x < BLUE_NOISE_SIZE; x++)
+                {
+                    FloatingType_t const dx = (FloatingType_t)std::min(x, BLUE_NOISE_SIZE - x);
+                    FloatingType_t const dy = (FloatingType_t)std::min(y, BLUE_NOISE_SIZE - y);
+                    Kernel[y * BLUE_NOISE_SIZE + x] = std::exp(-(dx * dx + dy * dy) / (2 * VOID_AND_CLUSTER_SIGMA * VOID_AND_CLUSTER_SIGMA));
+                }
+            }
+        }
+
+        std::vector<FloatingType_t> Run()
+        {
+            // random initial pattern, deterministic
+            std::vector<uint32_t> rank(MASK_AREA, 0);
+            uint32_t initialCount = 0;
+            for (uint32_t i = 0; i < MASK_AREA; i++)
+            {
+                if (Uniform(0, i, 0, 0, 0) >= VOID_AND_CLUSTER_INITIAL_FILL)
+                    continue;
+                Set(i, true);
+                initialCount++;
+            }
+
+            // spread it evenly: move the tightest cluster into the largest void until that changes nothing
+            while (true)
+            {
+                uint32_t const cluster = FindExtreme(true, true);
+                Set(cluster, false);
+                uint32_t const largestVoid = FindExtreme(false, false);
+                Set(largestVoid, true);
+                if (cluster == largestVoid)
+                    break;
+            }
+            std::vector<bool> const prototype = IsSet;
+            std::vector<FloatingType_t> const prototypeEnergy = Energy;
+
+            // ranks below the prototype: remove tightest clusters
+            for (uint32_t count = initialCount; count > 0; count--)
+            {
+                uint32_t const cluster = FindExtreme(true, true);
+                Set(cluster, false);
+                rank[cluster] = count - 1;
+            }
+
+            // ranks above the prototype: fill largest voids
+            IsSet = prototype;
+            Energy = prototypeEnergy;
+            for (uint32_t count = initialCount; count < MASK_AREA; count++)
+            {
+                uint32_t const largestVoid = FindExtreme(false, false);
+                Set(largestVoid, true);
+                rank[largestVoid] = count;
+            }
+
+            std::vector<FloatingType_t> mask(MASK_AREA);
+            for (uint32_t i = 0; i < MASK_AREA; i++)
+                mask[i] = (rank[i] + FloatingType_t{0.5}) / MASK_AREA;
+            return mask;
+        }
+
+    private:
+        std::array<FloatingType_t, MASK_AREA> Kernel;
+        std::vector<FloatingType_t> Energy = std::vector<FloatingType_t>(MASK_AREA, 0);
+        std::vector<bool> IsSet = std::vector<bool>(MASK_AREA, false);
+
+        void Set(uint32_t index, bool value)
+        {
+            DEBUG_ASSERT(IsSet[index] != value, "Point already in that state");
+            IsSet[index] = value;
+
+            uint32_t const x = index % BLUE_NOISE_SIZE;
+            uint32_t const y = index / BLUE_NOISE_SIZE;
+            FloatingType_t const sign = value ? 1 : -1;
+            for (uint32_t j = 0; j < BLUE_NOISE_SIZE; j++)
+            {
+                uint32_t const kernelRow = ((j + BLUE_NOISE_SIZE - y) % BLUE_NOISE_SIZE) * BLUE_NOISE_SIZE;
+                for (uint32_t i = 0; i < BLUE_NOISE_SIZE; i++)
+                    Energy[j * BLUE_NOISE_SIZE + i] += sign * Kernel[kernelRow + (i + BLUE_NOISE_SIZE - x) % BLUE_NOISE_SIZE];
+            }
+        }
+
+        /// @brief Tightest cluster: set point of highest energy. Largest void: unset point of lowest energy
+        uint32_t FindExtreme(bool amongSet, bool highest) const
+        {
+            uint32_t best = MASK_AREA;
+            for (uint32_t i = 0; i < MASK_AREA; i++)
+            {
+                if (IsSet[i] != amongSet)
+                    continue;
+                if (best == MASK_AREA || (highest ? Energy[i] > Energy[best] : Energy[i] < Energy[best]))
+                    best = i;
+            }
+            DEBUG_ASSERT(best < MASK_AREA, "No candidate left");
+            return best;
+        }
+    };
+
+    FloatingType_t const *GetBlueNoiseMask()
+    {
+        // thread safe initialization on first use
+        static std::vector<FloatingType_t> const mask = voidAndCluster_t{}.Run();
+        return mask.data();
+    }
+}
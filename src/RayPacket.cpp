@@ -0,0 +1,552 @@
+#include "RayPacket.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "CompiledScene.h"
+#include "Debug.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Scene
+{
+    static_assert(std::is_same_v<FloatingType_t, float>, "Packet kernels work on single precision lanes");
+
+    SimdLevel GetSimdLevel()
+    {
+#if defined(__x86_64__)
+        // thread safe initialization on first use. Also checks that the OS saves the wide registers
+        static SimdLevel const level = []()
+        {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return SimdLevel::Avx512;
+            if (__builtin_cpu_supports("avx2"))
+                return SimdLevel::Avx2;
+            return SimdLevel::Sse;
+        }();
+        return level;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }
+
+    char const *ToString(SimdLevel level)
+    {
+        switch (level)
+        {
+        case SimdLevel::Scalar:
+            return "Scalar";
+        case SimdLevel::Sse:
+            return "SSE";
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Avx512:
+            return "AVX-512";
+        }
+        return "";
+    }
+
+    // fallback: lane by lane through the single ray kernels
+
+    static uint32_t intersectBoxScalar(Aabb const &box, RayPacket const &packet, PacketHits const &closest)
+    {
+        uint32_t mask = 0;
+        for (size_t lane = 0; lane < PACKET_SIZE; lane++)
+        {
+            if (!packet.IsActive(lane))
+                continue;
+
+            Vec3d const origin{packet.OriginX[lane], packet.OriginY[lane], packet.OriginZ[lane]};
+            Vec3d const inverseDirection{packet.InverseDirectionX[lane], packet.InverseDirectionY[lane], packet.InverseDirectionZ[lane]};
+            if (Bvh::IntersectsBox(box, origin, inverseDirection, closest.DistanceToSurface[lane]))
+                mask |= 1u << lane;
+        }
+        return mask;
+    }
+
+    static void intersectSpheresScalar(SphereSoa const &spheres, size_t begin, size_t end, RayPacket const &packet, PacketHits &closest)
+    {
+        for (size_t lane = 0; lane < PACKET_SIZE; lane++)
+        {
+            if (!packet.IsActive(lane))
+                continue;
+
+            KernelHit hit{.DistanceToSurface = closest.DistanceToSurface[lane]};
+            IntersectSpheres(spheres, begin, end, packet.Get(lane), hit);
+            if (hit.DistanceToSurface >= closest.DistanceToSurface[lane])
+                continue;
+            closest.DistanceToSurface[lane] = hit.DistanceToSurface;
+            closest.Index[lane] = hit.Index;
+        }
+    }
+
+    static void intersectPlanesScalar(PlaneSoa const &planes, RayPacket const &packet, PacketHits &closest)
+    {
+        for (size_t lane = 0; lane < PACKET_SIZE; lane++)
+        {
+            if (!packet.IsActive(lane))
+                continue;
+
+            KernelHit hit{.DistanceToSurface = closest.DistanceToSurface[lane]};
+            IntersectPlanes(planes, packet.Get(lane), hit);
+            if (hit.DistanceToSurface >= closest.DistanceToSurface[lane])
+                continue;
+            closest.DistanceToSurface[lane] = hit.DistanceToSurface;
+            closest.Index[lane] = hit.Index;
+        }
+    }
+
+#if defined(__x86_64__)
+    // the kernels below repeat the math of the single ray kernels operation by operation, so every lane comes out
+    // the same as tracing its ray alone. Primitives are broadcast one at a time, the lanes stay in registers
+
+    /// @brief Lanes of mask which are set, as all ones per lane
+    static __m128i getLaneMask4(uint32_t mask)
+    {
+        __m128i const bits = _mm_setr_epi32(1, 2, 4, 8);
+        return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)mask), bits), bits);
+    }
+
+    static uint32_t intersectBoxSse(Aabb const &box, RayPacket const &packet, PacketHits const &closest)
+    {
+        std::array<FloatingType_t const *, 3> const origins = {packet.OriginX.data(), packet.OriginY.data(), packet.OriginZ.data()};
+        std::array<FloatingType_t const *, 3> const inverseDirections = {packet.InverseDirectionX.data(), packet.InverseDirectionY.data(), packet.InverseDirectionZ.data()};
+
+        uint32_t mask = 0;
+        for (size_t lane = 0; lane < PACKET_SIZE; lane += 4)
+        {
+            if (!((packet.ActiveMask >> lane) & 0xf))
+                continue;
+
+            // candidates come first, so NaNs of rays parallel to a slab are dropped like in the single ray test
+            __m128 nearDistance = _mm_setzero_ps();
+            __m128 farDistance = _mm_load_ps(&closest.DistanceToSurface[lane]);
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                __m128 const origin = _mm_load_ps(origins[axis] + lane);
+                __m128 const inverseDirection = _mm_load_ps(inverseDirections[axis] + lane);
+                __m128 const t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.Min.Data[axis]), origin), inverseDirection);
+                __m128 const t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.Max.Data[axis]), origin), inverseDirection);
+                nearDistance = _mm_max_ps(_mm_min_ps(t0, t1), nearDistance);
+                farDistance = _mm_min_ps(_mm_max_ps(t0, t1), farDistance);
+            }
+            mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(nearDistance, farDistance)) << lane;
+        }
+        return mask & packet.ActiveMask;
+    }
+
+    static void intersectSpheresSse(SphereSoa const &spheres, size_t begin, size_t end, RayPacket const &packet, PacketHits &closest)
+    {
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const offsetDelta = _mm_set1_ps(Shapes::OFFSET_DELTA);
+        __m128 const signBit = _mm_set1_ps(-0.f);
+
+        for (size_t lane = 0; lane < PACKET_SIZE; lane += 4)
+        {
+            uint32_t const laneMask = (packet.ActiveMask >> lane) & 0xf;
+            if (!laneMask)
+                continue;
+
+            __m128 const active = _mm_castsi128_ps(getLaneMask4(laneMask));
+            __m128 const originX = _mm_load_ps(&packet.OriginX[lane]);
+            __m128 const originY = _mm_load_ps(&packet.OriginY[lane]);
+            __m128 const originZ = _mm_load_ps(&packet.OriginZ[lane]);
+            __m128 const directionX = _mm_load_ps(&packet.DirectionX[lane]);
+            __m128 const directionY = _mm_load_ps(&packet.DirectionY[lane]);
+            __m128 const directionZ = _mm_load_ps(&packet.DirectionZ[lane]);
+            __m128 bestDistance = _mm_load_ps(&closest.DistanceToSurface[lane]);
+            __m128i bestIndex = _mm_load_si128((__m128i const *)&closest.Index[lane]);
+
+            for (size_t i = begin; i < end; i++)
+            {
+                __m128 const betweenX = _mm_sub_ps(originX, _mm_set1_ps(spheres.CenterX[i]));
+                __m128 const betweenY = _mm_sub_ps(originY, _mm_set1_ps(spheres.CenterY[i]));
+                __m128 const betweenZ = _mm_sub_ps(originZ, _mm_set1_ps(spheres.CenterZ[i]));
+                __m128 const b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(betweenX, directionX), _mm_mul_ps(betweenY, directionY)), _mm_mul_ps(betweenZ, directionZ));
+                __m128 const c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(betweenX, betweenX), _mm_mul_ps(betweenY, betweenY)), _mm_mul_ps(betweenZ, betweenZ)),
+                                            _mm_set1_ps(spheres.Radius[i] * spheres.Radius[i]));
+                __m128 const discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+
+                // no intersection, or ray is outside of sphere and pointing away from sphere
+                __m128 const outside = _mm_cmpgt_ps(c, zero);
+                __m128 const miss = _mm_or_ps(_mm_cmplt_ps(discriminant, zero), _mm_and_ps(outside, _mm_cmpgt_ps(b, zero)));
+
+                __m128 const root = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+                __m128 const signedRoot = _mm_xor_ps(root, _mm_andnot_ps(outside, signBit));
+                __m128 const distance = _mm_sub_ps(_mm_sub_ps(_mm_xor_ps(b, signBit), signedRoot), offsetDelta);
+
+                __m128 const closer = _mm_and_ps(_mm_andnot_ps(miss, _mm_cmplt_ps(distance, bestDistance)), active);
+                bestDistance = _mm_or_ps(_mm_and_ps(closer, distance), _mm_andnot_ps(closer, bestDistance));
+                __m128i const closerIndex = _mm_castps_si128(closer);
+                bestIndex = _mm_or_si128(_mm_and_si128(closerIndex, _mm_set1_epi32((int)i)), _mm_andnot_si128(closerIndex, bestIndex));
+            }
+
+            _mm_store_ps(&closest.DistanceToSurface[lane], bestDistance);
+            _mm_store_si128((__m128i *)&closest.Index[lane], bestIndex);
+        }
+    }
+
+    static void intersectPlanesSse(PlaneSoa const &planes, RayPacket const &packet, PacketHits &closest)
+    {
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const offsetDelta = _mm_set1_ps(Shapes::OFFSET_DELTA);
+        __m128 const negativeOffsetDelta = _mm_set1_ps(-Shapes::OFFSET_DELTA);
+
+        for (size_t lane = 0; lane < PACKET_SIZE; lane += 4)
+        {
+            uint32_t const laneMask = (packet.ActiveMask >> lane) & 0xf;
+            if (!laneMask)
+                continue;
+
+            __m128 const active = _mm_castsi128_ps(getLaneMask4(laneMask));
+            __m128 const originX = _mm_load_ps(&packet.OriginX[lane]);
+            __m128 const originY = _mm_load_ps(&packet.OriginY[lane]);
+            __m128 const originZ = _mm_load_ps(&packet.OriginZ[lane]);
+            __m128 const directionX = _mm_load_ps(&packet.DirectionX[lane]);
+            __m128 const directionY = _mm_load_ps(&packet.DirectionY[lane]);
+            __m128 const directionZ = _mm_load_ps(&packet.DirectionZ[lane]);
+            __m128 bestDistance = _mm_load_ps(&closest.DistanceToSurface[lane]);
+            __m128i bestIndex = _mm_load_si128((__m128i const *)&closest.Index[lane]);
+
+            for (size_t i = 0; i < planes.Size(); i++)
+            {
+                __m128 const normalX = _mm_set1_ps(planes.NormalX[i]);
+                __m128 const normalY = _mm_set1_ps(planes.NormalY[i]);
+                __m128 const normalZ = _mm_set1_ps(planes.NormalZ[i]);
+                __m128 const denominator = _mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, normalX), _mm_mul_ps(directionY, normalY)), _mm_mul_ps(directionZ, normalZ));
+                __m128 const numerator = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(planes.PinX[i]), originX), normalX),
+                                                               _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(planes.PinY[i]), originY), normalY)),
+                                                    _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(planes.PinZ[i]), originZ), normalZ));
+                __m128 const distance = _mm_sub_ps(_mm_div_ps(numerator, denominator), offsetDelta);
+
+                // parallel rays never hit
+                __m128 const hit = _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(denominator, zero), _mm_cmpnlt_ps(distance, negativeOffsetDelta)),
+                                              _mm_cmplt_ps(distance, bestDistance));
+                __m128 const closer = _mm_and_ps(hit, active);
+                bestDistance = _mm_or_ps(_mm_and_ps(closer, distance), _mm_andnot_ps(closer, bestDistance));
+                __m128i const closerIndex = _mm_castps_si128(closer);
+                bestIndex = _mm_or_si128(_mm_and_si128(closerIndex, _mm_set1_epi32((int)i)), _mm_andnot_si128(closerIndex, bestIndex));
+            }
+
+            _mm_store_ps(&closest.DistanceToSurface[lane], bestDistance);
+            _mm_store_si128((__m128i *)&closest.Index[lane], bestIndex);
+        }
+    }
+
+    __attribute__((target("avx2"))) static __m256i getLaneMask8(uint32_t mask)
+    {
+        __m256i const bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)mask), bits), bits);
+    }
+
+    __attribute__((target("avx2"))) static uint32_t intersectBoxAvx2(Aabb const &box, RayPacket const &packet, PacketHits const &closest)
+    {
+        std::array<FloatingType_t const *, 3> const origins = {packet.OriginX.data(), packet.OriginY.data(), packet.OriginZ.data()};
+        std::array<FloatingType_t const *, 3> const inverseDirections = {packet.InverseDirectionX.data(), packet.InverseDirectionY.data(), packet.InverseDirectionZ.data()};
+
+        uint32_t mask = 0;
+        for (size_t lane = 0; lane < PACKET_SIZE; lane += 8)
+        {
+            if (!((packet.ActiveMask >> lane) & 0xff))
+                continue;
+
+            // candidates come first, so NaNs of rays parallel to a slab are dropped like in the single ray test
+            __m256 nearDistance = _mm256_setzero_ps();
+            __m256 farDistance = _mm256_load_ps(&closest.DistanceToSurface[lane]);
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                __m256 const origin = _mm256_load_ps(origins[axis] + lane);
+                __m256 const inverseDirection = _mm256_load_ps(inverseDirections[axis] + lane);
+                __m256 const t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.Min.Data[axis]), origin), inverseDirection);
+                __m256 const t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.Max.Data[axis]), origin), inverseDirection);
+                nearDistance = _mm256_max_ps(_mm256_min_ps(t0, t1), nearDistance);
+                farDistance = _mm256_min_ps(_mm256_max_ps(t0, t1), farDistance);
+            }
+            mask |= (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(nearDistance, farDistance, _CMP_LE_OQ)) << lane;
+        }
+        return mask & packet.ActiveMask;
+    }
+
+    __attribute__((target("avx2"))) static void intersectSpheresAvx2(SphereSoa const &spheres, size_t begin, size_t end, RayPacket const &packet, PacketHits &closest)
+    {
+        __m256 const zero = _mm256_setzero_ps();
+        __m256 const offsetDelta = _mm256_set1_ps(Shapes::OFFSET_DELTA);
+        __m256 const signBit = _mm256_set1_ps(-0.f);
+
+        for (size_t lane = 0; lane < PACKET_SIZE; lane += 8)
+        {
+            uint32_t const laneMask = (packet.ActiveMask >> lane) & 0xff;
+            if (!laneMask)
+                continue;
+
+            __m256 const active = _mm256_castsi256_ps(getLaneMask8(laneMask));
+            __m256 const originX = _mm256_load_ps(&packet.OriginX[lane]);
+            __m256 const originY = _mm256_load_ps(&packet.OriginY[lane]);
+            __m256 const originZ = _mm256_load_ps(&packet.OriginZ[lane]);
+            __m256 const directionX = _mm256_load_ps(&packet.DirectionX[lane]);
+            __m256 const directionY = _mm256_load_ps(&packet.DirectionY[lane]);
+            __m256 const directionZ = _mm256_load_ps(&packet.DirectionZ[lane]);
+            __m256 bestDistance = _mm256_load_ps(&closest.DistanceToSurface[lane]);
+            __m256 bestIndex = _mm256_load_ps((float const *)&closest.Index[lane]);
+
+            for (size_t i = begin; i < end; i++)
+            {
+                __m256 const betweenX = _mm256_sub_ps(originX, _mm256_set1_ps(spheres.CenterX[i]));
+                __m256 const betweenY = _mm256_sub_ps(originY, _mm256_set1_ps(spheres.CenterY[i]));
+                __m256 const betweenZ = _mm256_sub_ps(originZ, _mm256_set1_ps(spheres.CenterZ[i]));
+                __m256 const b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(betweenX, directionX), _mm256_mul_ps(betweenY, directionY)), _mm256_mul_ps(betweenZ, directionZ));
+                __m256 const c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(betweenX, betweenX), _mm256_mul_ps(betweenY, betweenY)), _mm256_mul_ps(betweenZ, betweenZ)),
+                                               _mm256_set1_ps(spheres.Radius[i] * spheres.Radius[i]));
+                __m256 const discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+
+                // no intersection, or ray is outside of sphere and pointing away from sphere
+                __m256 const outside = _mm256_cmp_ps(c, zero, _CMP_GT_OQ);
+                __m256 const miss = _mm256_or_ps(_mm256_cmp_ps(discriminant, zero, _CMP_LT_OQ), _mm256_and_ps(outside, _mm256_cmp_ps(b, zero, _CMP_GT_OQ)));
+
+                __m256 const root = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+                __m256 const signedRoot = _mm256_xor_ps(root, _mm256_andnot_ps(outside, signBit));
+                __m256 const distance = _mm256_sub_ps(_mm256_sub_ps(_mm256_xor_ps(b, signBit), signedRoot), offsetDelta);
+
+                __m256 const closer = _mm256_and_ps(_mm256_andnot_ps(miss, _mm256_cmp_ps(distance, bestDistance, _CMP_LT_OQ)), active);
+                bestDistance = _mm256_blendv_ps(bestDistance, distance, closer);
+                bestIndex = _mm256_blendv_ps(bestIndex, _mm256_castsi256_ps(_mm256_set1_epi32((int)i)), closer);
+            }
+
+            _mm256_store_ps(&closest.DistanceToSurface[lane], bestDistance);
+            _mm256_store_ps((float *)&closest.Index[lane], bestIndex);
+        }
+    }
+
+    __attribute__((target("avx2"))) static void intersectPlanesAvx2(PlaneSoa const &planes, RayPacket const &packet, PacketHits &closest)
+    {
+        __m256 const zero = _mm256_setzero_ps();
+        __m256 const offsetDelta = _mm256_set1_ps(Shapes::OFFSET_DELTA);
+        __m256 const negativeOffsetDelta = _mm256_set1_ps(-Shapes::OFFSET_DELTA);
+
+        for (size_t lane = 0; lane < PACKET_SIZE; lane += 8)
+        {
+            uint32_t const laneMask = (packet.ActiveMask >> lane) & 0xff;
+            if (!laneMask)
+                continue;
+
+            __m256 const active = _mm256_castsi256_ps(getLaneMask8(laneMask));
+            __m256 const originX = _mm256_load_ps(&packet.OriginX[lane]);
+            __m256 const originY = _mm256_load_ps(&packet.OriginY[lane]);
+            __m256 const originZ = _mm256_load_ps(&packet.OriginZ[lane]);
+            __m256 const directionX = _mm256_load_ps(&packet.DirectionX[lane]);
+            __m256 const directionY = _mm256_load_ps(&packet.DirectionY[lane]);
+            __m256 const directionZ = _mm256_load_ps(&packet.DirectionZ[lane]);
+            __m256 bestDistance = _mm256_load_ps(&closest.DistanceToSurface[lane]);
+            __m256 bestIndex = _mm256_load_ps((float const *)&closest.Index[lane]);
+
+            for (size_t i = 0; i < planes.Size(); i++)
+            {
+                __m256 const normalX = _mm256_set1_ps(planes.NormalX[i]);
+                __m256 const normalY = _mm256_set1_ps(planes.NormalY[i]);
+                __m256 const normalZ = _mm256_set1_ps(planes.NormalZ[i]);
+                __m256 const denominator = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(directionX, normalX), _mm256_mul_ps(directionY, normalY)), _mm256_mul_ps(directionZ, normalZ));
+                __m256 const numerator = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(planes.PinX[i]), originX), normalX),
+                                                                     _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(planes.PinY[i]), originY), normalY)),
+                                                       _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(planes.PinZ[i]), originZ), normalZ));
+                __m256 const distance = _mm256_sub_ps(_mm256_div_ps(numerator, denominator), offsetDelta);
+
+                // parallel rays never hit
+                __m256 const hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(denominator, zero, _CMP_NEQ_UQ), _mm256_cmp_ps(distance, negativeOffsetDelta, _CMP_NLT_UQ)),
+                                                 _mm256_cmp_ps(distance, bestDistance, _CMP_LT_OQ));
+                __m256 const closer = _mm256_and_ps(hit, active);
+                bestDistance = _mm256_blendv_ps(bestDistance, distance, closer);
+                bestIndex = _mm256_blendv_ps(bestIndex, _mm256_castsi256_ps(_mm256_set1_epi32((int)i)), closer);
+            }
+
+            _mm256_store_ps(&closest.DistanceToSurface[lane], bestDistance);
+            _mm256_store_ps((float *)&closest.Index[lane], bestIndex);
+        }
+    }
+
+    // a single register holds the whole packet, inactive lanes are masked out of every update. AVX-512 brings
+    // FMA along, contracting multiply and add would round differently than the single ray kernels
+
+    /// @brief _mm512_min_ps() with every lane selected. The unmasked intrinsic hands an undefined source register to
+    /// the builtin, which GCC 12 reports as uninitialized once it is inlined
+    __attribute__((target("avx512f"))) static inline __m512 min16(__m512 a, __m512 b)
+    {
+        return _mm512_mask_min_ps(a, 0xffff, a, b);
+    }
+
+    /// @brief _mm512_max_ps() with every lane selected, see min16()
+    __attribute__((target("avx512f"))) static inline __m512 max16(__m512 a, __m512 b)
+    {
+        return _mm512_mask_max_ps(a, 0xffff, a, b);
+    }
+
+    /// @brief _mm512_sqrt_ps() with every lane selected, see min16()
+    __attribute__((target("avx512f"))) static inline __m512 sqrt16(__m512 a)
+    {
+        return _mm512_mask_sqrt_ps(a, 0xffff, a);
+    }
+
+    __attribute__((target("avx512f"), optimize("fp-contract=off"))) static uint32_t intersectBoxAvx512(Aabb const &box, RayPacket const &packet, PacketHits const &closest)
+    {
+        std::array<FloatingType_t const *, 3> const origins = {packet.OriginX.data(), packet.OriginY.data(), packet.OriginZ.data()};
+        std::array<FloatingType_t const *, 3> const inverseDirections = {packet.InverseDirectionX.data(), packet.InverseDirectionY.data(), packet.InverseDirectionZ.data()};
+
+        // candidates come first, so NaNs of rays parallel to a slab are dropped like in the single ray test
+        __m512 nearDistance = _mm512_setzero_ps();
+        __m512 farDistance = _mm512_load_ps(closest.DistanceToSurface.data());
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            __m512 const origin = _mm512_load_ps(origins[axis]);
+            __m512 const inverseDirection = _mm512_load_ps(inverseDirections[axis]);
+            __m512 const t0 = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(box.Min.Data[axis]), origin), inverseDirection);
+            __m512 const t1 = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(box.Max.Data[axis]), origin), inverseDirection);
+            nearDistance = max16(min16(t0, t1), nearDistance);
+            farDistance = min16(max16(t0, t1), farDistance);
+        }
+        return _mm512_mask_cmp_ps_mask((__mmask16)packet.ActiveMask, nearDistance, farDistance, _CMP_LE_OQ);
+    }
+
+    __attribute__((target("avx512f"), optimize("fp-contract=off"))) static void intersectSpheresAvx512(SphereSoa const &spheres, size_t begin, size_t end, RayPacket const &packet, PacketHits &closest)
+    {
+        static_assert(PACKET_SIZE == 16, "AVX-512 kernel expects one packet per register");
+        __m512 const zero = _mm512_setzero_ps();
+        __m512 const offsetDelta = _mm512_set1_ps(Shapes::OFFSET_DELTA);
+
+        __mmask16 const active = (__mmask16)packet.ActiveMask;
+        __m512 const originX = _mm512_load_ps(packet.OriginX.data());
+        __m512 const originY = _mm512_load_ps(packet.OriginY.data());
+        __m512 const originZ = _mm512_load_ps(packet.OriginZ.data());
+        __m512 const directionX = _mm512_load_ps(packet.DirectionX.data());
+        __m512 const directionY = _mm512_load_ps(packet.DirectionY.data());
+        __m512 const directionZ = _mm512_load_ps(packet.DirectionZ.data());
+        __m512 bestDistance = _mm512_load_ps(closest.DistanceToSurface.data());
+        __m512i bestIndex = _mm512_load_si512(closest.Index.data());
+
+        for (size_t i = begin; i < end; i++)
+        {
+            __m512 const betweenX = _mm512_sub_ps(originX, _mm512_set1_ps(spheres.CenterX[i]));
+            __m512 const betweenY = _mm512_sub_ps(originY, _mm512_set1_ps(spheres.CenterY[i]));
+            __m512 const betweenZ = _mm512_sub_ps(originZ, _mm512_set1_ps(spheres.CenterZ[i]));
+            __m512 const b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(betweenX, directionX), _mm512_mul_ps(betweenY, directionY)), _mm512_mul_ps(betweenZ, directionZ));
+            __m512 const c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(betweenX, betweenX), _mm512_mul_ps(betweenY, betweenY)), _mm512_mul_ps(betweenZ, betweenZ)),
+                                           _mm512_set1_ps(spheres.Radius[i] * spheres.Radius[i]));
+            __m512 const discriminant = _mm512_sub_ps(_mm512_mul_ps(b, b), c);
+
+            // no intersection, or ray is outside of sphere and pointing away from sphere
+            __mmask16 const outside = _mm512_cmp_ps_mask(c, zero, _CMP_GT_OQ);
+            __mmask16 const miss = _mm512_cmp_ps_mask(discriminant, zero, _CMP_LT_OQ) | (outside & _mm512_cmp_ps_mask(b, zero, _CMP_GT_OQ));
+
+            __m512 const root = sqrt16(max16(discriminant, zero));
+            __m512 const signedRoot = _mm512_mask_sub_ps(root, (__mmask16)~outside, zero, root);
+            __m512 const distance = _mm512_sub_ps(_mm512_sub_ps(_mm512_sub_ps(zero, b), signedRoot), offsetDelta);
+
+            __mmask16 const closer = _mm512_mask_cmp_ps_mask(active & (__mmask16)~miss, distance, bestDistance, _CMP_LT_OQ);
+            bestDistance = _mm512_mask_mov_ps(bestDistance, closer, distance);
+            bestIndex = _mm512_mask_mov_epi32(bestIndex, closer, _mm512_set1_epi32((int)i));
+        }
+
+        _mm512_store_ps(closest.DistanceToSurface.data(), bestDistance);
+        _mm512_store_si512(closest.Index.data(), bestIndex);
+    }
+
+    __attribute__((target("avx512f"), optimize("fp-contract=off"))) static void intersectPlanesAvx512(PlaneSoa const &planes, RayPacket const &packet, PacketHits &closest)
+    {
+        __m512 const zero = _mm512_setzero_ps();
+        __m512 const offsetDelta = _mm512_set1_ps(Shapes::OFFSET_DELTA);
+        __m512 const negativeOffsetDelta = _mm512_set1_ps(-Shapes::OFFSET_DELTA);
+
+        __mmask16 const active = (__mmask16)packet.ActiveMask;
+        __m512 const originX = _mm512_load_ps(packet.OriginX.data());
+        __m512 const originY = _mm512_load_ps(packet.OriginY.data());
+        __m512 const originZ = _mm512_load_ps(packet.OriginZ.data());
+        __m512 const directionX = _mm512_load_ps(packet.DirectionX.data());
+        __m512 const directionY = _mm512_load_ps(packet.DirectionY.data());
+        __m512 const directionZ = _mm512_load_ps(packet.DirectionZ.data());
+        __m512 bestDistance = _mm512_load_ps(closest.DistanceToSurface.data());
+        __m512i bestIndex = _mm512_load_si512(closest.Index.data());
+
+        for (size_t i = 0; i < planes.Size(); i++)
+        {
+            __m512 const normalX = _mm512_set1_ps(planes.NormalX[i]);
+            __m512 const normalY = _mm512_set1_ps(planes.NormalY[i]);
+            __m512 const normalZ = _mm512_set1_ps(planes.NormalZ[i]);
+            __m512 const denominator = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(directionX, normalX), _mm512_mul_ps(directionY, normalY)), _mm512_mul_ps(directionZ, normalZ));
+            __m512 const numerator = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(planes.PinX[i]), originX), normalX),
+                                                                 _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(planes.PinY[i]), originY), normalY)),
+                                                   _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(planes.PinZ[i]), originZ), normalZ));
+            __m512 const distance = _mm512_sub_ps(_mm512_div_ps(numerator, denominator), offsetDelta);
+
+            // parallel rays never hit
+            __mmask16 const valid = _mm512_mask_cmp_ps_mask(active, denominator, zero, _CMP_NEQ_UQ) & _mm512_cmp_ps_mask(distance, negativeOffsetDelta, _CMP_NLT_UQ);
+            __mmask16 const closer = _mm512_mask_cmp_ps_mask(valid, distance, bestDistance, _CMP_LT_OQ);
+            bestDistance = _mm512_mask_mov_ps(bestDistance, closer, distance);
+            bestIndex = _mm512_mask_mov_epi32(bestIndex, closer, _mm512_set1_epi32((int)i));
+        }
+
+        _mm512_store_ps(closest.DistanceToSurface.data(), bestDistance);
+        _mm512_store_si512(closest.Index.data(), bestIndex);
+    }
+#endif
+
+    uint32_t IntersectBox(Aabb const &box, RayPacket const &packet, PacketHits const &closest, SimdLevel level)
+    {
+        DEBUG_ASSERT(level <= GetSimdLevel(), "Kernel not supported by this CPU");
+        switch (level)
+        {
+#if defined(__x86_64__)
+        case SimdLevel::Sse:
+            return intersectBoxSse(box, packet, closest);
+        case SimdLevel::Avx2:
+            return intersectBoxAvx2(box, packet, closest);
+        case SimdLevel::Avx512:
+            return intersectBoxAvx512(box, packet, closest);
+#endif
+        default:
+            return intersectBoxScalar(box, packet, closest);
+        }
+    }
+
+    void IntersectSpheres(SphereSoa const &spheres, size_t begin, size_t end, RayPacket const &packet, PacketHits &closest, SimdLevel level)
+    {
+        DEBUG_ASSERT(level <= GetSimdLevel(), "Kernel not supported by this CPU");
+        if (begin == end || !packet.ActiveMask)
+            return;
+
+        switch (level)
+        {
+#if defined(__x86_64__)
+        case SimdLevel::Sse:
+            return intersectSpheresSse(spheres, begin, end, packet, closest);
+        case SimdLevel::Avx2:
+            return intersectSpheresAvx2(spheres, begin, end, packet, closest);
+        case SimdLevel::Avx512:
+            return intersectSpheresAvx512(spheres, begin, end, packet, closest);
+#endif
+        default:
+            return intersectSpheresScalar(spheres, begin, end, packet, closest);
+        }
+    }
+
+    void IntersectPlanes(PlaneSoa const &planes, RayPacket const &packet, PacketHits &closest, SimdLevel level)
+    {
+        DEBUG_ASSERT(level <= GetSimdLevel(), "Kernel not supported by this CPU");
+        if (planes.Size() == 0 || !packet.ActiveMask)
+            return;
+
+        switch (level)
+        {
+#if defined(__x86_64__)
+        case SimdLevel::Sse:
+            return intersectPlanesSse(planes, packet, closest);
+        case SimdLevel::Avx2:
+            return intersectPlanesAvx2(planes, packet, closest);
+        case SimdLevel::Avx512:
+            return intersectPlanesAvx512(planes, packet, closest);
+#endif
+        default:
+            return intersectPlanesScalar(planes, packet, closest);
+        }
+    }
+}
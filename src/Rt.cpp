@@ -1,51 +1,199 @@
 #include "Rt.h"
 
 #include <algorithm>
-#include <thread>
+#include <sstream>
 
 #include "Debug.h"
 
 namespace Rt
 {
-    // see if ray intersects any object
-    struct rayIntersection_t
+    /// @brief sin² of DIFFUSE_LOBE_ANGLE, radius² of the disk probes are projected from
+    FloatingType_t const DIFFUSE_LOBE_SIN_SQUARED = sin(DIFFUSE_LOBE_ANGLE) * sin(DIFFUSE_LOBE_ANGLE);
+    /// @brief Mean of cos(angle) of the probes towards the surface normal
+    FloatingType_t const DIFFUSE_LOBE_MEAN_COSINE = Sampling::GetCosineConeMeanCosine(cos(DIFFUSE_LOBE_ANGLE));
+    /// @brief Probes have no density beyond this cosine towards the surface normal
+    FloatingType_t const DIFFUSE_LOBE_MIN_COSINE = cos(DIFFUSE_LOBE_ANGLE);
+    /// @brief Solid angle density of a probe per cosine towards the surface normal, see SpawnDiffuseProbe()
+    FloatingType_t const DIFFUSE_LOBE_PDF_PER_COSINE = 1 / (FloatingType_t{M_PI} * DIFFUSE_LOBE_SIN_SQUARED);
+
+    /// @return Cosine of the angle between reflection and surface normal, 1 is perpendicular incidence
+    inline FloatingType_t getCosineOfIncidence(Shapes::HitEvent const &hitEvent)
+    {
+        // both are normalized, rounding may still exceed 1 slightly
+        return std::min(FloatingType_t{1}, abs(hitEvent.ReflectedRay.Direction * hitEvent.SurfaceNormal));
+    }
+
+    inline FloatingType_t getApparentDiffusionFactor(Materials::Material const &material, FloatingType_t cosineOfIncidence)
+    {
+        // lerp between diffusion factor and 0 between the range critical cosine .. 0 (90°)
+        FloatingType_t const apparentDiffusionFactor = cosineOfIncidence >= material.CriticalCosine ? material.DiffusionFactor
+                                                                                                     : material.DiffusionFactor * cosineOfIncidence / material.CriticalCosine;
+        DEBUG_ASSERT(apparentDiffusionFactor >= 0 && apparentDiffusionFactor <= material.DiffusionFactor, "Bad diffusion fadeout");
+        return apparentDiffusionFactor;
+    }
+
+    /// @brief Shares of a hit's light that go on through its mirror reflection and through its diffuse probes
+    struct lobeWeights_t
     {
-        Shapes::Shape const *Shape;
-        Shapes::HitEvent Hitevent;
+        FloatingType_t Reflection = 0;
+        FloatingType_t Diffuse = 0;
     };
 
-    constexpr unsigned int constexpr_pow(unsigned int base, unsigned int power)
+    /// @brief Weights MarchRay() ends up giving the children of a parent that has no siblings. The reflection only
+    /// keeps 0.3 of the share it is normalized with, so a hit spawning both lobes passes on less than it receives,
+    /// while a lone child gets everything
+    /// @param probes Probes MarchRay() spawns per diffuse hit
+    inline lobeWeights_t getLobeWeights(Materials::Material const &material, FloatingType_t cosineOfIncidence, FloatingType_t apparentDiffusionFactor, uint32_t probes)
+    {
+        FloatingType_t const reflectionWeight = FloatingType_t{1} - apparentDiffusionFactor;
+        bool const hasReflection = reflectionWeight > 0.01;
+        // mirror material or total reflection never scatter diffusely
+        uint32_t const probeCount = apparentDiffusionFactor >= 0.01 && cosineOfIncidence >= material.CriticalCosine ? probes : 0;
+        if (probeCount == 0)
+            return lobeWeights_t{.Reflection = hasReflection ? FloatingType_t{1} : FloatingType_t{0}};
+        if (!hasReflection && probeCount == 1)
+            return lobeWeights_t{.Diffuse = 1};
+
+        FloatingType_t const diffuseWeight = probeCount * DIFFUSE_LOBE_MEAN_COSINE;
+        FloatingType_t const weightSum = (hasReflection ? reflectionWeight : 0) + diffuseWeight;
+        return lobeWeights_t{.Reflection = hasReflection ? reflectionWeight * (FloatingType_t)0.3 / weightSum : 0, .Diffuse = diffuseWeight / weightSum};
+    }
+
+    size_t GenerationScratch::GetRequiredCapacity(RenderSettings const &settings)
+    {
+        // the last generation spawns no further rays. Without probes a hit still spawns its reflection
+        size_t capacity = 1;
+        for (size_t i = 0; i < settings.RayGenerations; i++)
+            capacity *= std::max(settings.DiffuseRays, 1u);
+        return capacity;
+    }
+
+    GenerationScratch::GenerationScratch(RenderSettings const &settings)
+        : Capacity{GetRequiredCapacity(settings)}
+    {
+        // default-initialized, MarchRay() never reads beyond what it has written
+        for (auto &generation : Generations)
+            generation.reset(new generationElement_t[Capacity]);
+    }
+
+    size_t GenerationScratch::GetCapacity() const
+    {
+        return Capacity;
+    }
+
+    /// @brief Octant of a direction, one bit per negative component. Same signs as the inverse direction the tree
+    /// traversal orders its children by
+    inline uint32_t getOctant(Vec3d const &direction)
     {
-        unsigned int multiplier = base;
-        for (size_t i = 0; i < power - 1; i++)
-            multiplier *= base;
-        return multiplier;
+        return (uint32_t)std::signbit(direction.X()) | (uint32_t)std::signbit(direction.Y()) << 1 | (uint32_t)std::signbit(direction.Z()) << 2;
     }
 
-    Raytracer::Raytracer(unsigned int seed)
-        : RngEngine{seed}
+    /// @brief Stable counting sort of elements by small keys
+    /// @param keys Key per element, in [0, keyCount)
+    /// @param order Receives the elements sorted by key
+    /// @param keyStarts Receives the position of each key's first element within order, plus the end
+    void sortByKeys(std::span<uint32_t const> keys, size_t keyCount, std::span<uint32_t> order, std::vector<uint32_t> &keyStarts)
+    {
+        DEBUG_ASSERT(order.size() == keys.size(), "Order must have room for every element");
+        keyStarts.assign(keyCount + 1, 0);
+        for (uint32_t const key : keys)
+            keyStarts[key + 1]++;
+        for (size_t key = 0; key < keyCount; key++)
+            keyStarts[key + 1] += keyStarts[key];
+
+        // positions are handed out in element order, which keeps the sort stable
+        for (uint32_t i = 0; i < keys.size(); i++)
+            order[keyStarts[keys[i]]++] = i;
+
+        // every start was moved to the start of the next key
+        std::copy_backward(keyStarts.begin(), keyStarts.end() - 1, keyStarts.end());
+        keyStarts[0] = 0;
+    }
+
+    void WavefrontScratch::Grow(size_t length)
+    {
+        if (Hits.size() >= length)
+            return;
+
+        Hits.resize(length);
+        Shading.resize(length);
+        Keys.resize(length);
+        Order.resize(length);
+    }
+
+    StageTimes &StageTimes::operator+=(StageTimes const &other)
+    {
+        Generate += other.Generate;
+        Intersect += other.Intersect;
+        Shade += other.Shade;
+        Compact += other.Compact;
+        Rays += other.Rays;
+        return *this;
+    }
+
+    std::string StageTimes::ToString() const
+    {
+        double const total = (Generate + Intersect + Shade + Compact).count();
+        std::stringstream stream;
+        stream.precision(1);
+        stream << std::fixed;
+        stream << "Stages:";
+        for (auto const &[label, time] : {std::pair{"generate", Generate}, std::pair{"intersect", Intersect}, std::pair{"shade", Shade}, std::pair{"compact", Compact}})
+            stream << " " << label << " " << time.count() * 1000 << "ms (" << (total > 0 ? time.count() * 100 / total : 0) << "%)";
+        stream << ", " << Rays << " rays\n";
+        return stream.str();
+    }
+
+    WorkerState::WorkerState(RenderSettings const &settings)
+        : Scratch{settings}
     {
     }
 
+    Raytracer::Raytracer(unsigned int seed, RenderSettings const &settings, std::span<Shapes::Shape const *const> objects)
+        : Seed{seed}, Settings{settings}, CompiledObjects{objects}
+    {
+    }
+
+    ColorD_t Raytracer::TracePixel(Line const &ray, uint32_t x, uint32_t y, uint32_t pass, WorkerState &worker, PrimaryHits const *primary) const
+    {
+        // every sample sees the same first hit
+        if (Settings.Mode == Integrator::PrimaryVisibility)
+        {
+            Scene::Intersection const nearest = primary ? primary->Camera : CompiledObjects.GetClosestIntersection(ray);
+            worker.Bounces += nearest.Material ? Settings.SamplesPerPixel : 0;
+            return ShadeFirstHit(nearest, ray);
+        }
+
+        ColorD_t sum{0, 0, 0};
+        for (unsigned int i = 0; i < Settings.SamplesPerPixel; i++)
+        {
+            Random::Stream random{Settings.Sampler, Seed, x, y, pass * Settings.SamplesPerPixel + i, Settings.ExpectedSamples};
+            sum = sum + (Settings.Mode == Integrator::PathTracing ? TracePath(ray, random, worker, primary) : MarchRay(ray, random, worker, primary));
+        }
+
+        return sum * (FloatingType_t{1} / Settings.SamplesPerPixel);
+    }
+
     void Raytracer::RunBitmap(Bitmap::BitmapD &output)
     {
-        Transformation::Map2Sphere const cameraTransformation{Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT, Camera::FOV};
+        WorkerState worker{Settings};
+        Camera::RayTable const &camera = GetCameraRays(worker, output.GetWidth(), output.GetHeight());
         unsigned int lastProgress = 0;
-        for (size_t y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+        for (size_t y = 0; y < output.GetHeight(); y++)
         {
-            for (size_t x = 0; x < Bitmap::BITMAP_WIDTH; x++)
+            for (size_t x = 0; x < output.GetWidth(); x++)
             {
                 // first ray comes from cam
-                Line ray = {Camera::Origin, cameraTransformation.Transform(x, y)};
+                Line ray = GetCameraRay(camera, (uint32_t)x, (uint32_t)y, 0);
 
                 // Let ray bounce around and determine the color
-                auto const pixelcolor = MarchRay(ray);
+                auto const pixelcolor = TracePixel(ray, (uint32_t)x, (uint32_t)y, 0, worker);
 
                 // paint pixel with object color into *image space*
                 std::copy(pixelcolor.Data.begin(), pixelcolor.Data.end(), output.atPixel(x, y));
             }
 
-            unsigned int progress = y * 100u / Bitmap::BITMAP_HEIGHT;
+            unsigned int progress = y * 100u / output.GetHeight();
             if (progress != lastProgress)
             {
                 lastProgress = progress;
@@ -54,170 +202,401 @@ namespace Rt
         }
     }
 
-    void Raytracer::RunBitmapParallel(Bitmap::BitmapD &output, unsigned int numSidethreads)
+    // scheduler tiles map onto whole tiles of the tiled layout, so workers never share its pages
+    static_assert(Scheduler::TILE_SIZE % Bitmap::TILE_EDGE == 0, "Scheduler tiles must cover whole layout tiles");
+
+    template <typename TAccumulator>
+    void Raytracer::RenderTile(Scheduler::Tile const &tile, TAccumulator &accumulator, unsigned int firstPass, unsigned int passes, WorkerState &worker, Aov::Framebuffer *aovs) const
     {
-        // spawn threads
-        std::vector<std::thread> sidethreads;
-        size_t argFromX = 0;
-        size_t argFromY = 0;
-        size_t const xStep = (size_t)ceil((FloatingType_t)Bitmap::BITMAP_WIDTH / (FloatingType_t)numSidethreads);
-        size_t const yStep = (size_t)ceil((FloatingType_t)Bitmap::BITMAP_HEIGHT / (FloatingType_t)numSidethreads);
-        for (size_t i = 0; i < numSidethreads; i++)
+        if (passes == 0)
+            return;
+
+        // camera rays only have no bounces to advance together
+        DEBUG_ASSERT(!aovs || (aovs->GetWidth() == accumulator.GetWidth() && aovs->GetHeight() == accumulator.GetHeight()), "AOVs must have the size of the accumulator");
+        if (Settings.Backend == Engine::Wavefront && Settings.Mode != Integrator::PrimaryVisibility)
+            return RenderTileWavefront(tile, accumulator, firstPass, passes, worker, aovs);
+
+        Camera::RayTable const &camera = GetCameraRays(worker, accumulator.GetWidth(), accumulator.GetHeight());
+        std::array<PrimaryHits, Scene::PACKET_SIZE> primaryHits;
+
+        // camera rays of neighbouring pixels are coherent, so blocks of them are traced together. Unless the camera
+        // jitters, the hits do not depend on the pass and all passes share them
+        unsigned int const sharedPasses = camera.Config.Jitter ? 1 : passes;
+        for (unsigned int blockY = tile.FromY; blockY < tile.ToY; blockY += PACKET_HEIGHT)
         {
-            size_t const argToX = std::min((size_t)Bitmap::BITMAP_WIDTH, argFromX + xStep);
-            size_t const argToY = std::min((size_t)Bitmap::BITMAP_HEIGHT, argFromY + yStep);
-
-            // run as sidethread
-            sidethreads.emplace_back([this, &output](size_t fromY, size_t toY, size_t argFromX, size_t argToX)
-                                     {
-                                        Transformation::Map2Sphere const cameraTransformation{Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT, Camera::FOV};
-                                        for (size_t y = fromY; y < toY; y++)
-                                        {
-                                            for (size_t x = argFromX; x < argToX; x++)
-                                            {
-                                                // first ray comes from cam
-                                                Line ray = {Camera::Origin, cameraTransformation.Transform(x, y)};
-
-                                                // Let ray bounce around and determine the color
-                                                ColorD_t const pixelcolor = MarchRay(ray);
-
-                                                // paint pixel with object color into *image space*
-                                                std::copy(pixelcolor.Data.begin(), pixelcolor.Data.end(), output.atPixel(x, y));
-                                            }
-                                        } },
-                                     argFromY, argToY, 0, Bitmap::BITMAP_WIDTH);
-            argFromX += xStep;
-            argFromY += yStep;
-        }
+            for (unsigned int blockX = tile.FromX; blockX < tile.ToX; blockX += PACKET_WIDTH)
+            {
+                Scheduler::Tile const block{blockX, blockY, std::min(tile.ToX, blockX + PACKET_WIDTH), std::min(tile.ToY, blockY + PACKET_HEIGHT)};
+                for (unsigned int firstShared = firstPass; firstShared < firstPass + passes; firstShared += sharedPasses)
+                {
+                    Scene::RayPacket cameraRays;
+                    for (unsigned int y = block.FromY; y < block.ToY; y++)
+                        for (unsigned int x = block.FromX; x < block.ToX; x++)
+                            cameraRays.Set((y - block.FromY) * PACKET_WIDTH + (x - block.FromX), GetCameraRay(camera, x, y, firstShared));
+                    TracePrimaryHits(cameraRays, primaryHits);
+                    if (aovs && firstShared == firstPass)
+                        WriteFirstHits(block, primaryHits, *aovs);
+
+                    for (unsigned int y = block.FromY; y < block.ToY; y++)
+                    {
+                        for (unsigned int x = block.FromX; x < block.ToX; x++)
+                        {
+                            // first ray comes from cam
+                            size_t const lane = (y - block.FromY) * PACKET_WIDTH + (x - block.FromX);
+                            Line const ray = cameraRays.Get(lane);
+                            PrimaryHits const &primary = primaryHits[lane];
 
-        // wait for completion
-        for (auto &thread : sidethreads)
-            thread.join();
+                            // Let ray bounce around and determine the color, summed over the passes sharing it
+                            ColorD_t pixelcolor{0, 0, 0};
+                            worker.Bounces = 0;
+                            for (unsigned int pass = firstShared; pass < firstShared + sharedPasses; pass++)
+                                pixelcolor = pixelcolor + TracePixel(ray, x, y, pass, worker, &primary);
+
+                            // add to pixel in *image space*, the tile belongs to this worker alone
+                            FloatingType_t *const target = accumulator.atPixel(x, y);
+                            for (size_t i = 0; i < Bitmap::COLOR_COUNT; i++)
+                                target[i] += pixelcolor.Data[i];
+                            if (aovs)
+                                aovs->Bounces[aovs->GetIndex(x, y)] += worker.Bounces;
+                        }
+                    }
+                }
+            }
+        }
     }
 
-    inline rayIntersection_t GetClosestIntersection(Line const &ray)
+    void Raytracer::RenderTileAdaptive(Scheduler::Tile const &tile, Adaptive::Frame &frame, WorkerState &worker, Aov::Framebuffer *aovs) const
     {
-        std::array<rayIntersection_t, Scene::Objects.size()> possibleHits = {};
-        unsigned int hitCount = 0;
-        for (unsigned int i = 0; i < Scene::Objects.size(); i++)
+        DEBUG_ASSERT(!aovs || (aovs->GetWidth() == frame.GetWidth() && aovs->GetHeight() == frame.GetHeight()), "AOVs must have the size of the frame");
+        Camera::RayTable const &camera = GetCameraRays(worker, frame.GetWidth(), frame.GetHeight());
+        std::array<PrimaryHits, Scene::PACKET_SIZE> primaryHits;
+        std::array<unsigned int, Scene::PACKET_SIZE> roundPasses;
+
+        // same blocks as RenderTile(), converged ones are skipped before their camera rays are traced
+        for (unsigned int blockY = tile.FromY; blockY < tile.ToY; blockY += PACKET_HEIGHT)
         {
-            Shapes::Shape const *shape = Scene::Objects[i];
+            for (unsigned int blockX = tile.FromX; blockX < tile.ToX; blockX += PACKET_WIDTH)
+            {
+                Scheduler::Tile const block{blockX, blockY, std::min(tile.ToX, blockX + PACKET_WIDTH), std::min(tile.ToY, blockY + PACKET_HEIGHT)};
+                bool isActive = false;
+                unsigned int maxPasses = 1;
+                for (unsigned int y = block.FromY; y < block.ToY; y++)
+                {
+                    for (unsigned int x = block.FromX; x < block.ToX; x++)
+                    {
+                        size_t const lane = (y - block.FromY) * PACKET_WIDTH + (x - block.FromX);
+                        roundPasses[lane] = frame.GetRoundPasses(x, y);
+                        isActive |= frame.IsActive(x, y);
+                        if (frame.IsActive(x, y))
+                            maxPasses = std::max(maxPasses, roundPasses[lane]);
+                    }
+                }
+                if (!isActive)
+                    continue;
 
-            auto hitevent = shape->CheckHit(ray);
-            if (!hitevent)
-                continue;
+                // passes continue the pixel's own sequence, the result does not depend on how many rounds it took. A
+                // jittering camera traces the lanes pass by pass, each one at its pixel's own pass index
+                unsigned int const steps = camera.Config.Jitter ? maxPasses : 1;
+                for (unsigned int step = 0; step < steps; step++)
+                {
+                    Scene::RayPacket cameraRays;
+                    for (unsigned int y = block.FromY; y < block.ToY; y++)
+                    {
+                        for (unsigned int x = block.FromX; x < block.ToX; x++)
+                        {
+                            size_t const lane = (y - block.FromY) * PACKET_WIDTH + (x - block.FromX);
+                            if (frame.IsActive(x, y) && (step == 0 || step < roundPasses[lane]))
+                                cameraRays.Set(lane, GetCameraRay(camera, x, y, frame.At(x, y).Passes));
+                        }
+                    }
+                    TracePrimaryHits(cameraRays, primaryHits);
+
+                    for (unsigned int y = block.FromY; y < block.ToY; y++)
+                    {
+                        for (unsigned int x = block.FromX; x < block.ToX; x++)
+                        {
+                            size_t const lane = (y - block.FromY) * PACKET_WIDTH + (x - block.FromX);
+                            if (!cameraRays.IsActive(lane))
+                                continue;
+
+                            Line const ray = cameraRays.Get(lane);
+                            PrimaryHits const &primary = primaryHits[lane];
+                            Adaptive::PixelStatistics &pixel = frame.At(x, y);
+                            worker.Bounces = 0;
+                            unsigned int const stepPasses = camera.Config.Jitter ? std::min(roundPasses[lane] - step, 1u) : roundPasses[lane];
+                            for (unsigned int passes = stepPasses; passes > 0; passes--)
+                                pixel.Add(TracePixel(ray, x, y, pixel.Passes, worker, &primary));
 
-            possibleHits[hitCount++] = rayIntersection_t{shape, hitevent.value()};
+                            if (aovs)
+                            {
+                                if (step == 0)
+                                    aovs->SetFirstHit(x, y, primary.Camera, CompiledObjects.GetShapeIndex(primary.Camera.Material));
+                                aovs->Bounces[aovs->GetIndex(x, y)] += worker.Bounces;
+                            }
+                        }
+                    }
+                }
+            }
         }
+    }
 
-        if (hitCount == 0)
-            return rayIntersection_t{};
+    void Raytracer::TracePrimaryHits(Scene::RayPacket const &cameraRays, std::array<PrimaryHits, Scene::PACKET_SIZE> &hits) const
+    {
+        std::array<Scene::Intersection, Scene::PACKET_SIZE> intersections;
+        CompiledObjects.GetClosestIntersections(cameraRays, intersections);
 
-        // find element with shortest distance
-        FloatingType_t shortestDistance = INFINITY;
-        decltype(possibleHits)::iterator nearest = possibleHits.end();
-        for (auto it = possibleHits.begin(); it < possibleHits.begin() + hitCount; it++)
+        // reflections of a smooth surface stay coherent, rays that hit nothing are dropped from the packet
+        Scene::RayPacket reflectedRays;
+        bool const needsReflections = Settings.Mode != Integrator::PrimaryVisibility;
+        for (size_t lane = 0; lane < Scene::PACKET_SIZE; lane++)
         {
-            if (!it->Shape)
+            if (!cameraRays.IsActive(lane))
                 continue;
+            hits[lane].Camera = intersections[lane];
+            if (needsReflections && intersections[lane].Material)
+                reflectedRays.Set(lane, intersections[lane].Hitevent.ReflectedRay);
+        }
 
-            if (it->Hitevent.DistanceToSurface >= shortestDistance)
-                continue;
+        if (!reflectedRays.ActiveMask)
+            return;
 
-            shortestDistance = it->Hitevent.DistanceToSurface;
-            nearest = it;
+        CompiledObjects.GetClosestIntersections(reflectedRays, intersections);
+        for (size_t lane = 0; lane < Scene::PACKET_SIZE; lane++)
+            if (reflectedRays.IsActive(lane))
+                hits[lane].Reflection = intersections[lane];
+    }
+
+    void Raytracer::WriteFirstHits(Scheduler::Tile const &block, std::array<PrimaryHits, Scene::PACKET_SIZE> const &hits, Aov::Framebuffer &aovs) const
+    {
+        for (unsigned int y = block.FromY; y < block.ToY; y++)
+        {
+            for (unsigned int x = block.FromX; x < block.ToX; x++)
+            {
+                Scene::Intersection const &hit = hits[(y - block.FromY) * PACKET_WIDTH + (x - block.FromX)].Camera;
+                aovs.SetFirstHit(x, y, hit, CompiledObjects.GetShapeIndex(hit.Material));
+            }
         }
+    }
+
+    ColorD_t Raytracer::ShadeFirstHit(Scene::Intersection const &nearest, Line const &ray)
+    {
+        if (!nearest.Material)
+            return ColorD_t{0, 0, 0};
+
+        Materials::Material const &material = *nearest.Material;
+        if (material.IsLightsource)
+            return material.Emission;
 
-        return *nearest;
+        // albedo in the range of the emission, so both read alike
+        return (255 * abs(ray.Direction * nearest.Hitevent.SurfaceNormal)) * material.ColorFilter;
     }
 
-    ColorD_t Raytracer::MarchRay(Line const &ray)
+    Camera::RayTable const &Raytracer::GetCameraRays(WorkerState &worker, unsigned int width, unsigned int height) const
     {
-        struct generationElement_t
-        {
-            uint16_t ParentRayIndex;
-            float ParentWeight;
-            float Weight;
-            Vec3d ColorFilter;
-        };
-        struct generation_t
-        {
-            std::array<generationElement_t, constexpr_pow(NUM_DIFFUSE_RAYS, NUM_RAY_GENERATIONS)> Elements;
-            uint16_t Count;
-        };
-        struct parentRays_t
+        if (!worker.CameraRays || !worker.CameraRays->IsFor(Settings.View, width, height))
+            worker.CameraRays.emplace(Settings.View, width, height);
+        return *worker.CameraRays;
+    }
+
+    Line Raytracer::GetCameraRay(Camera::RayTable const &camera, uint32_t x, uint32_t y, uint32_t pass) const
+    {
+        if (!camera.Config.Jitter)
+            return camera.GetRay(x, y);
+
+        // the first sample of the pass keys the offset, so the sampler spreads the offsets of consecutive passes
+        Random::Stream random{Settings.Sampler, Seed, x, y, pass * Settings.SamplesPerPixel, Settings.ExpectedSamples};
+        random.SetBounce(Random::CAMERA_BOUNCE);
+        return camera.GetRay(x, y, random.Get(0) - FloatingType_t{0.5}, random.Get(1) - FloatingType_t{0.5});
+    }
+
+    std::unique_ptr<WorkerState> Raytracer::CreateWorkerState() const
+    {
+        return std::make_unique<WorkerState>(Settings);
+    }
+
+    unsigned int Raytracer::GetSeed() const
+    {
+        return Seed;
+    }
+
+    RenderSettings const &Raytracer::GetSettings() const
+    {
+        return Settings;
+    }
+
+    RenderContext::RenderContext(Raytracer const &raytracer, unsigned int numWorkers)
+        : Tracer{raytracer}, Pool{numWorkers}
+    {
+        for (unsigned int i = 0; i < Pool.GetWorkerCount(); i++)
+            Workers.push_back(Tracer.CreateWorkerState());
+    }
+
+    template <typename TAccumulator>
+    void RenderContext::SubmitPasses(TAccumulator &accumulator, unsigned int passes, Aov::Framebuffer *aovs, TileDone_t tileDone)
+    {
+        // previous frame may still write its accumulator
+        Pool.Wait();
+        for (auto &worker : Workers)
+            worker->Wavefront.Times = StageTimes{};
+        Aovs = aovs;
+        TileDone = std::move(tileDone);
+        FirstPass += Passes;
+        Passes = passes;
+        Pool.Submit(accumulator.GetWidth(), accumulator.GetHeight(), [this, &accumulator](unsigned int worker, Scheduler::Tile const &tile)
+                    {
+                        Tracer.RenderTile(tile, accumulator, FirstPass, Passes, *Workers[worker], Aovs);
+                        if (TileDone)
+                            TileDone(tile); });
+    }
+
+    void RenderContext::Submit(Bitmap::BitmapD &accumulator, unsigned int passes, Aov::Framebuffer *aovs, TileDone_t tileDone)
+    {
+        SubmitPasses(accumulator, passes, aovs, std::move(tileDone));
+    }
+
+    void RenderContext::Submit(Bitmap::TiledBitmapD &accumulator, unsigned int passes, Aov::Framebuffer *aovs, TileDone_t tileDone)
+    {
+        SubmitPasses(accumulator, passes, aovs, std::move(tileDone));
+    }
+
+    void RenderContext::Detile(Bitmap::TiledBitmapD const &accumulator, Bitmap::BitmapD &output)
+    {
+        DEBUG_ASSERT(accumulator.HasSizeOf(output), "Output must have the size of the accumulator");
+        // the frame in flight still writes the accumulator
+        Pool.Wait();
+        Pool.Run(output.GetWidth(), output.GetHeight(), [&accumulator, &output](unsigned int, Scheduler::Tile const &tile)
+                 { accumulator.Detile(output, tile.FromX, tile.FromY, tile.ToX, tile.ToY); });
+    }
+
+    Adaptive::Summary const &RenderContext::RenderAdaptive(Adaptive::Frame &frame, Aov::Framebuffer *aovs, TileDone_t tileDone)
+    {
+        // previous frame may still write its accumulator
+        Pool.Wait();
+        auto const start = std::chrono::steady_clock::now();
+        do
         {
-            std::array<Line, constexpr_pow(NUM_DIFFUSE_RAYS, NUM_RAY_GENERATIONS - 1)> Rays;
-            uint16_t Count;
-        };
-        std::array<generation_t, 2> generationBuffer{};
-        std::array<parentRays_t, 2> generationRays{};
+            Pool.Run(frame.GetWidth(), frame.GetHeight(), [this, &frame, aovs, &tileDone](unsigned int worker, Scheduler::Tile const &tile)
+                     {
+                         Tracer.RenderTileAdaptive(tile, frame, *Workers[worker], aovs);
+                         if (tileDone)
+                             tileDone(tile); });
+        } while (frame.EndRound(std::chrono::steady_clock::now() - start));
+        return frame.GetSummary();
+    }
+
+    unsigned int RenderContext::GetSubmittedPasses() const
+    {
+        return FirstPass + Passes;
+    }
+
+    void RenderContext::ResumeAt(unsigned int passes)
+    {
+        // the frame in flight still reads FirstPass
+        Pool.Wait();
+        FirstPass = passes;
+        Passes = 0;
+    }
+
+    Raytracer const &RenderContext::GetRaytracer() const
+    {
+        return Tracer;
+    }
+
+    bool RenderContext::Poll() const
+    {
+        return Pool.Poll();
+    }
+
+    Scheduler::FrameStatistics RenderContext::Wait()
+    {
+        return Pool.Wait();
+    }
+
+    StageTimes RenderContext::GetStageTimes() const
+    {
+        StageTimes times;
+        for (auto const &worker : Workers)
+            times += worker->Wavefront.Times;
+        return times;
+    }
+
+    ColorD_t Raytracer::MarchRay(Line const &ray, Random::Stream &random, WorkerState &worker, PrimaryHits const *primary) const
+    {
+        using generationElement_t = GenerationScratch::generationElement_t;
+        GenerationScratch &scratch = worker.Scratch;
+        DEBUG_ASSERT(scratch.GetCapacity() >= GenerationScratch::GetRequiredCapacity(Settings), "Scratch too small for settings");
+
         Vec3d emissionAccumulator{0, 0, 0};
         FloatingType_t weightSum;
+        uint32_t const probesPerHit = GetProbesPerHit();
+        // the mirror reflection of the camera ray comes first in generation 1, if it was spawned at all
+        bool firstIsReflection = false;
+        // generations that hit anything so far
+        uint32_t bounces = 0;
 
-        // asserts
-        {
-            size_t const STACK_SIZE_KB = (sizeof(generationBuffer) + sizeof(generationRays)) / 1024u;
-            static_assert(STACK_SIZE_KB < 1024, "Critical Stack Size");
-            static_assert(constexpr_pow(2, sizeof(generation_t::Count) * 8) > generationBuffer[0].Elements.size(), "Count is too small");
-            static_assert(constexpr_pow(2, sizeof(parentRays_t::Count) * 8) > generationRays[0].Rays.size(), "Count is too small");
-            static_assert(constexpr_pow(2, sizeof(generationElement_t::ParentRayIndex) * 8) > generationRays[0].Rays.size(), "ParentRayIndex is too small");
-        }
-
-        // prepare initial conditions
-        generationRays[0].Rays[0] = ray;
-        generationBuffer[0].Count = 1;
-        generationBuffer[0].Elements[0] = generationElement_t{
-            .ParentRayIndex = 0,
+        // prepare initial conditions, only the live range of each generation is ever touched
+        scratch.Counts[0] = 1;
+        scratch.Generations[0][0] = generationElement_t{
+            .Ray = ray,
             .ParentWeight = 1.0,
             .Weight = 1.0,
-            .ColorFilter = Vec3d{1, 1, 1}};
+            .ColorFilter = Vec3d{1, 1, 1},
+            .ProbeCosine = 0,
+            .DirectLight = ColorD_t{0, 0, 0}};
 
-        for (size_t generationIndex = 0; generationIndex < NUM_RAY_GENERATIONS + 1; generationIndex++)
+        for (size_t generationIndex = 0; generationIndex < Settings.RayGenerations + 1; generationIndex++)
         {
             // swaps buffers on each iteration automatically
-            generation_t const &lastGeneration = generationBuffer[generationIndex % 2];
-            generation_t &nextGeneration = generationBuffer[(1 + generationIndex) % 2];
-
-            parentRays_t const &lastRays = generationRays[generationIndex % 2];
-            parentRays_t &nextRays = generationRays[(1 + generationIndex) % 2];
+            generationElement_t const *lastGeneration = scratch.Generations[generationIndex % 2].get();
+            size_t const lastCount = scratch.Counts[generationIndex % 2];
+            generationElement_t *nextGeneration = scratch.Generations[(1 + generationIndex) % 2].get();
+            size_t &nextCount = scratch.Counts[(1 + generationIndex) % 2];
 
             // "clear" next generation
-            nextGeneration.Count = 0;
-            nextRays.Count = 0;
+            nextCount = 0;
             weightSum = 0;
 
-            for (size_t i = 0; i < lastGeneration.Count; i++)
+            // every probe of the generation gets its own dimensions
+            random.SetBounce((uint32_t)generationIndex);
+            uint32_t probeCount = 0;
+
+            for (size_t i = 0; i < lastCount; i++)
             {
-                generationElement_t const &parentElement = lastGeneration.Elements[i];
+                generationElement_t const &parentElement = lastGeneration[i];
 
                 // skip non-significant elements
                 if (parentElement.Weight < 0.01)
                     continue;
 
-                auto const nearest = GetClosestIntersection(lastRays.Rays[parentElement.ParentRayIndex]);
+                // the camera ray and its reflection may have been traced ahead of time
+                auto const nearest = primary && generationIndex == 0                                  ? primary->Camera
+                                     : primary && generationIndex == 1 && i == 0 && firstIsReflection ? primary->Reflection
+                                                                                                      : CompiledObjects.GetClosestIntersection(parentElement.Ray);
 
-                if (!nearest.Shape)
+                // light samples of the parent are carried by its probes, whatever they hit
+                bool const isLight = nearest.Material && nearest.Material->IsLightsource;
+                if (isLight || parentElement.ProbeCosine > 0)
+                    emissionAccumulator = emissionAccumulator + parentElement.Weight * GetIncidentRadiance(nearest, parentElement.Ray, parentElement.ProbeCosine, parentElement.DirectLight, probesPerHit).MultiplyElementwise(parentElement.ColorFilter);
+
+                if (!nearest.Material)
                 {
                     // nothing hit, bad?
                     DEBUG_WARN("Ray did not hit anything!");
                     continue;
                 }
 
-                Materials::Material const &material = nearest.Shape->GetMaterial(nearest.Hitevent);
+                bounces = (uint32_t)generationIndex + 1;
+                Materials::Material const &material = *nearest.Material;
 
                 // check if light source was hit
-                if (material.IsLightsource)
-                {
-                    emissionAccumulator = emissionAccumulator + parentElement.Weight * material.Emission.MultiplyElementwise(parentElement.ColorFilter);
+                if (isLight)
                     continue;
-                }
 
                 // todo, add some light in the color of the material
                 // emissionAccumulator = emissionAccumulator + (255 * material.ColorFilter);
 
                 // do not generate more rays on last iteration as they will not be checked anymore
-                if (generationIndex == NUM_RAY_GENERATIONS)
+                if (generationIndex == Settings.RayGenerations)
                     continue;
 
                 Vec3d const effectiveColor = parentElement.ColorFilter.MultiplyElementwise(material.ColorFilter);
@@ -226,94 +605,564 @@ namespace Rt
                 if (effectiveColor.GetNorm() < 0.01)
                     continue;
 
-                FloatingType_t angleOfIncidence = abs(nearest.Hitevent.ReflectedRay.Direction.AngleTo(nearest.Hitevent.SurfaceNormal));
-                if (isnan(angleOfIncidence))
-                    // bad bahaviour when angle gets small
-                    angleOfIncidence = 0;
-
-                // lerp between diffusion factor and 0 between the range critical angle .. 90°
-                FloatingType_t const apparentDiffusionFactor = angleOfIncidence < material.CriticalAngle ? material.DiffusionFactor
-                                                                                                         : std::lerp(material.DiffusionFactor, 0.0,
-                                                                                                                     (angleOfIncidence - material.CriticalAngle) / (Deg2Rad(90) - material.CriticalAngle));
-                DEBUG_ASSERT(apparentDiffusionFactor >= 0 && apparentDiffusionFactor <= material.DiffusionFactor, "Bad diffusion fadeout");
+                FloatingType_t const cosineOfIncidence = getCosineOfIncidence(nearest.Hitevent);
+                FloatingType_t const apparentDiffusionFactor = getApparentDiffusionFactor(material, cosineOfIncidence);
 
                 // perfect mirror will only spawn single ray
                 FloatingType_t const weight = FloatingType_t{1} - apparentDiffusionFactor;
                 // too little contribution
                 if (weight > 0.01)
                 {
-                    nextRays.Rays[nextRays.Count] = nearest.Hitevent.ReflectedRay;
-                    nextGeneration.Elements[nextGeneration.Count] = generationElement_t{
-                        .ParentRayIndex = nextRays.Count,
+                    nextGeneration[nextCount++] = generationElement_t{
+                        .Ray = nearest.Hitevent.ReflectedRay,
                         .ParentWeight = parentElement.Weight,
                         .Weight = (FloatingType_t{1} - apparentDiffusionFactor) * (FloatingType_t)0.3,
-                        .ColorFilter = effectiveColor};
-                    nextRays.Count++;
-                    nextGeneration.Count++;
+                        .ColorFilter = effectiveColor,
+                        .ProbeCosine = 0,
+                        .DirectLight = ColorD_t{0, 0, 0}};
                     weightSum += weight;
+                    firstIsReflection |= generationIndex == 0;
                 }
 
                 // mirror material or total reflection
-                if ((apparentDiffusionFactor < 0.01) || (angleOfIncidence > material.CriticalAngle))
+                if ((apparentDiffusionFactor < 0.01) || (cosineOfIncidence < material.CriticalCosine))
                     continue;
 
                 // spawn random rays (1 is already spawned)
-                for (size_t j = 1; j < NUM_DIFFUSE_RAYS; j++)
-                {
-                    // Start from reflection
-                    Line probingRay {nearest.Hitevent.ReflectedRay.Origin, nearest.Hitevent.SurfaceNormal};
-
-                    // rotate away from surface normal in the plane (surface normal) x (reflection)
-                    probingRay.Direction = probingRay.Direction.RotateAboutPlane(nearest.Hitevent.SurfaceNormal, nearest.Hitevent.ReflectedRay.Direction, RandFloat() * Deg2Rad(60));
-
-                    // start rotating about the normal in appropriate steps
-                    probingRay.Direction = probingRay.Direction.RotateAboutAxis(nearest.Hitevent.SurfaceNormal, RandFloat() * Deg2Rad(360));
-
-                    DEBUG_ASSERT(AlmostSame(probingRay.Direction.GetNorm(), 1.0), "Rotation is bad for vector");
-
-                    FloatingType_t const weight = abs(nearest.Hitevent.SurfaceNormal * probingRay.Direction);
-
-                    // too little contribution
-                    if (weight < 0.01)
-                        continue;
+                if (!probesPerHit)
+                    continue;
 
-                    nextRays.Rays[nextRays.Count] = probingRay;
-                    nextGeneration.Elements[nextGeneration.Count] = generationElement_t{
-                        .ParentRayIndex = nextRays.Count,
+                Sampling::Onb const basis = Sampling::Onb::FromNormal(nearest.Hitevent.SurfaceNormal);
+                ColorD_t const directLight = SampleLights(nearest.Hitevent.SurfaceNormal, nearest.Hitevent.ReflectedRay.Origin, random, probeCount / probesPerHit * Settings.LightSamples, probesPerHit);
+                for (size_t j = 1; j < Settings.DiffuseRays; j++)
+                {
+                    // probes are already distributed by cos(angle to surface normal), so they share the same weight
+                    Line const probe = SpawnDiffuseProbe(basis, nearest.Hitevent.ReflectedRay.Origin, random, probeCount++);
+                    nextGeneration[nextCount++] = generationElement_t{
+                        .Ray = probe,
                         .ParentWeight = parentElement.Weight,
-                        // both have norm = 1! So this weights parallel lines to 1 and perpendicular to 0
-                        .Weight = weight,
-                        .ColorFilter = effectiveColor};
-                    nextRays.Count++;
-                    nextGeneration.Count++;
-                    weightSum += weight;
+                        .Weight = DIFFUSE_LOBE_MEAN_COSINE,
+                        .ColorFilter = effectiveColor,
+                        .ProbeCosine = probe.Direction * basis.Normal,
+                        .DirectLight = directLight};
+                    weightSum += DIFFUSE_LOBE_MEAN_COSINE;
                 };
             }
 
             // do not convert weights as they will not be read anymore
-            if (generationIndex == NUM_RAY_GENERATIONS)
+            if (generationIndex == Settings.RayGenerations)
                 break;
 
             // make "local abs" to "global rel" weights
-            if (nextGeneration.Count < 2)
+            if (nextCount < 2)
             {
-                nextGeneration.Elements[0].Weight = 1.0;
+                nextGeneration[0].Weight = 1.0;
             }
             else
             {
-                for (size_t i = 0; i < nextGeneration.Count; i++)
+                for (size_t i = 0; i < nextCount; i++)
                 {
-                    FloatingType_t const localWeight = nextGeneration.Elements[i].Weight / weightSum;
-                    nextGeneration.Elements[i].Weight = nextGeneration.Elements[i].ParentWeight * localWeight;
+                    FloatingType_t const localWeight = nextGeneration[i].Weight / weightSum;
+                    nextGeneration[i].Weight = nextGeneration[i].ParentWeight * localWeight;
                 }
             }
         }
 
+        worker.Bounces += bounces;
         return emissionAccumulator;
     }
 
-    FloatingType_t Raytracer::RandFloat()
+    ColorD_t Raytracer::TracePath(Line const &ray, Random::Stream &random, WorkerState &worker, PrimaryHits const *primary) const
     {
-        return std::uniform_real_distribution<FloatingType_t>{}(RngEngine);
+        Line currentRay = ray;
+        // true while currentRay is the mirror reflection of the camera ray
+        bool isReflection = false;
+        ColorD_t throughput{1, 1, 1};
+        ColorD_t emissionAccumulator{0, 0, 0};
+        // of currentRay towards the normal it was probed around, 0 for any other ray
+        FloatingType_t probeCosine = 0;
+        // surfaces hit so far
+        uint32_t hits = 0;
+
+        for (unsigned int bounce = 0; bounce < Settings.MaxBounces; bounce++)
+        {
+            random.SetBounce(bounce);
+            // the camera ray and its reflection may have been traced ahead of time
+            auto const nearest = primary && bounce == 0   ? primary->Camera
+                                 : primary && isReflection ? primary->Reflection
+                                                           : CompiledObjects.GetClosestIntersection(currentRay);
+            isReflection = false;
+            if (!nearest.Material)
+            {
+                // nothing hit, bad?
+                DEBUG_WARN("Ray did not hit anything!");
+                break;
+            }
+
+            hits++;
+            Materials::Material const &material = *nearest.Material;
+            if (material.IsLightsource)
+            {
+                // probes share the emitters with the light samples
+                FloatingType_t const misWeight = GetProbeMisWeight(nearest, currentRay, probeCosine, 1);
+                emissionAccumulator = emissionAccumulator + (misWeight * material.Emission).MultiplyElementwise(throughput);
+                break;
+            }
+
+            throughput = throughput.MultiplyElementwise(material.ColorFilter);
+
+            // russian roulette, survivors carry the weight of the terminated paths
+            if (bounce >= Settings.RouletteStartBounce)
+            {
+                FloatingType_t const survivalProbability = std::min(FloatingType_t{1}, std::max({throughput.X(), throughput.Y(), throughput.Z()}));
+                if (random.Get(Random::ROULETTE) >= survivalProbability)
+                    break;
+                throughput = throughput * (FloatingType_t{1} / survivalProbability);
+            }
+
+            FloatingType_t const cosineOfIncidence = getCosineOfIncidence(nearest.Hitevent);
+            FloatingType_t const apparentDiffusionFactor = getApparentDiffusionFactor(material, cosineOfIncidence);
+
+            // pick one lobe in proportion to the weight MarchRay() gives it, the throughput keeps what both pass on
+            lobeWeights_t const lobes = getLobeWeights(material, cosineOfIncidence, apparentDiffusionFactor, GetBranchingProbes());
+            FloatingType_t const lobeSum = lobes.Reflection + lobes.Diffuse;
+            if (lobeSum <= 0)
+                break;
+
+            throughput = throughput * lobeSum;
+            bool const isSpecular = random.Get(Random::LOBE_SELECTION) * lobeSum < lobes.Reflection;
+            if (isSpecular)
+            {
+                currentRay = nearest.Hitevent.ReflectedRay;
+                isReflection = bounce == 0;
+                probeCosine = 0;
+                continue;
+            }
+
+            // drawn with the cosine weighting of MarchRay() as density, which cancels out of the throughput
+            currentRay = SpawnDiffuseProbe(Sampling::Onb::FromNormal(nearest.Hitevent.SurfaceNormal), nearest.Hitevent.ReflectedRay.Origin, random, 0);
+            probeCosine = currentRay.Direction * nearest.Hitevent.SurfaceNormal;
+            // the light samples share the lobe with the probe, which the last bounce does not trace anymore
+            if (Settings.LightSamples > 0 && bounce + 1 < Settings.MaxBounces)
+                emissionAccumulator = emissionAccumulator + SampleLights(nearest.Hitevent.SurfaceNormal, nearest.Hitevent.ReflectedRay.Origin, random, 0, 1).MultiplyElementwise(throughput);
+        }
+
+        worker.Bounces += hits;
+        return emissionAccumulator;
     }
+
+    template <typename TAccumulator>
+    void Raytracer::RenderTileWavefront(Scheduler::Tile const &tile, TAccumulator &accumulator, unsigned int firstPass, unsigned int passes, WorkerState &worker, Aov::Framebuffer *aovs) const
+    {
+        using queueElement_t = WavefrontScratch::queueElement_t;
+        using shading_t = WavefrontScratch::shading_t;
+        using sample_t = WavefrontScratch::sample_t;
+        WavefrontScratch &scratch = worker.Wavefront;
+        StageTimes &times = scratch.Times;
+
+        auto lapStart = std::chrono::steady_clock::now();
+        auto const lap = [&](std::chrono::duration<double> &stage)
+        {
+            auto const now = std::chrono::steady_clock::now();
+            stage += now - lapStart;
+            lapStart = now;
+        };
+
+        // generate: samples ordered by pixel, then pass, then sample within the pass
+        Camera::RayTable const &camera = GetCameraRays(worker, accumulator.GetWidth(), accumulator.GetHeight());
+        unsigned int const tileWidth = tile.ToX - tile.FromX;
+        unsigned int const samplesPerPixel = passes * Settings.SamplesPerPixel;
+        size_t const sampleCount = (size_t)(tile.ToY - tile.FromY) * tileWidth * samplesPerPixel;
+        if (scratch.Queues[0].size() < sampleCount)
+            scratch.Queues[0].resize(sampleCount);
+        scratch.Grow(sampleCount);
+        scratch.Counts[0] = sampleCount;
+        scratch.Samples.clear();
+        for (unsigned int y = tile.FromY; y < tile.ToY; y++)
+        {
+            for (unsigned int x = tile.FromX; x < tile.ToX; x++)
+            {
+                for (unsigned int pass = firstPass; pass < firstPass + passes; pass++)
+                {
+                    Line const ray = GetCameraRay(camera, x, y, pass);
+                    for (unsigned int i = 0; i < Settings.SamplesPerPixel; i++)
+                    {
+                        uint32_t const sampleIndex = (uint32_t)scratch.Samples.size();
+                        scratch.Queues[0][sampleIndex] = queueElement_t{.Ray = ray, .ParentWeight = 1, .Weight = 1, .ColorFilter = Vec3d{1, 1, 1}, .ProbeCosine = 0, .DirectLight = ColorD_t{0, 0, 0}, .Sample = sampleIndex};
+                        scratch.Samples.push_back(sample_t{.Random = Random::Stream{Settings.Sampler, Seed, x, y, pass * Settings.SamplesPerPixel + i, Settings.ExpectedSamples},
+                                                           .Emission = ColorD_t{0, 0, 0}});
+                    }
+                }
+            }
+        }
+        lap(times.Generate);
+
+        // all samples of a pixel start with the same camera ray, which is traced only once. A jittering camera has
+        // a ray per pass, shared by the samples of the pass
+        std::array<Scene::Intersection, Scene::PACKET_SIZE> intersections;
+        unsigned int const sharedPasses = camera.Config.Jitter ? 1 : passes;
+        for (unsigned int blockY = tile.FromY; blockY < tile.ToY; blockY += PACKET_HEIGHT)
+        {
+            for (unsigned int blockX = tile.FromX; blockX < tile.ToX; blockX += PACKET_WIDTH)
+            {
+                for (unsigned int firstShared = firstPass; firstShared < firstPass + passes; firstShared += sharedPasses)
+                {
+                    Scene::RayPacket cameraRays;
+                    for (unsigned int y = blockY; y < std::min(tile.ToY, blockY + PACKET_HEIGHT); y++)
+                        for (unsigned int x = blockX; x < std::min(tile.ToX, blockX + PACKET_WIDTH); x++)
+                            cameraRays.Set((y - blockY) * PACKET_WIDTH + (x - blockX), GetCameraRay(camera, x, y, firstShared));
+                    CompiledObjects.GetClosestIntersections(cameraRays, intersections);
+                    times.Rays += __builtin_popcount(cameraRays.ActiveMask);
+
+                    for (unsigned int y = blockY; y < std::min(tile.ToY, blockY + PACKET_HEIGHT); y++)
+                    {
+                        for (unsigned int x = blockX; x < std::min(tile.ToX, blockX + PACKET_WIDTH); x++)
+                        {
+                            size_t const pixel = (y - tile.FromY) * tileWidth + (x - tile.FromX);
+                            size_t const firstSample = pixel * samplesPerPixel + (size_t)(firstShared - firstPass) * Settings.SamplesPerPixel;
+                            Scene::Intersection const &hit = intersections[(y - blockY) * PACKET_WIDTH + (x - blockX)];
+                            std::fill_n(scratch.Hits.begin() + firstSample, sharedPasses * Settings.SamplesPerPixel, hit);
+                            if (aovs && firstShared == firstPass)
+                                aovs->SetFirstHit(x, y, hit, CompiledObjects.GetShapeIndex(hit.Material));
+                        }
+                    }
+                }
+            }
+        }
+        lap(times.Intersect);
+
+        // decisions of MarchRay() and TracePath() for a single hit, without spawning the children yet
+        uint32_t const probesPerHit = GetProbesPerHit();
+        uint32_t const branchingProbes = GetBranchingProbes();
+        auto const shadeBranching = [&](queueElement_t const &element, Scene::Intersection const &nearest, bool isLast)
+        {
+            shading_t shading{.Emission = ColorD_t{0, 0, 0}};
+            bool const isLight = nearest.Material && nearest.Material->IsLightsource;
+            if (isLight || element.ProbeCosine > 0)
+                shading.Emission = element.Weight * GetIncidentRadiance(nearest, element.Ray, element.ProbeCosine, element.DirectLight, probesPerHit).MultiplyElementwise(element.ColorFilter);
+
+            if (!nearest.Material)
+            {
+                DEBUG_WARN("Ray did not hit anything!");
+                return shading;
+            }
+
+            Materials::Material const &material = *nearest.Material;
+            if (isLight)
+                return shading;
+
+            shading.ColorFilter = element.ColorFilter.MultiplyElementwise(material.ColorFilter);
+            if (isLast || shading.ColorFilter.GetNorm() < 0.01)
+                return shading;
+
+            FloatingType_t const cosineOfIncidence = getCosineOfIncidence(nearest.Hitevent);
+            FloatingType_t const apparentDiffusionFactor = getApparentDiffusionFactor(material, cosineOfIncidence);
+            FloatingType_t const weight = FloatingType_t{1} - apparentDiffusionFactor;
+            if (weight > 0.01)
+            {
+                shading.ReflectionWeight = weight;
+                shading.Reflections = 1;
+            }
+
+            if ((apparentDiffusionFactor >= 0.01) && (cosineOfIncidence >= material.CriticalCosine))
+                shading.Probes = std::max(Settings.DiffuseRays, 1u) - 1;
+            return shading;
+        };
+
+        auto const shadePath = [&](queueElement_t const &element, Scene::Intersection const &nearest, Random::Stream const &random, size_t bounce, bool isLast)
+        {
+            shading_t shading{.Emission = ColorD_t{0, 0, 0}};
+            if (!nearest.Material)
+            {
+                DEBUG_WARN("Ray did not hit anything!");
+                return shading;
+            }
+
+            Materials::Material const &material = *nearest.Material;
+            if (material.IsLightsource)
+            {
+                FloatingType_t const misWeight = GetProbeMisWeight(nearest, element.Ray, element.ProbeCosine, 1);
+                shading.Emission = (misWeight * material.Emission).MultiplyElementwise(element.ColorFilter);
+                return shading;
+            }
+
+            if (isLast)
+                return shading;
+
+            ColorD_t throughput = element.ColorFilter.MultiplyElementwise(material.ColorFilter);
+            if (bounce >= Settings.RouletteStartBounce)
+            {
+                FloatingType_t const survivalProbability = std::min(FloatingType_t{1}, std::max({throughput.X(), throughput.Y(), throughput.Z()}));
+                if (random.Get(Random::ROULETTE) >= survivalProbability)
+                    return shading;
+                throughput = throughput * (FloatingType_t{1} / survivalProbability);
+            }
+
+            FloatingType_t const cosineOfIncidence = getCosineOfIncidence(nearest.Hitevent);
+            FloatingType_t const apparentDiffusionFactor = getApparentDiffusionFactor(material, cosineOfIncidence);
+            lobeWeights_t const lobes = getLobeWeights(material, cosineOfIncidence, apparentDiffusionFactor, branchingProbes);
+            FloatingType_t const lobeSum = lobes.Reflection + lobes.Diffuse;
+            if (lobeSum <= 0)
+                return shading;
+
+            bool const isSpecular = random.Get(Random::LOBE_SELECTION) * lobeSum < lobes.Reflection;
+            shading.ColorFilter = throughput * lobeSum;
+            (isSpecular ? shading.Reflections : shading.Probes) = 1;
+            return shading;
+        };
+
+        size_t const generationCount = Settings.Mode == Integrator::PathTracing ? Settings.MaxBounces : Settings.RayGenerations + 1;
+        for (size_t generation = 0; generation < generationCount && scratch.Counts[generation % 2] > 0; generation++)
+        {
+            std::span<queueElement_t const> const queue{scratch.Queues[generation % 2].data(), scratch.Counts[generation % 2]};
+            scratch.Grow(queue.size());
+            std::span<Scene::Intersection const> const hits{scratch.Hits.data(), queue.size()};
+            std::span<shading_t> const shadings{scratch.Shading.data(), queue.size()};
+            std::span<uint32_t> const order{scratch.Order.data(), queue.size()};
+            bool const isLast = generation + 1 == generationCount;
+
+            // intersect: the camera rays were traced while generating
+            if (generation > 0)
+            {
+                IntersectQueue(scratch, queue);
+                lap(times.Intersect);
+            }
+
+            // shade: hits of the same material are decided on together. Streams start at bounce 0
+            if (generation > 0)
+                for (size_t i = 0; i < queue.size(); i++)
+                    if (i == 0 || queue[i].Sample != queue[i - 1].Sample)
+                        scratch.Samples[queue[i].Sample].Random.SetBounce((uint32_t)generation);
+
+            for (size_t i = 0; i < queue.size(); i++)
+                scratch.Keys[i] = (uint32_t)CompiledObjects.GetMaterialIndex(hits[i].Material);
+            sortByKeys({scratch.Keys.data(), queue.size()}, CompiledObjects.GetMaterialCount() + 1, order, scratch.KeyStarts);
+
+            for (uint32_t const i : order)
+            {
+                queueElement_t const &element = queue[i];
+                shadings[i] = Settings.Mode == Integrator::PathTracing ? shadePath(element, hits[i], scratch.Samples[element.Sample].Random, generation, isLast)
+                                                                       : shadeBranching(element, hits[i], isLast);
+            }
+            lap(times.Shade);
+
+            // compact: in queue order, so the children of a sample stay together and its probes keep the indices
+            // MarchRay() gives them. Emission is summed up in the same order, too
+            uint32_t childCount = 0;
+            uint32_t probeCount = 0;
+            for (size_t i = 0; i < queue.size(); i++)
+            {
+                shading_t &shading = shadings[i];
+                sample_t &sample = scratch.Samples[queue[i].Sample];
+                if (i == 0 || queue[i].Sample != queue[i - 1].Sample)
+                {
+                    probeCount = 0;
+                    sample.WeightSum = 0;
+                    sample.Children = 0;
+                }
+
+                sample.Emission = sample.Emission + shading.Emission;
+                if (hits[i].Material)
+                    sample.Bounces = (uint32_t)generation + 1;
+                shading.FirstChild = childCount;
+                shading.FirstProbe = probeCount;
+                childCount += shading.Reflections + shading.Probes;
+                probeCount += shading.Probes;
+                sample.Children += shading.Reflections + shading.Probes;
+                if (shading.Reflections)
+                    sample.WeightSum += shading.ReflectionWeight;
+                for (uint32_t j = 0; j < shading.Probes; j++)
+                    sample.WeightSum += DIFFUSE_LOBE_MEAN_COSINE;
+            }
+
+            // grow only, the current queue lives in the other vector
+            std::vector<queueElement_t> &nextQueue = scratch.Queues[(generation + 1) % 2];
+            if (nextQueue.size() < childCount)
+                nextQueue.resize(childCount);
+            std::span<queueElement_t> const next{nextQueue.data(), childCount};
+            lap(times.Compact);
+
+            // shade: children are spawned in material order as well, straight into their slots
+            for (uint32_t const i : order)
+            {
+                shading_t const &shading = shadings[i];
+                if (!shading.Reflections && !shading.Probes)
+                    continue;
+
+                queueElement_t const &element = queue[i];
+                Shapes::HitEvent const &hitEvent = hits[i].Hitevent;
+                queueElement_t *child = &next[shading.FirstChild];
+                if (shading.Reflections)
+                    *child++ = queueElement_t{.Ray = hitEvent.ReflectedRay,
+                                              .ParentWeight = element.Weight,
+                                              .Weight = shading.ReflectionWeight * (FloatingType_t)0.3,
+                                              .ColorFilter = shading.ColorFilter,
+                                              .ProbeCosine = 0,
+                                              .DirectLight = ColorD_t{0, 0, 0},
+                                              .Sample = element.Sample};
+                if (!shading.Probes)
+                    continue;
+
+                // light samples are indexed like the probes, by the hits of the sample before this one
+                sample_t &sample = scratch.Samples[element.Sample];
+                ColorD_t const directLight = SampleLights(hitEvent.SurfaceNormal, hitEvent.ReflectedRay.Origin, sample.Random, shading.FirstProbe / probesPerHit * Settings.LightSamples, probesPerHit);
+                Sampling::Onb const basis = Sampling::Onb::FromNormal(hitEvent.SurfaceNormal);
+                for (uint32_t j = 0; j < shading.Probes; j++)
+                {
+                    Line const probe = SpawnDiffuseProbe(basis, hitEvent.ReflectedRay.Origin, sample.Random, shading.FirstProbe + j);
+                    *child++ = queueElement_t{.Ray = probe,
+                                              .ParentWeight = element.Weight,
+                                              .Weight = DIFFUSE_LOBE_MEAN_COSINE,
+                                              .ColorFilter = shading.ColorFilter,
+                                              .ProbeCosine = probe.Direction * basis.Normal,
+                                              .DirectLight = Settings.Mode == Integrator::Branching ? directLight : ColorD_t{0, 0, 0},
+                                              .Sample = element.Sample};
+                }
+
+                // the path tracer adds its light samples right away, after the emission of this bounce
+                if (Settings.Mode == Integrator::PathTracing && Settings.LightSamples > 0)
+                    sample.Emission = sample.Emission + directLight.MultiplyElementwise(shading.ColorFilter);
+            }
+            lap(times.Shade);
+
+            // compact: "local abs" to "global rel" weights like MarchRay(), which would skip the insignificant ones
+            size_t kept = next.size();
+            if (Settings.Mode == Integrator::Branching)
+            {
+                kept = 0;
+                for (size_t i = 0; i < next.size(); i++)
+                {
+                    sample_t const &sample = scratch.Samples[next[i].Sample];
+                    FloatingType_t const weight = sample.Children < 2 ? FloatingType_t{1} : next[i].ParentWeight * (next[i].Weight / sample.WeightSum);
+                    if (weight < 0.01)
+                        continue;
+
+                    next[kept] = next[i];
+                    next[kept++].Weight = weight;
+                }
+            }
+            scratch.Counts[(generation + 1) % 2] = kept;
+            lap(times.Compact);
+        }
+
+        // average the samples of a pass like TracePixel() and add up the passes like RenderTile()
+        for (unsigned int y = tile.FromY; y < tile.ToY; y++)
+        {
+            for (unsigned int x = tile.FromX; x < tile.ToX; x++)
+            {
+                sample_t const *samples = &scratch.Samples[((y - tile.FromY) * tileWidth + (x - tile.FromX)) * samplesPerPixel];
+                ColorD_t pixelcolor{0, 0, 0};
+                uint32_t bounces = 0;
+                for (unsigned int pass = 0; pass < passes; pass++)
+                {
+                    ColorD_t sum{0, 0, 0};
+                    for (unsigned int i = 0; i < Settings.SamplesPerPixel; i++, samples++)
+                    {
+                        sum = sum + samples->Emission;
+                        bounces += samples->Bounces;
+                    }
+                    pixelcolor = pixelcolor + sum * (FloatingType_t{1} / Settings.SamplesPerPixel);
+                }
+
+                FloatingType_t *const target = accumulator.atPixel(x, y);
+                for (size_t i = 0; i < Bitmap::COLOR_COUNT; i++)
+                    target[i] += pixelcolor.Data[i];
+                if (aovs)
+                    aovs->Bounces[aovs->GetIndex(x, y)] += bounces;
+            }
+        }
+        lap(times.Generate);
+    }
+
+    void Raytracer::IntersectQueue(WavefrontScratch &scratch, std::span<WavefrontScratch::queueElement_t const> queue) const
+    {
+        // rays of the same octant agree on the order the tree's children are visited in
+        for (size_t i = 0; i < queue.size(); i++)
+            scratch.Keys[i] = getOctant(queue[i].Ray.Direction);
+        sortByKeys({scratch.Keys.data(), queue.size()}, 8, {scratch.Order.data(), queue.size()}, scratch.KeyStarts);
+
+        std::array<Scene::Intersection, Scene::PACKET_SIZE> intersections;
+        for (size_t octant = 0; octant < 8; octant++)
+        {
+            // packets do not straddle octants, only the last one of each may be partially filled
+            uint32_t const octantEnd = scratch.KeyStarts[octant + 1];
+            for (uint32_t begin = scratch.KeyStarts[octant]; begin < octantEnd; begin += (uint32_t)Scene::PACKET_SIZE)
+            {
+                uint32_t const end = std::min(begin + (uint32_t)Scene::PACKET_SIZE, octantEnd);
+                Scene::RayPacket packet;
+                for (uint32_t k = begin; k < end; k++)
+                    packet.Set(k - begin, queue[scratch.Order[k]].Ray);
+
+                CompiledObjects.GetClosestIntersections(packet, intersections);
+                for (uint32_t k = begin; k < end; k++)
+                    scratch.Hits[scratch.Order[k]] = intersections[k - begin];
+            }
+        }
+        scratch.Times.Rays += queue.size();
+    }
+
+    uint32_t Raytracer::GetProbesPerHit() const
+    {
+        if (Settings.Mode == Integrator::PathTracing)
+            return 1;
+        return GetBranchingProbes();
+    }
+
+    uint32_t Raytracer::GetBranchingProbes() const
+    {
+        return Settings.DiffuseRays > 0 ? Settings.DiffuseRays - 1 : 0;
+    }
+
+    ColorD_t Raytracer::SampleLights(Vec3d const &normal, Vec3d const &origin, Random::Stream const &random, uint32_t firstLight, uint32_t probes) const
+    {
+        ColorD_t radiance{0, 0, 0};
+        for (uint32_t k = 0; k < Settings.LightSamples; k++)
+        {
+            uint32_t const dimension = Random::LIGHT_SAMPLE + 4 * (firstLight + k);
+            auto const sample = CompiledObjects.SampleEmitter(random.Get(dimension), random.Get(dimension + 2), random.Get(dimension + 3), origin, normal);
+
+            // the light samples estimate the probes' lobe, nothing outside of it counts
+            FloatingType_t const cosine = sample.Direction * normal;
+            if (sample.Pdf == 0 || cosine < DIFFUSE_LOBE_MIN_COSINE)
+                continue;
+
+            if (CompiledObjects.IsOccluded(Line{origin, sample.Direction}, sample.Distance))
+                continue;
+
+            // balance heuristic over all probes and light samples of the hit, the probes' density cancels out
+            FloatingType_t const probePdf = cosine * DIFFUSE_LOBE_PDF_PER_COSINE;
+            radiance = radiance + sample.Material->Emission * (probePdf / (probes * probePdf + Settings.LightSamples * sample.Pdf));
+        }
+        return radiance;
+    }
+
+    FloatingType_t Raytracer::GetProbeMisWeight(Scene::Intersection const &nearest, Line const &ray, FloatingType_t probeCosine, uint32_t probes) const
+    {
+        if (Settings.LightSamples == 0 || probeCosine <= 0)
+            return 1;
+
+        FloatingType_t const probePdf = probes * probeCosine * DIFFUSE_LOBE_PDF_PER_COSINE;
+        return probePdf / (probePdf + Settings.LightSamples * CompiledObjects.GetEmitterPdf(nearest, ray, probeCosine));
+    }
+
+    ColorD_t Raytracer::GetIncidentRadiance(Scene::Intersection const &nearest, Line const &ray, FloatingType_t probeCosine, ColorD_t const &directLight, uint32_t probes) const
+    {
+        if (!nearest.Material || !nearest.Material->IsLightsource)
+            return directLight;
+
+        return directLight + GetProbeMisWeight(nearest, ray, probeCosine, probes) * nearest.Material->Emission;
+    }
+
+    Line Raytracer::SpawnDiffuseProbe(Sampling::Onb const &basis, Vec3d const &origin, Random::Stream const &random, uint32_t probe)
+    {
+        Vec3d const local = Sampling::SampleCosineCone(random.Get(Random::DIFFUSE_PROBE + 2 * probe), random.Get(Random::DIFFUSE_PROBE + 2 * probe + 1), DIFFUSE_LOBE_SIN_SQUARED);
+        Line const probingRay{origin, basis.ToWorld(local)};
+
+        DEBUG_ASSERT(AlmostSame(probingRay.Direction.GetNorm(), 1.0), "Basis is bad for vector");
+        return probingRay;
+    }
+
+    // the layouts the accumulator comes in
+    template void Raytracer::RenderTile(Scheduler::Tile const &, Bitmap::BitmapD &, unsigned int, unsigned int, WorkerState &, Aov::Framebuffer *) const;
+    template void Raytracer::RenderTile(Scheduler::Tile const &, Bitmap::TiledBitmapD &, unsigned int, unsigned int, WorkerState &, Aov::Framebuffer *) const;
 }
\ No newline at end of file
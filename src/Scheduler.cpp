@@ -0,0 +1,188 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "Debug.h"
+
+namespace Scheduler
+{
+    std::string FrameStatistics::ToString() const
+    {
+        std::stringstream stream;
+        stream.precision(1);
+        stream << std::fixed;
+        stream << "Frame: " << Wall.count() * 1000 << "ms, startup " << Startup.count() * 1e6 << "us\n";
+        for (size_t i = 0; i < Workers.size(); i++)
+        {
+            WorkerStatistics const &worker = Workers[i];
+            stream << "Worker " << i << ": startup " << worker.Startup.count() * 1e6 << "us, busy " << worker.Busy.count() * 1000
+                   << "ms, idle " << worker.Idle.count() * 1000 << "ms, " << worker.TilesRendered << " tiles (" << worker.TilesStolen << " stolen)\n";
+        }
+        return stream.str();
+    }
+
+    TileScheduler::TileScheduler(unsigned int numWorkers)
+        : NumWorkers{std::max(1u, numWorkers)}, Queues(std::max(1u, numWorkers))
+    {
+        Statistics.Workers.resize(NumWorkers);
+        for (unsigned int worker = 0; worker < NumWorkers; worker++)
+            Threads.emplace_back(&TileScheduler::WorkerLoop, this, worker);
+    }
+
+    TileScheduler::~TileScheduler()
+    {
+        Wait();
+        {
+            std::lock_guard lock{FrameMutex};
+            Stopping = true;
+        }
+        FrameStarted.notify_all();
+        for (auto &thread : Threads)
+            thread.join();
+    }
+
+    unsigned int TileScheduler::GetWorkerCount() const
+    {
+        return NumWorkers;
+    }
+
+    unsigned int TileScheduler::GetHardwareConcurrency()
+    {
+        return std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    }
+
+    void TileScheduler::Submit(unsigned int width, unsigned int height, RenderTile_t renderTile)
+    {
+        std::unique_lock lock{FrameMutex};
+        FrameDone.wait(lock, [this]()
+                       { return BusyWorkers == 0; });
+
+        // cut frame into tiles
+        std::vector<Tile> tiles;
+        for (unsigned int y = 0; y < height; y += TILE_SIZE)
+            for (unsigned int x = 0; x < width; x += TILE_SIZE)
+                tiles.push_back(Tile{x, y, std::min(width, x + TILE_SIZE), std::min(height, y + TILE_SIZE)});
+
+        // deal contiguous runs of tiles, neighbouring tiles tend to share cache lines of the scene
+        for (unsigned int worker = 0; worker < NumWorkers; worker++)
+        {
+            auto const from = tiles.begin() + tiles.size() * worker / NumWorkers;
+            auto const to = tiles.begin() + tiles.size() * (worker + 1) / NumWorkers;
+            std::lock_guard queueLock{Queues[worker].Mutex};
+            Queues[worker].Tiles.assign(from, to);
+        }
+
+        std::fill(Statistics.Workers.begin(), Statistics.Workers.end(), WorkerStatistics{});
+        RenderTile = std::move(renderTile);
+        BusyWorkers = NumWorkers;
+        FrameIndex++;
+        SubmitTime = std::chrono::steady_clock::now();
+
+        lock.unlock();
+        FrameStarted.notify_all();
+    }
+
+    bool TileScheduler::Poll() const
+    {
+        std::lock_guard lock{FrameMutex};
+        return BusyWorkers == 0;
+    }
+
+    FrameStatistics TileScheduler::Wait()
+    {
+        std::unique_lock lock{FrameMutex};
+        FrameDone.wait(lock, [this]()
+                       { return BusyWorkers == 0; });
+        return Statistics;
+    }
+
+    FrameStatistics TileScheduler::Run(unsigned int width, unsigned int height, RenderTile_t renderTile)
+    {
+        Submit(width, height, std::move(renderTile));
+        return Wait();
+    }
+
+    void TileScheduler::WorkerLoop(unsigned int worker)
+    {
+        size_t lastFrameIndex = 0;
+        while (true)
+        {
+            std::unique_lock lock{FrameMutex};
+            FrameStarted.wait(lock, [&]()
+                              { return Stopping || FrameIndex != lastFrameIndex; });
+            if (Stopping)
+                return;
+
+            lastFrameIndex = FrameIndex;
+            // own slot, nobody else writes it during the frame
+            WorkerStatistics &statistics = Statistics.Workers[worker];
+            statistics.Startup = std::chrono::steady_clock::now() - SubmitTime;
+            lock.unlock();
+
+            RunWorker(worker, statistics);
+
+            lock.lock();
+            DEBUG_ASSERT(BusyWorkers > 0, "Worker finished a frame twice");
+            if (--BusyWorkers > 0)
+                continue;
+
+            // last one out summarizes the frame
+            Statistics.Wall = std::chrono::steady_clock::now() - SubmitTime;
+            Statistics.Startup = Statistics.Workers.front().Startup;
+            for (auto &workerStatistics : Statistics.Workers)
+            {
+                workerStatistics.Idle = Statistics.Wall - workerStatistics.Busy;
+                Statistics.Startup = std::min(Statistics.Startup, workerStatistics.Startup);
+            }
+            // release whatever the frame captured
+            RenderTile = nullptr;
+
+            lock.unlock();
+            FrameDone.notify_all();
+        }
+    }
+
+    void TileScheduler::RunWorker(unsigned int worker, WorkerStatistics &statistics)
+    {
+        while (true)
+        {
+            Tile tile;
+            bool found = false;
+
+            // own tiles from the front
+            {
+                std::lock_guard lock{Queues[worker].Mutex};
+                if (!Queues[worker].Tiles.empty())
+                {
+                    tile = Queues[worker].Tiles.front();
+                    Queues[worker].Tiles.pop_front();
+                    found = true;
+                }
+            }
+
+            // others' tiles from the back, furthest away from where their owner is working
+            for (unsigned int i = 1; !found && i < NumWorkers; i++)
+            {
+                workerQueue_t &victim = Queues[(worker + i) % NumWorkers];
+                std::lock_guard lock{victim.Mutex};
+                if (victim.Tiles.empty())
+                    continue;
+
+                tile = victim.Tiles.back();
+                victim.Tiles.pop_back();
+                found = true;
+                statistics.TilesStolen++;
+            }
+
+            // no tiles are added during a frame, so empty queues stay empty
+            if (!found)
+                return;
+
+            auto const start = std::chrono::steady_clock::now();
+            RenderTile(worker, tile);
+            statistics.Busy += std::chrono::steady_clock::now() - start;
+            statistics.TilesRendered++;
+        }
+    }
+}
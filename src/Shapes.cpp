@@ -1,11 +1,10 @@
 #include "Shapes.h"
 
+#include "CompiledScene.h"
 #include "Debug.h"
 
 namespace Shapes
 {
-    constexpr FloatingType_t OFFSET_DELTA = 1e-3;
-
     FloatingType_t signOf(FloatingType_t val)
     {
         if (val > 0)
@@ -14,18 +13,18 @@ namespace Shapes
             return -1.0;
     }
 
-    Vec3d Reflect(Vec3d const &direction, Vec3d const &normal)
+    Shape::Shape(std::string const &label)
+        : Label{label}
     {
-        // https://math.stackexchange.com/questions/13261/how-to-get-a-reflection-vector
-        Vec3d const reflectionDirection = direction - 2.0 * (direction * normal) * normal;
-        DEBUG_ASSERT(AlmostSame(reflectionDirection.GetNorm(), 1.0), "Reflection did not yield normalized vector");
-
-        return reflectionDirection;
     }
 
-    Shape::Shape(std::string const &label)
-        : Label{label}
+    std::optional<HitEvent> Shape::CheckHit(Line const &line) const
     {
+        auto const candidate = Intersect(line);
+        if (!candidate)
+            return std::nullopt;
+
+        return Shade(line, *candidate);
     }
 
     Sphere::Sphere(std::string const &label, Materials::Material const &material, Vec3d center, FloatingType_t radius)
@@ -33,7 +32,7 @@ namespace Shapes
     {
     }
 
-    std::optional<HitEvent> Sphere::CheckHit(Line const &line) const
+    std::optional<HitCandidate> Sphere::Intersect(Line const &line) const
     {
         DEBUG_ASSERT(AlmostSame(line.Direction.GetNorm(), 1.0), "Line argument not normalized");
 
@@ -61,15 +60,21 @@ namespace Shapes
         DEBUG_ASSERT(distance > 0, "Distance must be in the ray direction");
         distance -= OFFSET_DELTA;
 
+        // remember if ray came from outside
+        return HitCandidate{.DistanceToSurface = distance, .Payload = c > 0};
+    }
+
+    HitEvent Sphere::Shade(Line const &line, HitCandidate const &candidate) const
+    {
         // intersection point
-        Vec3d const intersectionPoint = line.Origin + distance * line.Direction;
+        Vec3d const intersectionPoint = line.Origin + candidate.DistanceToSurface * line.Direction;
 
         // calc intersection normal
         Vec3d const directionToIntersection = (intersectionPoint - Centerpoint).ToNormalized();
-        Vec3d const normal = c > 0 ? directionToIntersection : -directionToIntersection; // takes into consideration when within sphere
+        Vec3d const normal = candidate.Payload ? directionToIntersection : -directionToIntersection; // takes into consideration when within sphere
         Vec3d const reflectionDirection = Reflect(line.Direction, normal);
 
-        return HitEvent{.DistanceToSurface = distance,
+        return HitEvent{.DistanceToSurface = candidate.DistanceToSurface,
                         .SurfaceNormal = normal,
                         .ReflectedRay = Line{intersectionPoint, reflectionDirection}};
     }
@@ -79,6 +84,11 @@ namespace Shapes
         return Material;
     }
 
+    void Sphere::Compile(Scene::PrimitiveArrays &target) const
+    {
+        target.Spheres.Add(Centerpoint, Radius, target.AddMaterial(Material));
+    }
+
     Plane::Plane(std::string const &label, Materials::Material const &material, Vec3d pin, Vec3d planeNormal)
         // make ctor more accessible by always normalizing normal vector
         : Shape(label), Material{material}, Pin{pin}, Normal{planeNormal.ToNormalized()}
@@ -90,7 +100,7 @@ namespace Shapes
     {
     }
 
-    std::optional<HitEvent> Plane::CheckHit(Line const &line) const
+    std::optional<HitCandidate> Plane::Intersect(Line const &line) const
     {
         DEBUG_ASSERT(AlmostSame(line.Direction.GetNorm(), 1.0), "Line argument not normalized");
 
@@ -113,11 +123,16 @@ namespace Shapes
         DEBUG_ASSERT(distance > 0, "Distance too close!");
         distance -= OFFSET_DELTA;
 
+        return HitCandidate{.DistanceToSurface = distance, .Payload = 0};
+    }
+
+    HitEvent Plane::Shade(Line const &line, HitCandidate const &candidate) const
+    {
         // Calc reflection ray
         Vec3d const reflectionDirection = Reflect(line.Direction, Normal);
-        Vec3d const reflectionPoint = line.Origin + distance * line.Direction;
+        Vec3d const reflectionPoint = line.Origin + candidate.DistanceToSurface * line.Direction;
 
-        return HitEvent{.DistanceToSurface = distance,
+        return HitEvent{.DistanceToSurface = candidate.DistanceToSurface,
                         .SurfaceNormal = Normal,
                         .ReflectedRay = Line{reflectionPoint, reflectionDirection}};
     }
@@ -127,6 +142,12 @@ namespace Shapes
         return Material;
     }
 
+    void Plane::Compile(Scene::PrimitiveArrays &target) const
+    {
+        uint32_t const materialIndex = target.AddMaterial(Material);
+        target.Planes.Add(Pin, Normal, materialIndex, materialIndex, 0);
+    }
+
     CheckerboardPlane::CheckerboardPlane(std::string const &label, std::pair<Materials::Material, Materials::Material> materials, FloatingType_t width, Vec3d pin, Vec3d normal)
         : Plane(label, pin, normal), Materials{materials}, Width{width}
     {
@@ -134,8 +155,14 @@ namespace Shapes
 
     Materials::Material const &CheckerboardPlane::GetMaterial(HitEvent const &hitEvent) const
     {
-        return ((int)std::floor(hitEvent.ReflectedRay.Origin.X / Width) + (int)std::floor(hitEvent.ReflectedRay.Origin.Y / Width) ) % 2
+        return ((int)std::floor(hitEvent.ReflectedRay.Origin.X() / Width) + (int)std::floor(hitEvent.ReflectedRay.Origin.Y() / Width) ) % 2
                    ? Materials.first
                    : Materials.second;
     }
+
+    void CheckerboardPlane::Compile(Scene::PrimitiveArrays &target) const
+    {
+        uint32_t const firstIndex = target.AddMaterial(Materials.first);
+        target.Planes.Add(Pin, Normal, firstIndex, target.AddMaterial(Materials.second), Width);
+    }
 }
@@ -0,0 +1,221 @@
+#include "ToneMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Debug.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace ToneMap
+{
+    static_assert(std::is_same_v<FloatingType_t, float>, "Conversion kernels work on single precision lanes");
+
+    /// @brief Resolution of the sRGB table. Its slope is 12.92 at most, so neighbouring steps stay within a byte
+    constexpr int SRGB_STEPS = 4095;
+
+    /// @brief Narkowicz's fit, x (A x + B) / (x (C x + D) + E)
+    constexpr float ACES_A = 2.51f;
+    constexpr float ACES_B = 0.03f;
+    constexpr float ACES_C = 2.43f;
+    constexpr float ACES_D = 0.59f;
+    constexpr float ACES_E = 0.14f;
+
+    /// @brief What every channel of a frame is converted with
+    struct conversion_t
+    {
+        Curve Operator;
+        /// @brief The curve is applied to channel * Gain + Bias
+        float Gain;
+        float Bias;
+        /// @brief nullptr for linear output
+        int32_t const *SrgbTable;
+    };
+
+    /// @brief The SIMD kernels repeat it operation by operation, so all kernels give the same bytes
+    inline float applyCurve(Curve curve, float x)
+    {
+        switch (curve)
+        {
+        case Curve::Reinhard:
+            return x / (1 + x);
+        case Curve::Aces:
+            return (x * (x * ACES_A + ACES_B)) / (x * (x * ACES_C + ACES_D) + ACES_E);
+        default:
+            return x;
+        }
+    }
+
+    inline unsigned char convertScalar(conversion_t const &conversion, float value)
+    {
+        // the lower bound first, it also turns NaN into 0
+        float const mapped = std::min(1.f, std::max(0.f, applyCurve(conversion.Operator, value * conversion.Gain + conversion.Bias)));
+        if (conversion.SrgbTable)
+            return (unsigned char)conversion.SrgbTable[(int)(mapped * SRGB_STEPS + 0.5f)];
+        return (unsigned char)(int)(mapped * 255 + 0.5f);
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("avx2"))) static __m256 applyCurveAvx2(Curve curve, __m256 x)
+    {
+        switch (curve)
+        {
+        case Curve::Reinhard:
+            return _mm256_div_ps(x, _mm256_add_ps(_mm256_set1_ps(1), x));
+        case Curve::Aces:
+        {
+            __m256 const numerator = _mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(ACES_A)), _mm256_set1_ps(ACES_B)));
+            __m256 const denominator = _mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(ACES_C)), _mm256_set1_ps(ACES_D))), _mm256_set1_ps(ACES_E));
+            return _mm256_div_ps(numerator, denominator);
+        }
+        default:
+            return x;
+        }
+    }
+
+    /// @brief convertScalar() for 8 neighbouring channels
+    __attribute__((target("avx2"))) static void convertAvx2(conversion_t const &conversion, float const *source, unsigned char *target)
+    {
+        __m256 const value = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(source), _mm256_set1_ps(conversion.Gain)), _mm256_set1_ps(conversion.Bias));
+        // max returns its second operand for NaN, like std::max(0, NaN)
+        __m256 const mapped = _mm256_min_ps(_mm256_max_ps(applyCurveAvx2(conversion.Operator, value), _mm256_setzero_ps()), _mm256_set1_ps(1));
+        __m256i quantized;
+        if (conversion.SrgbTable)
+        {
+            __m256i const index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(mapped, _mm256_set1_ps(SRGB_STEPS)), _mm256_set1_ps(0.5f)));
+            quantized = _mm256_i32gather_epi32(conversion.SrgbTable, index, 4);
+        }
+        else
+        {
+            quantized = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(mapped, _mm256_set1_ps(255)), _mm256_set1_ps(0.5f)));
+        }
+
+        // 8 x 32 bit to 8 bytes, both halves are packed side by side
+        __m128i const words = _mm_packus_epi32(_mm256_castsi256_si128(quantized), _mm256_extracti128_si256(quantized, 1));
+        _mm_storel_epi64((__m128i *)target, _mm_packus_epi16(words, words));
+    }
+
+    __attribute__((target("avx2"))) static size_t findRangeAvx2(float const *row, size_t length, float &minimum, float &maximum)
+    {
+        __m256 lower = _mm256_set1_ps(minimum);
+        __m256 upper = _mm256_set1_ps(maximum);
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m256 const value = _mm256_loadu_ps(row + i);
+            lower = _mm256_min_ps(lower, value);
+            upper = _mm256_max_ps(upper, value);
+        }
+
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, lower);
+        minimum = *std::min_element(lanes, lanes + 8);
+        _mm256_store_ps(lanes, upper);
+        maximum = *std::max_element(lanes, lanes + 8);
+        return i;
+    }
+#endif
+
+    /// @brief Linear [0, 1] to sRGB bytes, indexed by the value rounded to SRGB_STEPS. Built on first use
+    static std::vector<int32_t> const &getSrgbTable()
+    {
+        static std::vector<int32_t> const table = []()
+        {
+            std::vector<int32_t> result(SRGB_STEPS + 1);
+            for (int i = 0; i <= SRGB_STEPS; i++)
+            {
+                double const linear = (double)i / SRGB_STEPS;
+                double const encoded = linear <= 0.0031308 ? 12.92 * linear : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+                result[i] = (int32_t)(encoded * 255 + 0.5);
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    /// @brief Conversion of a frame whose curve does not depend on the frame, MinMax adjusts it
+    static conversion_t getConversion(Settings const &settings, FloatingType_t samples)
+    {
+        return conversion_t{.Operator = settings.Operator, .Gain = settings.Exposure / samples, .Bias = 0, .SrgbTable = settings.Srgb ? getSrgbTable().data() : nullptr};
+    }
+
+    static void convertChannels(conversion_t const &conversion, Scene::SimdLevel simd, float const *source, size_t count, unsigned char *target)
+    {
+        size_t i = 0;
+#if defined(__x86_64__)
+        if (simd >= Scene::SimdLevel::Avx2)
+            for (; i + 8 <= count; i += 8)
+                convertAvx2(conversion, source + i, target + i);
+#endif
+        for (; i < count; i++)
+            target[i] = convertScalar(conversion, source[i]);
+    }
+
+    void Convert(Settings const &settings, FloatingType_t samples, FloatingType_t const *source, size_t count, unsigned char *target)
+    {
+        DEBUG_ASSERT(settings.Operator != Curve::MinMax, "MinMax needs the whole frame");
+        DEBUG_ASSERT(samples > 0, "Samples must be positive");
+        convertChannels(getConversion(settings, samples), settings.Simd, source, count, target);
+    }
+
+    Mapper::Mapper(Settings const &settings, unsigned int numWorkers)
+        : Config{settings},
+          Pool{numWorkers}
+    {
+    }
+
+    void Mapper::Run(Bitmap::BitmapD const &image, FloatingType_t samples, unsigned char *output, size_t outputStride)
+    {
+        DEBUG_ASSERT(samples > 0, "Samples must be positive");
+        size_t const rowLength = (size_t)image.GetWidth() * Bitmap::COLOR_COUNT;
+        DEBUG_ASSERT(outputStride >= rowLength, "Output rows must hold a row of the image");
+
+        conversion_t conversion = getConversion(Config, samples);
+        if (Config.Operator == Curve::MinMax)
+        {
+            size_t const bands = (image.GetHeight() + Scheduler::TILE_SIZE - 1) / Scheduler::TILE_SIZE;
+            BandMinimum.assign(bands, std::numeric_limits<FloatingType_t>::infinity());
+            BandMaximum.assign(bands, -std::numeric_limits<FloatingType_t>::infinity());
+            // one column of tiles, i.e. bands of whole rows
+            Pool.Run(Scheduler::TILE_SIZE, image.GetHeight(), [this, &image](unsigned int, Scheduler::Tile const &tile)
+                     { FindRange(image, tile.FromY, tile.ToY); });
+
+            // a flat or empty frame has no range to spread, it turns black
+            FloatingType_t const minimum = bands ? *std::min_element(BandMinimum.begin(), BandMinimum.end()) : 0;
+            FloatingType_t const maximum = bands ? *std::max_element(BandMaximum.begin(), BandMaximum.end()) : 0;
+            conversion.Gain = maximum > minimum ? 1 / (maximum - minimum) : 0;
+            conversion.Bias = maximum > minimum ? -minimum * conversion.Gain : 0;
+        }
+
+        Pool.Run(Scheduler::TILE_SIZE, image.GetHeight(), [this, &image, &conversion, rowLength, output, outputStride](unsigned int, Scheduler::Tile const &tile)
+                 {
+                     for (unsigned int y = tile.FromY; y < tile.ToY; y++)
+                         convertChannels(conversion, Config.Simd, image.Row(y), rowLength, output + y * outputStride); });
+    }
+
+    void Mapper::FindRange(Bitmap::BitmapD const &image, unsigned int fromY, unsigned int toY)
+    {
+        size_t const rowLength = (size_t)image.GetWidth() * Bitmap::COLOR_COUNT;
+        float minimum = std::numeric_limits<float>::infinity();
+        float maximum = -std::numeric_limits<float>::infinity();
+        for (unsigned int y = fromY; y < toY; y++)
+        {
+            float const *const row = image.Row(y);
+            size_t i = 0;
+#if defined(__x86_64__)
+            if (Config.Simd >= Scene::SimdLevel::Avx2)
+                i = findRangeAvx2(row, rowLength, minimum, maximum);
+#endif
+            for (; i < rowLength; i++)
+            {
+                minimum = std::min(minimum, row[i]);
+                maximum = std::max(maximum, row[i]);
+            }
+        }
+        BandMinimum[fromY / Scheduler::TILE_SIZE] = minimum;
+        BandMaximum[fromY / Scheduler::TILE_SIZE] = maximum;
+    }
+}
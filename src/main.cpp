@@ -1,92 +1,192 @@
 #include "main.h"
 
+#include <cstdlib>
 #include <iostream>
 #include <algorithm>
 #include <vector>
-#include <thread>
 #include <memory>
 
 #include "Rt.h"
 #include "ImgFile.h"
+#include "MappedImage.h"
+#include "ToneMap.h"
+#include "Denoise.h"
+#include "Progressive.h"
 #include "TESTS.h"
+#include "BENCHMARKS.h"
 
 #ifdef NDEBUG
 // optimize through parallel threads
 constexpr bool USE_PARALLEL = true;
 // skip tests
 constexpr bool DO_TESTS = false;
+// run benchmarks instead of rendering
+constexpr bool DO_BENCHMARKS = false;
 constexpr unsigned int NUM_SMOOTHING_PASSES = 10;
+// spend passes where the image is still noisy, instead of NUM_SMOOTHING_PASSES everywhere
+constexpr bool USE_ADAPTIVE_SAMPLING = false;
+// refine pass by pass with intermediate images and checkpoints, resuming an earlier render; overrides the above
+constexpr bool USE_PROGRESSIVE = false;
+// edge aware filter over the result, guided by the first hits
+constexpr bool USE_DENOISER = false;
+// depth, normal, albedo, shape and bounce images next to the output, from the same render. With adaptive sampling
+// also where the passes went
+constexpr bool WRITE_AOVS = false;
+// uniform smoothing passes, i.e. without adaptive sampling, are summed tile by tile into contiguous blocks and
+// converted to rows once the frame is done. Adaptive sampling keeps statistics per pixel instead
+constexpr bool USE_TILED_ACCUMULATOR = true;
+// the means stream to Render\stream.pfm tile by tile, which can be watched while rendering. Uniform passes write
+// every tile once, adaptive sampling again after every round
+constexpr bool STREAM_OUTPUT = false;
 #else
 constexpr bool USE_PARALLEL = false;
 constexpr bool DO_TESTS = true;
+constexpr bool DO_BENCHMARKS = false;
 constexpr unsigned int NUM_SMOOTHING_PASSES = 1;
+constexpr bool USE_ADAPTIVE_SAMPLING = false;
+constexpr bool USE_PROGRESSIVE = false;
+constexpr bool USE_DENOISER = false;
+constexpr bool WRITE_AOVS = false;
+constexpr bool USE_TILED_ACCUMULATOR = false;
+constexpr bool STREAM_OUTPUT = false;
 #endif
 
+// projection and placement of the camera, jitter antialiases over the passes but traces camera rays per pass
+const Camera::Settings CameraSettings{.Model = Camera::Projection::Spherical, .Position = Camera::Origin, .Forward = Camera::Pointing, .Jitter = false};
 
-const unsigned int AvailableWorkers = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+// integrator, sample count and sampler of every smoothing pass
+const Rt::RenderSettings Settings{.Mode = Rt::Integrator::Branching, .SamplesPerPixel = 1, .Sampler = Random::Sampler::Sobol, .View = CameraSettings};
 
-void Sidethread(std::shared_ptr<Bitmap::BitmapD> bitmap)
-{
-    unsigned int const rngSeed = std::hash<std::thread::id>{}(std::this_thread::get_id());
-    auto raytracer = Rt::Raytracer{rngSeed};
-    raytracer.RunBitmapParallel(*bitmap, (unsigned int)ceil((FloatingType_t)AvailableWorkers / (FloatingType_t)NUM_SMOOTHING_PASSES));
-}
+// when adaptive sampling stops a pixel and the whole frame
+const Adaptive::Settings AdaptiveSettings{.MinPasses = 4, .MaxPasses = 64, .PixelThreshold = 0.02, .TargetNoise = 0.01, .TimeBudget = std::chrono::seconds{30}};
+
+// how the output is mapped to 8 bit, MinMax spreads whatever range the frame has like earlier renders
+const ToneMap::Settings ToneMapSettings{.Operator = ToneMap::Curve::MinMax, .Srgb = false};
+
+// format of Render\output, PFM keeps the means as they are, QOI compresses the bytes of the PPM
+constexpr ImgFile::Format OUTPUT_FORMAT = ImgFile::Format::Ppm;
 
-// exe entry point
-int main()
+// when progressive rendering stops and writes its state
+const Progressive::Settings ProgressiveSettings{.PassesPerStep = 2, .MaxPasses = 1024, .TimeBudget = std::chrono::seconds{60}, .ToneMapping = ToneMapSettings};
+
+int render(unsigned int width, unsigned int height)
 {
+    if (width == 0 || height == 0)
+    {
+        std::cout << "Bad frame size " << width << "x" << height << std::endl;
+        return 1;
+    }
+
     if (DO_TESTS)
     {
         std::cout << "Tests..." << std::endl;
         Tests::RunTests();
     }
 
+    if (DO_BENCHMARKS)
+    {
+        std::cout << "Benchmarks..." << std::endl;
+        Benchmarks::RunBenchmarks();
+        return 0;
+    }
+
     std::cout << "Raytracing..." << std::endl;
-    std::unique_ptr<Bitmap::BitmapD> resultBuffer{new Bitmap::BitmapD{}};
+    Bitmap::BitmapD resultBuffer{width, height};
+    // samples summed into every pixel of the result, adaptive sampling leaves means
+    unsigned int resultSamples = 1;
     if (!USE_PARALLEL)
     {
-        auto raytracer = Rt::Raytracer{};
-        raytracer.RunBitmap(*resultBuffer);
+        auto raytracer = Rt::Raytracer{1u, Settings};
+        raytracer.RunBitmap(resultBuffer);
     }
     else
     {
-        // sidethread handling
-
-        std::vector<std::shared_ptr<Bitmap::BitmapD>> workerResults;
-        std::vector<std::thread> sidethreads;
-        for (size_t i = 0; i < NUM_SMOOTHING_PASSES; i++)
+        // all passes are summed up in place, tile by tile, one worker per hardware thread
+        auto const raytracer = Rt::Raytracer{1u, Settings};
+        Rt::RenderContext context{raytracer};
+        std::unique_ptr<Aov::Framebuffer> aovs{USE_DENOISER || WRITE_AOVS ? new Aov::Framebuffer{width, height} : nullptr};
+        // samples summed into the bounces, adaptive pixels differ in passes and show their sum
+        unsigned int aovSamples = 1;
+        std::unique_ptr<ImgFile::MappedImage> stream{STREAM_OUTPUT && !USE_PROGRESSIVE ? new ImgFile::MappedImage{"Render\\stream.pfm", ImgFile::Format::Pfm, width, height} : nullptr};
+        if (USE_PROGRESSIVE)
+        {
+            Progressive::Summary const summary = Progressive::Render(context, resultBuffer, ProgressiveSettings, aovs.get());
+            std::cout << summary.ToString();
+            resultSamples = summary.Passes * Settings.SamplesPerPixel;
+        }
+        else if (USE_ADAPTIVE_SAMPLING)
         {
-            // heap alloc bitmap
-            workerResults.push_back(std::make_shared<Bitmap::BitmapD>());
+            // the mean of every pixel, plus where the passes went
+            Adaptive::Frame frame{AdaptiveSettings, width, height};
+            // every round streams the means of its tiles so far
+            auto const streamTile = [&](Scheduler::Tile const &tile)
+            {
+                frame.Resolve(resultBuffer, tile.FromX, tile.FromY, tile.ToX, tile.ToY);
+                stream->WriteTile(tile, resultBuffer, 1);
+            };
+            std::cout << context.RenderAdaptive(frame, aovs.get(), stream ? Rt::RenderContext::TileDone_t{streamTile} : nullptr).ToString();
+            frame.Resolve(resultBuffer);
 
-            // run as sidethread
-            sidethreads.emplace_back(Sidethread, workerResults.back());
+            if (WRITE_AOVS)
+            {
+                Bitmap::BitmapD passesBuffer{width, height};
+                frame.ResolvePasses(passesBuffer);
+                ImgFile::writeNetPbm("Render\\samples.ppm", passesBuffer);
+            }
+        }
+        else
+        {
+            aovSamples = resultSamples = NUM_SMOOTHING_PASSES * Settings.SamplesPerPixel;
+            if (USE_TILED_ACCUMULATOR)
+            {
+                Bitmap::TiledBitmapD tiledBuffer{width, height};
+                context.Submit(tiledBuffer, NUM_SMOOTHING_PASSES, aovs.get(), stream ? [&](Scheduler::Tile const &tile)
+                               { stream->WriteTile(tile, tiledBuffer, resultSamples); } : Rt::RenderContext::TileDone_t{});
+                std::cout << context.Wait().ToString();
+                context.Detile(tiledBuffer, resultBuffer);
+            }
+            else
+            {
+                context.Submit(resultBuffer, NUM_SMOOTHING_PASSES, aovs.get(), stream ? [&](Scheduler::Tile const &tile)
+                               { stream->WriteTile(tile, resultBuffer, resultSamples); } : Rt::RenderContext::TileDone_t{});
+                std::cout << context.Wait().ToString();
+            }
+            if (Settings.Backend == Rt::Engine::Wavefront)
+                std::cout << context.GetStageTimes().ToString();
         }
-        for (auto &thread : sidethreads)
-            thread.join();
 
-        // average all results
-        std::cout << "Averaging..." << std::endl;
-        for (auto const &piece : workerResults)
+        if (WRITE_AOVS)
         {
-            for (size_t y = 0; y < Bitmap::BITMAP_HEIGHT; y++)
+            Bitmap::BitmapD aovBuffer{width, height};
+            for (auto const &[channel, file] : {std::pair{Aov::Channel::Depth, "Render\\depth.ppm"}, std::pair{Aov::Channel::Normal, "Render\\normal.ppm"},
+                                                std::pair{Aov::Channel::Albedo, "Render\\albedo.ppm"}, std::pair{Aov::Channel::ShapeId, "Render\\shapes.ppm"},
+                                                std::pair{Aov::Channel::Bounces, "Render\\bounces.ppm"}})
             {
-                for (size_t x = 0; x < Bitmap::BITMAP_WIDTH; x++)
-                {
-                    for (size_t i = 0; i < 3; i++)
-                    {
-                        resultBuffer->at(x, y, i) += piece->at(x, y, i) / (FloatingType_t)NUM_SMOOTHING_PASSES;
-                    }
-                }
+                Aov::Visualize(*aovs, channel, aovBuffer, aovSamples);
+                ImgFile::writeNetPbm(file, aovBuffer);
             }
         }
+
+        if (USE_DENOISER)
+            std::cout << Denoise::Denoiser{}.Run(resultBuffer, *aovs).ToString();
     }
 
     std::cout << "Writing to file..." << std::endl;
 
-    ImgFile::writeNetPbm("Render\\output.ppm", *resultBuffer);
+    // sum of all passes or adaptive means, the mapper divides by the sample count
+    std::unique_ptr<ImgFile::Writer> const writer = ImgFile::CreateWriter(OUTPUT_FORMAT, ToneMapSettings);
+    if (!writer->Write(std::string{"Render\\output."} + writer->GetExtension(), resultBuffer, resultSamples))
+        DEBUG_CRASH("Cannot open output file");
 
     std::cout << "Done" << std::endl;
 
     return 0;
+}
+
+// exe entry point, optionally with the frame size: "rt 320 240" for a preview, "rt 3840 2160" for a final
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+        return render(Bitmap::BITMAP_WIDTH, Bitmap::BITMAP_HEIGHT);
+    return render((unsigned int)std::strtoul(argv[1], nullptr, 10), (unsigned int)std::strtoul(argv[2], nullptr, 10));
 }
\ No newline at end of file